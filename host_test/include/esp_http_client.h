@@ -0,0 +1,33 @@
+#pragma once
+#include "esp_err.h"
+
+// The part of the SDK's esp_http_client.h the OTA client uses, plain HTTP over host
+// sockets (sim/esp_http_client_sim.c).
+typedef enum {
+    HTTP_METHOD_GET = 0,
+    HTTP_METHOD_POST,
+} esp_http_client_method_t;
+
+typedef struct {
+    const char* url;
+    esp_http_client_method_t method;
+    int timeout_ms;
+} esp_http_client_config_t;
+
+typedef struct esp_http_client* esp_http_client_handle_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value);
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len);
+// Connect and send the request line and headers, write_len bytes of body follow.
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len);
+// The Content-Length of the response, -1 (ESP_FAIL) if its headers could not be read.
+int esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+// Up to len bytes of the body, 0 at its end or once the server closed, -1 on errors.
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len);
+// open, the post field, fetch_headers, the whole body read and dropped, close.
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
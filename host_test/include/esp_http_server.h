@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#define HTTPD_MAX_URI_LEN 512
+
+#define ESP_ERR_HTTPD_BASE          0x8000
+#define ESP_ERR_HTTPD_RESULT_TRUNC  (ESP_ERR_HTTPD_BASE + 7)
+
+typedef void* httpd_handle_t;
+
+// aux is the server's private request data, sim_httpd_req_init() fills in the parsed URL.
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char uri[HTTPD_MAX_URI_LEN + 1];
+    size_t content_len;
+    void* aux;
+    void* user_ctx;
+    void* sess_ctx;
+} httpd_req_t;
+
+size_t httpd_req_get_url_query_len(httpd_req_t* r);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* r, char* buf, size_t buf_len);
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size);
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// FreeRTOS on POSIX threads, tasks are detached threads and ticks follow CONFIG_FREERTOS_HZ=100.
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdFAIL              pdFALSE
+#define pdPASS              pdTRUE
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS  10
+#define pdMS_TO_TICKS(ms)   ((TickType_t)((ms) / portTICK_PERIOD_MS))
@@ -0,0 +1,13 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct sim_queue* QueueHandle_t;
+
+#define errQUEUE_EMPTY  pdFALSE
+#define errQUEUE_FULL   pdFALSE
+
+// Items are copied in and out, item_size may be 0 for a semaphore.
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks_to_wait);
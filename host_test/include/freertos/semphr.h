@@ -0,0 +1,11 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// As in FreeRTOS, a semaphore is a queue of empty items.
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateBinary()        xQueueCreate(1, 0)
+#define vSemaphoreDelete(sem)           vQueueDelete(sem)
+#define xSemaphoreGive(sem)             xQueueSend((sem), NULL, 0)
+#define xSemaphoreTake(sem, ticks)      xQueueReceive((sem), NULL, (ticks))
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+enum http_parser_url_fields {
+    UF_SCHEMA = 0,
+    UF_HOST = 1,
+    UF_PORT = 2,
+    UF_PATH = 3,
+    UF_QUERY = 4,
+    UF_FRAGMENT = 5,
+    UF_USERINFO = 6,
+    UF_MAX = 7
+};
+
+struct http_parser_url {
+    uint16_t field_set;
+    uint16_t port;
+    struct {
+        uint16_t off;
+        uint16_t len;
+    } field_data[UF_MAX];
+};
@@ -0,0 +1,54 @@
+/*
+ * The firmware of test_ota_delta: built twice, as OTA_DELTA_FIRMWARE_BUILD 1 and 2, it is the
+ * image of a release and of the bug fix release after it. The second build changes a string
+ * and a function, the rest is the host_main code both link, moved by the few bytes in between.
+ */
+#include <stdio.h>
+
+#include "configuration_adapter.h"
+#include "esp_http_server_ext.h"
+#include "json_stream.h"
+#include "ota_selftest.h"
+#include "ota_stream.h"
+#include "pwm_engine.h"
+#include "switch_adapter.h"
+
+#ifndef OTA_DELTA_FIRMWARE_BUILD
+#define OTA_DELTA_FIRMWARE_BUILD 1
+#endif
+#define STR(x) STR_(x)
+#define STR_(x) #x
+
+typedef void (*entry_t)(void);
+
+// What the tasks of the firmware would call, so that the linker keeps it.
+static const entry_t s_entries[] = {
+    (entry_t)cfg_adp_init,
+    (entry_t)cfg_adp_id_from_name,
+    (entry_t)httpd_req_query_value_decode_byref,
+    (entry_t)json_reader_parse,
+    (entry_t)json_writer_init,
+    (entry_t)ota_selftest_init,
+    (entry_t)ota_stream_begin,
+    (entry_t)ota_stream_write,
+    (entry_t)ota_stream_finish,
+    (entry_t)pwm_engine_init,
+    (entry_t)switch_adapter_init,
+};
+
+static int duty_percent(int percent)
+{
+#if OTA_DELTA_FIRMWARE_BUILD > 1
+    // the fix: a negative duty no longer wraps around
+    if (percent < 0)
+        return 0;
+#endif
+    return (percent > 100) ? 100 : percent;
+}
+
+int main(int argc, char** argv)
+{
+    printf("modbus switch 1.%s.0, %u entries, duty %d\n", STR(OTA_DELTA_FIRMWARE_BUILD),
+           (unsigned)(sizeof(s_entries) / sizeof(s_entries[0])), duty_percent(argc - 2));
+    return 0;
+}
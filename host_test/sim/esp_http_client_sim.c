@@ -0,0 +1,245 @@
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_http_client.h"
+
+#define SIM_HTTP_URL_MAXLEN    256
+#define SIM_HTTP_HEADERS_MAX   4
+#define SIM_HTTP_HEADER_MAXLEN 128
+#define SIM_HTTP_RESPONSE_HEAD 2048
+
+// One connection per request, "Connection: close" spares the keep-alive bookkeeping.
+struct esp_http_client {
+    char url[SIM_HTTP_URL_MAXLEN];
+    esp_http_client_method_t method;
+    int timeout_ms;
+    char headers[SIM_HTTP_HEADERS_MAX][SIM_HTTP_HEADER_MAXLEN];
+    const char* post_data;
+    int post_len;
+    int sock;
+    int status;
+    int content_length;
+    int received;           // of the body
+    char head[SIM_HTTP_RESPONSE_HEAD];
+    int head_len;
+    int body_off;           // of the body bytes read with the headers, in head
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config)
+{
+    esp_http_client_handle_t client;
+
+    if (config->url == NULL || strlen(config->url) >= SIM_HTTP_URL_MAXLEN)
+        return NULL;
+    client = calloc(1, sizeof(*client));
+    if (client == NULL)
+        return NULL;
+    strcpy(client->url, config->url);
+    client->method = config->method;
+    client->timeout_ms = (config->timeout_ms > 0) ? config->timeout_ms : 5000;
+    client->sock = -1;
+    return client;
+}
+
+// A header set again replaces the previous value, as in the SDK.
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value)
+{
+    size_t key_len = strlen(key);
+    int free_slot = -1;
+
+    for (int i = 0; i < SIM_HTTP_HEADERS_MAX; i++) {
+        if (client->headers[i][0] == '\0') {
+            if (free_slot < 0)
+                free_slot = i;
+        } else if (strncasecmp(client->headers[i], key, key_len) == 0 && client->headers[i][key_len] == ':') {
+            free_slot = i;
+            break;
+        }
+    }
+    if (free_slot < 0 || snprintf(client->headers[free_slot], SIM_HTTP_HEADER_MAXLEN, "%s: %s", key, value)
+                             >= SIM_HTTP_HEADER_MAXLEN)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len)
+{
+    client->post_data = data;
+    client->post_len = len;
+    return ESP_OK;
+}
+
+static int sim_http_send(int sock, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    char host[64];
+    char port[8] = "80";
+    char request[SIM_HTTP_URL_MAXLEN + SIM_HTTP_HEADERS_MAX * SIM_HTTP_HEADER_MAXLEN + 128];
+    const char* authority;
+    const char* path;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* addr;
+    struct timeval timeout = {client->timeout_ms / 1000, (client->timeout_ms % 1000) * 1000};
+    size_t host_len;
+    int len;
+
+    // http://host[:port][/path]
+    if (strncmp(client->url, "http://", 7) != 0)
+        return ESP_ERR_NOT_SUPPORTED;
+    authority = client->url + 7;
+    path = authority + strcspn(authority, "/");
+    host_len = strcspn(authority, ":/");
+    if (host_len == 0 || host_len >= sizeof(host))
+        return ESP_ERR_INVALID_ARG;
+    memcpy(host, authority, host_len);
+    host[host_len] = '\0';
+    if (authority[host_len] == ':')
+        snprintf(port, sizeof(port), "%.*s", (int)(path - authority - host_len - 1), authority + host_len + 1);
+
+    esp_http_client_close(client);
+    if (getaddrinfo(host, port, &hints, &addr) != 0)
+        return ESP_FAIL;
+    client->sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (client->sock >= 0) {
+        setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client->sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(client->sock, addr->ai_addr, addr->ai_addrlen) != 0) {
+            close(client->sock);
+            client->sock = -1;
+        }
+    }
+    freeaddrinfo(addr);
+    if (client->sock < 0)
+        return ESP_FAIL;
+
+    len = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: %.*s\r\nConnection: close\r\n",
+                   (client->method == HTTP_METHOD_POST) ? "POST" : "GET", (*path != '\0') ? path : "/",
+                   (int)(path - authority), authority);
+    if (client->method == HTTP_METHOD_POST)
+        len += snprintf(request + len, sizeof(request) - len, "Content-Length: %d\r\n", write_len);
+    for (int i = 0; i < SIM_HTTP_HEADERS_MAX; i++) {
+        if (client->headers[i][0] != '\0')
+            len += snprintf(request + len, sizeof(request) - len, "%s\r\n", client->headers[i]);
+    }
+    len += snprintf(request + len, sizeof(request) - len, "\r\n");
+    if (sim_http_send(client->sock, request, len) != 0) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len)
+{
+    return (client->sock >= 0 && sim_http_send(client->sock, buffer, len) == 0) ? len : -1;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    char* end = NULL;
+    char* line;
+
+    client->head_len = 0;
+    client->status = 0;
+    client->content_length = 0;
+    client->received = 0;
+    while (end == NULL) {
+        ssize_t n = recv(client->sock, client->head + client->head_len,
+                         sizeof(client->head) - 1 - client->head_len, 0);
+        if (n <= 0)
+            return ESP_FAIL;
+        client->head_len += n;
+        client->head[client->head_len] = '\0';
+        end = strstr(client->head, "\r\n\r\n");
+        if (end == NULL && client->head_len == sizeof(client->head) - 1)
+            return ESP_FAIL;
+    }
+    client->body_off = end + 4 - client->head;
+    end[2] = '\0';
+
+    if (sscanf(client->head, "HTTP/1.%*d %d", &client->status) != 1)
+        return ESP_FAIL;
+    for (line = strstr(client->head, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+            client->content_length = atoi(line + 17);
+    }
+    return client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len)
+{
+    int left = client->content_length - client->received;
+    int n;
+
+    if (client->sock < 0)
+        return -1;
+    if (len > left)
+        len = left;
+    if (len == 0)
+        return 0;
+    if (client->body_off < client->head_len) {
+        n = client->head_len - client->body_off;
+        n = (n < len) ? n : len;
+        memcpy(buffer, client->head + client->body_off, n);
+        client->body_off += n;
+    } else {
+        n = recv(client->sock, buffer, len, 0);
+        if (n < 0)
+            return -1;
+    }
+    client->received += n;
+    return n;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    char buf[256];
+    esp_err_t err = esp_http_client_open(client, client->post_len);
+
+    if (err == ESP_OK && client->post_len > 0
+            && esp_http_client_write(client, client->post_data, client->post_len) != client->post_len)
+        err = ESP_FAIL;
+    if (err == ESP_OK && esp_http_client_fetch_headers(client) < 0)
+        err = ESP_FAIL;
+    while (err == ESP_OK && esp_http_client_read(client, buf, sizeof(buf)) > 0)
+        ;
+    esp_http_client_close(client);
+    return err;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->sock >= 0)
+        close(client->sock);
+    client->sock = -1;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
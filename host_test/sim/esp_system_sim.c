@@ -0,0 +1,44 @@
+#include <stdlib.h>
+
+#include "esp_system.h"
+
+#include "sim.h"
+
+static uint32_t s_restarts = 0;
+static esp_reset_reason_t s_reset_reason = ESP_RST_POWERON;
+
+void esp_restart(void)
+{
+    s_restarts++;
+}
+
+uint32_t sim_restart_count(void)
+{
+    return s_restarts;
+}
+
+void sim_set_reset_reason(esp_reset_reason_t reason)
+{
+    s_reset_reason = reason;
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return s_reset_reason;
+}
+
+// The host has no meaningful heap figure, the metrics only render it.
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_random(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
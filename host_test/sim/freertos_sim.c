@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+typedef struct sim_task {
+    TaskFunction_t task;
+    void* arg;
+} sim_task_t;
+
+static void* sim_task_run(void* arg)
+{
+    sim_task_t task = *(sim_task_t*)arg;
+
+    free(arg);
+    task.task(task.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* out_handle)
+{
+    sim_task_t* sim_task = malloc(sizeof(*sim_task));
+    pthread_t thread;
+
+    if (sim_task == NULL)
+        return pdFAIL;
+    sim_task->task = task;
+    sim_task->arg = arg;
+    if (pthread_create(&thread, NULL, sim_task_run, sim_task) != 0) {
+        free(sim_task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (out_handle != NULL)
+        *out_handle = (TaskHandle_t)thread;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL)
+        pthread_exit(NULL);
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * 1000 / portTICK_PERIOD_MS + now.tv_nsec / (portTICK_PERIOD_MS * 1000000L));
+}
+
+struct sim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(struct sim_queue) + (size_t)length * item_size);
+
+    if (queue == NULL)
+        return NULL;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->changed);
+    free(queue);
+}
+
+// Wait for changed with the mutex held, false once ticks_to_wait passed.
+static bool sim_queue_wait(QueueHandle_t queue, TickType_t ticks_to_wait, const struct timespec* deadline)
+{
+    if (ticks_to_wait == 0)
+        return false;
+    if (ticks_to_wait == portMAX_DELAY)
+        return pthread_cond_wait(&queue->changed, &queue->mutex) == 0;
+    return pthread_cond_timedwait(&queue->changed, &queue->mutex, deadline) == 0;
+}
+
+static struct timespec sim_queue_deadline(TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    uint64_t ms = (ticks_to_wait == portMAX_DELAY) ? 0 : (uint64_t)ticks_to_wait * portTICK_PERIOD_MS;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = sim_queue_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!sim_queue_wait(queue, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return errQUEUE_FULL;
+        }
+    }
+    if (queue->item_size > 0)
+        memcpy(&queue->items[(queue->head + queue->count) % queue->length * queue->item_size], item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = sim_queue_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (!sim_queue_wait(queue, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return errQUEUE_EMPTY;
+        }
+    }
+    if (queue->item_size > 0)
+        memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
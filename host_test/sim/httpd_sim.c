@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_http_server_ext.h"
+
+#include "sim.h"
+
+void sim_httpd_req_init(httpd_req_t* req, const char* uri)
+{
+    size_t len = strlen(uri);
+    size_t path_len = strcspn(uri, "?#");
+    struct http_parser_url* url;
+
+    memset(req, 0, sizeof(*req));
+    if (len > HTTPD_MAX_URI_LEN)
+        len = HTTPD_MAX_URI_LEN;
+    memcpy((char*)req->uri, uri, len);
+
+    // The server keeps the parsed URL at AUX_OFFSET of its private data.
+    req->aux = calloc(1, AUX_OFFSET + sizeof(struct http_parser_url));
+    url = httpd_url_from_req(req);
+    url->field_set = 1 << UF_PATH;
+    url->field_data[UF_PATH].len = path_len;
+    if (uri[path_len] == '?') {
+        url->field_set |= 1 << UF_QUERY;
+        url->field_data[UF_QUERY].off = path_len + 1;
+        url->field_data[UF_QUERY].len = strcspn(uri + path_len + 1, "#");
+    }
+}
+
+void sim_httpd_req_free(httpd_req_t* req)
+{
+    free(req->aux);
+    req->aux = NULL;
+}
+
+// The SDK's copying versions, as in esp_http_server/src/httpd_uri.c.
+size_t httpd_req_get_url_query_len(httpd_req_t* r)
+{
+    struct http_parser_url* res = httpd_url_from_req(r);
+
+    return (res->field_set & (1 << UF_QUERY)) ? res->field_data[UF_QUERY].len : 0;
+}
+
+static void copy_truncated(char* dst, const char* src, size_t len, size_t size)
+{
+    if (len >= size)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* r, char* buf, size_t buf_len)
+{
+    struct http_parser_url* res = httpd_url_from_req(r);
+
+    if (!(res->field_set & (1 << UF_QUERY)))
+        return ESP_ERR_NOT_FOUND;
+    if (buf == NULL || buf_len == 0)
+        return ESP_ERR_INVALID_ARG;
+    copy_truncated(buf, r->uri + res->field_data[UF_QUERY].off, res->field_data[UF_QUERY].len, buf_len);
+    return (buf_len < res->field_data[UF_QUERY].len + 1u) ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size)
+{
+    if (qry == NULL || key == NULL || val == NULL || val_size == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    while (*qry) {
+        const char* val_ptr = strchr(qry, '=');
+        if (val_ptr == NULL)
+            break;
+        size_t offset = val_ptr - qry;
+        if (offset != strlen(key) || strncasecmp(qry, key, offset)) {
+            qry = strchr(val_ptr, '&');
+            if (qry == NULL)
+                break;
+            qry++;
+            continue;
+        }
+
+        val_ptr++;
+        size_t len = strcspn(val_ptr, "&");
+        copy_truncated(val, val_ptr, len, val_size);
+        return (val_size < len + 1) ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,226 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "sim.h"
+
+#define SIM_NVS_ENTRY_MAX 64
+#define SIM_NVS_KEY_MAXLEN 16
+#define SIM_NVS_VALUE_MAXLEN 512
+
+enum sim_nvs_type {
+    SIM_NVS_U8,
+    SIM_NVS_U32,
+    SIM_NVS_STR,
+    SIM_NVS_BLOB
+};
+
+typedef struct sim_nvs_entry {
+    char ns[SIM_NVS_KEY_MAXLEN];
+    char key[SIM_NVS_KEY_MAXLEN];
+    enum sim_nvs_type type;
+    size_t len;
+    uint8_t value[SIM_NVS_VALUE_MAXLEN];
+} sim_nvs_entry_t;
+
+// A handle is the index of its namespace in s_namespaces, plus one.
+#define SIM_NVS_NAMESPACE_MAX 8
+
+static sim_nvs_entry_t s_entries[SIM_NVS_ENTRY_MAX];
+static size_t s_entry_count = 0;
+static char s_namespaces[SIM_NVS_NAMESPACE_MAX][SIM_NVS_KEY_MAXLEN];
+static bool s_read_only[SIM_NVS_NAMESPACE_MAX + 1];
+static sim_nvs_stats_t s_stats;
+static uint32_t s_commit_failures = 0;
+static esp_err_t s_commit_err = ESP_OK;
+
+static const char* sim_nvs_ns(nvs_handle handle)
+{
+    return (handle > 0 && handle <= SIM_NVS_NAMESPACE_MAX) ? s_namespaces[handle - 1] : NULL;
+}
+
+static sim_nvs_entry_t* sim_nvs_find(nvs_handle handle, const char* key)
+{
+    const char* ns = sim_nvs_ns(handle);
+    for (size_t i = 0; ns != NULL && i < s_entry_count; i++) {
+        if (strcmp(s_entries[i].ns, ns) == 0 && strcmp(s_entries[i].key, key) == 0)
+            return &s_entries[i];
+    }
+    return NULL;
+}
+
+static esp_err_t sim_nvs_set(nvs_handle handle, const char* key, enum sim_nvs_type type,
+                             const void* value, size_t len)
+{
+    sim_nvs_entry_t* entry;
+
+    if (sim_nvs_ns(handle) == NULL)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (s_read_only[handle])
+        return ESP_ERR_NVS_READ_ONLY;
+    if (strlen(key) >= SIM_NVS_KEY_MAXLEN || len > SIM_NVS_VALUE_MAXLEN)
+        return ESP_ERR_INVALID_ARG;
+    entry = sim_nvs_find(handle, key);
+    if (entry == NULL) {
+        if (s_entry_count == SIM_NVS_ENTRY_MAX)
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        entry = &s_entries[s_entry_count++];
+        strcpy(entry->ns, sim_nvs_ns(handle));
+        strcpy(entry->key, key);
+    }
+    entry->type = type;
+    entry->len = len;
+    memcpy(entry->value, value, len);
+    s_stats.writes++;
+    return ESP_OK;
+}
+
+static esp_err_t sim_nvs_get(nvs_handle handle, const char* key, enum sim_nvs_type type,
+                             void* out_value, size_t* length)
+{
+    sim_nvs_entry_t* entry = sim_nvs_find(handle, key);
+
+    if (sim_nvs_ns(handle) == NULL)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (entry == NULL)
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (entry->type != type)
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    // Like the SDK, a NULL buffer only asks for the length.
+    if (out_value != NULL) {
+        if (*length < entry->len)
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        memcpy(out_value, entry->value, entry->len);
+    }
+    *length = entry->len;
+    return ESP_OK;
+}
+
+void sim_nvs_reset(void)
+{
+    s_entry_count = 0;
+    memset(s_namespaces, 0, sizeof(s_namespaces));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_commit_failures = 0;
+}
+
+sim_nvs_stats_t sim_nvs_get_stats(void)
+{
+    return s_stats;
+}
+
+void sim_nvs_reset_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void sim_nvs_fail_commits(uint32_t count, esp_err_t err)
+{
+    s_commit_failures = count;
+    s_commit_err = err;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    sim_nvs_reset();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode open_mode, nvs_handle* out_handle)
+{
+    size_t i;
+
+    s_stats.opens++;
+    if (strlen(name) >= SIM_NVS_KEY_MAXLEN)
+        return ESP_ERR_INVALID_ARG;
+    for (i = 0; i < SIM_NVS_NAMESPACE_MAX && s_namespaces[i][0] != '\0'; i++) {
+        if (strcmp(s_namespaces[i], name) == 0)
+            break;
+    }
+    if (i == SIM_NVS_NAMESPACE_MAX)
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    // A namespace nothing was written to does not exist yet for a reader.
+    if (s_namespaces[i][0] == '\0') {
+        if (open_mode == NVS_READONLY)
+            return ESP_ERR_NVS_NOT_FOUND;
+        strcpy(s_namespaces[i], name);
+    }
+    *out_handle = i + 1;
+    s_read_only[i + 1] = (open_mode == NVS_READONLY);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    if (sim_nvs_ns(handle) == NULL)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    s_stats.commits++;
+    if (s_commit_failures > 0) {
+        s_commit_failures--;
+        return s_commit_err;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char* key)
+{
+    sim_nvs_entry_t* entry = sim_nvs_find(handle, key);
+
+    if (entry == NULL)
+        return ESP_ERR_NVS_NOT_FOUND;
+    *entry = s_entries[--s_entry_count];
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle handle, const char* key, uint8_t value)
+{
+    return sim_nvs_set(handle, key, SIM_NVS_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle handle, const char* key, uint8_t* out_value)
+{
+    size_t len = sizeof(*out_value);
+    return sim_nvs_get(handle, key, SIM_NVS_U8, out_value, &len);
+}
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char* key, uint32_t value)
+{
+    return sim_nvs_set(handle, key, SIM_NVS_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle handle, const char* key, uint32_t* out_value)
+{
+    size_t len = sizeof(*out_value);
+    return sim_nvs_get(handle, key, SIM_NVS_U32, out_value, &len);
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char* key, const char* value)
+{
+    return sim_nvs_set(handle, key, SIM_NVS_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char* key, char* out_value, size_t* length)
+{
+    return sim_nvs_get(handle, key, SIM_NVS_STR, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length)
+{
+    return sim_nvs_set(handle, key, SIM_NVS_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_value, size_t* length)
+{
+    return sim_nvs_get(handle, key, SIM_NVS_BLOB, out_value, length);
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+#include "sim.h"
+
+#define SIM_OTA_HANDLE 1
+
+static const esp_partition_t s_partitions[] = {
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, SIM_PARTITION_SIZE, "ota_0", false},
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x110000, SIM_PARTITION_SIZE, "ota_1", false},
+};
+#define SIM_PARTITION_COUNT (sizeof(s_partitions) / sizeof(s_partitions[0]))
+
+static uint8_t s_data[SIM_PARTITION_COUNT][SIM_PARTITION_SIZE];
+static const esp_partition_t* s_running = &s_partitions[0];
+static const esp_partition_t* s_boot = &s_partitions[0];
+// the partition esp_ota_begin() opened, NULL once esp_ota_end() closed it.
+static const esp_partition_t* s_writing = NULL;
+static size_t s_written = 0;
+static uint32_t s_writes = 0;
+static size_t s_erased = 0;
+static uint32_t s_erase_us = 0;
+static uint32_t s_write_us_per_kib = 0;
+
+static size_t sim_partition_index(const esp_partition_t* partition)
+{
+    return (size_t)(partition - s_partitions);
+}
+
+static bool sim_partition_valid(const esp_partition_t* partition)
+{
+    return partition != NULL && sim_partition_index(partition) < SIM_PARTITION_COUNT;
+}
+
+void sim_partition_reset(void)
+{
+    memset(s_data, 0xff, sizeof(s_data));
+    s_running = s_boot = &s_partitions[0];
+    s_writing = NULL;
+    s_written = s_erased = 0;
+    s_writes = 0;
+    s_erase_us = s_write_us_per_kib = 0;
+}
+
+uint8_t* sim_partition_data(esp_partition_subtype_t subtype)
+{
+    for (size_t i = 0; i < SIM_PARTITION_COUNT; i++) {
+        if (s_partitions[i].subtype == subtype)
+            return s_data[i];
+    }
+    return NULL;
+}
+
+size_t sim_partition_written(void)
+{
+    return s_written;
+}
+
+uint32_t sim_partition_writes(void)
+{
+    return s_writes;
+}
+
+void sim_flash_set_timing(uint32_t erase_us_per_sector, uint32_t write_us_per_kib)
+{
+    s_erase_us = erase_us_per_sector;
+    s_write_us_per_kib = write_us_per_kib;
+}
+
+void sim_partition_reboot(void)
+{
+    s_running = s_boot;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label)
+{
+    for (size_t i = 0; i < SIM_PARTITION_COUNT; i++) {
+        if (s_partitions[i].type == type
+            && (subtype == ESP_PARTITION_SUBTYPE_ANY || s_partitions[i].subtype == subtype)
+            && (label == NULL || strcmp(s_partitions[i].label, label) == 0))
+            return &s_partitions[i];
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if (!sim_partition_valid(partition))
+        return ESP_ERR_INVALID_ARG;
+    if (src_offset > partition->size || size > partition->size - src_offset)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, &s_data[sim_partition_index(partition)][src_offset], size);
+    return ESP_OK;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void)
+{
+    return s_running;
+}
+
+const esp_partition_t* esp_ota_get_boot_partition(void)
+{
+    return s_boot;
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+    if (start_from == NULL)
+        start_from = s_running;
+    return &s_partitions[(sim_partition_index(start_from) + 1) % SIM_PARTITION_COUNT];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle)
+{
+    if (!sim_partition_valid(partition))
+        return ESP_ERR_INVALID_ARG;
+    if (partition == s_running)
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    if (image_size != OTA_SIZE_UNKNOWN && image_size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    s_writing = partition;
+    s_written = s_erased = 0;
+    s_writes = 0;
+    *out_handle = SIM_OTA_HANDLE;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size)
+{
+    uint8_t* dst;
+
+    if (handle != SIM_OTA_HANDLE || s_writing == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (size > s_writing->size - s_written)
+        return ESP_ERR_INVALID_SIZE;
+    dst = &s_data[sim_partition_index(s_writing)][0];
+    // sectors are erased as the image reaches them.
+    while (s_erased < s_written + size) {
+        memset(&dst[s_erased], 0xff, SIM_FLASH_SECTOR_SIZE);
+        s_erased += SIM_FLASH_SECTOR_SIZE;
+        if (s_erase_us > 0)
+            usleep(s_erase_us);
+    }
+    memcpy(&dst[s_written], data, size);
+    s_written += size;
+    s_writes++;
+    if (s_write_us_per_kib > 0)
+        usleep((useconds_t)((uint64_t)size * s_write_us_per_kib / 1024));
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (handle != SIM_OTA_HANDLE || s_writing == NULL)
+        return ESP_ERR_INVALID_ARG;
+    s_writing = NULL;
+    return (s_written > 0) ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    if (!sim_partition_valid(partition) || partition == s_writing)
+        return ESP_ERR_INVALID_ARG;
+    s_boot = partition;
+    return ESP_OK;
+}
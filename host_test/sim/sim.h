@@ -0,0 +1,57 @@
+/*
+ * sim.h
+ *
+ * Controls and counters of the host emulations standing in for the SDK: NVS kept in RAM,
+ * two OTA app partitions kept in RAM, the restart / reset reason of esp_system.h and the
+ * requests of esp_http_server.h.
+ * board_hal.h has the controls of the simulated clock, GPIOs and timers.
+ */
+
+#ifndef HOST_TEST_SIM_H_
+#define HOST_TEST_SIM_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+// NVS: every open, commit and set since the last sim_nvs_reset().
+typedef struct sim_nvs_stats {
+    uint32_t opens;
+    uint32_t commits;
+    uint32_t writes;
+} sim_nvs_stats_t;
+
+// Erase every key and clear the counters and injected failures.
+void sim_nvs_reset(void);
+sim_nvs_stats_t sim_nvs_get_stats(void);
+void sim_nvs_reset_stats(void);
+// The next count commits return err.
+void sim_nvs_fail_commits(uint32_t count, esp_err_t err);
+
+// OTA partitions: ota_0 and ota_1, SIM_PARTITION_SIZE each, the device runs ota_0.
+#define SIM_PARTITION_SIZE (1024 * 1024)
+#define SIM_FLASH_SECTOR_SIZE 4096
+
+void sim_partition_reset(void);
+// Raw content of an app partition, e.g. to compare with the image written to it.
+uint8_t* sim_partition_data(esp_partition_subtype_t subtype);
+// Bytes esp_ota_write() wrote, and the number of calls, since the last esp_ota_begin().
+size_t sim_partition_written(void);
+uint32_t sim_partition_writes(void);
+// esp_ota_write() blocks for the time a real flash takes, per erased sector and per KiB written.
+void sim_flash_set_timing(uint32_t erase_us_per_sector, uint32_t write_us_per_kib);
+// Boot the boot partition: it becomes the running one.
+void sim_partition_reboot(void);
+
+// esp_system.h
+uint32_t sim_restart_count(void);
+void sim_set_reset_reason(esp_reset_reason_t reason);
+
+// esp_http_server.h: a GET request of uri, with the URL parsed the way the server does it.
+void sim_httpd_req_init(httpd_req_t* req, const char* uri);
+void sim_httpd_req_free(httpd_req_t* req);
+
+#endif /* HOST_TEST_SIM_H_ */
@@ -0,0 +1,130 @@
+/*
+ * Field name lookup through the generated perfect hash, for the real schema and a 200 field
+ * one, checked against and timed beside the linear strcmp() scan it replaced.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "configuration_adapter.h"
+
+#include "cfg_bench_schema.h"
+#include "test_util.h"
+
+#define BENCH_LOOKUPS 1000000
+
+#define BENCH_FIELD_ID(id, name, type, default_val, validator) id,
+#define BENCH_FIELD_NAME(id, name, type, default_val, validator) [id] = name,
+
+enum cfg_bench_idt {
+    CFG_BENCH_SCHEMA(BENCH_FIELD_ID)
+    CFG_BENCH_IDT_MAX
+};
+
+// generated for the enum above
+#include "cfg_bench_schema_hash.h"
+
+static const char* const s_bench_names[CFG_BENCH_IDT_MAX] = {
+    CFG_BENCH_SCHEMA(BENCH_FIELD_NAME)
+};
+
+// Same as cfg_name_hash() and cfg_adp_id_from_name() in configuration_adapter.c, on the bench table.
+static uint32_t bench_hash(uint32_t seed, const char* name)
+{
+    uint32_t h = 0x811c9dc5 ^ seed;
+    while (*name) {
+        h = (h ^ (uint8_t)*name++) * 0x01000193;
+    }
+    // Mix the high bits into the low ones, the table size is often a power of two.
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h;
+}
+
+static int bench_id_from_name(const char* name)
+{
+    int16_t disp = cfg_name_hash_disp[bench_hash(0, name) % CFG_BENCH_IDT_MAX];
+    uint32_t slot = (disp < 0) ? (uint32_t)(-disp - 1) : bench_hash(disp, name) % CFG_BENCH_IDT_MAX;
+    int id = cfg_name_hash_ids[slot];
+
+    return (strcmp(name, s_bench_names[id]) == 0) ? id : CFG_BENCH_IDT_MAX;
+}
+
+static int bench_linear_id_from_name(const char* name)
+{
+    for (int id = 0; id < CFG_BENCH_IDT_MAX; id++) {
+        if (strcmp(name, s_bench_names[id]) == 0)
+            return id;
+    }
+    return CFG_BENCH_IDT_MAX;
+}
+
+// The lookup cfg_adp_id_from_name() replaced.
+static enum cfg_data_idt linear_id_from_name(const char* name)
+{
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX; id++) {
+        if (strcmp(name, cfg_adp_name_from_id(id)) == 0)
+            return id;
+    }
+    return CFG_IDT_MAX;
+}
+
+static void test_schema(void)
+{
+    static const char* const unknown[] = {"", "switch", "switch4", "Switch1", "wifi_sta_ssid_", "bench_field_0"};
+
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX; id++)
+        TEST_CHECK_EQ(id, cfg_adp_id_from_name(cfg_adp_name_from_id(id)));
+    for (size_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); i++)
+        TEST_CHECK_EQ(CFG_IDT_MAX, cfg_adp_id_from_name(unknown[i]));
+    TEST_CHECK_EQ(CFG_IDT_MAX, cfg_adp_id_from_name(NULL));
+}
+
+static void test_bench_schema(void)
+{
+    TEST_CHECK_EQ(CFG_BENCH_IDT_MAX, CFG_SCHEMA_HASH_FIELD_COUNT);
+    for (int id = 0; id < CFG_BENCH_IDT_MAX; id++)
+        TEST_CHECK_EQ(id, bench_id_from_name(s_bench_names[id]));
+    TEST_CHECK_EQ(CFG_BENCH_IDT_MAX, bench_id_from_name("bench_field_200"));
+    TEST_CHECK_EQ(CFG_BENCH_IDT_MAX, bench_id_from_name("wifi_mode"));
+}
+
+static void bench_schema(void)
+{
+    volatile int sink = 0;
+    uint64_t start_ns, hash_ns, linear_ns;
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++)
+        sink += cfg_adp_id_from_name(cfg_adp_name_from_id(i % CFG_IDT_MAX));
+    hash_ns = test_time_ns() - start_ns;
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++)
+        sink += linear_id_from_name(cfg_adp_name_from_id(i % CFG_IDT_MAX));
+    linear_ns = test_time_ns() - start_ns;
+
+    printf("bench: %d fields: %.1f ns/lookup hashed, %.1f ns/lookup linear\n", CFG_IDT_MAX,
+           (double)hash_ns / BENCH_LOOKUPS, (double)linear_ns / BENCH_LOOKUPS);
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++)
+        sink += bench_id_from_name(s_bench_names[i % CFG_BENCH_IDT_MAX]);
+    hash_ns = test_time_ns() - start_ns;
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++)
+        sink += bench_linear_id_from_name(s_bench_names[i % CFG_BENCH_IDT_MAX]);
+    linear_ns = test_time_ns() - start_ns;
+
+    printf("bench: %d fields: %.1f ns/lookup hashed, %.1f ns/lookup linear\n", CFG_BENCH_IDT_MAX,
+           (double)hash_ns / BENCH_LOOKUPS, (double)linear_ns / BENCH_LOOKUPS);
+}
+
+int main(void)
+{
+    test_schema();
+    test_bench_schema();
+    bench_schema();
+    return test_result();
+}
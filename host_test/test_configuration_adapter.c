@@ -0,0 +1,219 @@
+/*
+ * Configuration cache on the emulated NVS: reads never touch NVS, a burst of updates is
+ * committed once after CFG_FLUSH_DELAY_MS, and the cost of a get or set compared with the
+ * open / set / commit / close round trip each of them used to take.
+ */
+#include <string.h>
+
+#include "board_hal.h"
+#include "configuration_adapter.h"
+
+#include "sim.h"
+#include "test_util.h"
+
+#define BENCH_ROUNDS 100000
+
+static uint32_t nvs_u32(const char* key)
+{
+    nvs_handle handle;
+    uint32_t value = 0;
+
+    TEST_CHECK_EQ(ESP_OK, nvs_open(CFG_STORAGE_NAMESPACE, NVS_READONLY, &handle));
+    TEST_CHECK_EQ(ESP_OK, nvs_get_u32(handle, key, &value));
+    nvs_close(handle);
+    return value;
+}
+
+static void setup(void)
+{
+    nvs_handle handle;
+    uint32_t baud = 0;
+    char ssid[CFG_STR_MAXLEN];
+    size_t len = sizeof(ssid);
+
+    hal_sim_reset();
+    sim_nvs_reset();
+    // a field stored by an earlier boot, the others are default.
+    TEST_CHECK_EQ(ESP_OK, nvs_open(CFG_STORAGE_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_CHECK_EQ(ESP_OK, nvs_set_u32(handle, "uart_baud_rate", 115200));
+    TEST_CHECK_EQ(ESP_OK, nvs_commit(handle));
+    nvs_close(handle);
+    sim_nvs_reset_stats();
+
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_init());
+    TEST_CHECK_EQ(1, sim_nvs_get_stats().opens);
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_get_u32_by_id(CFG_UART_BAUD, &baud));
+    TEST_CHECK_EQ(115200, baud);
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_get_by_id(CFG_WIFI_PASS_AP, ssid, &len));
+    TEST_CHECK(strcmp(ssid, CFG_WIFI_AP_PASS_DEFAULT) == 0);
+}
+
+static void test_reads_stay_in_ram(void)
+{
+    sim_nvs_stats_t before = sim_nvs_get_stats();
+    uint8_t value;
+
+    for (int i = 0; i < 1000; i++)
+        cfg_adp_get_u8_by_id(CFG_SW_1 + i % 3, &value);
+    TEST_CHECK_EQ(before.opens, sim_nvs_get_stats().opens);
+}
+
+static void test_burst_single_commit(void)
+{
+    sim_nvs_stats_t before = sim_nvs_get_stats();
+
+    // ten fields, as a form submission sets them, each one pushing the flush back.
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_CHECK_EQ(ESP_OK, cfg_adp_set_u32_by_id(CFG_OTA_INTERVAL, 100 + i));
+        TEST_CHECK_EQ(ESP_OK, cfg_adp_set_u8_by_id(CFG_SW_1 + i % 3, i));
+        hal_sim_advance_us((CFG_FLUSH_DELAY_MS - 100) * 1000ULL);
+    }
+    TEST_CHECK_EQ(before.commits, sim_nvs_get_stats().commits);
+    hal_sim_advance_us(100 * 1000ULL);
+    TEST_CHECK_EQ(before.commits + 1, sim_nvs_get_stats().commits);
+    TEST_CHECK_EQ(before.opens + 1, sim_nvs_get_stats().opens);
+    // only the four changed fields are written.
+    TEST_CHECK_EQ(before.writes + 4, sim_nvs_get_stats().writes);
+    TEST_CHECK_EQ(109, nvs_u32("ota_interval"));
+
+    // nothing changed, nothing to commit.
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_flush());
+    hal_sim_advance_us(CFG_FLUSH_DELAY_MS * 1000ULL);
+    TEST_CHECK_EQ(before.commits + 1, sim_nvs_get_stats().commits);
+}
+
+static void test_explicit_flush(void)
+{
+    sim_nvs_stats_t before = sim_nvs_get_stats();
+
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_set_u32_by_id(CFG_UART_TX_DELAY, 7));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_flush());
+    TEST_CHECK_EQ(before.commits + 1, sim_nvs_get_stats().commits);
+    TEST_CHECK_EQ(7, nvs_u32("uart_tx_delay"));
+    // the flush timer finds nothing left to do.
+    hal_sim_advance_us(CFG_FLUSH_DELAY_MS * 1000ULL);
+    TEST_CHECK_EQ(before.commits + 1, sim_nvs_get_stats().commits);
+}
+
+static void test_transaction(void)
+{
+    sim_nvs_stats_t before = sim_nvs_get_stats();
+    cfg_adp_txn_handle_t txn = cfg_adp_txn_begin();
+    uint32_t baud = 0;
+
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_stage(txn, CFG_UART_BAUD, (void*)9600));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_stage_from_raw(txn, CFG_UART_PARITY, "1"));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_stage_from_raw(txn, CFG_WIFI_SSID, "plant-3"));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_validate(txn));
+    TEST_CHECK_EQ(before.commits, sim_nvs_get_stats().commits);
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_commit(txn));
+    TEST_CHECK_EQ(before.commits + 1, sim_nvs_get_stats().commits);
+    TEST_CHECK_EQ(9600, nvs_u32("uart_baud_rate"));
+
+    // one invalid field, nothing is applied.
+    txn = cfg_adp_txn_begin();
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_stage(txn, CFG_UART_BAUD, (void*)19200));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_stage(txn, CFG_WIFI_AUTH_AP, (void*)99));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, cfg_adp_txn_validate(txn));
+    TEST_CHECK(cfg_adp_txn_commit(txn) != ESP_OK);
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_get_u32_by_id(CFG_UART_BAUD, &baud));
+    TEST_CHECK_EQ(9600, baud);
+    TEST_CHECK_EQ(before.commits + 1, sim_nvs_get_stats().commits);
+}
+
+static void test_transaction_commit_failure(void)
+{
+    sim_nvs_stats_t before = sim_nvs_get_stats();
+    cfg_adp_txn_handle_t txn = cfg_adp_txn_begin();
+    uint32_t baud = 0;
+
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_txn_stage(txn, CFG_UART_BAUD, (void*)57600));
+    sim_nvs_fail_commits(1, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_CHECK_EQ(ESP_ERR_NVS_NOT_ENOUGH_SPACE, cfg_adp_txn_commit(txn));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_get_u32_by_id(CFG_UART_BAUD, &baud));
+    TEST_CHECK_EQ(9600, baud);
+
+    // the field is still dirty, the flush timer writes the previous value back to NVS.
+    hal_sim_advance_us(CFG_FLUSH_DELAY_MS * 1000ULL);
+    TEST_CHECK_EQ(before.commits + 2, sim_nvs_get_stats().commits);
+    TEST_CHECK_EQ(9600, nvs_u32("uart_baud_rate"));
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_flush());
+    TEST_CHECK_EQ(before.commits + 2, sim_nvs_get_stats().commits);
+}
+
+// What cfg_adp_get_by_id() and cfg_adp_set_by_id() did for a U32 field before the cache.
+static esp_err_t nvs_round_trip_get(const char* key, uint32_t* value)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_get_u32(handle, key, value);
+    nvs_close(handle);
+    return err;
+}
+
+static esp_err_t nvs_round_trip_set(const char* key, uint32_t value)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_u32(handle, key, value);
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+static void bench_get_set(void)
+{
+    sim_nvs_stats_t before;
+    sim_nvs_stats_t after;
+    uint64_t start_ns;
+    uint64_t get_ns, set_ns, old_get_ns, old_set_ns;
+    uint32_t value = 0;
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        cfg_adp_get_u32_by_id(CFG_UART_BAUD, &value);
+    get_ns = test_time_ns() - start_ns;
+
+    before = sim_nvs_get_stats();
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        cfg_adp_set_u32_by_id(CFG_OTA_INTERVAL, i);
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_flush());
+    set_ns = test_time_ns() - start_ns;
+    after = sim_nvs_get_stats();
+    TEST_CHECK_EQ(before.commits + 1, after.commits);
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        nvs_round_trip_get("uart_baud_rate", &value);
+    old_get_ns = test_time_ns() - start_ns;
+
+    before = sim_nvs_get_stats();
+    start_ns = test_time_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        nvs_round_trip_set("ota_interval", i);
+    old_set_ns = test_time_ns() - start_ns;
+    TEST_CHECK_EQ(before.commits + BENCH_ROUNDS, sim_nvs_get_stats().commits);
+
+    printf("bench: get %.0f ns/field cached, %.0f ns/field with an NVS round trip\n",
+           (double)get_ns / BENCH_ROUNDS, (double)old_get_ns / BENCH_ROUNDS);
+    printf("bench: set %.0f ns/field and 1 commit cached, %.0f ns/field and %d commits with an NVS round trip\n",
+           (double)set_ns / BENCH_ROUNDS, (double)old_set_ns / BENCH_ROUNDS, BENCH_ROUNDS);
+}
+
+int main(void)
+{
+    setup();
+    test_reads_stay_in_ram();
+    test_burst_single_commit();
+    test_explicit_flush();
+    test_transaction();
+    test_transaction_commit_failure();
+    bench_get_set();
+    return test_result();
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+#
+# tools/gen_cfg_hash.py finds a table for the real schema grown by random names, at every
+# size up to 255 fields and at the power of two sizes in particular, and every name is
+# found again the way cfg_adp_id_from_name() looks it up.
+#
+# usage: test_gen_cfg_hash.py [schema.h]
+
+import os
+import random
+import string
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools'))
+import gen_cfg_hash  # noqa: E402
+
+NAME_CHARS = string.ascii_lowercase + string.digits + '_'
+ROUNDS = 20
+
+
+def lookup(disp, slots, names, name):
+    n = len(names)
+    d = disp[gen_cfg_hash.fnv_hash(0, name) % n]
+    slot = -d - 1 if d < 0 else gen_cfg_hash.fnv_hash(d, name) % n
+    return slots[slot]
+
+
+def check(names):
+    disp, slots = gen_cfg_hash.build_hash(names)
+    assert sorted(slots) == list(range(len(names))), 'not a permutation'
+    for i, name in enumerate(names):
+        assert lookup(disp, slots, names, name) == i, '"%s" not found among %d names' % (name, len(names))
+
+
+def random_names(rng, taken, count):
+    names = []
+    while len(names) < count:
+        name = ''.join(rng.choice(NAME_CHARS) for _ in range(rng.randint(1, gen_cfg_hash.NVS_KEY_MAXLEN)))
+        if name not in taken:
+            taken.add(name)
+            names.append(name)
+    return names
+
+
+def main():
+    schema = sys.argv[1] if len(sys.argv) > 1 else gen_cfg_hash.DEFAULT_SCHEMA
+    names = [name for _, name in gen_cfg_hash.parse_schema(schema)]
+    rng = random.Random(0x5eed)
+
+    # Names close to each other, like a setting added next to its siblings.
+    check(names + ['ota_retry', 'ota_channel'])
+    check(['switch%d' % i for i in range(1, 17)])
+    check(['field_%02d' % i for i in range(64)])
+
+    for total in list(range(1, 65)) + [128, 200, 255]:
+        for _ in range(ROUNDS if total <= 64 else 2):
+            base = names[:total]
+            check(base + random_names(rng, set(base), total - len(base)))
+
+    # The generator end to end, on a schema with the added names.
+    fields = ['    CFG_FIELD(CFG_T_%d, "%s", U8, 0, NULL) \\' % (i, name)
+              for i, name in enumerate(names + random_names(rng, set(names), 32 - len(names)))]
+    with tempfile.TemporaryDirectory() as tmp:
+        schema_path = os.path.join(tmp, 'schema.h')
+        with open(schema_path, 'w') as f:
+            f.write('#define CFG_SCHEMA(CFG_FIELD) \\\n%s\n\n' % '\n'.join(fields))
+        sys.argv = [sys.argv[0], schema_path, os.path.join(tmp, 'schema_hash.h')]
+        gen_cfg_hash.main()
+    print('ok')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,85 @@
+#include <malloc.h>
+#include <stdbool.h>
+
+#include "test_heap.h"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static uint32_t s_heap_allocs = 0;
+static size_t s_heap_now = 0;
+static size_t s_heap_peak = 0;
+
+static void heap_count(void* ptr, bool alloc)
+{
+    size_t size = (ptr != NULL) ? malloc_usable_size(ptr) : 0;
+    size_t now;
+    size_t peak;
+
+    if (!alloc) {
+        __atomic_sub_fetch(&s_heap_now, size, __ATOMIC_RELAXED);
+        return;
+    }
+    if (ptr != NULL)
+        __atomic_add_fetch(&s_heap_allocs, 1, __ATOMIC_RELAXED);
+    now = __atomic_add_fetch(&s_heap_now, size, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&s_heap_peak, __ATOMIC_RELAXED);
+    while (now > peak && !__atomic_compare_exchange_n(&s_heap_peak, &peak, now, true, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED))
+        ;
+}
+
+void* __wrap_malloc(size_t size)
+{
+    void* ptr = __real_malloc(size);
+
+    heap_count(ptr, true);
+    return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    void* ptr = __real_calloc(count, size);
+
+    heap_count(ptr, true);
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    size_t old_size = (ptr != NULL) ? malloc_usable_size(ptr) : 0;
+    void* moved = __real_realloc(ptr, size);
+
+    // A failed realloc() keeps ptr.
+    if (moved == NULL && size > 0)
+        return NULL;
+    __atomic_sub_fetch(&s_heap_now, old_size, __ATOMIC_RELAXED);
+    heap_count(moved, true);
+    return moved;
+}
+
+void __wrap_free(void* ptr)
+{
+    heap_count(ptr, false);
+    __real_free(ptr);
+}
+
+uint32_t test_heap_allocs(void)
+{
+    return __atomic_load_n(&s_heap_allocs, __ATOMIC_RELAXED);
+}
+
+size_t test_heap_peak_start(void)
+{
+    size_t now = __atomic_load_n(&s_heap_now, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&s_heap_peak, now, __ATOMIC_RELAXED);
+    return now;
+}
+
+size_t test_heap_peak(void)
+{
+    return __atomic_load_n(&s_heap_peak, __ATOMIC_RELAXED);
+}
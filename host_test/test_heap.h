@@ -0,0 +1,22 @@
+/*
+ * test_heap.h
+ *
+ * Heap accounting for the tests linked by host_test_count_heap(): test_heap.c wraps malloc,
+ * calloc, realloc and free (-Wl,--wrap), in every thread. Counts are host figures, "bench:"
+ * lines print them beside the timings.
+ */
+
+#ifndef HOST_TEST_TEST_HEAP_H_
+#define HOST_TEST_TEST_HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Successful malloc(), calloc() and realloc() calls so far.
+uint32_t test_heap_allocs(void);
+// Restart the peak at the heap in use now, which is returned.
+size_t test_heap_peak_start(void);
+// The most heap in use since test_heap_peak_start().
+size_t test_heap_peak(void);
+
+#endif /* HOST_TEST_TEST_HEAP_H_ */
@@ -0,0 +1,274 @@
+/*
+ * The JSON API requests the web UI sends, get, set and wifi_sta_status, handled the way
+ * web_server.c does with json_stream and the way it used to with cJSON, on the same decoded
+ * request body. Both give the same response, the benchmark prints ns and allocations per
+ * request (test_heap.c). cJSON is the SDK's json component, or any cJSON tree set as
+ * CJSON_DIR; without it only json_stream is timed.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_stream.h"
+#include "web_server.h"
+
+#ifdef HOST_TEST_CJSON
+#include "cJSON.h"
+#endif
+
+#include "test_heap.h"
+#include "test_util.h"
+
+#define BENCH_ROUNDS 100000
+#define BODY_MAXLEN 512
+#define RESPONSE_MAXLEN 1024
+
+static const struct {
+    const char* name;
+    const char* body;
+} s_requests[] = {
+    {"get", "{\"method\":\"get\",\"trans_id\":1,\"fields\":[\"wifi_sta_ssid\",\"wifi_sta_retry\",\"wifi_ap_ssid\","
+            "\"wifi_ap_auth\",\"wifi_mode\",\"uart_baud_rate\",\"uart_parity\",\"uart_tx_delay\",\"switch1\","
+            "\"switch2\",\"switch3\"]}"},
+    {"set", "{\"method\":\"set\",\"trans_id\":2,\"fields\":{\"uart_baud_rate\":\"19200\",\"uart_parity\":\"1\","
+            "\"switch1\":\"1\",\"wifi_sta_ssid\":\"plant \\\"3\\\"\"}}"},
+    {"wifi", "{\"method\":\"wifi_sta_status\",\"trans_id\":\"t3\"}"},
+};
+
+// The configuration and the Wi-Fi status stand still, the bench is about the JSON.
+static const struct {
+    const char* name;
+    const char* value;
+} s_fields[] = {
+    {"wifi_sta_ssid", "plant-3"}, {"wifi_sta_retry", "5"}, {"wifi_ap_ssid", "Modbus Switch"},
+    {"wifi_ap_auth", "4"}, {"wifi_mode", "1"}, {"uart_baud_rate", "9600"}, {"uart_parity", "0"},
+    {"uart_tx_delay", "1"}, {"switch1", "0"}, {"switch2", "1"}, {"switch3", "0"},
+};
+
+static const char* s_ip6[] = {"fe80::a:bff:fec:d0e", "2001:db8::a:bff:fec:d0e"};
+
+static const char* field_value(const char* name)
+{
+    for (size_t i = 0; name != NULL && i < sizeof(s_fields) / sizeof(s_fields[0]); i++) {
+        if (strcmp(name, s_fields[i].name) == 0)
+            return s_fields[i].value;
+    }
+    return NULL;
+}
+
+// Staging a field: known and given a value.
+static bool field_stage(const char* name, const char* value)
+{
+    return field_value(name) != NULL && value != NULL;
+}
+
+typedef struct output {
+    char text[RESPONSE_MAXLEN];
+    size_t len;
+} output_t;
+
+static esp_err_t output_sink(void* ctx, const char* data, size_t len)
+{
+    output_t* out = ctx;
+
+    if (out->len + len >= sizeof(out->text))
+        return ESP_ERR_NO_MEM;
+    memcpy(out->text + out->len, data, len);
+    out->len += len;
+    out->text[out->len] = '\0';
+    return ESP_OK;
+}
+
+// As json_dispatch() and the json_method_*() handlers in web_server.c.
+static void stream_request(const char* body, output_t* out)
+{
+    json_token_t tokens[WEB_SRV_JSON_TOKEN_MAX];
+    json_reader_t reader;
+    json_writer_t writer;
+    char buf[BODY_MAXLEN];
+    size_t len = strlen(body);
+    int item;
+
+    out->len = 0;
+    // The handler owns the body, it is tokenized in place.
+    memcpy(buf, body, len + 1);
+    if (json_reader_parse(&reader, buf, len, tokens, WEB_SRV_JSON_TOKEN_MAX) != ESP_OK)
+        return;
+    const char* method = json_reader_str(&reader, json_reader_find(&reader, 0, "method"));
+    if (method == NULL)
+        return;
+
+    json_writer_init(&writer, output_sink, out);
+    json_writer_begin_object(&writer);
+    json_writer_kv_string(&writer, "method", method);
+    int trans_id = json_reader_find(&reader, 0, "trans_id");
+    if (trans_id >= 0) {
+        json_writer_key(&writer, "trans_id");
+        if (json_reader_type(&reader, trans_id) == JSON_STRING)
+            json_writer_string(&writer, json_reader_text(&reader, trans_id));
+        else
+            json_writer_primitive(&writer, json_reader_text(&reader, trans_id));
+    }
+
+    if (strcmp(method, "get") == 0) {
+        int fields = json_reader_find(&reader, 0, "fields");
+        json_reader_for_each_item(&reader, fields, item) {
+            const char* value = field_value(json_reader_str(&reader, item));
+            if (value != NULL)
+                json_writer_kv_string(&writer, json_reader_str(&reader, item), value);
+        }
+    } else if (strcmp(method, "set") == 0) {
+        const char* ret = "200 OK";
+        int fields = json_reader_find(&reader, 0, "fields");
+        json_reader_for_each_key(&reader, fields, item) {
+            if (!field_stage(json_reader_str(&reader, item), json_reader_str(&reader, item + 1)))
+                ret = "404 Not Found";
+        }
+        json_writer_kv_string(&writer, "return_value", ret);
+    } else {
+        json_writer_kv_string(&writer, "wifi_sta_status", "connected");
+        json_writer_kv_string(&writer, "wifi_sta_ap_ssid", "plant-3");
+        json_writer_kv_string(&writer, "wifi_sta_ip4_address", "192.168.1.23");
+        json_writer_kv_string(&writer, "wifi_sta_ip4_netmask", "255.255.255.0");
+        json_writer_kv_string(&writer, "wifi_sta_ip4_gateway", "192.168.1.1");
+        json_writer_key(&writer, "wifi_sta_ip6_address");
+        json_writer_begin_array(&writer);
+        for (size_t i = 0; i < sizeof(s_ip6) / sizeof(s_ip6[0]); i++)
+            json_writer_string(&writer, s_ip6[i]);
+        json_writer_end_array(&writer);
+    }
+    json_writer_end_object(&writer);
+    json_writer_flush(&writer);
+}
+
+#ifdef HOST_TEST_CJSON
+// As json_get_parser() and web_srv_json_get_service() did before json_stream.
+static void cjson_request(const char* body, output_t* out)
+{
+    cJSON* req = cJSON_Parse(body);
+    cJSON* resp;
+    cJSON* item;
+    char* text;
+
+    out->len = 0;
+    if (req == NULL)
+        return;
+    item = cJSON_GetObjectItem(req, "method");
+    const char* method = cJSON_GetStringValue(item);
+    if (method == NULL) {
+        cJSON_Delete(req);
+        return;
+    }
+
+    resp = cJSON_CreateObject();
+    cJSON_DetachItemViaPointer(req, item);
+    cJSON_AddItemToObject(resp, "method", item);
+    item = cJSON_GetObjectItem(req, "trans_id");
+    if (item != NULL) {
+        cJSON_DetachItemViaPointer(req, item);
+        cJSON_AddItemToObject(resp, "trans_id", item);
+    }
+
+    if (strcmp(method, "get") == 0) {
+        cJSON_ArrayForEach(item, cJSON_GetObjectItem(req, "fields")) {
+            const char* value = field_value(cJSON_GetStringValue(item));
+            if (value != NULL)
+                cJSON_AddStringToObject(resp, cJSON_GetStringValue(item), value);
+        }
+    } else if (strcmp(method, "set") == 0) {
+        const char* ret = "200 OK";
+        cJSON_ArrayForEach(item, cJSON_GetObjectItem(req, "fields")) {
+            if (!field_stage(item->string, cJSON_GetStringValue(item)))
+                ret = "404 Not Found";
+        }
+        cJSON_AddItemToObjectCS(resp, "return_value", cJSON_CreateString(ret));
+    } else {
+        cJSON_AddItemToObjectCS(resp, "wifi_sta_status", cJSON_CreateString("connected"));
+        cJSON_AddItemToObjectCS(resp, "wifi_sta_ap_ssid", cJSON_CreateString("plant-3"));
+        cJSON_AddItemToObjectCS(resp, "wifi_sta_ip4_address", cJSON_CreateString("192.168.1.23"));
+        cJSON_AddItemToObjectCS(resp, "wifi_sta_ip4_netmask", cJSON_CreateString("255.255.255.0"));
+        cJSON_AddItemToObjectCS(resp, "wifi_sta_ip4_gateway", cJSON_CreateString("192.168.1.1"));
+        cJSON_AddItemToObjectCS(resp, "wifi_sta_ip6_address",
+                                cJSON_CreateStringArray(s_ip6, sizeof(s_ip6) / sizeof(s_ip6[0])));
+    }
+
+    text = cJSON_PrintUnformatted(resp);
+    if (text != NULL)
+        output_sink(out, text, strlen(text));
+    free(text);
+    cJSON_Delete(resp);
+    cJSON_Delete(req);
+}
+#endif
+
+static void test_responses(void)
+{
+    output_t* out = malloc(sizeof(output_t));
+    json_token_t tokens[WEB_SRV_JSON_TOKEN_MAX];
+    json_reader_t reader;
+
+    for (size_t i = 0; i < sizeof(s_requests) / sizeof(s_requests[0]); i++) {
+        stream_request(s_requests[i].body, out);
+        TEST_CHECK(out->len > 0);
+        char* streamed = malloc(out->len + 1);
+        memcpy(streamed, out->text, out->len + 1);
+#ifdef HOST_TEST_CJSON
+        // The same text from both.
+        cjson_request(s_requests[i].body, out);
+        if (strcmp(streamed, out->text) != 0)
+            fprintf(stderr, "%s: json_stream '%s', cJSON '%s'\n", s_requests[i].name, streamed, out->text);
+        TEST_CHECK(strcmp(streamed, out->text) == 0);
+#endif
+        // Every response reads back, with the method of its request.
+        TEST_CHECK_EQ(ESP_OK, json_reader_parse(&reader, streamed, strlen(streamed), tokens, WEB_SRV_JSON_TOKEN_MAX));
+        TEST_CHECK(json_reader_str(&reader, json_reader_find(&reader, 0, "method")) != NULL);
+        free(streamed);
+    }
+    free(out);
+}
+
+typedef void (*request_handler_t)(const char* body, output_t* out);
+
+static void bench_one(const char* lib, const char* name, const char* body, request_handler_t handler, output_t* out)
+{
+    uint32_t allocs = test_heap_allocs();
+    size_t heap_base = test_heap_peak_start();
+    uint64_t start = test_time_ns();
+
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        handler(body, out);
+    uint64_t ns = test_time_ns() - start;
+
+    printf("bench: json %-4s %-11s %6.0f ns/request, %4.1f allocations/request, peak heap %5u bytes\n", name, lib,
+           (double)ns / BENCH_ROUNDS, (double)(test_heap_allocs() - allocs) / BENCH_ROUNDS,
+           (unsigned)(test_heap_peak() - heap_base));
+}
+
+static void bench(void)
+{
+    output_t* out = malloc(sizeof(output_t));
+    uint32_t allocs;
+
+    // The stream path allocates nothing.
+    allocs = test_heap_allocs();
+    for (size_t i = 0; i < sizeof(s_requests) / sizeof(s_requests[0]); i++)
+        stream_request(s_requests[i].body, out);
+    TEST_CHECK_EQ(allocs, test_heap_allocs());
+
+    for (size_t i = 0; i < sizeof(s_requests) / sizeof(s_requests[0]); i++) {
+        bench_one("json_stream", s_requests[i].name, s_requests[i].body, stream_request, out);
+#ifdef HOST_TEST_CJSON
+        bench_one("cJSON", s_requests[i].name, s_requests[i].body, cjson_request, out);
+#endif
+    }
+#ifndef HOST_TEST_CJSON
+    printf("bench: cJSON not built, set CJSON_DIR to compare with it\n");
+#endif
+    free(out);
+}
+
+int main(void)
+{
+    test_responses();
+    bench();
+    return test_result();
+}
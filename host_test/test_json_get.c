@@ -0,0 +1,383 @@
+/*
+ * The /json_get request path: httpd_req_query_value_decode_byref() finds the query value in the
+ * request URI and URL-decodes it in place, the reader tokenizes it in place. Fuzzed against the
+ * SDK's copying helpers (the path it replaced) and benchmarked against them, the allocations
+ * as counted by test_heap.c.
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_http_server_ext.h"
+#include "json_stream.h"
+#include "web_server.h"
+#include "web_server_cfg_service.h"
+
+#include "sim.h"
+#include "test_heap.h"
+#include "test_util.h"
+
+#define FUZZ_ROUNDS 20000
+#define BENCH_ROUNDS 200000
+
+static uint32_t s_rand = 0x2545f491;
+
+static uint32_t rand_next(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+static char rand_pick(const char* set)
+{
+    return set[rand_next() % strlen(set)];
+}
+
+typedef struct get_result {
+    esp_err_t err;
+    json_reader_t reader;
+    json_token_t tokens[WEB_SRV_JSON_TOKEN_MAX];
+    char* heap; // the copying path's decoded JSON
+} get_result_t;
+
+// What web_srv_json_get_service() does before the dispatch, err is what it answers 400 for.
+static void get_in_place(httpd_req_t* req, get_result_t* res)
+{
+    size_t json_len;
+    char* json;
+
+    res->heap = NULL;
+    res->err = httpd_req_query_value_decode_byref(req, "json", HTTP_GET_ARG_MAXLEN, &json, &json_len);
+    if (res->err == ESP_OK)
+        res->err = json_reader_parse(&res->reader, json, json_len, res->tokens, WEB_SRV_JSON_TOKEN_MAX);
+}
+
+// The same request the way the handler used to do it.
+static void get_copying(httpd_req_t* req, get_result_t* res)
+{
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    char* buf = NULL;
+    char* raw_json = NULL;
+
+    res->heap = NULL;
+    res->err = ESP_ERR_INVALID_SIZE;
+    if (buf_len > HTTP_GET_ARG_MAXLEN)
+        return;
+    res->err = ESP_ERR_NOT_FOUND;
+    buf = malloc(buf_len);
+    raw_json = malloc(buf_len);
+    if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK
+            && httpd_query_key_value(buf, "json", raw_json, buf_len) == ESP_OK) {
+        res->heap = malloc(buf_len);
+        size_t json_len = httpd_query_value_decode(raw_json, strlen(raw_json), res->heap) - 1;
+        res->err = json_reader_parse(&res->reader, res->heap, json_len, res->tokens, WEB_SRV_JSON_TOKEN_MAX);
+    }
+    free(buf);
+    free(raw_json);
+}
+
+static void check_same_result(const get_result_t* a, const get_result_t* b, const char* uri)
+{
+    bool same = a->err == b->err;
+
+    if (same && a->err == ESP_OK) {
+        same = a->reader.count == b->reader.count;
+        for (int tok = 0; same && tok < a->reader.count; tok++) {
+            const json_token_t* tok_a = &a->tokens[tok];
+            const json_token_t* tok_b = &b->tokens[tok];
+            const char* text_a = json_reader_text(&a->reader, tok);
+            const char* text_b = json_reader_text(&b->reader, tok);
+            same = tok_a->type == tok_b->type && tok_a->start == tok_b->start && tok_a->end == tok_b->end
+                   && tok_a->next == tok_b->next
+                   && ((text_a == NULL) ? text_b == NULL : text_b != NULL && strcmp(text_a, text_b) == 0);
+        }
+    }
+    if (!same)
+        fprintf(stderr, "paths differ on '%s'\n", uri);
+    TEST_CHECK(same);
+}
+
+// Straightforward %XX decoding, to check httpd_query_value_decode() against.
+static size_t decode_reference(const char* raw, size_t len, char* out)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (raw[i] == '%' && i + 2 < len && isxdigit((uint8_t)raw[i + 1]) && isxdigit((uint8_t)raw[i + 2])) {
+            char hex[3] = {raw[i + 1], raw[i + 2], '\0'};
+            out[n++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else {
+            out[n++] = raw[i];
+        }
+    }
+    out[n] = '\0';
+    return n + 1;
+}
+
+static void test_decode(void)
+{
+    static const struct {
+        const char* raw;
+        const char* decoded;
+    } cases[] = {
+        {"", ""}, {"abc", "abc"}, {"%7B%22a%22%3A1%7D", "{\"a\":1}"}, {"%41%4a%4A", "AJJ"},
+        {"%", "%"}, {"%4", "%4"}, {"a%", "a%"}, {"%%41", "%A"}, {"%g1", "%g1"}, {"%1g", "%1g"},
+        {"+", "+"}, {"%25%32%35", "%25"},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t len = strlen(cases[i].raw);
+        char* buf = malloc(len + 1);
+
+        memcpy(buf, cases[i].raw, len);
+        TEST_CHECK_EQ(strlen(cases[i].decoded) + 1, httpd_query_value_decode(buf, len, buf));
+        TEST_CHECK(strcmp(buf, cases[i].decoded) == 0);
+        free(buf);
+    }
+
+    // Exact size buffers without a terminator: any read past the value is an ASan error.
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+        size_t len = rand_next() % 24;
+        char* raw = malloc(len ? len : 1);
+        char* in_place = malloc(len + 1);
+        char* copied = malloc(len + 1);
+        char* expected = malloc(len + 1);
+
+        for (size_t i = 0; i < len; i++)
+            raw[i] = (rand_next() % 4) ? rand_pick("%%%0179aAfFgG{\"") : (char)rand_next();
+        memcpy(in_place, raw, len);
+        size_t n = decode_reference(raw, len, expected);
+        TEST_CHECK_EQ(n, httpd_query_value_decode(raw, len, copied));
+        TEST_CHECK_EQ(n, httpd_query_value_decode(in_place, len, in_place));
+        TEST_CHECK(memcmp(copied, expected, n) == 0);
+        TEST_CHECK(memcmp(in_place, expected, n) == 0);
+        free(raw);
+        free(in_place);
+        free(copied);
+        free(expected);
+    }
+}
+
+static void test_key_value(void)
+{
+    static const char* const keys[] = {"json", "JSON", "jsonx", "jso", "id", ""};
+    char val[64];
+
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+        char query[64];
+        size_t len = 0;
+        int pairs = rand_next() % 4;
+
+        for (int i = 0; i < pairs; i++) {
+            len += sprintf(query + len, "%s%s", i ? "&" : "", keys[rand_next() % 6]);
+            if (rand_next() % 8)
+                query[len++] = '=';
+            for (int n = rand_next() % 6; n > 0; n--)
+                query[len++] = rand_pick("ab%7B=");
+        }
+        query[len] = '\0';
+
+        char* exact = malloc(len + 1);
+        size_t value_len = 0;
+        memcpy(exact, query, len + 1);
+        const char* value = httpd_query_key_value_byref(exact, "json", &value_len);
+        esp_err_t err = httpd_query_key_value(exact, "json", val, sizeof(val));
+        TEST_CHECK_EQ(err == ESP_OK, value != NULL);
+        if (value != NULL && err == ESP_OK) {
+            TEST_CHECK_EQ(strlen(val), value_len);
+            TEST_CHECK(strncmp(val, value, value_len) == 0);
+        }
+        free(exact);
+    }
+}
+
+// A random document within the reader's limits, at most len bytes.
+static size_t gen_value(char* out, size_t len, int depth)
+{
+    static const char* const primitives[] = {"0", "-12", "3.5e-2", "true", "false", "null", "1"};
+    static const char* const chars[] = {"a", "Z", " ", "&", "#", "%", "=", "+", "?", "\\\"", "\\\\", "\\/",
+                                        "\\n", "\\u00e9", "\\u20ac", "\xc3\xa9", ":", ",", "{", "]"};
+    size_t n = 0;
+    int kind = 0; // object, array, string, primitive
+
+    if (len < 16)
+        kind = 3;
+    else if (depth > 0)
+        kind = (depth < 3) ? rand_next() % 4 : 2 + rand_next() % 2;
+    switch (kind) {
+    case 0:
+    case 1: {
+        int items = rand_next() % 4;
+        out[n++] = kind ? '[' : '{';
+        for (int i = 0; i < items && len - n > 24; i++) {
+            if (i)
+                out[n++] = ',';
+            if (!kind)
+                n += sprintf(out + n, "\"k%u\":", (unsigned)(rand_next() % 100));
+            n += gen_value(out + n, len - n - 2, depth + 1);
+        }
+        out[n++] = kind ? ']' : '}';
+        break;
+    }
+    case 2:
+        out[n++] = '"';
+        for (int i = rand_next() % 6; i > 0 && len - n > 8; i--)
+            n += sprintf(out + n, "%s", chars[rand_next() % 20]);
+        out[n++] = '"';
+        break;
+    default:
+        n = sprintf(out, "%s", primitives[rand_next() % 7]);
+        break;
+    }
+    return n;
+}
+
+// URL-encode text into uri, the characters the query syntax needs always, others at random.
+static size_t url_encode(char* uri, const char* text)
+{
+    size_t n = 0;
+
+    for (; *text; text++) {
+        uint8_t c = *text;
+        if (c <= ' ' || c >= 0x7f || strchr("%&#+", c) != NULL || rand_next() % 4 == 0)
+            n += sprintf(uri + n, (rand_next() % 2) ? "%%%02X" : "%%%02x", c);
+        else
+            uri[n++] = c;
+    }
+    uri[n] = '\0';
+    return n;
+}
+
+// Each path gets its own request, the readers point into them until release_both().
+static void run_both(httpd_req_t reqs[2], const char* uri, get_result_t* in_place, get_result_t* copying)
+{
+    sim_httpd_req_init(&reqs[0], uri);
+    get_in_place(&reqs[0], in_place);
+    sim_httpd_req_init(&reqs[1], uri);
+    get_copying(&reqs[1], copying);
+}
+
+static void release_both(httpd_req_t reqs[2], get_result_t* copying)
+{
+    sim_httpd_req_free(&reqs[0]);
+    sim_httpd_req_free(&reqs[1]);
+    free(copying->heap);
+}
+
+static void test_requests(void)
+{
+    static const char* const before[] = {"", "id=1&", "jsonx=2&", "JSON2=&", "id&jsonx=&"};
+    static const char* const after[] = {"", "&id=1", "&json=[]", "#frag", "&"};
+    get_result_t* in_place = malloc(sizeof(get_result_t));
+    get_result_t* copying = malloc(sizeof(get_result_t));
+    get_result_t* direct = malloc(sizeof(get_result_t));
+    httpd_req_t* reqs = malloc(2 * sizeof(httpd_req_t));
+    char doc[256];
+    char uri[HTTPD_MAX_URI_LEN * 2];
+    int parsed = 0;
+
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+        size_t doc_len = gen_value(doc, 200, 0);
+        doc[doc_len] = '\0';
+        size_t n = sprintf(uri, "/json_get?%s%s=", before[rand_next() % 5], (rand_next() % 8) ? "json" : "Json");
+        n += url_encode(uri + n, doc);
+        n += sprintf(uri + n, "%s", after[rand_next() % 5]);
+        if (n > HTTPD_MAX_URI_LEN)
+            continue;
+
+        // Well formed: decoded in place, the document reads as it was generated.
+        run_both(reqs, uri, in_place, copying);
+        check_same_result(in_place, copying, uri);
+        direct->reader.count = 0;
+        direct->err = json_reader_parse(&direct->reader, doc, doc_len, direct->tokens, WEB_SRV_JSON_TOKEN_MAX);
+        if (direct->err != ESP_ERR_NO_MEM) {
+            TEST_CHECK_EQ(ESP_OK, direct->err);
+            check_same_result(in_place, direct, uri);
+            parsed += in_place->err == ESP_OK;
+        }
+        release_both(reqs, copying);
+
+        // Then mangled: both paths reject or accept it alike, without a sanitizer report.
+        for (int i = rand_next() % 4; i >= 0; i--) {
+            size_t at = 10 + rand_next() % (n - 10);
+            uri[at] = (rand_next() % 2) ? rand_pick("%&=#{}[]\",:\\") : (char)(rand_next() % 255 + 1);
+        }
+        run_both(reqs, uri, in_place, copying);
+        check_same_result(in_place, copying, uri);
+        release_both(reqs, copying);
+    }
+    printf("fuzz: %d of %d generated requests parsed\n", parsed, FUZZ_ROUNDS);
+    TEST_CHECK(parsed > FUZZ_ROUNDS / 2);
+
+    // No query, or no json in it.
+    run_both(reqs, "/json_get", in_place, copying);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, in_place->err);
+    TEST_CHECK_EQ(ESP_ERR_NOT_FOUND, copying->err);
+    release_both(reqs, copying);
+    run_both(reqs, "/json_get?jsonx={}&id=1#json={}", in_place, copying);
+    TEST_CHECK_EQ(ESP_ERR_NOT_FOUND, in_place->err);
+    TEST_CHECK_EQ(ESP_ERR_NOT_FOUND, copying->err);
+    release_both(reqs, copying);
+
+    free(reqs);
+    free(in_place);
+    free(copying);
+    free(direct);
+}
+
+static void bench(void)
+{
+    static const char uri[] = "/json_get?json=%7B%22method%22%3A%22set%22%2C%22params%22%3A%7B%22switch1%22%3A1"
+                              "%2C%22switch2%22%3A0%2C%22hold_ms%22%3A%5B2000%2C1500%5D%7D%7D";
+    get_result_t* res = malloc(sizeof(get_result_t));
+    httpd_req_t req;
+    uint64_t start;
+    uint64_t in_place_ns;
+    uint64_t copying_ns;
+    uint32_t in_place_allocs;
+    uint32_t copying_allocs;
+
+    // The request is set up again each time, decoding in place changes it.
+    sim_httpd_req_init(&req, uri);
+    in_place_allocs = test_heap_allocs();
+    start = test_time_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        memcpy((char*)req.uri, uri, sizeof(uri));
+        get_in_place(&req, res);
+    }
+    in_place_ns = test_time_ns() - start;
+    in_place_allocs = test_heap_allocs() - in_place_allocs;
+    TEST_CHECK_EQ(ESP_OK, res->err);
+
+    copying_allocs = test_heap_allocs();
+    start = test_time_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        memcpy((char*)req.uri, uri, sizeof(uri));
+        get_copying(&req, res);
+        free(res->heap);
+    }
+    copying_ns = test_time_ns() - start;
+    copying_allocs = test_heap_allocs() - copying_allocs;
+    TEST_CHECK_EQ(ESP_OK, res->err);
+    sim_httpd_req_free(&req);
+
+    // Nothing on the heap is the point of the in place path.
+    TEST_CHECK_EQ(0, in_place_allocs);
+    printf("bench: json_get in place %.0f ns/request, %.1f allocations/request\n", (double)in_place_ns / BENCH_ROUNDS,
+           (double)in_place_allocs / BENCH_ROUNDS);
+    printf("bench: json_get copying  %.0f ns/request, %.1f allocations/request\n", (double)copying_ns / BENCH_ROUNDS,
+           (double)copying_allocs / BENCH_ROUNDS);
+    free(res);
+}
+
+int main(void)
+{
+    test_decode();
+    test_key_value();
+    test_requests();
+    bench();
+    return test_result();
+}
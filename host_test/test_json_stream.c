@@ -0,0 +1,178 @@
+/*
+ * JSON reader and writer: valid documents, malformed ones (every buffer is allocated to its
+ * exact size so the sanitizers catch any access outside of it), limits and escapes.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_stream.h"
+
+#include "test_util.h"
+
+#define TOKENS_MAX 32
+
+// Parse a copy of text into max_tokens tokens, both freed by release().
+static esp_err_t parse(json_reader_t* reader, const char* text, uint16_t max_tokens)
+{
+    size_t len = strlen(text);
+    char* buf = malloc(len + 1);
+
+    memcpy(buf, text, len + 1);
+    return json_reader_parse(reader, buf, len, malloc(max_tokens * sizeof(json_token_t)), max_tokens);
+}
+
+static void release(json_reader_t* reader)
+{
+    free(reader->buf);
+    free(reader->tokens);
+}
+
+static esp_err_t parse_only(const char* text)
+{
+    json_reader_t reader;
+    esp_err_t err = parse(&reader, text, TOKENS_MAX);
+
+    release(&reader);
+    return err;
+}
+
+static void test_valid(void)
+{
+    json_reader_t reader;
+    int item;
+    int count = 0;
+
+    TEST_CHECK_EQ(ESP_OK, parse(&reader, " {\"method\": \"set\", \"params\": {\"switch1\": 1, \"a\": [true, null, -2.5e3, \"x\"]}}\n",
+                                TOKENS_MAX));
+    TEST_CHECK_EQ(JSON_OBJECT, json_reader_type(&reader, 0));
+    TEST_CHECK(strcmp(json_reader_str(&reader, json_reader_find(&reader, 0, "method")), "set") == 0);
+    int params = json_reader_find(&reader, 0, "params");
+    TEST_CHECK_EQ(JSON_OBJECT, json_reader_type(&reader, params));
+    TEST_CHECK(strcmp(json_reader_text(&reader, json_reader_find(&reader, params, "switch1")), "1") == 0);
+    TEST_CHECK_EQ(NULL, json_reader_str(&reader, json_reader_find(&reader, params, "switch1")));
+    int arr = json_reader_find(&reader, params, "a");
+    json_reader_for_each_item(&reader, arr, item)
+        count++;
+    TEST_CHECK_EQ(4, count);
+    TEST_CHECK_EQ(-1, json_reader_find(&reader, 0, "switch1"));
+    TEST_CHECK_EQ(-1, json_reader_find(&reader, arr, "a"));
+    release(&reader);
+
+    // a lone value is a document too.
+    TEST_CHECK_EQ(ESP_OK, parse_only("\"a\""));
+    TEST_CHECK_EQ(ESP_OK, parse_only("1"));
+    TEST_CHECK_EQ(ESP_OK, parse_only("[]"));
+    TEST_CHECK_EQ(ESP_OK, parse_only("{}"));
+    TEST_CHECK_EQ(ESP_OK, parse_only("[[],{},[1,[2]]]"));
+    TEST_CHECK_EQ(ESP_OK, parse_only("[true,false,null,0,-0,10,-12,0.5,-1.25,1e3,1E+3,2.5e-3,-0.0e0]"));
+}
+
+static void test_malformed(void)
+{
+    static const char* const malformed[] = {
+        "\"a\",1", "1,2", "{,}", "[1,]", "{\"a\":1,}", ",", ",1", "\"a\",", "\"a\" \"b\"", "1 2",
+        "", " ", "{", "}", "[", "]", "[1", "{\"a\"", "{\"a\":", "{\"a\":1", "{\"a\" 1}", "{1:2}",
+        "{\"a\"::1}", "[1,,2]", "[,1]", "{]", "[}", "{}}", "[]]", "{} {}", "[] 1", "\"a\":1",
+        "\"abc", "\"a\\\"", "\"\\x\"", "\"\\u12\"", "\"\\u12g4\"", "\"a\nb\"", "x", "{\"a\":x}", "[:]",
+        // primitives are checked whole, not by their first character.
+        "nul", "tru", "nullx", "falsey", "True", "-x", "-", "1\"a\"", "[1\"a\"]", "{\"a\":tru}", "01", "-01",
+        "1.", ".5", "1.e3", "1e", "1e+", "1x", "0x10", "1-2", "+1", "--1", "1.2.3", "[n]",
+    };
+
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        esp_err_t err = parse_only(malformed[i]);
+        if (err != ESP_ERR_INVALID_ARG)
+            fprintf(stderr, "accepted: '%s'\n", malformed[i]);
+        TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, err);
+    }
+}
+
+static void test_limits(void)
+{
+    json_reader_t reader;
+
+    TEST_CHECK_EQ(ESP_ERR_NO_MEM, parse(&reader, "[1,2,3]", 3));
+    release(&reader);
+    TEST_CHECK_EQ(ESP_OK, parse(&reader, "[1,2,3]", 4));
+    release(&reader);
+    TEST_CHECK_EQ(ESP_OK, parse_only("[[[[[[[[1]]]]]]]]"));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, parse_only("[[[[[[[[[1]]]]]]]]]"));
+}
+
+static void test_escapes(void)
+{
+    json_reader_t reader;
+
+    TEST_CHECK_EQ(ESP_OK, parse(&reader, "[\"a\\\"b\\\\c\\/d\\n\", \"\\u0041\\u00e9\\u20ac\"]", TOKENS_MAX));
+    TEST_CHECK(strcmp(json_reader_str(&reader, 1), "a\"b\\c/d\n") == 0);
+    TEST_CHECK(strcmp(json_reader_str(&reader, 2), "A\xc3\xa9\xe2\x82\xac") == 0);
+    release(&reader);
+}
+
+typedef struct output {
+    char text[1024];
+    size_t len;
+    int calls;
+} output_t;
+
+static esp_err_t output_sink(void* ctx, const char* data, size_t len)
+{
+    output_t* out = ctx;
+
+    if (out->len + len >= sizeof(out->text))
+        return ESP_ERR_NO_MEM;
+    memcpy(out->text + out->len, data, len);
+    out->len += len;
+    out->text[out->len] = '\0';
+    out->calls++;
+    return ESP_OK;
+}
+
+static void test_writer(void)
+{
+    json_writer_t writer;
+    output_t out = {0};
+    json_reader_t reader;
+
+    json_writer_init(&writer, output_sink, &out);
+    json_writer_begin_object(&writer);
+    json_writer_kv_string(&writer, "s", "q\"b\\\x01");
+    json_writer_kv_uint(&writer, "n", 4294967295u);
+    json_writer_kv_bool(&writer, "b", false);
+    json_writer_key(&writer, "a");
+    json_writer_begin_array(&writer);
+    json_writer_begin_object(&writer);
+    json_writer_end_object(&writer);
+    json_writer_primitive(&writer, "null");
+    json_writer_string(&writer, NULL);
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    TEST_CHECK_EQ(ESP_OK, json_writer_flush(&writer));
+    TEST_CHECK(strcmp(out.text, "{\"s\":\"q\\\"b\\\\\\u0001\",\"n\":4294967295,\"b\":false,\"a\":[{},null,\"\"]}") == 0);
+
+    // the output reads back.
+    TEST_CHECK_EQ(ESP_OK, parse(&reader, out.text, TOKENS_MAX));
+    TEST_CHECK(strcmp(json_reader_str(&reader, json_reader_find(&reader, 0, "s")), "q\"b\\\x01") == 0);
+    release(&reader);
+
+    // longer than the buffer, it goes out in several chunks.
+    memset(&out, 0, sizeof(out));
+    json_writer_init(&writer, output_sink, &out);
+    json_writer_begin_array(&writer);
+    for (int i = 0; i < 100; i++)
+        json_writer_uint(&writer, i);
+    json_writer_end_array(&writer);
+    TEST_CHECK_EQ(ESP_OK, json_writer_flush(&writer));
+    TEST_CHECK(out.calls > 1);
+    TEST_CHECK_EQ(ESP_ERR_NO_MEM, parse_only(out.text));
+}
+
+int main(void)
+{
+    test_valid();
+    test_malformed();
+    test_limits();
+    test_escapes();
+    test_writer();
+    return test_result();
+}
@@ -0,0 +1,243 @@
+/*
+ * OTA writer: images land intact in the emulated partition, one esp_ota_write() per sector,
+ * errors reach the producer, and with flash and network delays emulated, the pipeline
+ * overlaps them where the former receive-then-write loop adds them up.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbedtls/sha256.h"
+
+#include "ota_adapter.h"
+
+#include "sim.h"
+#include "test_util.h"
+
+#define IMAGE_SIZE          (300 * 1024 + 17)
+#define BENCH_IMAGE_SIZE    (256 * 1024)
+// Scaled down from a real flash: erasing a sector and programming 4 KiB take the same time.
+#define BENCH_ERASE_US      2000
+#define BENCH_WRITE_US_KIB  500
+// A TCP segment every 1 ms, about 1.4 MB/s.
+#define BENCH_SEGMENT       1460
+#define BENCH_SEGMENT_US    1000
+// The former /fota loop received and wrote OTA_BUF_SIZE bytes at a time.
+#define OLD_OTA_BUF_SIZE    256
+
+static uint8_t* s_image;
+static uint32_t s_rand = 0x9e3779b9;
+
+static uint32_t rand_next(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+static const esp_partition_t* update_partition(void)
+{
+    return esp_ota_get_next_update_partition(NULL);
+}
+
+static void test_sha256(void)
+{
+    static const struct {
+        const char* input;
+        const char* digest;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    };
+    uint8_t digest[32];
+    char hex[65];
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        mbedtls_sha256_ret((const unsigned char*)vectors[i].input, strlen(vectors[i].input), digest, 0);
+        for (int b = 0; b < 32; b++)
+            sprintf(hex + b * 2, "%02x", digest[b]);
+        TEST_CHECK(strcmp(hex, vectors[i].digest) == 0);
+    }
+
+    // Fed in odd pieces, the digest is the same as in one go.
+    uint8_t pieces[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    for (size_t off = 0, n; off < IMAGE_SIZE; off += n) {
+        n = rand_next() % 200;
+        if (n > IMAGE_SIZE - off)
+            n = IMAGE_SIZE - off;
+        mbedtls_sha256_update_ret(&ctx, s_image + off, n);
+    }
+    mbedtls_sha256_finish_ret(&ctx, pieces);
+    mbedtls_sha256_free(&ctx);
+    mbedtls_sha256_ret(s_image, IMAGE_SIZE, digest, 0);
+    TEST_CHECK(memcmp(pieces, digest, 32) == 0);
+}
+
+static void test_image_written(void)
+{
+    ota_adp_writer_handle_t writer;
+    ota_adp_stats_t stats;
+    uint8_t digest[OTA_ADP_SHA256_LEN];
+    size_t off = 0;
+
+    sim_partition_reset();
+    mbedtls_sha256_ret(s_image, IMAGE_SIZE, digest, 0);
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(update_partition(), IMAGE_SIZE, &writer));
+    ota_adp_expect_sha256(writer, digest);
+    // Segments of any size, through both producer interfaces.
+    while (off < IMAGE_SIZE) {
+        size_t n = 1 + rand_next() % 1460;
+        if (n > IMAGE_SIZE - off)
+            n = IMAGE_SIZE - off;
+        if (rand_next() % 2) {
+            TEST_CHECK_EQ(ESP_OK, ota_adp_write(writer, s_image + off, n));
+        } else {
+            size_t space;
+            uint8_t* buf = ota_adp_get_buf(writer, &space);
+            if (n > space)
+                n = space;
+            memcpy(buf, s_image + off, n);
+            TEST_CHECK_EQ(ESP_OK, ota_adp_put(writer, n));
+        }
+        off += n;
+    }
+    TEST_CHECK_EQ(ESP_OK, ota_adp_end(writer, &stats));
+
+    TEST_CHECK_EQ(IMAGE_SIZE, stats.bytes);
+    TEST_CHECK(memcmp(stats.sha256, digest, OTA_ADP_SHA256_LEN) == 0);
+    TEST_CHECK_EQ(IMAGE_SIZE, sim_partition_written());
+    TEST_CHECK(memcmp(sim_partition_data(update_partition()->subtype), s_image, IMAGE_SIZE) == 0);
+    // Whole sectors, the last one partly.
+    TEST_CHECK_EQ((IMAGE_SIZE + OTA_ADP_BUF_SIZE - 1) / OTA_ADP_BUF_SIZE, sim_partition_writes());
+}
+
+static void test_sha256_mismatch(void)
+{
+    ota_adp_writer_handle_t writer;
+    uint8_t digest[OTA_ADP_SHA256_LEN];
+
+    sim_partition_reset();
+    mbedtls_sha256_ret(s_image, IMAGE_SIZE, digest, 0);
+    digest[31] ^= 1;
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(update_partition(), IMAGE_SIZE, &writer));
+    ota_adp_expect_sha256(writer, digest);
+    TEST_CHECK_EQ(ESP_OK, ota_adp_write(writer, s_image, IMAGE_SIZE));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_CRC, ota_adp_end(writer, NULL));
+}
+
+static void test_one_update_at_a_time(void)
+{
+    ota_adp_writer_handle_t writer;
+    ota_adp_writer_handle_t second;
+
+    sim_partition_reset();
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(update_partition(), OTA_SIZE_UNKNOWN, &writer));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_STATE, ota_adp_begin(update_partition(), OTA_SIZE_UNKNOWN, &second));
+    TEST_CHECK_EQ(ESP_OK, ota_adp_write(writer, s_image, 5000));
+    ota_adp_abort(writer);
+    // The writer stopped before the buffers queued after the abort.
+    TEST_CHECK(sim_partition_written() <= OTA_ADP_BUF_SIZE);
+
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(update_partition(), OTA_SIZE_UNKNOWN, &writer));
+    TEST_CHECK_EQ(ESP_OK, ota_adp_write(writer, s_image, 100));
+    TEST_CHECK_EQ(ESP_OK, ota_adp_end(writer, NULL));
+}
+
+static void test_errors_reach_producer(void)
+{
+    ota_adp_writer_handle_t writer;
+    esp_err_t err = ESP_OK;
+    size_t off = 0;
+
+    // The image outgrows the partition: the write error stops the producer, which never blocks.
+    sim_partition_reset();
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(update_partition(), OTA_SIZE_UNKNOWN, &writer));
+    while (err == ESP_OK && off < 2 * SIM_PARTITION_SIZE) {
+        err = ota_adp_write(writer, s_image, 1024);
+        off += 1024;
+    }
+    TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, err);
+    TEST_CHECK(off <= SIM_PARTITION_SIZE + OTA_ADP_BUF_COUNT * OTA_ADP_BUF_SIZE + 1024);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, ota_adp_end(writer, NULL));
+
+    // esp_ota_begin() refuses the running partition, the data still drains.
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(esp_ota_get_running_partition(), OTA_SIZE_UNKNOWN, &writer));
+    for (int i = 0; i < 10 && err != ESP_ERR_OTA_PARTITION_CONFLICT; i++)
+        err = ota_adp_write(writer, s_image, OTA_ADP_BUF_SIZE);
+    TEST_CHECK_EQ(ESP_ERR_OTA_PARTITION_CONFLICT, err);
+    TEST_CHECK_EQ(ESP_ERR_OTA_PARTITION_CONFLICT, ota_adp_end(writer, NULL));
+}
+
+// The wire time of len bytes, as BENCH_SEGMENT segments arrive.
+static void net_receive(size_t len)
+{
+    usleep((useconds_t)((uint64_t)len * BENCH_SEGMENT_US / BENCH_SEGMENT));
+}
+
+static void bench(void)
+{
+    const esp_partition_t* partition = update_partition();
+    ota_adp_writer_handle_t writer;
+    esp_ota_handle_t handle;
+    uint64_t start;
+    uint64_t pipelined_ns;
+    uint64_t serial_ns;
+
+    // ota_adp_stats_t follows the simulated HAL clock, which stands still here, wall time is taken instead.
+    sim_partition_reset();
+    sim_flash_set_timing(BENCH_ERASE_US, BENCH_WRITE_US_KIB);
+    start = test_time_ns();
+    TEST_CHECK_EQ(ESP_OK, ota_adp_begin(partition, BENCH_IMAGE_SIZE, &writer));
+    for (size_t off = 0; off < BENCH_IMAGE_SIZE; off += BENCH_SEGMENT) {
+        size_t n = (BENCH_IMAGE_SIZE - off < BENCH_SEGMENT) ? BENCH_IMAGE_SIZE - off : BENCH_SEGMENT;
+        net_receive(n);
+        TEST_CHECK_EQ(ESP_OK, ota_adp_write(writer, s_image + off, n));
+    }
+    TEST_CHECK_EQ(ESP_OK, ota_adp_end(writer, NULL));
+    pipelined_ns = test_time_ns() - start;
+
+    // Receive a little, write it, receive again.
+    sim_partition_reset();
+    sim_flash_set_timing(BENCH_ERASE_US, BENCH_WRITE_US_KIB);
+    start = test_time_ns();
+    TEST_CHECK_EQ(ESP_OK, esp_ota_begin(partition, BENCH_IMAGE_SIZE, &handle));
+    for (size_t off = 0; off < BENCH_IMAGE_SIZE; off += OLD_OTA_BUF_SIZE) {
+        net_receive(OLD_OTA_BUF_SIZE);
+        TEST_CHECK_EQ(ESP_OK, esp_ota_write(handle, s_image + off, OLD_OTA_BUF_SIZE));
+    }
+    TEST_CHECK_EQ(ESP_OK, esp_ota_end(handle));
+    serial_ns = test_time_ns() - start;
+    sim_partition_reset();
+
+    printf("bench: ota %u KiB, network %u ms and flash %u ms apart\n", BENCH_IMAGE_SIZE / 1024,
+           (unsigned)((uint64_t)BENCH_IMAGE_SIZE * BENCH_SEGMENT_US / BENCH_SEGMENT / 1000),
+           (unsigned)(BENCH_IMAGE_SIZE / SIM_FLASH_SECTOR_SIZE * BENCH_ERASE_US / 1000
+                      + BENCH_IMAGE_SIZE / 1024 * BENCH_WRITE_US_KIB / 1000));
+    printf("bench: ota pipelined   %6.0f ms, %4.0f KiB/s\n", pipelined_ns / 1e6,
+           BENCH_IMAGE_SIZE / 1024.0 / (pipelined_ns / 1e9));
+    printf("bench: ota serial %3u B %6.0f ms, %4.0f KiB/s\n", OLD_OTA_BUF_SIZE, serial_ns / 1e6,
+           BENCH_IMAGE_SIZE / 1024.0 / (serial_ns / 1e9));
+}
+
+int main(void)
+{
+    s_image = malloc(2 * SIM_PARTITION_SIZE);
+    for (size_t i = 0; i < 2 * SIM_PARTITION_SIZE; i++)
+        s_image[i] = (uint8_t)rand_next();
+
+    ota_adp_init();
+    test_sha256();
+    test_image_written();
+    test_sha256_mismatch();
+    test_one_update_at_a_time();
+    test_errors_reach_producer();
+    bench();
+    free(s_image);
+    return test_result();
+}
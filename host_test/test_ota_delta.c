@@ -0,0 +1,264 @@
+/*
+ * Delta patches: what tools/gen_ota_delta.py gen makes of two builds of a firmware (the
+ * ota_delta_patch fixture diffs OTA_DELTA_TEST_OLD and OTA_DELTA_TEST_NEW) rebuilds the new
+ * image through the /fota upload path, from the old one in the running partition. Truncated,
+ * damaged and wrong source patches fail with the errors of ota_delta.h and never end in a
+ * wrong image. The benchmark compares the bytes on the wire and the upload time of the image
+ * and the patch.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbedtls/sha256.h"
+
+#include "ota_delta.h"
+#include "ota_stream.h"
+
+#include "sim.h"
+#include "test_util.h"
+
+// as web_server_fota_service.c
+#define FOTA_RECV_BUF_SIZE  1024
+// The network and flash timing of test_ota_lz.c.
+#define BENCH_SEGMENT       1460
+#define BENCH_SEGMENT_US    2000
+#define BENCH_ERASE_US      2000
+#define BENCH_WRITE_US_KIB  500
+
+typedef struct file {
+    uint8_t* data;
+    size_t len;
+} file_t;
+
+static file_t s_old;
+static file_t s_new;
+static file_t s_patch;
+static uint8_t s_new_sha[32];
+static uint32_t s_rand = 0x27d4eb2f;
+
+static uint32_t rand_next(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+static file_t read_file(const char* path)
+{
+    file_t file = {NULL, 0};
+    FILE* f = fopen(path, "rb");
+
+    if (f == NULL) {
+        fprintf(stderr, "%s missing, run the test with ctest (fixture ota_delta_patch)\n", path);
+        return file;
+    }
+    fseek(f, 0, SEEK_END);
+    file.len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file.data = malloc(file.len);
+    if (fread(file.data, 1, file.len, f) != file.len)
+        file.len = 0;
+    fclose(f);
+    return file;
+}
+
+static uint32_t get_u32(const uint8_t* buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void put_u32(uint8_t* buf, uint32_t val)
+{
+    for (int i = 0; i < 4; i++)
+        buf[i] = (uint8_t)(val >> (8 * i));
+}
+
+// The device runs image, from a fresh flash.
+static void run_image(const file_t* image)
+{
+    sim_partition_reset();
+    memcpy(sim_partition_data(esp_ota_get_running_partition()->subtype), image->data, image->len);
+}
+
+// Upload file through the /fota path (web_srv_fota_recv()) in pieces of up to max_piece bytes,
+// or paced as the network delivers them. The new image must come out, with its SHA-256.
+static esp_err_t upload(const file_t* file, size_t max_piece, bool paced)
+{
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    uint8_t* buf = malloc(FOTA_RECV_BUF_SIZE);
+    uint8_t sha[32];
+    uint8_t stream_sha[OTA_STREAM_SHA256_LEN];
+    ota_stream_handle_t stream;
+    ota_adp_writer_handle_t writer;
+    esp_err_t err = ota_stream_begin(partition, file->len, &stream);
+
+    for (size_t off = 0; off < file->len && err == ESP_OK;) {
+        size_t space = FOTA_RECV_BUF_SIZE;
+        uint8_t* direct = ota_stream_get_buf(stream, &space);
+        size_t n = paced ? BENCH_SEGMENT : 1 + rand_next() % max_piece;
+
+        n = (n < space) ? n : space;
+        n = (n < file->len - off) ? n : file->len - off;
+        if (paced)
+            usleep((useconds_t)((uint64_t)n * BENCH_SEGMENT_US / BENCH_SEGMENT));
+        memcpy((direct != NULL) ? direct : buf, file->data + off, n);
+        err = (direct != NULL) ? ota_stream_put(stream, n) : ota_stream_write(stream, buf, n);
+        off += n;
+    }
+    free(buf);
+    if (err != ESP_OK) {
+        ota_stream_abort(stream);
+        return err;
+    }
+    // The stream hashes what arrived, the patch here.
+    ota_stream_sha256(stream, stream_sha);
+    mbedtls_sha256_ret(file->data, file->len, sha, 0);
+    if (memcmp(sha, stream_sha, sizeof(sha)) != 0) {
+        ota_stream_abort(stream);
+        return ESP_FAIL;
+    }
+    err = ota_stream_finish(stream, &writer);
+    if (err != ESP_OK)
+        return err;
+    ota_adp_expect_sha256(writer, s_new_sha);
+    err = ota_adp_end(writer, NULL);
+    if (err == ESP_OK && memcmp(sim_partition_data(partition->subtype), s_new.data, s_new.len) != 0)
+        err = ESP_ERR_INVALID_CRC;
+    return err;
+}
+
+static void test_apply(void)
+{
+    uint8_t* target;
+
+    TEST_CHECK(ota_delta_is_patch(s_patch.data, s_patch.len));
+    TEST_CHECK_EQ(s_old.len, get_u32(s_patch.data + 8));
+    TEST_CHECK_EQ(s_new.len, get_u32(s_patch.data + 16));
+
+    // One byte at a time and in TCP segments, the parser resumes anywhere.
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_OK, upload(&s_patch, 1, false));
+    TEST_CHECK_EQ(s_new.len, sim_partition_written());
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_OK, upload(&s_patch, BENCH_SEGMENT, false));
+    // Only the image was written, the rest of the partition is still erased.
+    target = sim_partition_data(esp_ota_get_next_update_partition(NULL)->subtype);
+    TEST_CHECK(memcmp(target, s_new.data, s_new.len) == 0);
+    TEST_CHECK(target[s_new.len] == 0xff);
+    // The old image is the source, it is not touched.
+    TEST_CHECK(memcmp(sim_partition_data(esp_ota_get_running_partition()->subtype), s_old.data, s_old.len) == 0);
+}
+
+static void test_truncated(void)
+{
+    file_t copy = {malloc(s_patch.len), 0};
+
+    memcpy(copy.data, s_patch.data, s_patch.len);
+    // Within the header (past the magic, shorter is a plain image) and anywhere in the ops:
+    // the target size is not reached.
+    for (int round = 0; round < 20; round++) {
+        copy.len = (round < 4) ? 4 + rand_next() % (OTA_DELTA_HEADER_LEN - 4)
+                               : OTA_DELTA_HEADER_LEN + rand_next() % (s_patch.len - OTA_DELTA_HEADER_LEN);
+        run_image(&s_old);
+        TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, upload(&copy, BENCH_SEGMENT, false));
+    }
+    free(copy.data);
+}
+
+static void test_corrupt(void)
+{
+    file_t copy = {malloc(s_patch.len), s_patch.len};
+    esp_err_t err;
+
+    // Bad headers.
+    memcpy(copy.data, s_patch.data, s_patch.len);
+    copy.data[4] = OTA_DELTA_VERSION + 1;
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, upload(&copy, BENCH_SEGMENT, false));
+    copy.data[4] = OTA_DELTA_VERSION;
+    put_u32(copy.data + 20, get_u32(s_patch.data + 20) ^ 1);
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_CRC, upload(&copy, BENCH_SEGMENT, false));
+    // A larger target than announced.
+    put_u32(copy.data + 20, get_u32(s_patch.data + 20));
+    put_u32(copy.data + 16, s_new.len - 1);
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, upload(&copy, BENCH_SEGMENT, false));
+    put_u32(copy.data + 16, s_new.len);
+
+    // An unknown op right after the header.
+    copy.data[OTA_DELTA_HEADER_LEN] = OTA_DELTA_OP_INSERT + 1;
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, upload(&copy, BENCH_SEGMENT, false));
+
+    // Flipped bytes: an error, or the right image after all (a copy from equal bytes).
+    for (int round = 0; round < 50; round++) {
+        memcpy(copy.data, s_patch.data, s_patch.len);
+        for (int i = 1 + rand_next() % 4; i > 0; i--)
+            copy.data[OTA_DELTA_HEADER_LEN + rand_next() % (s_patch.len - OTA_DELTA_HEADER_LEN)] ^= 1 << (rand_next() % 8);
+        run_image(&s_old);
+        err = upload(&copy, BENCH_SEGMENT, false);
+        TEST_CHECK(err == ESP_OK || err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE ||
+                   err == ESP_ERR_INVALID_CRC);
+    }
+    free(copy.data);
+}
+
+static void test_wrong_source(void)
+{
+    file_t copy = {malloc(s_patch.len), s_patch.len};
+
+    // Another firmware runs: nothing is written.
+    run_image(&s_new);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_VERSION, upload(&s_patch, BENCH_SEGMENT, false));
+    TEST_CHECK_EQ(0, sim_partition_written());
+    // The old image with one byte changed.
+    run_image(&s_old);
+    sim_partition_data(esp_ota_get_running_partition()->subtype)[rand_next() % s_old.len] ^= 0x10;
+    TEST_CHECK_EQ(ESP_ERR_INVALID_VERSION, upload(&s_patch, BENCH_SEGMENT, false));
+    // A source larger than the partition.
+    memcpy(copy.data, s_patch.data, s_patch.len);
+    put_u32(copy.data + 8, SIM_PARTITION_SIZE + 1);
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_VERSION, upload(&copy, BENCH_SEGMENT, false));
+    free(copy.data);
+}
+
+static void bench_upload(const char* name, const file_t* file)
+{
+    uint64_t start;
+
+    run_image(&s_old);
+    sim_flash_set_timing(BENCH_ERASE_US, BENCH_WRITE_US_KIB);
+    start = test_time_ns();
+    TEST_CHECK_EQ(ESP_OK, upload(file, BENCH_SEGMENT, true));
+    printf("bench: ota upload %-5s %7u bytes on the wire (%5.1f%% of the image), %5.0f ms\n", name,
+           (unsigned)file->len, 100.0 * file->len / s_new.len, (test_time_ns() - start) / 1e6);
+    sim_partition_reset();
+}
+
+int main(void)
+{
+    s_old = read_file(OTA_DELTA_TEST_OLD);
+    s_new = read_file(OTA_DELTA_TEST_NEW);
+    s_patch = read_file(OTA_DELTA_TEST_PATCH);
+    if (s_old.len == 0 || s_new.len == 0 || s_patch.len == 0)
+        return 1;
+    TEST_CHECK(s_old.len <= SIM_PARTITION_SIZE && s_new.len < SIM_PARTITION_SIZE);
+    mbedtls_sha256_ret(s_new.data, s_new.len, s_new_sha, 0);
+
+    ota_adp_init();
+    test_apply();
+    test_truncated();
+    test_corrupt();
+    test_wrong_source();
+    bench_upload("image", &s_new);
+    bench_upload("patch", &s_patch);
+
+    free(s_old.data);
+    free(s_new.data);
+    free(s_patch.data);
+    return test_result();
+}
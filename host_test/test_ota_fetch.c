@@ -0,0 +1,233 @@
+/*
+ * The downloads of the OTA client against tools/ota_server.py, started here on a free port
+ * with the builds of the ota_delta_patch fixture: the second build as the release, the patch
+ * from the first. The manifest offers the patch to the first build and the image to any
+ * other, every download is dropped after OTA_FETCH_TEST_DROP_AT bytes and continued with
+ * a Range request. SHA-256 mismatches and a patch for another source are refused.
+ */
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mbedtls/sha256.h"
+
+#include "ota_fetch.h"
+#include "ota_manifest.h"
+
+#include "sim.h"
+#include "test_util.h"
+
+#define OTA_FETCH_TEST_DROP_AT 20000
+#define OTA_FETCH_TEST_OLD_VERSION "1.1.0"
+
+typedef struct file {
+    uint8_t* data;
+    size_t len;
+} file_t;
+
+static file_t s_old;
+static file_t s_new;
+static pid_t s_server = -1;
+static FILE* s_server_out;
+static char s_manifest_url[OTA_CLIENT_URL_MAXLEN];
+static size_t s_progress_offset;
+static size_t s_progress_total;
+static uint32_t s_progress_calls;
+
+static file_t read_file(const char* path)
+{
+    file_t file = {NULL, 0};
+    FILE* f = fopen(path, "rb");
+
+    if (f == NULL) {
+        fprintf(stderr, "%s missing, run the test with ctest (fixture ota_delta_patch)\n", path);
+        return file;
+    }
+    fseek(f, 0, SEEK_END);
+    file.len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file.data = malloc(file.len);
+    if (fread(file.data, 1, file.len, f) != file.len)
+        file.len = 0;
+    fclose(f);
+    return file;
+}
+
+// Run tools/ota_server.py on a free port and wait for it to listen, the manifest URL is set.
+static bool server_start(void)
+{
+    char drop_at[16];
+    char line[256];
+    int out[2];
+    unsigned port = 0;
+
+    snprintf(drop_at, sizeof(drop_at), "%d", OTA_FETCH_TEST_DROP_AT);
+    if (pipe(out) != 0)
+        return false;
+    s_server = fork();
+    if (s_server == 0) {
+        // Gone with the test, whatever ends it.
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execl(OTA_FETCH_TEST_PYTHON, OTA_FETCH_TEST_PYTHON, "-u", OTA_FETCH_TEST_SERVER,
+              "--version", "1.2.0", "--image", OTA_DELTA_TEST_NEW,
+              "--patch", OTA_FETCH_TEST_OLD_VERSION ":" OTA_DELTA_TEST_PATCH,
+              "--percent", "25", "--window", "3600", "--drop-at", drop_at, "--port", "0", (char*)NULL);
+        _exit(127);
+    }
+    close(out[1]);
+    if (s_server < 0)
+        return false;
+
+    // Kept open: the server prints nothing more to stdout, but for reports, and logs to stderr.
+    s_server_out = fdopen(out[0], "r");
+    while (port == 0 && fgets(line, sizeof(line), s_server_out) != NULL)
+        sscanf(line, "serving on port %u", &port);
+    if (port == 0) {
+        fprintf(stderr, "%s did not start\n", OTA_FETCH_TEST_SERVER);
+        return false;
+    }
+    snprintf(s_manifest_url, sizeof(s_manifest_url), "http://127.0.0.1:%u/fw/manifest.json", port);
+    return true;
+}
+
+static void server_stop(void)
+{
+    if (s_server > 0) {
+        kill(s_server, SIGTERM);
+        waitpid(s_server, NULL, 0);
+        fclose(s_server_out);
+    }
+}
+
+static void progress(size_t offset, size_t total)
+{
+    s_progress_offset = offset;
+    s_progress_total = total;
+    s_progress_calls++;
+}
+
+// The device runs image, from a fresh flash.
+static void run_image(const file_t* image)
+{
+    sim_partition_reset();
+    memcpy(sim_partition_data(esp_ota_get_running_partition()->subtype), image->data, image->len);
+}
+
+static esp_err_t fetch_offer(const char* running_version, ota_manifest_offer_t* offer)
+{
+    char buf[OTA_CLIENT_MANIFEST_MAXLEN + 1];
+    size_t len = 0;
+    esp_err_t err = ota_fetch_text(s_manifest_url, buf, OTA_CLIENT_MANIFEST_MAXLEN, &len);
+
+    if (err == ESP_OK)
+        err = ota_manifest_parse(s_manifest_url, running_version, buf, len, offer);
+    return err;
+}
+
+static esp_err_t fetch_image(const ota_manifest_offer_t* offer)
+{
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    esp_err_t err;
+
+    s_progress_offset = s_progress_total = 0;
+    s_progress_calls = 0;
+    err = ota_fetch_image(offer, partition, progress);
+    if (err == ESP_OK && memcmp(sim_partition_data(partition->subtype), s_new.data, s_new.len) != 0)
+        err = ESP_FAIL;
+    return err;
+}
+
+static void test_manifest(void)
+{
+    ota_manifest_offer_t offer;
+    uint8_t sha[32];
+    char url[OTA_CLIENT_URL_MAXLEN];
+    char text[16 + 1];
+    size_t len;
+
+    // The first build gets the patch, any other version the image.
+    TEST_CHECK_EQ(ESP_OK, fetch_offer(OTA_FETCH_TEST_OLD_VERSION, &offer));
+    TEST_CHECK(strcmp(offer.version, "1.2.0") == 0);
+    TEST_CHECK(strstr(offer.url, "/fw/ota_delta_firmware.patch") != NULL);
+    TEST_CHECK(offer.check_image);
+    mbedtls_sha256_ret(s_new.data, s_new.len, sha, 0);
+    TEST_CHECK(memcmp(offer.image_sha256, sha, sizeof(sha)) == 0);
+    TEST_CHECK_EQ(25, offer.percent);
+    TEST_CHECK_EQ(3600, offer.window_s);
+    TEST_CHECK(strstr(offer.report_url, "/fw/report") != NULL);
+
+    TEST_CHECK_EQ(ESP_OK, fetch_offer("1.0.0", &offer));
+    TEST_CHECK(strstr(offer.url, "/fw/ota_delta_firmware_2") != NULL);
+    TEST_CHECK(memcmp(offer.sha256, sha, sizeof(sha)) == 0);
+
+    // Not there, or longer than the buffer.
+    TEST_CHECK_EQ(ESP_OK, ota_manifest_resolve(s_manifest_url, "missing.json", url));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_RESPONSE, ota_fetch_text(url, text, sizeof(text) - 1, &len));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, ota_fetch_text(s_manifest_url, text, sizeof(text) - 1, &len));
+    TEST_CHECK_EQ(ESP_FAIL, ota_fetch_text("http://127.0.0.1:1/manifest.json", text, sizeof(text) - 1, &len));
+}
+
+static void test_download(void)
+{
+    ota_manifest_offer_t offer;
+
+    // The patch, on the build it was made from, and the image: both dropped once and resumed.
+    TEST_CHECK_EQ(ESP_OK, fetch_offer(OTA_FETCH_TEST_OLD_VERSION, &offer));
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_OK, fetch_image(&offer));
+    TEST_CHECK(s_progress_total > OTA_FETCH_TEST_DROP_AT && s_progress_offset == s_progress_total);
+    printf("patch: %u bytes, %u progress reports\n", (unsigned)s_progress_total, (unsigned)s_progress_calls);
+
+    TEST_CHECK_EQ(ESP_OK, fetch_offer("1.0.0", &offer));
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_OK, fetch_image(&offer));
+    TEST_CHECK_EQ(s_new.len, s_progress_total);
+    TEST_CHECK_EQ(s_new.len, sim_partition_written());
+}
+
+static void test_refused(void)
+{
+    ota_manifest_offer_t offer;
+
+    // The download is not what the manifest says.
+    TEST_CHECK_EQ(ESP_OK, fetch_offer(OTA_FETCH_TEST_OLD_VERSION, &offer));
+    offer.sha256[7] ^= 0x01;
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_CRC, fetch_image(&offer));
+    // The image written is not the one announced.
+    TEST_CHECK_EQ(ESP_OK, fetch_offer(OTA_FETCH_TEST_OLD_VERSION, &offer));
+    offer.image_sha256[0] ^= 0x80;
+    run_image(&s_old);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_CRC, fetch_image(&offer));
+    // The device runs another build than the patch was made from.
+    TEST_CHECK_EQ(ESP_OK, fetch_offer(OTA_FETCH_TEST_OLD_VERSION, &offer));
+    run_image(&s_new);
+    TEST_CHECK_EQ(ESP_ERR_INVALID_VERSION, fetch_image(&offer));
+    // Nothing there.
+    strcpy(strrchr(offer.url, '/'), "/missing.lz");
+    TEST_CHECK_EQ(ESP_ERR_INVALID_RESPONSE, fetch_image(&offer));
+}
+
+int main(void)
+{
+    s_old = read_file(OTA_DELTA_TEST_OLD);
+    s_new = read_file(OTA_DELTA_TEST_NEW);
+    if (s_old.len == 0 || s_new.len == 0 || !server_start())
+        return 1;
+
+    ota_adp_init();
+    test_manifest();
+    test_download();
+    test_refused();
+
+    server_stop();
+    free(s_old.data);
+    free(s_new.data);
+    return test_result();
+}
@@ -0,0 +1,245 @@
+/*
+ * Compressed images: what tools/ota_lz.py compress makes (the ota_lz_images fixture compresses
+ * OTA_LZ_TEST_IMAGE) decompresses to the original, alone and through the /fota upload path.
+ * Damaged streams fail without touching memory out of bounds. The benchmark compares the upload
+ * time and the peak heap of the plain and the compressed image, the heap as counted by
+ * test_heap.c.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbedtls/sha256.h"
+
+#include "ota_lz.h"
+#include "ota_stream.h"
+
+#include "sim.h"
+#include "test_heap.h"
+#include "test_util.h"
+
+// as web_server_fota_service.c
+#define FOTA_RECV_BUF_SIZE  1024
+// A TCP segment every 2 ms, about 700 KB/s, and the flash timing of test_ota_adapter.c.
+#define BENCH_SEGMENT       1460
+#define BENCH_SEGMENT_US    2000
+#define BENCH_ERASE_US      2000
+#define BENCH_WRITE_US_KIB  500
+
+typedef struct file {
+    uint8_t* data;
+    size_t len;
+} file_t;
+
+static file_t s_image;
+static uint8_t s_image_sha[32];
+static uint32_t s_rand = 0x85ebca6b;
+
+static uint32_t rand_next(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+static file_t read_file(const char* path)
+{
+    file_t file = {NULL, 0};
+    FILE* f = fopen(path, "rb");
+
+    if (f == NULL) {
+        fprintf(stderr, "%s missing, run the test with ctest (fixture ota_lz_images)\n", path);
+        return file;
+    }
+    fseek(f, 0, SEEK_END);
+    file.len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file.data = malloc(file.len);
+    if (fread(file.data, 1, file.len, f) != file.len)
+        file.len = 0;
+    fclose(f);
+    return file;
+}
+
+typedef struct output {
+    uint8_t* data;
+    size_t len;
+    size_t max;
+} output_t;
+
+static esp_err_t output_sink(void* ctx, const uint8_t* data, size_t len)
+{
+    output_t* out = ctx;
+
+    if (len > out->max - out->len)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return ESP_OK;
+}
+
+// Decompress lz fed in pieces of up to max_piece bytes into out.
+static esp_err_t decompress(const file_t* lz, size_t max_piece, output_t* out)
+{
+    ota_lz_handle_t handle;
+    esp_err_t err;
+
+    out->len = 0;
+    if (lz->len < OTA_LZ_HEADER_LEN || !ota_lz_is_compressed(lz->data, lz->len))
+        return ESP_ERR_INVALID_ARG;
+    err = ota_lz_begin(lz->data, &handle);
+    if (err != ESP_OK)
+        return err;
+    for (size_t off = OTA_LZ_HEADER_LEN, n; off < lz->len && err == ESP_OK; off += n) {
+        n = 1 + rand_next() % max_piece;
+        if (n > lz->len - off)
+            n = lz->len - off;
+        err = ota_lz_feed(handle, lz->data + off, n, output_sink, out);
+    }
+    esp_err_t end_err = ota_lz_end(handle);
+    return (err != ESP_OK) ? err : end_err;
+}
+
+static void test_round_trip(const file_t* lz, uint8_t bits)
+{
+    output_t out = {malloc(s_image.len), 0, s_image.len};
+
+    TEST_CHECK(ota_lz_is_compressed(lz->data, lz->len));
+    TEST_CHECK_EQ(bits, lz->data[5]);
+    // One byte at a time and in large pieces, the parser resumes anywhere.
+    TEST_CHECK_EQ(ESP_OK, decompress(lz, 1, &out));
+    TEST_CHECK_EQ(s_image.len, out.len);
+    TEST_CHECK(memcmp(out.data, s_image.data, s_image.len) == 0);
+    TEST_CHECK_EQ(ESP_OK, decompress(lz, 8192, &out));
+    TEST_CHECK_EQ(s_image.len, out.len);
+    TEST_CHECK(memcmp(out.data, s_image.data, s_image.len) == 0);
+    free(out.data);
+}
+
+static void test_damaged(const file_t* lz)
+{
+    file_t copy = {malloc(lz->len), lz->len};
+    output_t out = {malloc(s_image.len), 0, s_image.len};
+
+    // Truncated: the size in the header is not reached.
+    memcpy(copy.data, lz->data, lz->len);
+    copy.len = lz->len - 1 - rand_next() % 100;
+    TEST_CHECK_EQ(ESP_ERR_INVALID_SIZE, decompress(&copy, 1460, &out));
+
+    // Bad headers.
+    copy.len = lz->len;
+    copy.data[4] = OTA_LZ_VERSION + 1;
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, decompress(&copy, 1460, &out));
+    copy.data[4] = OTA_LZ_VERSION;
+    copy.data[5] = OTA_LZ_WINDOW_BITS_MAX + 1;
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, decompress(&copy, 1460, &out));
+    copy.data[5] = lz->data[5];
+
+    // Flipped bytes: whatever comes out, never more than the header announced.
+    for (int round = 0; round < 50; round++) {
+        memcpy(copy.data, lz->data, lz->len);
+        for (int i = 1 + rand_next() % 4; i > 0; i--)
+            copy.data[OTA_LZ_HEADER_LEN + rand_next() % (lz->len - OTA_LZ_HEADER_LEN)] ^= 1 << (rand_next() % 8);
+        decompress(&copy, 1460, &out);
+        TEST_CHECK(out.len <= s_image.len);
+    }
+    free(copy.data);
+    free(out.data);
+}
+
+// The wire time of len bytes, as BENCH_SEGMENT segments arrive.
+static void net_receive(size_t len)
+{
+    usleep((useconds_t)((uint64_t)len * BENCH_SEGMENT_US / BENCH_SEGMENT));
+}
+
+// Upload file through the /fota path (web_srv_fota_recv()) into the emulated partition.
+static esp_err_t upload(const file_t* file, bool paced)
+{
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    uint8_t* buf = malloc(FOTA_RECV_BUF_SIZE);
+    ota_stream_handle_t stream;
+    ota_adp_writer_handle_t writer;
+    esp_err_t err = ota_stream_begin(partition, file->len, &stream);
+
+    for (size_t off = 0; off < file->len && err == ESP_OK;) {
+        size_t space = FOTA_RECV_BUF_SIZE;
+        uint8_t* direct = ota_stream_get_buf(stream, &space);
+        size_t n = paced ? BENCH_SEGMENT : 1 + rand_next() % BENCH_SEGMENT;
+
+        n = (n < space) ? n : space;
+        n = (n < file->len - off) ? n : file->len - off;
+        if (paced)
+            net_receive(n);
+        memcpy((direct != NULL) ? direct : buf, file->data + off, n);
+        err = (direct != NULL) ? ota_stream_put(stream, n) : ota_stream_write(stream, buf, n);
+        off += n;
+    }
+    free(buf);
+    if (err != ESP_OK) {
+        ota_stream_abort(stream);
+        return err;
+    }
+    err = ota_stream_finish(stream, &writer);
+    if (err != ESP_OK)
+        return err;
+    ota_adp_expect_sha256(writer, s_image_sha);
+    err = ota_adp_end(writer, NULL);
+    if (err == ESP_OK && memcmp(sim_partition_data(partition->subtype), s_image.data, s_image.len) != 0)
+        err = ESP_ERR_INVALID_CRC;
+    return err;
+}
+
+static void test_upload(const file_t* lz)
+{
+    sim_partition_reset();
+    TEST_CHECK_EQ(ESP_OK, upload(lz, false));
+    TEST_CHECK_EQ(s_image.len, sim_partition_written());
+    sim_partition_reset();
+    TEST_CHECK_EQ(ESP_OK, upload(&s_image, false));
+}
+
+static void bench_upload(const char* name, const file_t* file)
+{
+    uint64_t start;
+    size_t heap_base;
+
+    sim_partition_reset();
+    sim_flash_set_timing(BENCH_ERASE_US, BENCH_WRITE_US_KIB);
+    heap_base = test_heap_peak_start();
+    start = test_time_ns();
+    TEST_CHECK_EQ(ESP_OK, upload(file, true));
+    printf("bench: ota upload %-14s %7u bytes on the wire, %5.0f ms, peak heap %5u bytes\n", name,
+           (unsigned)file->len, (test_time_ns() - start) / 1e6, (unsigned)(test_heap_peak() - heap_base));
+    sim_partition_reset();
+}
+
+int main(void)
+{
+    file_t lz12;
+    file_t lz8;
+
+    s_image = read_file(OTA_LZ_TEST_IMAGE);
+    lz12 = read_file(OTA_LZ_TEST_IMAGE ".12.lz");
+    lz8 = read_file(OTA_LZ_TEST_IMAGE ".8.lz");
+    if (s_image.len == 0 || lz12.len == 0 || lz8.len == 0)
+        return 1;
+    TEST_CHECK(s_image.len <= SIM_PARTITION_SIZE);
+    mbedtls_sha256_ret(s_image.data, s_image.len, s_image_sha, 0);
+
+    ota_adp_init();
+    test_round_trip(&lz12, 12);
+    test_round_trip(&lz8, 8);
+    test_damaged(&lz12);
+    test_damaged(&lz8);
+    test_upload(&lz12);
+    bench_upload("plain", &s_image);
+    bench_upload("lz 4 KiB", &lz12);
+    bench_upload("lz 256 B", &lz8);
+
+    free(s_image.data);
+    free(lz12.data);
+    free(lz8.data);
+    return test_result();
+}
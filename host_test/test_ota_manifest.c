@@ -0,0 +1,167 @@
+/*
+ * The update manifest of the OTA client: URLs relative to the manifest, the patch for the
+ * running version or else the image, missing and invalid fields, and the rollout buckets,
+ * stable per device and even across a fleet.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "ota_manifest.h"
+
+#include "test_util.h"
+
+#define SHA_A "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define SHA_B "fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210"
+#define SHA_C "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff"
+#define FLEET 10000
+
+static const char* s_manifest_url = "http://updates.local:8070/fw/manifest.json";
+
+static void check_resolve(const char* base, const char* ref, esp_err_t expected, const char* url)
+{
+    char out[OTA_CLIENT_URL_MAXLEN];
+    esp_err_t err = ota_manifest_resolve(base, ref, out);
+
+    if (err != expected || (err == ESP_OK && strcmp(out, url) != 0))
+        fprintf(stderr, "resolve '%s' against '%s': 0x%x '%s'\n", ref, base, err, (err == ESP_OK) ? out : "");
+    TEST_CHECK_EQ(expected, err);
+    if (err == ESP_OK)
+        TEST_CHECK(strcmp(out, url) == 0);
+}
+
+static void test_resolve(void)
+{
+    char long_ref[OTA_CLIENT_URL_MAXLEN];
+
+    check_resolve(s_manifest_url, "a.lz", ESP_OK, "http://updates.local:8070/fw/a.lz");
+    check_resolve(s_manifest_url, "/b/a.lz", ESP_OK, "http://updates.local:8070/b/a.lz");
+    check_resolve(s_manifest_url, "http://cdn.local/a.lz", ESP_OK, "http://cdn.local/a.lz");
+    check_resolve("http://updates.local", "a.lz", ESP_OK, "http://updates.local/a.lz");
+    check_resolve("http://updates.local/", "a.lz", ESP_OK, "http://updates.local/a.lz");
+    check_resolve("manifest.json", "a.lz", ESP_ERR_INVALID_ARG, NULL);
+
+    memset(long_ref, 'x', sizeof(long_ref) - 1);
+    long_ref[sizeof(long_ref) - 1] = '\0';
+    check_resolve(s_manifest_url, long_ref, ESP_ERR_INVALID_SIZE, NULL);
+}
+
+static esp_err_t parse(const char* manifest, const char* running, ota_manifest_offer_t* offer)
+{
+    char buf[OTA_CLIENT_MANIFEST_MAXLEN + 1];
+
+    snprintf(buf, sizeof(buf), "%s", manifest);
+    memset(offer, 0xa5, sizeof(*offer));
+    return ota_manifest_parse(s_manifest_url, running, buf, strlen(buf), offer);
+}
+
+static void test_parse(void)
+{
+    static const char manifest[] =
+        "{\"version\":\"1.2.0\",\"url\":\"modbus_switch.lz\",\"sha256\":\"" SHA_A "\","
+        "\"patches\":[{\"from\":\"1.0.0\",\"url\":\"1.0.0.patch.lz\",\"sha256\":\"" SHA_B "\"},"
+        "{\"from\":\"1.1.0\",\"url\":\"/p/1.1.0.patch.lz\",\"sha256\":\"" SHA_C "\"}],"
+        "\"rollout\":{\"percent\":25,\"window_s\":3600},\"report\":\"report\",\"image_sha256\":\"" SHA_B "\"}";
+    ota_manifest_offer_t offer;
+
+    // No patch from 0.9.0: the image.
+    TEST_CHECK_EQ(ESP_OK, parse(manifest, "0.9.0", &offer));
+    TEST_CHECK(strcmp(offer.version, "1.2.0") == 0);
+    TEST_CHECK(strcmp(offer.url, "http://updates.local:8070/fw/modbus_switch.lz") == 0);
+    TEST_CHECK_EQ(0x01, offer.sha256[0]);
+    TEST_CHECK_EQ(0xef, offer.sha256[31]);
+    TEST_CHECK(offer.check_image);
+    TEST_CHECK_EQ(0xfe, offer.image_sha256[0]);
+    TEST_CHECK_EQ(25, offer.percent);
+    TEST_CHECK_EQ(3600, offer.window_s);
+    TEST_CHECK(strcmp(offer.report_url, "http://updates.local:8070/fw/report") == 0);
+
+    // The patch for the running version, the image SHA-256 stays that of the new image.
+    TEST_CHECK_EQ(ESP_OK, parse(manifest, "1.1.0", &offer));
+    TEST_CHECK(strcmp(offer.url, "http://updates.local:8070/p/1.1.0.patch.lz") == 0);
+    TEST_CHECK_EQ(0x00, offer.sha256[0]);
+    TEST_CHECK_EQ(0x11, offer.sha256[1]);
+    TEST_CHECK_EQ(0xfe, offer.image_sha256[0]);
+    TEST_CHECK_EQ(ESP_OK, parse(manifest, "1.0.0", &offer));
+    TEST_CHECK(strcmp(offer.url, "http://updates.local:8070/fw/1.0.0.patch.lz") == 0);
+    TEST_CHECK_EQ(0xfe, offer.sha256[0]);
+
+    // The optional fields: everyone, at once, no report, no image check.
+    TEST_CHECK_EQ(ESP_OK, parse("{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"" SHA_A "\"}", "1.1.0", &offer));
+    TEST_CHECK_EQ(100, offer.percent);
+    TEST_CHECK_EQ(0, offer.window_s);
+    TEST_CHECK(!offer.check_image);
+    TEST_CHECK_EQ('\0', offer.report_url[0]);
+    TEST_CHECK_EQ(ESP_OK, parse("{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"" SHA_A "\","
+                                "\"rollout\":{\"percent\":250}}", "1.1.0", &offer));
+    TEST_CHECK_EQ(100, offer.percent);
+}
+
+static void test_parse_invalid(void)
+{
+    static const char* const manifests[] = {
+        "",
+        "[]",
+        "{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":",
+        "{\"url\":\"a\",\"sha256\":\"" SHA_A "\"}",
+        "{\"version\":12,\"url\":\"a\",\"sha256\":\"" SHA_A "\"}",
+        "{\"version\":\"a version much longer than fits in the offer\",\"url\":\"a\",\"sha256\":\"" SHA_A "\"}",
+        "{\"version\":\"1.2.0\",\"sha256\":\"" SHA_A "\"}",
+        "{\"version\":\"1.2.0\",\"url\":\"a\"}",
+        "{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"0123\"}",
+        "{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"" SHA_A "00\"}",
+        "{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"x123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\"}",
+        "{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"" SHA_A "\",\"image_sha256\":\"ab\"}",
+        // The patch for the running version is broken, the image is not taken instead.
+        "{\"version\":\"1.2.0\",\"url\":\"a\",\"sha256\":\"" SHA_A "\",\"patches\":[{\"from\":\"1.1.0\",\"url\":\"p\"}]}",
+    };
+    ota_manifest_offer_t offer;
+
+    for (size_t i = 0; i < sizeof(manifests) / sizeof(manifests[0]); i++) {
+        esp_err_t err = parse(manifests[i], "1.1.0", &offer);
+        if (err != ESP_ERR_INVALID_RESPONSE)
+            fprintf(stderr, "accepted '%s'\n", manifests[i]);
+        TEST_CHECK_EQ(ESP_ERR_INVALID_RESPONSE, err);
+    }
+}
+
+static void test_bucket(void)
+{
+    static const uint8_t mac[6] = {0x5c, 0xcf, 0x7f, 0x01, 0x02, 0x03};
+    uint32_t counts[OTA_MANIFEST_ROLLOUT_BUCKETS] = {0};
+    uint32_t below_25 = 0;
+    uint32_t seed = 0x9e3779b9;
+    uint32_t min = FLEET, max = 0;
+
+    TEST_CHECK_EQ(ota_manifest_bucket(mac), ota_manifest_bucket(mac));
+    TEST_CHECK(ota_manifest_bucket(mac) < OTA_MANIFEST_ROLLOUT_BUCKETS);
+
+    // A fleet of one vendor: only the last 3 bytes differ.
+    for (uint32_t i = 0; i < FLEET; i++) {
+        uint8_t m[6] = {0x5c, 0xcf, 0x7f};
+        seed = seed * 1664525 + 1013904223;
+        m[3] = seed >> 24;
+        m[4] = seed >> 16;
+        m[5] = seed >> 8;
+        uint8_t bucket = ota_manifest_bucket(m);
+        counts[bucket]++;
+        below_25 += (bucket < 25);
+    }
+    for (size_t i = 0; i < OTA_MANIFEST_ROLLOUT_BUCKETS; i++) {
+        min = (counts[i] < min) ? counts[i] : min;
+        max = (counts[i] > max) ? counts[i] : max;
+    }
+    printf("rollout: %u of %u devices in 25%%, %u to %u per bucket\n", (unsigned)below_25, FLEET,
+           (unsigned)min, (unsigned)max);
+    TEST_CHECK(below_25 > FLEET * 22 / 100 && below_25 < FLEET * 28 / 100);
+    TEST_CHECK(min > FLEET / OTA_MANIFEST_ROLLOUT_BUCKETS / 2);
+    TEST_CHECK(max < FLEET / OTA_MANIFEST_ROLLOUT_BUCKETS * 2);
+}
+
+int main(void)
+{
+    test_resolve();
+    test_parse();
+    test_parse_invalid();
+    test_bucket();
+    return test_result();
+}
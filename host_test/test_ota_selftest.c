@@ -0,0 +1,145 @@
+/*
+ * Trial boots of a new image: confirmed once every service passed, rejected after a missed
+ * deadline, a panic or a watchdog reset, tried again after a power cut or an external reset.
+ * A boot is hal_sim_reset(), sim_partition_reboot() and ota_selftest_init(); NVS is kept.
+ */
+#include <string.h>
+#include <unistd.h>
+
+#include "board_hal.h"
+#include "ota_selftest.h"
+
+#include "sim.h"
+#include "test_util.h"
+
+#define VERSION "1.2.0"
+
+// The confirm and fail tasks are threads, give them up to a second.
+#define WAIT_FOR(cond) do {                                     \
+        for (int __i = 0; __i < 1000 && !(cond); __i++)         \
+            usleep(1000);                                       \
+    } while (0)
+
+static const esp_partition_t* s_prev;
+static const esp_partition_t* s_next;
+
+static void boot(esp_reset_reason_t reason)
+{
+    hal_sim_reset();
+    sim_partition_reboot();
+    sim_set_reset_reason(reason);
+    TEST_CHECK_EQ(ESP_OK, ota_selftest_init());
+}
+
+// Install VERSION the way the FOTA service and the OTA client do, and boot it.
+static void boot_new_image(void)
+{
+    TEST_CHECK_EQ(ESP_OK, ota_selftest_arm(s_next, VERSION));
+    TEST_CHECK_EQ(ESP_OK, esp_ota_set_boot_partition(s_next));
+    boot(ESP_RST_SW);
+    TEST_CHECK(esp_ota_get_running_partition() == s_next);
+    TEST_CHECK(ota_selftest_on_trial());
+    // A crash from here returns to the previous image.
+    TEST_CHECK(esp_ota_get_boot_partition() == s_prev);
+}
+
+// The last services pass, the confirm task makes the image the boot partition and stores it.
+static void pass_all(void)
+{
+    uint32_t commits = sim_nvs_get_stats().commits;
+
+    ota_selftest_pass(OTA_SELFTEST_SWITCH);
+    ota_selftest_pass(OTA_SELFTEST_MODBUS);
+    TEST_CHECK(!ota_selftest_on_trial());
+    WAIT_FOR(sim_nvs_get_stats().commits > commits);
+    TEST_CHECK(esp_ota_get_boot_partition() == s_next);
+}
+
+static void setup(void)
+{
+    sim_nvs_reset();
+    sim_partition_reset();
+    s_prev = esp_ota_get_running_partition();
+    s_next = esp_ota_get_next_update_partition(NULL);
+    boot(ESP_RST_POWERON);
+    TEST_CHECK(!ota_selftest_on_trial());
+}
+
+static void test_passed(void)
+{
+    uint32_t restarts = sim_restart_count();
+
+    setup();
+    boot_new_image();
+    ota_selftest_pass(OTA_SELFTEST_SWITCH);
+    TEST_CHECK(ota_selftest_on_trial());
+    pass_all();
+
+    // The deadline is off, the image stays.
+    hal_sim_advance_us(2ULL * OTA_SELFTEST_DEADLINE_MS * 1000);
+    usleep(10000);
+    TEST_CHECK_EQ(restarts, sim_restart_count());
+    boot(ESP_RST_POWERON);
+    TEST_CHECK(esp_ota_get_running_partition() == s_next);
+    TEST_CHECK(!ota_selftest_on_trial());
+    TEST_CHECK(strcmp(ota_selftest_rejected_version(), "") == 0);
+}
+
+static void test_deadline(void)
+{
+    uint32_t restarts = sim_restart_count();
+
+    setup();
+    boot_new_image();
+    // Modbus up in AP mode, the switches never.
+    ota_selftest_pass(OTA_SELFTEST_MODBUS);
+    hal_sim_advance_us(OTA_SELFTEST_DEADLINE_MS * 1000ULL - 1000);
+    TEST_CHECK(ota_selftest_on_trial());
+    hal_sim_advance_us(1000);
+    TEST_CHECK(!ota_selftest_on_trial());
+    WAIT_FOR(sim_restart_count() > restarts);
+    TEST_CHECK_EQ(restarts + 1, sim_restart_count());
+
+    // Restarted by the self-test, the version is rejected.
+    boot(ESP_RST_SW);
+    TEST_CHECK(esp_ota_get_running_partition() == s_prev);
+    TEST_CHECK(!ota_selftest_on_trial());
+    TEST_CHECK(strcmp(ota_selftest_rejected_version(), VERSION) == 0);
+    // and stays rejected.
+    boot(ESP_RST_POWERON);
+    TEST_CHECK(strcmp(ota_selftest_rejected_version(), VERSION) == 0);
+}
+
+static void test_reset_during_trial(void)
+{
+    static const struct {
+        esp_reset_reason_t reason;
+        bool rejected;
+    } resets[] = {
+        {ESP_RST_PANIC, true}, {ESP_RST_INT_WDT, true}, {ESP_RST_TASK_WDT, true}, {ESP_RST_WDT, true},
+        {ESP_RST_POWERON, false}, {ESP_RST_EXT, false}, {ESP_RST_BROWNOUT, false}, {ESP_RST_SW, false},
+    };
+
+    for (size_t i = 0; i < sizeof(resets) / sizeof(resets[0]); i++) {
+        setup();
+        boot_new_image();
+        ota_selftest_pass(OTA_SELFTEST_SWITCH);
+        boot(resets[i].reason);
+        TEST_CHECK(esp_ota_get_running_partition() == s_prev);
+        TEST_CHECK(!ota_selftest_on_trial());
+        TEST_CHECK(strcmp(ota_selftest_rejected_version(), resets[i].rejected ? VERSION : "") == 0);
+        if (!resets[i].rejected) {
+            // Tried again, it may pass this time.
+            boot_new_image();
+            pass_all();
+        }
+    }
+}
+
+int main(void)
+{
+    test_passed();
+    test_deadline();
+    test_reset_during_trial();
+    return test_result();
+}
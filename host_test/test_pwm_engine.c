@@ -0,0 +1,197 @@
+/*
+ * PWM engine on the simulated board: edge timing of every channel against the ideal waveform,
+ * with a punctual hardware timer and with ISR latency, and the end of N-pulse trains.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "board_hal.h"
+#include "pwm_engine.h"
+
+#include "test_util.h"
+
+#define ON_LEVEL 0
+#define TEST_PINS ((1UL << 12) | (1UL << 13) | (1UL << 14))
+
+typedef struct waveform {
+    uint64_t on_us[HAL_SIM_EDGE_LOG_SIZE];
+    uint64_t off_us[HAL_SIM_EDGE_LOG_SIZE];
+    size_t on_count;
+    size_t off_count;
+} waveform_t;
+
+static hal_sim_edge_t s_edges[HAL_SIM_EDGE_LOG_SIZE];
+static uint32_t s_done_mask = 0;
+static uint64_t s_case_start_us = 0;
+
+static void pwm_done(uint8_t channel)
+{
+    s_done_mask |= 1UL << channel;
+}
+
+// Every case starts with the pins OFF, its edges are the ones recorded since.
+static void reset(void)
+{
+    static bool initialized = false;
+
+    if (!initialized) {
+        hal_sim_reset();
+        TEST_CHECK_EQ(ESP_OK, pwm_engine_init(pwm_done));
+        initialized = true;
+    }
+    for (uint8_t channel = 0; channel < PWM_ENGINE_CHANNEL_MAX; channel++)
+        pwm_engine_stop(channel);
+    hal_gpio_output_init(TEST_PINS);
+    hal_gpio_set_levels(TEST_PINS, ON_LEVEL ? 0 : TEST_PINS);
+    hal_sim_advance_us(10000);
+    s_case_start_us = hal_time_us();
+    s_done_mask = 0;
+}
+
+static void waveform_of(uint8_t pin, waveform_t* wave)
+{
+    size_t count = hal_sim_get_edges(s_edges, HAL_SIM_EDGE_LOG_SIZE);
+
+    memset(wave, 0, sizeof(*wave));
+    for (size_t i = 0; i < count; i++) {
+        if (s_edges[i].pin != pin || s_edges[i].time_us < s_case_start_us)
+            continue;
+        if (s_edges[i].level == ON_LEVEL)
+            wave->on_us[wave->on_count++] = s_edges[i].time_us;
+        else
+            wave->off_us[wave->off_count++] = s_edges[i].time_us;
+    }
+}
+
+static uint64_t abs_diff(uint64_t a, uint64_t b)
+{
+    return (a > b) ? a - b : b - a;
+}
+
+// Largest distance of an edge from the ideal waveform starting with the first ON edge at start_us.
+static uint64_t max_edge_error(const waveform_t* wave, uint64_t start_us, uint64_t period_us, uint64_t on_us)
+{
+    uint64_t error = 0;
+
+    for (size_t i = 0; i < wave->on_count; i++) {
+        uint64_t e = abs_diff(wave->on_us[i], start_us + i * period_us);
+        error = (e > error) ? e : error;
+    }
+    for (size_t i = 0; i < wave->off_count; i++) {
+        uint64_t e = abs_diff(wave->off_us[i], start_us + i * period_us + on_us);
+        error = (e > error) ? e : error;
+    }
+    return error;
+}
+
+static void test_punctual(void)
+{
+    const pwm_conf_t conf[PWM_ENGINE_CHANNEL_MAX] = {
+        {.period_ms = 10, .duty_permille = 300},
+        {.period_ms = 7, .duty_permille = 333},
+        {.period_ms = 1, .duty_permille = 500},
+    };
+    waveform_t wave;
+    uint64_t start_us;
+
+    reset();
+    start_us = hal_time_us() + PWM_ENGINE_TICK_US;
+    for (uint8_t channel = 0; channel < PWM_ENGINE_CHANNEL_MAX; channel++)
+        TEST_CHECK_EQ(ESP_OK, pwm_engine_start(channel, 12 + channel, ON_LEVEL, &conf[channel]));
+    hal_sim_advance_us(100000);
+
+    for (uint8_t channel = 0; channel < PWM_ENGINE_CHANNEL_MAX; channel++) {
+        uint64_t period_us = conf[channel].period_ms * 1000ULL;
+        uint64_t ideal_on_us = period_us * conf[channel].duty_permille / PWM_DUTY_MAX;
+        uint64_t on_us;
+
+        waveform_of(12 + channel, &wave);
+        TEST_CHECK(wave.on_count >= 100000 / period_us);
+        on_us = wave.off_us[0] - wave.on_us[0];
+        // the duty cycle is rounded to the nearest tick, the edges are then exact.
+        TEST_CHECK(abs_diff(on_us, ideal_on_us) <= PWM_ENGINE_TICK_US / 2);
+        TEST_CHECK_EQ(0, max_edge_error(&wave, start_us, period_us, on_us));
+        printf("bench: channel %u, %u ms at %u permille: %zu periods, ON for %llu us (ideal %llu), 0 us jitter\n",
+               channel, conf[channel].period_ms, conf[channel].duty_permille, wave.on_count,
+               (unsigned long long)on_us, (unsigned long long)ideal_on_us);
+    }
+}
+
+static void test_isr_latency(void)
+{
+    const uint32_t latency_us = 120;
+    const pwm_conf_t conf = {.period_ms = 10, .duty_permille = 250};
+    waveform_t wave;
+    uint64_t start_us;
+    uint64_t error_us;
+    uint64_t min_period_us = UINT64_MAX;
+    uint64_t max_period_us = 0;
+
+    reset();
+    hal_sim_set_hw_timer_latency(latency_us);
+    start_us = hal_time_us() + PWM_ENGINE_TICK_US;
+    TEST_CHECK_EQ(ESP_OK, pwm_engine_start(0, 12, ON_LEVEL, &conf));
+    hal_sim_advance_us(2000000);
+    hal_sim_set_hw_timer_latency(0);
+
+    waveform_of(12, &wave);
+    TEST_CHECK_EQ(200, wave.on_count);
+    // every edge is late by the latency of its own ISR only, nothing accumulates.
+    error_us = max_edge_error(&wave, start_us, 10000, 2500);
+    TEST_CHECK(error_us <= latency_us);
+    TEST_CHECK(error_us > 0);
+    for (size_t i = 1; i < wave.on_count; i++) {
+        uint64_t period_us = wave.on_us[i] - wave.on_us[i - 1];
+        min_period_us = (period_us < min_period_us) ? period_us : min_period_us;
+        max_period_us = (period_us > max_period_us) ? period_us : max_period_us;
+    }
+    TEST_CHECK(10000 - min_period_us <= latency_us);
+    TEST_CHECK(max_period_us - 10000 <= latency_us);
+    TEST_CHECK(abs_diff(wave.on_us[wave.on_count - 1] - wave.on_us[0], (wave.on_count - 1) * 10000ULL) <= latency_us);
+    printf("bench: %u us ISR latency: edges up to %llu us late, periods %llu..%llu us\n", latency_us,
+           (unsigned long long)error_us, (unsigned long long)min_period_us, (unsigned long long)max_period_us);
+}
+
+static void test_pulses(void)
+{
+    const pwm_conf_t conf = {.period_ms = 4, .duty_permille = 500, .pulses = 5};
+    waveform_t wave;
+    uint64_t start_us;
+
+    reset();
+    start_us = hal_time_us() + PWM_ENGINE_TICK_US;
+    TEST_CHECK_EQ(ESP_OK, pwm_engine_start(1, 13, ON_LEVEL, &conf));
+    hal_sim_advance_us(100000);
+
+    waveform_of(13, &wave);
+    TEST_CHECK_EQ(5, wave.on_count);
+    TEST_CHECK_EQ(5, wave.off_count);
+    TEST_CHECK_EQ(0, max_edge_error(&wave, start_us, 4000, 2000));
+    TEST_CHECK_EQ(1UL << 1, s_done_mask);
+    TEST_CHECK_EQ(!ON_LEVEL, hal_gpio_get_level(13));
+
+    // a stopped channel leaves its pin OFF at once.
+    TEST_CHECK_EQ(ESP_OK, pwm_engine_start(2, 14, ON_LEVEL, &(pwm_conf_t){.period_ms = 10, .duty_permille = 900}));
+    hal_sim_advance_us(5000);
+    TEST_CHECK_EQ(ON_LEVEL, hal_gpio_get_level(14));
+    pwm_engine_stop(2);
+    TEST_CHECK_EQ(!ON_LEVEL, hal_gpio_get_level(14));
+}
+
+static void test_conf(void)
+{
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, pwm_engine_check_conf(&(pwm_conf_t){.period_ms = 10, .duty_permille = 1001}));
+    TEST_CHECK_EQ(ESP_OK, pwm_engine_check_conf(&(pwm_conf_t){.period_ms = 1, .duty_permille = 1000}));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, pwm_engine_start(PWM_ENGINE_CHANNEL_MAX, 12, ON_LEVEL,
+                                                        &(pwm_conf_t){.period_ms = 10}));
+    TEST_CHECK_EQ(ESP_ERR_INVALID_ARG, pwm_engine_start(0, 12, ON_LEVEL, &(pwm_conf_t){.period_ms = 0}));
+}
+
+int main(void)
+{
+    test_punctual();
+    test_isr_latency();
+    test_pulses();
+    test_conf();
+    return test_result();
+}
@@ -0,0 +1,216 @@
+/*
+ * Switch adapter on the simulated board: output edges of TOGGLING, LIMIT and batch changes
+ * read back from the edge log, and the host cost of a switching request.
+ */
+#include <string.h>
+
+#include "board_hal.h"
+#include "configuration_adapter.h"
+#include "switch_adapter.h"
+
+#include "sim.h"
+#include "test_util.h"
+
+#define SW_OFF_LEVEL (!SW_ON_LEVEL)
+#define LIMIT_HOLD_S 2
+
+static hal_sim_edge_t s_edges[HAL_SIM_EDGE_LOG_SIZE];
+static size_t s_edges_seen = 0;
+static enum switch_status s_last_update[SW_MAX];
+static int s_update_count[SW_MAX];
+
+// Edges recorded since the previous call, into s_edges.
+static size_t new_edges(void)
+{
+    hal_sim_edge_t all[HAL_SIM_EDGE_LOG_SIZE];
+    size_t count = hal_sim_get_edges(all, HAL_SIM_EDGE_LOG_SIZE);
+    size_t fresh = count - s_edges_seen;
+
+    memcpy(s_edges, &all[s_edges_seen], fresh * sizeof(all[0]));
+    s_edges_seen = count;
+    return fresh;
+}
+
+static void status_updated(uint8_t sw_index, bool status)
+{
+    s_last_update[sw_index] = status;
+    s_update_count[sw_index]++;
+}
+
+static void set_switch_conf(enum cfg_data_idt id, uint8_t hold_s, enum switch_type type)
+{
+    switch_conf_t conf = {.conf = {.sw_hold_duration = hold_s, .sw_type = type, .sw_status = STA_OFF}};
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_set_u8_by_id(id, conf.value));
+}
+
+static void setup(void)
+{
+    hal_sim_reset();
+    sim_nvs_reset();
+    sim_partition_reset();
+    TEST_CHECK_EQ(ESP_OK, cfg_adp_init());
+    set_switch_conf(CFG_SW_1, LIMIT_HOLD_S, LIMIT);
+    set_switch_conf(CFG_SW_2, 0, TOGGLING);
+    set_switch_conf(CFG_SW_3, 0, TOGGLING);
+    switch_adapter_init();
+    for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+        switch_adapter_set_state_update_callback(sw_index, status_updated);
+
+    // every output starts at its OFF level.
+    TEST_CHECK_EQ(3, new_edges());
+    for (size_t i = 0; i < 3; i++) {
+        TEST_CHECK_EQ(0, s_edges[i].time_us);
+        TEST_CHECK_EQ(SW_OFF_LEVEL, s_edges[i].level);
+    }
+}
+
+static void test_toggling(void)
+{
+    uint8_t status;
+
+    hal_sim_advance_us(1000);
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW2, STA_ON));
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(SW_2_GPIO_PIN, s_edges[0].pin);
+    TEST_CHECK_EQ(SW_ON_LEVEL, s_edges[0].level);
+    TEST_CHECK_EQ(hal_time_us(), s_edges[0].time_us);
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_get_status(SW2, &status));
+    TEST_CHECK_EQ(STA_ON, status);
+
+    // setting the running status again is not an edge, and a TOGGLING switch stays put.
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW2, STA_ON));
+    hal_sim_advance_us(10 * 1000000ULL);
+    TEST_CHECK_EQ(0, new_edges());
+
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW2, STA_OFF));
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(SW_OFF_LEVEL, s_edges[0].level);
+}
+
+static void test_limit_timeout(void)
+{
+    uint64_t on_us;
+    int updates = s_update_count[SW1];
+
+    hal_sim_advance_us(1000);
+    on_us = hal_time_us();
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_ON));
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(SW_1_GPIO_PIN, s_edges[0].pin);
+    TEST_CHECK_EQ(SW_ON_LEVEL, s_edges[0].level);
+
+    hal_sim_advance_us(LIMIT_HOLD_S * 1000000ULL - 1);
+    TEST_CHECK_EQ(0, new_edges());
+    hal_sim_advance_us(1);
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(SW_1_GPIO_PIN, s_edges[0].pin);
+    TEST_CHECK_EQ(SW_OFF_LEVEL, s_edges[0].level);
+    TEST_CHECK_EQ(on_us + LIMIT_HOLD_S * 1000000ULL, s_edges[0].time_us);
+    // the Modbus coil follows the return to the default status.
+    TEST_CHECK_EQ(updates + 1, s_update_count[SW1]);
+    TEST_CHECK_EQ(STA_OFF, s_last_update[SW1]);
+
+    // a request while ON restarts the hold duration.
+    on_us = hal_time_us();
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_ON));
+    hal_sim_advance_us(1500000);
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_ON));
+    hal_sim_advance_us(LIMIT_HOLD_S * 1000000ULL);
+    TEST_CHECK_EQ(2, new_edges());
+    TEST_CHECK_EQ(on_us, s_edges[0].time_us);
+    TEST_CHECK_EQ(on_us + 1500000 + LIMIT_HOLD_S * 1000000ULL, s_edges[1].time_us);
+
+    // back to the default status by request, the timer must not toggle it later.
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_ON));
+    hal_sim_advance_us(500000);
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_OFF));
+    hal_sim_advance_us(LIMIT_HOLD_S * 1000000ULL);
+    TEST_CHECK_EQ(2, new_edges());
+}
+
+static void test_limit_hold_update(void)
+{
+    uint64_t on_us;
+
+    // a committed configuration change applies to the next ON period.
+    set_switch_conf(CFG_SW_1, 1, LIMIT);
+    hal_sim_advance_us(CFG_FLUSH_DELAY_MS * 1000ULL);
+    on_us = hal_time_us();
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_ON));
+    hal_sim_advance_us(LIMIT_HOLD_S * 1000000ULL);
+    TEST_CHECK_EQ(2, new_edges());
+    TEST_CHECK_EQ(on_us + 1000000, s_edges[1].time_us);
+
+    // a TOGGLING switch no longer returns.
+    set_switch_conf(CFG_SW_1, 1, TOGGLING);
+    hal_sim_advance_us(CFG_FLUSH_DELAY_MS * 1000ULL);
+    TEST_CHECK_EQ(TOGGLING, switch_adapter_get_type(SW1));
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_ON));
+    hal_sim_advance_us(LIMIT_HOLD_S * 1000000ULL);
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta(SW1, STA_OFF));
+    TEST_CHECK_EQ(1, new_edges());
+
+    set_switch_conf(CFG_SW_1, LIMIT_HOLD_S, LIMIT);
+    hal_sim_advance_us(CFG_FLUSH_DELAY_MS * 1000ULL);
+}
+
+static void test_batch(void)
+{
+    uint64_t now_us;
+
+    hal_sim_advance_us(1000);
+    now_us = hal_time_us();
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta_batch(0x7, 0x7));
+    TEST_CHECK_EQ(3, new_edges());
+    for (size_t i = 0; i < 3; i++) {
+        TEST_CHECK_EQ(now_us, s_edges[i].time_us);
+        TEST_CHECK_EQ(SW_ON_LEVEL, s_edges[i].level);
+    }
+
+    // the LIMIT switch of the batch still returns on its own.
+    hal_sim_advance_us(LIMIT_HOLD_S * 1000000ULL);
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(SW_1_GPIO_PIN, s_edges[0].pin);
+    TEST_CHECK_EQ(now_us + LIMIT_HOLD_S * 1000000ULL, s_edges[0].time_us);
+
+    // switches outside the mask are left alone.
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta_batch(0x4, 0x0));
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(SW_3_GPIO_PIN, s_edges[0].pin);
+    TEST_CHECK_EQ(ESP_OK, switch_adapter_chg_sta_batch(0x2, 0x0));
+    TEST_CHECK_EQ(1, new_edges());
+    TEST_CHECK_EQ(ESP_ERR_NOT_SUPPORTED, switch_adapter_chg_sta_batch(0x8, 0x8));
+}
+
+static void bench_switching(void)
+{
+    const int rounds = 100000;
+    uint64_t start_ns;
+    uint64_t single_ns;
+    uint64_t batch_ns;
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < rounds; i++)
+        switch_adapter_chg_sta(SW2, i & 1);
+    single_ns = test_time_ns() - start_ns;
+
+    start_ns = test_time_ns();
+    for (int i = 0; i < rounds; i++)
+        switch_adapter_chg_sta_batch(0x6, (i & 1) ? 0x6 : 0x0);
+    batch_ns = test_time_ns() - start_ns;
+
+    printf("bench: switch_adapter_chg_sta %.0f ns/request\n", (double)single_ns / rounds);
+    printf("bench: switch_adapter_chg_sta_batch (2 switches) %.0f ns/request\n", (double)batch_ns / rounds);
+}
+
+int main(void)
+{
+    setup();
+    test_toggling();
+    test_limit_timeout();
+    test_limit_hold_update();
+    test_batch();
+    bench_switching();
+    return test_result();
+}
@@ -0,0 +1,50 @@
+/*
+ * test_util.h
+ *
+ * Each host test is an executable run by ctest: checks report and count failures without
+ * stopping it, main() returns test_result(). Benchmarks print "bench:" lines, their figures
+ * are host timings to compare changes with, not target timings, so they are never checked.
+ */
+
+#ifndef HOST_TEST_TEST_UTIL_H_
+#define HOST_TEST_TEST_UTIL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int s_test_failures = 0;
+
+#define TEST_CHECK(cond) do {                                                   \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            s_test_failures++;                                                  \
+        }                                                                       \
+    } while (0)
+
+#define TEST_CHECK_EQ(expected, actual) do {                                    \
+        long long __expected = (long long)(expected);                           \
+        long long __actual = (long long)(actual);                               \
+        if (__expected != __actual) {                                           \
+            fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n",   \
+                    __FILE__, __LINE__, #expected, #actual, __expected, __actual); \
+            s_test_failures++;                                                  \
+        }                                                                       \
+    } while (0)
+
+static inline uint64_t test_time_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static inline int test_result(void)
+{
+    if (s_test_failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", s_test_failures);
+    return s_test_failures > 0;
+}
+
+#endif /* HOST_TEST_TEST_UTIL_H_ */
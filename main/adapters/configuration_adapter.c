@@ -1,95 +1,211 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "esp_log.h"
 #include "esp_wifi.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 
+#include "board_hal.h"
 #include "configuration_adapter.h"
+#include "configuration_schema_hash.h"
+#include "metrics.h"
+
+#define TAG "CFG"
+#define CFG_DIRTY_BIT(id) (1UL << (id))
+
+_Static_assert(CFG_IDT_MAX <= 32, "s_cfg_dirty holds one bit per field");
+
+// Every field lives in RAM after cfg_adp_init(), NVS is only touched by cfg_adp_flush().
+static cfg_value_t s_cfg_cache[CFG_IDT_MAX];
+static uint32_t s_cfg_dirty = 0;
+static hal_lock_handle_t s_cfg_lock = NULL;
+static hal_timer_handle_t s_cfg_flush_timer = NULL;
+// config commits are serialized by s_cfg_lock, blobs are only stored by the switch statistics timer.
+static metric_t s_cfg_commits = METRIC_COUNTER_INIT("nvs_commits_total", "NVS commits by record kind.", "kind=\"config\"");
+static metric_t s_blob_commits = METRIC_COUNTER_INIT("nvs_commits_total", "NVS commits by record kind.", "kind=\"blob\"");
+
+typedef struct cfg_subscription {
+    uint32_t ids;
+    cfg_adp_subscriber_t subscriber;
+    void* arg;
+} cfg_subscription_t;
+
+static cfg_subscription_t s_cfg_subscriptions[CFG_SUBSCRIBER_MAX];
+
+struct cfg_adp_txn {
+    uint32_t staged;
+    cfg_value_t values[CFG_IDT_MAX];
+};
 
-static config_def_t config_defs[CFG_IDT_MAX] = {
-    [CFG_WIFI_SSID] =           {.name = "wifi_sta_ssid",       .type = CFG_DATA_STR,   .default_val.str = NULL,    .validate.str = NULL},
-    [CFG_WIFI_PASS] =           {.name = "wifi_sta_pass",       .type = CFG_DATA_STR,   .default_val.str = NULL,    .validate.str = NULL},
-    [CFG_WIFI_STA_MAX_RETRY] =  {.name = "wifi_sta_retry",      .type = CFG_DATA_U8,    .default_val.u8 = 5,        .validate.u8 = NULL},
-    [CFG_WIFI_SSID_AP] =        {.name = "wifi_ap_ssid",    .type = CFG_DATA_STR,   .default_val.str = NULL,    .validate.str = NULL},
-    [CFG_WIFI_PASS_AP] =        {.name = "wifi_ap_pass",    .type = CFG_DATA_STR,   .default_val.str = CFG_WIFI_AP_PASS_DEFAULT,    .validate.str = NULL},
-    [CFG_WIFI_AUTH_AP] =        {.name = "wifi_ap_auth",    .type = CFG_DATA_U8,    .default_val.u8 = 4,        .validate.u8 = cfg_adp_check_ap_auth},
-    [CFG_WIFI_MAX_CONN_AP] =    {.name = "wifi_ap_conn",    .type = CFG_DATA_U8,    .default_val.u8 = CFG_WIFI_AP_MAX_CONN_DEFAULT, .validate.u8 = NULL},
-    [CFG_WIFI_MODE] =           {.name = "wifi_mode",       .type = CFG_DATA_U8,    .default_val.u8 = 1,        .validate.u8 = NULL},
-
-    [CFG_UART_BAUD] =           {.name = "uart_baud_rate",  .type = CFG_DATA_U32,   .default_val.u32 = 9600,    .validate.u32 = cfg_adp_check_set_baudrate},
-    [CFG_UART_PARITY] =         {.name = "uart_parity",     .type = CFG_DATA_U8,    .default_val.u8 = 0,        .validate.u8 = cfg_adp_check_set_parity},
-    [CFG_UART_TX_DELAY] =       {.name = "uart_tx_delay",   .type = CFG_DATA_U32,   .default_val.u32 = 1,       .validate.u32 = cfg_adp_check_set_tx_delay},
-
-    [CFG_SW_1] =                {.name = "switch1",   .type = CFG_DATA_U8,   .default_val.u8 = 0,       .validate.u8 = NULL},
-    [CFG_SW_2] =                {.name = "switch2",   .type = CFG_DATA_U8,   .default_val.u8 = 0,       .validate.u8 = NULL},
-    [CFG_SW_3] =                {.name = "switch3",   .type = CFG_DATA_U8,   .default_val.u8 = 0,       .validate.u8 = NULL},
+#define CFG_MEMBER_STR str
+#define CFG_MEMBER_U8 u8
+#define CFG_MEMBER_U32 u32
+#define CFG_FIELD_DEF(id, field_name, field_type, default_value, validator) \
+    [id] = {.name = field_name, .type = CFG_DATA_##field_type, \
+            .default_val.CFG_MEMBER_##field_type = default_value, .validate.CFG_MEMBER_##field_type = validator},
 
+static config_def_t config_defs[CFG_IDT_MAX] = {
+    CFG_SCHEMA(CFG_FIELD_DEF)
 };
 
+_Static_assert(CFG_SCHEMA_HASH_FIELD_COUNT == CFG_IDT_MAX,
+               "configuration_schema_hash.h is stale, run tools/gen_cfg_hash.py");
+
+// Must match fnv_hash() in tools/gen_cfg_hash.py
+static uint32_t cfg_name_hash(uint32_t seed, const char* name) {
+    uint32_t h = 0x811c9dc5 ^ seed;
+    while (*name) {
+        h = (h ^ (uint8_t)*name++) * 0x01000193;
+    }
+    // Mix the high bits into the low ones, the table size is often a power of two.
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h;
+}
+
+// Set by cfg_adp_init() when the generated table does not match the schema.
+static bool s_cfg_hash_stale = false;
+
+// O(1) in the number of fields, see tools/gen_cfg_hash.py
 enum cfg_data_idt cfg_adp_id_from_name(const char* name) {
-    for (enum cfg_data_idt i = 0; i<CFG_IDT_MAX; i++) {
-        if (strcmp(name, config_defs[i].name) == 0) {
-            return i;
+    if (name == NULL)
+        return CFG_IDT_MAX;
+    if (s_cfg_hash_stale) {
+        for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX; id++) {
+            if (strcmp(name, config_defs[id].name) == 0)
+                return id;
         }
+        return CFG_IDT_MAX;
     }
 
-    return CFG_IDT_MAX;
+    int16_t disp = cfg_name_hash_disp[cfg_name_hash(0, name) % CFG_IDT_MAX];
+    uint32_t slot = (disp < 0) ? (uint32_t)(-disp - 1) : cfg_name_hash(disp, name) % CFG_IDT_MAX;
+    enum cfg_data_idt id = cfg_name_hash_ids[slot];
+
+    return (strcmp(name, config_defs[id].name) == 0) ? id : CFG_IDT_MAX;
 }
 
 char* cfg_adp_name_from_id(enum cfg_data_idt id) {
     return cfg_adp_is_valid_id(id) ? config_defs[id].name : NULL;
 }
 
+static void cfg_adp_load_default(enum cfg_data_idt id) {
+    config_def_t* cfg = &(config_defs[id]);
+    cfg_value_t* val = &(s_cfg_cache[id]);
+
+    switch (cfg->type) {
+    case CFG_DATA_STR:
+        if (cfg->default_val.str != NULL) {
+            strncpy(val->str, cfg->default_val.str, sizeof(val->str));
+            val->str[sizeof(val->str) - 1] = '\0';
+        } else {
+            val->str[0] = '\0';
+        }
+        break;
+    case CFG_DATA_U8:
+        val->u8 = cfg->default_val.u8;
+        break;
+    case CFG_DATA_U32:
+        val->u32 = cfg->default_val.u32;
+        break;
+    default:
+        break;
+    }
+}
+
+// Load one field from NVS into the cache, falling back to its default.
+static esp_err_t cfg_adp_load_field(nvs_handle cfg_nvss_handle, enum cfg_data_idt id) {
+    config_def_t* cfg = &(config_defs[id]);
+    cfg_value_t* val = &(s_cfg_cache[id]);
+    size_t param_len = sizeof(val->str);
+    esp_err_t err;
+
+    switch (cfg->type) {
+    case CFG_DATA_STR:
+        err = nvs_get_str(cfg_nvss_handle, cfg->name, val->str, &param_len);
+        break;
+    case CFG_DATA_U8:
+        err = nvs_get_u8(cfg_nvss_handle, cfg->name, &val->u8);
+        break;
+    case CFG_DATA_U32:
+        err = nvs_get_u32(cfg_nvss_handle, cfg->name, &val->u32);
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (err != ESP_OK)
+        cfg_adp_load_default(id);
+    return (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
+}
+
+static void cfg_adp_flush_expired(void* arg) {
+    cfg_adp_flush();
+}
+
+esp_err_t cfg_adp_init(void) {
+    nvs_handle cfg_nvss_handle;
+    esp_err_t err = ESP_OK;
+
+    s_cfg_lock = hal_lock_create();
+    s_cfg_flush_timer = hal_timer_create("cfg flush", CFG_FLUSH_DELAY_MS, false, cfg_adp_flush_expired, NULL);
+    if (s_cfg_lock == NULL || s_cfg_flush_timer == NULL)
+        return ESP_ERR_NO_MEM;
+    metrics_register(&s_cfg_commits);
+    metrics_register(&s_blob_commits);
+
+    // The build regenerates the table from the schema, a stale one only costs the O(1) lookup.
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX; id++) {
+        if (cfg_adp_id_from_name(config_defs[id].name) != id) {
+            ESP_LOGE(TAG, "configuration_schema_hash.h is stale, names are looked up linearly");
+            s_cfg_hash_stale = true;
+            break;
+        }
+    }
+
+    // A namespace which was never written cannot be opened read-only, every field is default then.
+    if (nvs_open(CFG_STORAGE_NAMESPACE, NVS_READONLY, &cfg_nvss_handle) != ESP_OK) {
+        for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX; id++)
+            cfg_adp_load_default(id);
+    } else {
+        for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX && err == ESP_OK; id++)
+            err = cfg_adp_load_field(cfg_nvss_handle, id);
+        nvs_close(cfg_nvss_handle);
+    }
+
+    s_cfg_dirty = 0;
+    return err;
+}
+
 esp_err_t cfg_adp_get_by_id(enum cfg_data_idt id, void* buf, size_t* maxlen) {
     if (!cfg_adp_is_valid_id(id))
         return ESP_ERR_NOT_SUPPORTED;
 
     config_def_t* cfg = &(config_defs[id]);
+    cfg_value_t* val = &(s_cfg_cache[id]);
     esp_err_t err = ESP_OK;
-    nvs_handle cfg_nvss_handle;
-    size_t param_len;
 
-    // Open
-    err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READWRITE, &cfg_nvss_handle);
-    if (err != ESP_OK)
-        goto err_ret;
+    if (!hal_lock_take(s_cfg_lock))
+        return ESP_FAIL;
 
     switch (cfg->type) {
     case CFG_DATA_STR:
-        param_len = *maxlen;
-        err = nvs_get_str(cfg_nvss_handle, cfg->name, (char*)buf, &param_len);
-        if (err == ESP_ERR_NVS_NOT_FOUND) {
-            if (cfg->default_val.str != NULL) {
-                strncpy(buf, cfg->default_val.str, *maxlen);
-            } else {
-                *((char*)buf) = '\0';
-            }
-            err = ESP_OK;
-        } else if (err != ESP_OK) {
-            goto err_ret;
+        if (strlen(val->str) + 1 > *maxlen) {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+            break;
         }
-        *maxlen = param_len;
+        strcpy((char*)buf, val->str);
+        *maxlen = strlen(val->str) + 1;
         break;
 
     case CFG_DATA_U8:
-        err = nvs_get_u8(cfg_nvss_handle, cfg->name, (uint8_t*) buf);
-        if (err == ESP_ERR_NVS_NOT_FOUND) {
-            *((uint8_t*)buf) = cfg->default_val.u8;
-            err = ESP_OK;
-        } else if (err != ESP_OK) {
-            goto err_ret;
-        }
+        *((uint8_t*)buf) = val->u8;
         break;
 
     case CFG_DATA_U32:
-        err = nvs_get_u32(cfg_nvss_handle, cfg->name, (uint32_t*) buf);
-        if (err == ESP_ERR_NVS_NOT_FOUND) {
-            *((uint32_t*)buf) = cfg->default_val.u32;
-            err = ESP_OK;
-        } else if (err != ESP_OK) {
-            goto err_ret;
-        }
+        *((uint32_t*)buf) = val->u32;
         break;
 
     default:
@@ -97,63 +213,173 @@ esp_err_t cfg_adp_get_by_id(enum cfg_data_idt id, void* buf, size_t* maxlen) {
         break;
     }
 
-err_ret:
-    // Close
-    nvs_close(cfg_nvss_handle);
+    hal_lock_give(s_cfg_lock);
     return err;
 }
 
-esp_err_t cfg_adp_set_by_id(enum cfg_data_idt id, const void* buf) {
-    if (!cfg_adp_is_valid_id(id))
+// Convert a cfg_adp_set_by_id() style argument into a typed value.
+static esp_err_t cfg_adp_value_from_buf(enum cfg_data_idt id, const void* buf, cfg_value_t* val) {
+    switch (config_defs[id].type) {
+    case CFG_DATA_STR:
+        if (strlen((const char*)buf) >= sizeof(val->str))
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        strcpy(val->str, (const char*)buf);
+        return ESP_OK;
+    case CFG_DATA_U8:
+        val->u8 = (uint8_t) ((uint32_t)buf);
+        return ESP_OK;
+    case CFG_DATA_U32:
+        val->u32 = (uint32_t)buf;
+        return ESP_OK;
+    default:
         return ESP_ERR_NOT_SUPPORTED;
+    }
+}
 
+static esp_err_t cfg_adp_validate_value(enum cfg_data_idt id, const cfg_value_t* val) {
     config_def_t* cfg = &(config_defs[id]);
-    nvs_handle cfg_nvss_handle;
-    esp_err_t err = ESP_OK;
-
-    // Open
-    err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READWRITE, &cfg_nvss_handle);
-    if (err != ESP_OK)
-        goto err_ret;
 
     switch (cfg->type) {
     case CFG_DATA_STR:
-        if (cfg->validate.str != NULL)
-            err = cfg->validate.str((const char*)buf);
-        if (err == ESP_OK)
-            err = nvs_set_str(cfg_nvss_handle, cfg->name, (const char*)buf);
-        break;
+        return (cfg->validate.str != NULL) ? cfg->validate.str(val->str) : ESP_OK;
     case CFG_DATA_U8:
-        if (cfg->validate.u8 != NULL)
-            err = cfg->validate.u8((uint8_t) ((uint32_t)buf));
-        if (err == ESP_OK)
-            err = nvs_set_u8(cfg_nvss_handle, cfg->name, (uint8_t) ((uint32_t)buf));
-        break;
+        return (cfg->validate.u8 != NULL) ? cfg->validate.u8(val->u8) : ESP_OK;
     case CFG_DATA_U32:
-        if (cfg->validate.u32 != NULL)
-            err = cfg->validate.u32((uint32_t)buf);
-        if (err == ESP_OK)
-            err = nvs_set_u32(cfg_nvss_handle, cfg->name, (uint32_t)buf);
-        break;
+        return (cfg->validate.u32 != NULL) ? cfg->validate.u32(val->u32) : ESP_OK;
     default:
-        err = ESP_ERR_NOT_SUPPORTED;
-        break;
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+// Validates and stores the value in the cache only, see cfg_adp_flush().
+esp_err_t cfg_adp_set_by_id(enum cfg_data_idt id, const void* buf) {
+    if (!cfg_adp_is_valid_id(id))
+        return ESP_ERR_NOT_SUPPORTED;
+
+    cfg_value_t val;
+    esp_err_t err = cfg_adp_value_from_buf(id, buf, &val);
+    if (err == ESP_OK)
+        err = cfg_adp_validate_value(id, &val);
+    if (err != ESP_OK)
+        return err;
+
+    if (!hal_lock_take(s_cfg_lock))
+        return ESP_FAIL;
+    s_cfg_cache[id] = val;
+    s_cfg_dirty |= CFG_DIRTY_BIT(id);
+    hal_lock_give(s_cfg_lock);
+
+    // Persist later, so that a burst of updates costs a single commit.
+    hal_timer_start(s_cfg_flush_timer);
+    return ESP_OK;
+}
+
+esp_err_t cfg_adp_subscribe(enum cfg_data_idt id, cfg_adp_subscriber_t subscriber, void* arg) {
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    if (!cfg_adp_is_valid_id(id) || subscriber == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (!hal_lock_take(s_cfg_lock))
+        return ESP_FAIL;
+
+    // The same subscriber and arg share one slot for all of their fields.
+    cfg_subscription_t* slot = NULL;
+    for (uint8_t i = 0; i < CFG_SUBSCRIBER_MAX; i++) {
+        cfg_subscription_t* sub = &s_cfg_subscriptions[i];
+        if (sub->subscriber == subscriber && sub->arg == arg) {
+            slot = sub;
+            break;
+        }
+        if (sub->subscriber == NULL && slot == NULL)
+            slot = sub;
+    }
+    if (slot != NULL) {
+        slot->subscriber = subscriber;
+        slot->arg = arg;
+        slot->ids |= CFG_DIRTY_BIT(id);
+        err = ESP_OK;
+    }
+
+    hal_lock_give(s_cfg_lock);
+    return err;
+}
+
+// Push each committed field to its subscribers, outside the lock so they may read the configuration.
+static void cfg_adp_notify(uint32_t committed) {
+    cfg_value_t val;
+
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX && committed != 0; id++) {
+        if (!(committed & CFG_DIRTY_BIT(id)))
+            continue;
+        committed &= ~CFG_DIRTY_BIT(id);
+
+        if (!hal_lock_take(s_cfg_lock))
+            return;
+        val = s_cfg_cache[id];
+        hal_lock_give(s_cfg_lock);
+
+        for (uint8_t i = 0; i < CFG_SUBSCRIBER_MAX; i++) {
+            cfg_subscription_t* sub = &s_cfg_subscriptions[i];
+            if (sub->subscriber != NULL && (sub->ids & CFG_DIRTY_BIT(id)))
+                sub->subscriber(id, &val, sub->arg);
+        }
     }
+}
+
+esp_err_t cfg_adp_flush(void) {
+    nvs_handle cfg_nvss_handle;
+    esp_err_t err = ESP_OK;
+    uint32_t committed = 0;
+
+    if (!hal_lock_take(s_cfg_lock))
+        return ESP_FAIL;
+
+    if (s_cfg_dirty == 0)
+        goto unlock_ret;
 
+    // Open
+    err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READWRITE, &cfg_nvss_handle);
     if (err != ESP_OK)
-        goto err_ret;
+        goto unlock_ret;
+
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX && err == ESP_OK; id++) {
+        if (!(s_cfg_dirty & CFG_DIRTY_BIT(id)))
+            continue;
+
+        config_def_t* cfg = &(config_defs[id]);
+        cfg_value_t* val = &(s_cfg_cache[id]);
+        switch (cfg->type) {
+        case CFG_DATA_STR:
+            err = nvs_set_str(cfg_nvss_handle, cfg->name, val->str);
+            break;
+        case CFG_DATA_U8:
+            err = nvs_set_u8(cfg_nvss_handle, cfg->name, val->u8);
+            break;
+        case CFG_DATA_U32:
+            err = nvs_set_u32(cfg_nvss_handle, cfg->name, val->u32);
+            break;
+        default:
+            break;
+        }
+    }
 
     // Commit written value.
     // After setting any values, nvs_commit() must be called to ensure changes are written
-    // to flash storage. Implementations may write to storage at other times,
-    // but this is not guaranteed.
-    err = nvs_commit(cfg_nvss_handle);
-    if (err != ESP_OK)
-        goto err_ret;
+    // to flash storage. All dirty fields share this single commit.
+    if (err == ESP_OK)
+        err = nvs_commit(cfg_nvss_handle);
+    if (err == ESP_OK) {
+        metric_inc(&s_cfg_commits);
+        committed = s_cfg_dirty;
+        s_cfg_dirty = 0;
+    }
 
-err_ret:
     // Close
     nvs_close(cfg_nvss_handle);
+
+unlock_ret:
+    hal_lock_give(s_cfg_lock);
+    cfg_adp_notify(committed);
     return err;
 }
 
@@ -182,6 +408,257 @@ esp_err_t cfg_adp_set_by_id_from_raw(enum cfg_data_idt id, const char* param) {
     return err;
 }
 
+cfg_adp_txn_handle_t cfg_adp_txn_begin(void) {
+    return calloc(1, sizeof(struct cfg_adp_txn));
+}
+
+// Only type and length are checked here, validators run on commit.
+esp_err_t cfg_adp_txn_stage(cfg_adp_txn_handle_t txn, enum cfg_data_idt id, const void* buf) {
+    if (txn == NULL || !cfg_adp_is_valid_id(id))
+        return ESP_ERR_NOT_SUPPORTED;
+
+    esp_err_t err = cfg_adp_value_from_buf(id, buf, &txn->values[id]);
+    if (err == ESP_OK)
+        txn->staged |= CFG_DIRTY_BIT(id);
+    return err;
+}
+
+esp_err_t cfg_adp_txn_stage_from_raw(cfg_adp_txn_handle_t txn, enum cfg_data_idt id, const char* param) {
+    if (!cfg_adp_is_valid_id(id))
+        return ESP_ERR_NOT_SUPPORTED;
+
+    switch (config_defs[id].type) {
+    case CFG_DATA_STR:
+        return cfg_adp_txn_stage(txn, id, param);
+    case CFG_DATA_U8:
+    case CFG_DATA_U32:
+        return cfg_adp_txn_stage(txn, id, (void*) atoi(param));
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+esp_err_t cfg_adp_txn_validate(cfg_adp_txn_handle_t txn) {
+    esp_err_t err = ESP_OK;
+
+    if (txn == NULL)
+        return ESP_ERR_INVALID_ARG;
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX && err == ESP_OK; id++) {
+        if (txn->staged & CFG_DIRTY_BIT(id))
+            err = cfg_adp_validate_value(id, &txn->values[id]);
+    }
+    return err;
+}
+
+esp_err_t cfg_adp_txn_commit(cfg_adp_txn_handle_t txn) {
+    esp_err_t err;
+    enum cfg_data_idt id;
+
+    if (txn == NULL)
+        return ESP_ERR_INVALID_ARG;
+
+    // Validate everything first, a single bad field leaves the configuration untouched.
+    err = cfg_adp_txn_validate(txn);
+    if (err != ESP_OK)
+        goto free_ret;
+
+    if (!hal_lock_take(s_cfg_lock)) {
+        err = ESP_FAIL;
+        goto free_ret;
+    }
+    // Swap staged and cached values, txn->values keeps the previous ones for a rollback.
+    for (id = 0; id < CFG_IDT_MAX; id++) {
+        if (txn->staged & CFG_DIRTY_BIT(id)) {
+            cfg_value_t prev = s_cfg_cache[id];
+            s_cfg_cache[id] = txn->values[id];
+            txn->values[id] = prev;
+        }
+    }
+    s_cfg_dirty |= txn->staged;
+    hal_lock_give(s_cfg_lock);
+
+    err = cfg_adp_flush();
+    if (err != ESP_OK && hal_lock_take(s_cfg_lock)) {
+        // The fields stay dirty, so the previous values are written back by the next flush.
+        for (id = 0; id < CFG_IDT_MAX; id++) {
+            if (txn->staged & CFG_DIRTY_BIT(id))
+                s_cfg_cache[id] = txn->values[id];
+        }
+        hal_lock_give(s_cfg_lock);
+        hal_timer_start(s_cfg_flush_timer);
+    }
+
+free_ret:
+    free(txn);
+    return err;
+}
+
+void cfg_adp_txn_rollback(cfg_adp_txn_handle_t txn) {
+    free(txn);
+}
+
+// CRC-32 (IEEE 802.3, as zlib.crc32), bitwise since a snapshot is only a few hundred bytes.
+static uint32_t cfg_snapshot_crc32(const uint8_t* buf, size_t len) {
+    uint32_t crc = 0xffffffff;
+    while (len--) {
+        crc ^= *buf++;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void cfg_snapshot_put_u16(uint8_t* buf, uint16_t val) {
+    buf[0] = val & 0xff;
+    buf[1] = val >> 8;
+}
+
+static void cfg_snapshot_put_u32(uint8_t* buf, uint32_t val) {
+    cfg_snapshot_put_u16(buf, val & 0xffff);
+    cfg_snapshot_put_u16(buf + 2, val >> 16);
+}
+
+static uint16_t cfg_snapshot_get_u16(const uint8_t* buf) {
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t cfg_snapshot_get_u32(const uint8_t* buf) {
+    return cfg_snapshot_get_u16(buf) | ((uint32_t)cfg_snapshot_get_u16(buf + 2) << 16);
+}
+
+/*
+ * Layout, little endian:
+ *   u32 magic, u8 version, u8 record count, u16 records length,
+ *   records: u8 name length, name, u8 type, u8 value length, value,
+ *   u32 CRC-32 of everything before it.
+ * Records are keyed by name, so a snapshot survives fields being added or reordered.
+ */
+esp_err_t cfg_adp_export_snapshot(uint8_t* buf, size_t maxlen, size_t* len) {
+    size_t pos = CFG_SNAPSHOT_HEADER_LEN;
+
+    if (buf == NULL || len == NULL || maxlen < CFG_SNAPSHOT_MAXLEN)
+        return ESP_ERR_INVALID_SIZE;
+    if (!hal_lock_take(s_cfg_lock))
+        return ESP_FAIL;
+
+    for (enum cfg_data_idt id = 0; id < CFG_IDT_MAX; id++) {
+        config_def_t* cfg = &(config_defs[id]);
+        cfg_value_t* val = &(s_cfg_cache[id]);
+        uint8_t name_len = strlen(cfg->name);
+
+        buf[pos++] = name_len;
+        memcpy(&buf[pos], cfg->name, name_len);
+        pos += name_len;
+        buf[pos++] = cfg->type;
+        switch (cfg->type) {
+        case CFG_DATA_STR:
+            buf[pos] = strlen(val->str);
+            memcpy(&buf[pos + 1], val->str, buf[pos]);
+            break;
+        case CFG_DATA_U8:
+            buf[pos] = sizeof(uint8_t);
+            buf[pos + 1] = val->u8;
+            break;
+        case CFG_DATA_U32:
+            buf[pos] = sizeof(uint32_t);
+            cfg_snapshot_put_u32(&buf[pos + 1], val->u32);
+            break;
+        default:
+            buf[pos] = 0;
+            break;
+        }
+        pos += 1 + buf[pos];
+    }
+    hal_lock_give(s_cfg_lock);
+
+    cfg_snapshot_put_u32(buf, CFG_SNAPSHOT_MAGIC);
+    buf[4] = CFG_SNAPSHOT_VERSION;
+    buf[5] = CFG_IDT_MAX;
+    cfg_snapshot_put_u16(&buf[6], pos - CFG_SNAPSHOT_HEADER_LEN);
+    cfg_snapshot_put_u32(&buf[pos], cfg_snapshot_crc32(buf, pos));
+    *len = pos + CFG_SNAPSHOT_CRC_LEN;
+    return ESP_OK;
+}
+
+esp_err_t cfg_adp_import_snapshot(const uint8_t* buf, size_t len) {
+    char name[CFG_NAME_MAXLEN + 1];
+    char str[CFG_STR_MAXLEN];
+    esp_err_t err = ESP_OK;
+
+    if (buf == NULL || len < CFG_SNAPSHOT_HEADER_LEN + CFG_SNAPSHOT_CRC_LEN)
+        return ESP_ERR_INVALID_SIZE;
+    if (cfg_snapshot_get_u32(buf) != CFG_SNAPSHOT_MAGIC || buf[4] != CFG_SNAPSHOT_VERSION)
+        return ESP_ERR_INVALID_VERSION;
+
+    size_t end = CFG_SNAPSHOT_HEADER_LEN + cfg_snapshot_get_u16(&buf[6]);
+    if (end + CFG_SNAPSHOT_CRC_LEN != len)
+        return ESP_ERR_INVALID_SIZE;
+    if (cfg_snapshot_get_u32(&buf[end]) != cfg_snapshot_crc32(buf, end))
+        return ESP_ERR_INVALID_CRC;
+
+    cfg_adp_txn_handle_t txn = cfg_adp_txn_begin();
+    if (txn == NULL)
+        return ESP_ERR_NO_MEM;
+
+    size_t pos = CFG_SNAPSHOT_HEADER_LEN;
+    for (uint8_t record = 0; record < buf[5] && err == ESP_OK; record++) {
+        // name length, type and value length must all fit before the end.
+        if (pos + 3 > end || buf[pos] > CFG_NAME_MAXLEN || pos + 3 + buf[pos] > end) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        uint8_t name_len = buf[pos++];
+        memcpy(name, &buf[pos], name_len);
+        name[name_len] = '\0';
+        pos += name_len;
+        enum cfg_data_type type = buf[pos++];
+        uint8_t val_len = buf[pos++];
+        const uint8_t* val = &buf[pos];
+        pos += val_len;
+        if (pos > end) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+
+        enum cfg_data_idt id = cfg_adp_id_from_name(name);
+        if (id == CFG_IDT_MAX)
+            continue;
+        if (type != config_defs[id].type) {
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+
+        switch (type) {
+        case CFG_DATA_STR:
+            if (val_len >= sizeof(str)) {
+                err = ESP_ERR_NVS_INVALID_LENGTH;
+                break;
+            }
+            memcpy(str, val, val_len);
+            str[val_len] = '\0';
+            err = cfg_adp_txn_stage(txn, id, str);
+            break;
+        case CFG_DATA_U8:
+            err = (val_len == sizeof(uint8_t)) ? cfg_adp_txn_stage(txn, id, (void*)(uint32_t)val[0]) : ESP_ERR_INVALID_SIZE;
+            break;
+        case CFG_DATA_U32:
+            err = (val_len == sizeof(uint32_t)) ? cfg_adp_txn_stage(txn, id, (void*)cfg_snapshot_get_u32(val)) : ESP_ERR_INVALID_SIZE;
+            break;
+        default:
+            err = ESP_ERR_NOT_SUPPORTED;
+            break;
+        }
+    }
+    if (err == ESP_OK && pos != end)
+        err = ESP_ERR_INVALID_SIZE;
+
+    if (err != ESP_OK) {
+        cfg_adp_txn_rollback(txn);
+        return err;
+    }
+    return cfg_adp_txn_commit(txn);
+}
+
 esp_err_t cfg_adp_get_by_id_to_readable(enum cfg_data_idt id, char* buf, size_t maxlen) {
     if (!cfg_adp_is_valid_id(id))
         return ESP_ERR_NOT_SUPPORTED;
@@ -206,6 +683,40 @@ esp_err_t cfg_adp_get_by_id_to_readable(enum cfg_data_idt id, char* buf, size_t
     return err;
 }
 
+esp_err_t cfg_adp_load_blob(const char* key, void* buf, size_t len) {
+    nvs_handle cfg_nvss_handle;
+    size_t blob_len = len;
+
+    esp_err_t err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READONLY, &cfg_nvss_handle);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_get_blob(cfg_nvss_handle, key, buf, &blob_len);
+    // A record written by a different firmware layout is ignored.
+    if (err == ESP_OK && blob_len != len)
+        err = ESP_ERR_INVALID_SIZE;
+
+    nvs_close(cfg_nvss_handle);
+    return err;
+}
+
+esp_err_t cfg_adp_store_blob(const char* key, const void* buf, size_t len) {
+    nvs_handle cfg_nvss_handle;
+
+    esp_err_t err = nvs_open(CFG_STORAGE_NAMESPACE, NVS_READWRITE, &cfg_nvss_handle);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(cfg_nvss_handle, key, buf, len);
+    if (err == ESP_OK)
+        err = nvs_commit(cfg_nvss_handle);
+    if (err == ESP_OK)
+        metric_inc(&s_blob_commits);
+
+    nvs_close(cfg_nvss_handle);
+    return err;
+}
+
 esp_err_t cfg_adp_check_set_baudrate(uint32_t baudrate) {
     if (baudrate >= 1200 && baudrate <= 921600) {
         // TODO: set modbus tcp slave baudrate
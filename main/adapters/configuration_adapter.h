@@ -7,10 +7,25 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 
+#include "configuration_schema.h"
+
 #define CFG_WIFI_AP_SSID_DEFAULT "Modbus Switch"
 #define CFG_WIFI_AP_PASS_DEFAULT "password"
 #define CFG_WIFI_AP_MAX_CONN_DEFAULT 3
 #define CFG_STORAGE_NAMESPACE "app_cfg"
+// longest string field including the terminator (the STA password).
+#define CFG_STR_MAXLEN 64
+// changed fields are committed together once no update arrived for this long.
+#define CFG_FLUSH_DELAY_MS 2000
+
+// Binary snapshot of every field, see tools/cfg_snapshot.py for the layout.
+#define CFG_SNAPSHOT_MAGIC 0x4643534d // "MSCF"
+#define CFG_SNAPSHOT_VERSION 1
+#define CFG_SNAPSHOT_HEADER_LEN 8
+#define CFG_SNAPSHOT_CRC_LEN 4
+#define CFG_NAME_MAXLEN 15
+// name length, name, type, value length, value (strings without terminator).
+#define CFG_SNAPSHOT_RECORD_MAXLEN (3 + CFG_NAME_MAXLEN + CFG_STR_MAXLEN - 1)
 
 enum cfg_data_type {
     CFG_DATA_UNKNOWN = 0,
@@ -19,26 +34,24 @@ enum cfg_data_type {
     CFG_DATA_U32 = 3
 };
 
-enum cfg_data_idt {
-    CFG_WIFI_SSID,
-    CFG_WIFI_PASS,
-    CFG_WIFI_STA_MAX_RETRY,
-    CFG_WIFI_SSID_AP,
-    CFG_WIFI_PASS_AP,
-    CFG_WIFI_AUTH_AP,
-    CFG_WIFI_MAX_CONN_AP,
-    CFG_WIFI_MODE,
-
-    CFG_UART_BAUD,
-    CFG_UART_PARITY,
-    CFG_UART_TX_DELAY,
+#define CFG_FIELD_ID(id, name, type, default_val, validator) id,
 
-    CFG_SW_1,
-    CFG_SW_2,
-    CFG_SW_3,
+enum cfg_data_idt {
+    CFG_SCHEMA(CFG_FIELD_ID)
     CFG_IDT_MAX
 };
 
+typedef union cfg_value {
+    char str[CFG_STR_MAXLEN];
+    uint8_t u8;
+    uint32_t u32;
+} cfg_value_t;
+
+// Called with the committed value of every subscribed field, in the context
+// of whoever flushed (the flush timer task or an HTTP handler), keep it short.
+typedef void (*cfg_adp_subscriber_t)(enum cfg_data_idt id, const cfg_value_t* val, void* arg);
+#define CFG_SUBSCRIBER_MAX 8
+
 typedef esp_err_t (*validater_str_t)(const char*);
 typedef esp_err_t (*validater_u8_t)(uint8_t);
 typedef esp_err_t (*validater_u32_t)(uint32_t);
@@ -59,12 +72,36 @@ typedef struct config_def {
 } config_def_t;
 
 #define cfg_adp_is_valid_id(id) (id >= 0 && id < CFG_IDT_MAX)
+// Load every field into RAM, must be called once after nvs_flash_init().
+esp_err_t cfg_adp_init(void);
+// Write every changed field to NVS in a single commit.
+esp_err_t cfg_adp_flush(void);
+// Get the value of id pushed each time it is committed, instead of polling it.
+esp_err_t cfg_adp_subscribe(enum cfg_data_idt id, cfg_adp_subscriber_t subscriber, void* arg);
 enum cfg_data_idt cfg_adp_id_from_name(const char* name);
 char* cfg_adp_name_from_id(enum cfg_data_idt id);
 esp_err_t cfg_adp_get_by_id(enum cfg_data_idt id, void* buf, size_t* maxlen);
 esp_err_t cfg_adp_set_by_id(enum cfg_data_idt id, const void* buf);
 esp_err_t cfg_adp_set_by_id_from_raw(enum cfg_data_idt id, const char* param);
 esp_err_t cfg_adp_get_by_id_to_readable(enum cfg_data_idt id, char* buf, size_t maxlen);
+// Transactions: stage any number of fields, then validate and commit them all
+// at once in a single NVS commit, or drop them. Both commit and rollback free txn.
+typedef struct cfg_adp_txn* cfg_adp_txn_handle_t;
+cfg_adp_txn_handle_t cfg_adp_txn_begin(void);
+esp_err_t cfg_adp_txn_stage(cfg_adp_txn_handle_t txn, enum cfg_data_idt id, const void* buf);
+esp_err_t cfg_adp_txn_stage_from_raw(cfg_adp_txn_handle_t txn, enum cfg_data_idt id, const char* param);
+// Run the validators of the staged fields without committing, commit runs them again.
+esp_err_t cfg_adp_txn_validate(cfg_adp_txn_handle_t txn);
+esp_err_t cfg_adp_txn_commit(cfg_adp_txn_handle_t txn);
+void cfg_adp_txn_rollback(cfg_adp_txn_handle_t txn);
+// Serialize the cached configuration into buf, *len receives the snapshot size.
+esp_err_t cfg_adp_export_snapshot(uint8_t* buf, size_t maxlen, size_t* len);
+// Verify and apply a snapshot as one transaction, fields unknown to this firmware are skipped.
+esp_err_t cfg_adp_import_snapshot(const uint8_t* buf, size_t len);
+#define CFG_SNAPSHOT_MAXLEN (CFG_SNAPSHOT_HEADER_LEN + CFG_IDT_MAX * CFG_SNAPSHOT_RECORD_MAXLEN + CFG_SNAPSHOT_CRC_LEN)
+// raw records kept beside the configuration fields, e.g. runtime statistics.
+esp_err_t cfg_adp_load_blob(const char* key, void* buf, size_t len);
+esp_err_t cfg_adp_store_blob(const char* key, const void* buf, size_t len);
 #define cfg_adp_get_u8_by_id(id, out_addr) (cfg_adp_get_by_id(id, (void*)(out_addr), NULL))
 #define cfg_adp_set_u8_by_id(id, out_addr) (cfg_adp_set_by_id(id, (void*)((uint8_t)out_addr)))
 #define cfg_adp_get_u32_by_id(id, out_addr) (cfg_adp_get_by_id(id, (void*)(out_addr), NULL))
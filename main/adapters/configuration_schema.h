@@ -0,0 +1,36 @@
+/*
+ * configuration_schema.h
+ *
+ * The single declaration of every configuration field:
+ *   CFG_FIELD(id, name, type, default value, validator)
+ * name is also the NVS key (15 chars at most), type is STR, U8 or U32.
+ *
+ * tools/gen_cfg_hash.py reads this list and generates the name lookup table in
+ * configuration_schema_hash.h, the build reruns it whenever this file changes.
+ */
+
+#ifndef MAIN_CONFIGURATION_SCHEMA_H_
+#define MAIN_CONFIGURATION_SCHEMA_H_
+
+#define CFG_SCHEMA(CFG_FIELD) \
+    CFG_FIELD(CFG_WIFI_SSID,            "wifi_sta_ssid",    STR,    NULL,                           NULL) \
+    CFG_FIELD(CFG_WIFI_PASS,            "wifi_sta_pass",    STR,    NULL,                           NULL) \
+    CFG_FIELD(CFG_WIFI_STA_MAX_RETRY,   "wifi_sta_retry",   U8,     5,                              NULL) \
+    CFG_FIELD(CFG_WIFI_SSID_AP,         "wifi_ap_ssid",     STR,    NULL,                           NULL) \
+    CFG_FIELD(CFG_WIFI_PASS_AP,         "wifi_ap_pass",     STR,    CFG_WIFI_AP_PASS_DEFAULT,       NULL) \
+    CFG_FIELD(CFG_WIFI_AUTH_AP,         "wifi_ap_auth",     U8,     4,                              cfg_adp_check_ap_auth) \
+    CFG_FIELD(CFG_WIFI_MAX_CONN_AP,     "wifi_ap_conn",     U8,     CFG_WIFI_AP_MAX_CONN_DEFAULT,   NULL) \
+    CFG_FIELD(CFG_WIFI_MODE,            "wifi_mode",        U8,     1,                              NULL) \
+                                                                                                          \
+    CFG_FIELD(CFG_UART_BAUD,            "uart_baud_rate",   U32,    9600,                           cfg_adp_check_set_baudrate) \
+    CFG_FIELD(CFG_UART_PARITY,          "uart_parity",      U8,     0,                              cfg_adp_check_set_parity) \
+    CFG_FIELD(CFG_UART_TX_DELAY,        "uart_tx_delay",    U32,    1,                              cfg_adp_check_set_tx_delay) \
+                                                                                                          \
+    CFG_FIELD(CFG_SW_1,                 "switch1",          U8,     0,                              NULL) \
+    CFG_FIELD(CFG_SW_2,                 "switch2",          U8,     0,                              NULL) \
+    CFG_FIELD(CFG_SW_3,                 "switch3",          U8,     0,                              NULL) \
+                                                                                                          \
+    CFG_FIELD(CFG_OTA_URL,              "ota_url",          STR,    NULL,                           NULL) \
+    CFG_FIELD(CFG_OTA_INTERVAL,         "ota_interval",     U32,    60,                             NULL)
+
+#endif /* MAIN_CONFIGURATION_SCHEMA_H_ */
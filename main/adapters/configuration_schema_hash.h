@@ -0,0 +1,43 @@
+// Generated by tools/gen_cfg_hash.py from configuration_schema.h, do not edit.
+#pragma once
+
+#define CFG_SCHEMA_HASH_FIELD_COUNT 16
+
+// Indexed by cfg_name_hash(0, name) % count: seed of the second hash, or -(slot + 1).
+static const int16_t cfg_name_hash_disp[CFG_SCHEMA_HASH_FIELD_COUNT] = {
+    0,
+    7,
+    3,
+    -15,
+    1,
+    0,
+    -12,
+    0,
+    0,
+    -11,
+    0,
+    0,
+    -10,
+    -6,
+    -5,
+    -3,
+};
+
+static const uint8_t cfg_name_hash_ids[CFG_SCHEMA_HASH_FIELD_COUNT] = {
+    CFG_SW_1,               // "switch1"
+    CFG_SW_2,               // "switch2"
+    CFG_WIFI_PASS,          // "wifi_sta_pass"
+    CFG_SW_3,               // "switch3"
+    CFG_WIFI_PASS_AP,       // "wifi_ap_pass"
+    CFG_OTA_INTERVAL,       // "ota_interval"
+    CFG_WIFI_MAX_CONN_AP,   // "wifi_ap_conn"
+    CFG_WIFI_MODE,          // "wifi_mode"
+    CFG_UART_PARITY,        // "uart_parity"
+    CFG_WIFI_SSID_AP,       // "wifi_ap_ssid"
+    CFG_UART_BAUD,          // "uart_baud_rate"
+    CFG_WIFI_SSID,          // "wifi_sta_ssid"
+    CFG_WIFI_AUTH_AP,       // "wifi_ap_auth"
+    CFG_UART_TX_DELAY,      // "uart_tx_delay"
+    CFG_OTA_URL,            // "ota_url"
+    CFG_WIFI_STA_MAX_RETRY, // "wifi_sta_retry"
+};
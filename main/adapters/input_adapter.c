@@ -0,0 +1,88 @@
+#include <stdio.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+#include "board_hal.h"
+#include "input_adapter.h"
+
+static input_context_t in_context[IN_MAX] = {
+  [IN1] = {.in_gpio_pin = IN_1_GPIO_PIN},
+  [IN2] = {.in_gpio_pin = IN_2_GPIO_PIN},
+  [IN3] = {.in_gpio_pin = IN_3_GPIO_PIN}
+};
+
+// Only the timer task writes it, with a single byte store, so readers never need a lock.
+static volatile uint8_t s_in_states = 0;
+static input_update_callback_t s_state_update_callback = NULL;
+
+// Every edge restarts the debounce timer of its input, the state is only sampled
+// once the contact stayed quiet for IN_DEBOUNCE_MS. Nothing runs while inputs are idle.
+static void IRAM_ATTR input_edge_isr(void* arg)
+{
+  hal_timer_reset_from_isr(in_context[(uintptr_t) arg].in_debounce_timer);
+}
+
+static void input_debounce_expired(void* arg)
+{
+  uintptr_t in_index = (uintptr_t) arg;
+  uint8_t status = IN_GET_STATUS(hal_gpio_get_level(in_context[in_index].in_gpio_pin));
+  uint8_t states = (s_in_states & ~(1U << in_index)) | (status << in_index);
+
+  // bounces which ended at the previous level are not published.
+  if (states == s_in_states)
+    return;
+
+  s_in_states = states;
+  if (NULL != s_state_update_callback)
+  {
+    s_state_update_callback(states);
+  }
+}
+
+esp_err_t input_adapter_init()
+{
+  static const char* in_timer_name[IN_MAX] = {"IN1 Timer", "IN2 Timer", "IN3 Timer"};
+  uint8_t states = 0;
+  esp_err_t err;
+
+  err = hal_gpio_input_init(IN_PIN_SEL, true);
+  if (ESP_OK != err)
+    return err;
+
+  for (uintptr_t in_index = IN1; in_index < IN_MAX; in_index++)
+  {
+    input_context_t* in_ctx = &in_context[in_index];
+    in_ctx->in_debounce_timer = hal_timer_create(in_timer_name[in_index],
+                                                 IN_DEBOUNCE_MS,
+                                                 false,
+                                                 input_debounce_expired,
+                                                 (void *)in_index);
+    if (NULL == in_ctx->in_debounce_timer)
+      return ESP_ERR_NO_MEM;
+
+    states |= IN_GET_STATUS(hal_gpio_get_level(in_ctx->in_gpio_pin)) << in_index;
+  }
+  s_in_states = states;
+
+  for (uintptr_t in_index = IN1; in_index < IN_MAX; in_index++)
+  {
+    err = hal_gpio_set_edge_isr(in_context[in_index].in_gpio_pin, input_edge_isr, (void *)in_index);
+    if (ESP_OK != err)
+      return err;
+  }
+  return ESP_OK;
+}
+
+uint8_t input_adapter_get_states()
+{
+  return s_in_states;
+}
+
+void input_adapter_set_state_update_callback(input_update_callback_t state_update_callback)
+{
+  s_state_update_callback = state_update_callback;
+}
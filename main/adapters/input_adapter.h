@@ -0,0 +1,35 @@
+#pragma once
+#include "esp_err.h"
+
+#include "board_hal.h"
+
+#define IN_1_GPIO_PIN 4
+#define IN_2_GPIO_PIN 5
+#define IN_3_GPIO_PIN 14
+
+#define IN_PIN_SEL ((1UL<<IN_1_GPIO_PIN) | (1UL<<IN_2_GPIO_PIN) | (1UL<<IN_3_GPIO_PIN))
+
+// contacts must be stable this long before a change is published.
+#define IN_DEBOUNCE_MS 20
+
+// HW inputs are pulled up, a closed contact reads low level.
+#define IN_GET_STATUS(level) (!(level))
+
+enum input_index {
+  IN1 = 0,
+  IN2,
+  IN3,
+  IN_MAX
+};
+
+// states holds one bit per input, bit n is input n.
+typedef void (*input_update_callback_t)(uint8_t states);
+
+typedef struct input_context {
+  uint8_t in_gpio_pin;
+  hal_timer_handle_t in_debounce_timer;
+} input_context_t;
+
+esp_err_t input_adapter_init();
+uint8_t input_adapter_get_states();
+void input_adapter_set_state_update_callback(input_update_callback_t state_update_callback);
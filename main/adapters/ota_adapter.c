@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "board_hal.h"
+#include "ota_adapter.h"
+#include "metrics.h"
+
+#define TAG "OTA"
+#define OTA_ADP_NO_BUF 0xff
+
+typedef struct ota_adp_chunk {
+    uint8_t index;
+    uint16_t len; // 0 stops the writer
+} ota_adp_chunk_t;
+
+struct ota_adp_writer {
+    const esp_partition_t* partition;
+    size_t image_size;
+    esp_ota_handle_t handle;
+    bool begun;
+    volatile esp_err_t err; // first error of the writer, or of the producer for an abort
+    uint8_t* bufs[OTA_ADP_BUF_COUNT];
+    QueueHandle_t filled;   // ota_adp_chunk_t, to the writer
+    QueueHandle_t free;     // buffer indices, back to the producer
+    SemaphoreHandle_t done;
+    // producer side
+    uint8_t cur;
+    size_t cur_len;
+    uint32_t bytes;
+    uint64_t start_us;
+    uint64_t stall_us;
+    bool check_sha;
+    uint8_t expected_sha[OTA_ADP_SHA256_LEN];
+    // writer side
+    uint64_t flash_busy_us;
+    mbedtls_sha256_context sha; // of the buffers written so far
+};
+
+static volatile bool s_ota_busy = false;
+// only updated by ota_adp_end(), one update runs at a time.
+static metric_t s_ota_bytes = METRIC_COUNTER_INIT("ota_written_bytes_total",
+                                                  "Bytes written to the passive OTA partition.", NULL);
+static metric_t s_ota_flash_busy = METRIC_COUNTER_INIT("ota_flash_busy_ms_total",
+                                                       "Time the OTA writer spent erasing and programming flash.", NULL);
+static metric_t s_ota_stall = METRIC_COUNTER_INIT("ota_buffer_stall_ms_total",
+                                                  "Time an OTA producer waited for a free buffer.", NULL);
+static metric_t s_ota_throughput = METRIC_GAUGE_INIT("ota_last_throughput_bytes_per_second",
+                                                     "Throughput of the last OTA update.", NULL, NULL);
+
+void ota_adp_init(void) {
+    metrics_register(&s_ota_bytes);
+    metrics_register(&s_ota_flash_busy);
+    metrics_register(&s_ota_stall);
+    metrics_register(&s_ota_throughput);
+}
+
+static void ota_adp_writer_task(void* arg) {
+    ota_adp_writer_handle_t writer = (ota_adp_writer_handle_t) arg;
+    ota_adp_chunk_t chunk;
+    uint64_t t = hal_time_us();
+
+    // The erase runs here too, the first buffers are received meanwhile.
+    esp_err_t err = esp_ota_begin(writer->partition, writer->image_size, &writer->handle);
+    writer->flash_busy_us += hal_time_us() - t;
+    if (err == ESP_OK) {
+        writer->begun = true;
+    } else {
+        ESP_LOGE(TAG, "esp_ota_begin failed, err=0x%x", err);
+        writer->err = err;
+    }
+
+    for (;;) {
+        xQueueReceive(writer->filled, &chunk, portMAX_DELAY);
+        if (chunk.len == 0)
+            break;
+
+        // After an error the buffers still circulate, so that the producer never blocks.
+        if (writer->err == ESP_OK) {
+            t = hal_time_us();
+            err = esp_ota_write(writer->handle, writer->bufs[chunk.index], chunk.len);
+            writer->flash_busy_us += hal_time_us() - t;
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "esp_ota_write failed, err=0x%x", err);
+                writer->err = err;
+            }
+            // While the buffer is still in RAM, the producer fills the other one meanwhile.
+            mbedtls_sha256_update_ret(&writer->sha, writer->bufs[chunk.index], chunk.len);
+        }
+        xQueueSend(writer->free, &chunk.index, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(writer->done);
+    vTaskDelete(NULL);
+}
+
+static void ota_adp_free(ota_adp_writer_handle_t writer) {
+    for (uint8_t i = 0; i < OTA_ADP_BUF_COUNT; i++) {
+        free(writer->bufs[i]);
+    }
+    if (writer->filled != NULL)
+        vQueueDelete(writer->filled);
+    if (writer->free != NULL)
+        vQueueDelete(writer->free);
+    if (writer->done != NULL)
+        vSemaphoreDelete(writer->done);
+    mbedtls_sha256_free(&writer->sha);
+    free(writer);
+    s_ota_busy = false;
+}
+
+esp_err_t ota_adp_begin(const esp_partition_t* partition, size_t image_size, ota_adp_writer_handle_t* writer) {
+    ota_adp_writer_handle_t w;
+    bool busy;
+
+    hal_critical_enter();
+    busy = s_ota_busy;
+    s_ota_busy = true;
+    hal_critical_exit();
+    if (busy)
+        return ESP_ERR_INVALID_STATE;
+
+    w = (ota_adp_writer_handle_t) calloc(1, sizeof(struct ota_adp_writer));
+    if (w == NULL) {
+        s_ota_busy = false;
+        return ESP_ERR_NO_MEM;
+    }
+    w->partition = partition;
+    w->image_size = image_size;
+    w->cur = OTA_ADP_NO_BUF;
+    mbedtls_sha256_init(&w->sha);
+    mbedtls_sha256_starts_ret(&w->sha, 0);
+    w->filled = xQueueCreate(OTA_ADP_BUF_COUNT + 1, sizeof(ota_adp_chunk_t));
+    w->free = xQueueCreate(OTA_ADP_BUF_COUNT, sizeof(uint8_t));
+    w->done = xSemaphoreCreateBinary();
+    if (w->filled == NULL || w->free == NULL || w->done == NULL)
+        goto no_mem;
+
+    for (uint8_t i = 0; i < OTA_ADP_BUF_COUNT; i++) {
+        w->bufs[i] = (uint8_t*) malloc(OTA_ADP_BUF_SIZE);
+        if (w->bufs[i] == NULL)
+            goto no_mem;
+        xQueueSend(w->free, &i, 0);
+    }
+
+    w->start_us = hal_time_us();
+    if (xTaskCreate(ota_adp_writer_task, "ota_writer", OTA_ADP_WRITER_STACK, w, OTA_ADP_WRITER_PRIO, NULL) != pdPASS)
+        goto no_mem;
+
+    *writer = w;
+    return ESP_OK;
+
+no_mem:
+    ota_adp_free(w);
+    return ESP_ERR_NO_MEM;
+}
+
+static void ota_adp_queue_cur(ota_adp_writer_handle_t writer) {
+    ota_adp_chunk_t chunk = {
+        .index = writer->cur,
+        .len = writer->cur_len
+    };
+
+    xQueueSend(writer->filled, &chunk, portMAX_DELAY);
+    writer->cur = OTA_ADP_NO_BUF;
+}
+
+uint8_t* ota_adp_get_buf(ota_adp_writer_handle_t writer, size_t* space) {
+    if (writer->cur == OTA_ADP_NO_BUF) {
+        uint64_t t = hal_time_us();
+        xQueueReceive(writer->free, &writer->cur, portMAX_DELAY);
+        writer->stall_us += hal_time_us() - t;
+        writer->cur_len = 0;
+    }
+
+    *space = OTA_ADP_BUF_SIZE - writer->cur_len;
+    return writer->bufs[writer->cur] + writer->cur_len;
+}
+
+esp_err_t ota_adp_put(ota_adp_writer_handle_t writer, size_t len) {
+    writer->cur_len += len;
+    writer->bytes += len;
+    if (writer->cur_len == OTA_ADP_BUF_SIZE)
+        ota_adp_queue_cur(writer);
+    return writer->err;
+}
+
+esp_err_t ota_adp_write(ota_adp_writer_handle_t writer, const void* data, size_t len) {
+    const uint8_t* src = (const uint8_t*) data;
+    esp_err_t err = writer->err;
+
+    while (len > 0 && err == ESP_OK) {
+        size_t space;
+        uint8_t* buf = ota_adp_get_buf(writer, &space);
+        size_t n = (len < space) ? len : space;
+        memcpy(buf, src, n);
+        src += n;
+        len -= n;
+        err = ota_adp_put(writer, n);
+    }
+    return err;
+}
+
+void ota_adp_expect_sha256(ota_adp_writer_handle_t writer, const uint8_t digest[OTA_ADP_SHA256_LEN]) {
+    memcpy(writer->expected_sha, digest, OTA_ADP_SHA256_LEN);
+    writer->check_sha = true;
+}
+
+esp_err_t ota_adp_end(ota_adp_writer_handle_t writer, ota_adp_stats_t* stats) {
+    ota_adp_chunk_t stop = {
+        .index = OTA_ADP_NO_BUF,
+        .len = 0
+    };
+
+    if (writer->cur != OTA_ADP_NO_BUF && writer->cur_len > 0)
+        ota_adp_queue_cur(writer);
+    xQueueSend(writer->filled, &stop, portMAX_DELAY);
+    xSemaphoreTake(writer->done, portMAX_DELAY);
+
+    ota_adp_stats_t s = {
+        .bytes = writer->bytes,
+        .elapsed_ms = (hal_time_us() - writer->start_us) / 1000,
+        .flash_busy_ms = writer->flash_busy_us / 1000,
+        .stall_ms = writer->stall_us / 1000
+    };
+    mbedtls_sha256_finish_ret(&writer->sha, s.sha256);
+    ESP_LOGI(TAG, "%u bytes in %u ms, flash busy %u ms, producer stalled %u ms",
+             (unsigned) s.bytes, (unsigned) s.elapsed_ms, (unsigned) s.flash_busy_ms, (unsigned) s.stall_ms);
+    metric_add(&s_ota_bytes, s.bytes);
+    metric_add(&s_ota_flash_busy, s.flash_busy_ms);
+    metric_add(&s_ota_stall, s.stall_ms);
+    if (s.elapsed_ms > 0)
+        metric_set(&s_ota_throughput, (uint64_t) s.bytes * 1000 / s.elapsed_ms);
+    if (stats != NULL)
+        *stats = s;
+
+    esp_err_t err = writer->err;
+    if (err == ESP_OK && writer->check_sha && memcmp(s.sha256, writer->expected_sha, OTA_ADP_SHA256_LEN) != 0) {
+        ESP_LOGE(TAG, "SHA-256 of the image does not match");
+        err = ESP_ERR_INVALID_CRC;
+    }
+    // esp_ota_end() also releases the handle of a failed update.
+    if (writer->begun) {
+        esp_err_t end_err = esp_ota_end(writer->handle);
+        if (err == ESP_OK)
+            err = end_err;
+    }
+    ota_adp_free(writer);
+    return err;
+}
+
+void ota_adp_abort(ota_adp_writer_handle_t writer) {
+    // Stops further writes, the buffers already queued are skipped.
+    if (writer->err == ESP_OK)
+        writer->err = ESP_ERR_INVALID_STATE;
+    ota_adp_end(writer, NULL);
+}
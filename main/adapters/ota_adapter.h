@@ -0,0 +1,57 @@
+/*
+ * ota_adapter.h
+ *
+ * Streams a firmware image into the passive OTA partition. The producer (e.g. the
+ * /fota handler) fills one buffer while a flash writer task erases and programs the
+ * other, so the network is drained while the flash is busy.
+ * A buffer is one flash sector, every esp_ota_write() covers exactly one sector.
+ * The writer also hashes each buffer it programmed, so the image can be checked against
+ * a known SHA-256 without reading the partition back.
+ */
+
+#ifndef MAIN_OTA_ADAPTER_H_
+#define MAIN_OTA_ADAPTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+
+#define OTA_ADP_BUF_SIZE     4096 // SPI_FLASH_SEC_SIZE
+#define OTA_ADP_BUF_COUNT    2
+#define OTA_ADP_WRITER_STACK 2048
+// Below the producer, which refills a buffer whenever data arrived.
+#define OTA_ADP_WRITER_PRIO  4
+#define OTA_ADP_SHA256_LEN   32
+
+typedef struct ota_adp_stats {
+    uint32_t bytes;
+    uint32_t elapsed_ms;
+    uint32_t flash_busy_ms; // the writer in esp_ota_begin() and esp_ota_write()
+    uint32_t stall_ms;      // the producer waiting for a free buffer
+    uint8_t sha256[OTA_ADP_SHA256_LEN]; // of the image as written
+} ota_adp_stats_t;
+
+typedef struct ota_adp_writer* ota_adp_writer_handle_t;
+
+// Register the OTA metrics, once at start up.
+void ota_adp_init(void);
+// Start an update of partition, image_size (OTA_SIZE_UNKNOWN if not known) bounds the erase.
+// ESP_ERR_INVALID_STATE while another update is in progress.
+esp_err_t ota_adp_begin(const esp_partition_t* partition, size_t image_size, ota_adp_writer_handle_t* writer);
+// The free space of the current buffer, blocks until the writer hands one back.
+uint8_t* ota_adp_get_buf(ota_adp_writer_handle_t writer, size_t* space);
+// len bytes were stored at ota_adp_get_buf(), returns the first write error so far.
+esp_err_t ota_adp_put(ota_adp_writer_handle_t writer, size_t len);
+// ota_adp_get_buf() and ota_adp_put() for data the caller already holds.
+esp_err_t ota_adp_write(ota_adp_writer_handle_t writer, const void* data, size_t len);
+// The image must hash to digest, checked by ota_adp_end() before esp_ota_end().
+void ota_adp_expect_sha256(ota_adp_writer_handle_t writer, const uint8_t digest[OTA_ADP_SHA256_LEN]);
+// Write the rest, stop the writer and validate the image with esp_ota_end().
+// ESP_ERR_INVALID_CRC if an expected SHA-256 does not match. writer is freed either way, stats may be NULL.
+esp_err_t ota_adp_end(ota_adp_writer_handle_t writer, ota_adp_stats_t* stats);
+// Drop an incomplete update, writer is freed.
+void ota_adp_abort(ota_adp_writer_handle_t writer);
+
+#endif /* MAIN_OTA_ADAPTER_H_ */
@@ -0,0 +1,333 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "board_hal.h"
+#include "configuration_adapter.h"
+#include "json_stream.h"
+#include "metrics.h"
+#include "ota_client.h"
+#include "ota_fetch.h"
+#include "ota_manifest.h"
+#include "ota_selftest.h"
+#include "wifi_handler.h"
+
+#define TAG "OTA client"
+#define OTA_CLIENT_REPORT_MAXLEN    192
+#define OTA_CLIENT_RESTART_DELAY_MS 1000
+// ota_interval above this is taken as this, a week.
+#define OTA_CLIENT_PERIOD_MAX_MIN   (7 * 24 * 60)
+#define OTA_CLIENT_SLEEP_FOREVER    UINT32_MAX
+
+typedef struct ota_client_buf {
+    char* data;
+    size_t len;
+    size_t max;
+} ota_client_buf_t;
+
+static const char* const ota_client_state_strs[] = {
+    "disabled", "idle", "checking", "waiting", "downloading", "installed", "failed"
+};
+
+static hal_lock_handle_t s_lock;  // s_status and s_next_us, read by the httpd task
+static ota_client_status_t s_status;
+static uint64_t s_next_us;
+static SemaphoreHandle_t s_wake;
+static volatile bool s_check_now = false;
+// only used by the client task
+static char s_report_url[OTA_CLIENT_URL_MAXLEN];
+static bool s_boot_reported = false;
+
+static uint32_t ota_client_read_state(void) {
+    return s_status.state;
+}
+
+static metric_t s_checks = METRIC_COUNTER_INIT("ota_client_checks_total",
+                                               "Manifest checks of the OTA client.", NULL);
+static metric_t s_failures = METRIC_COUNTER_INIT("ota_client_failures_total",
+                                                 "Failed checks and downloads of the OTA client.", NULL);
+static metric_t s_state = METRIC_GAUGE_INIT("ota_client_state",
+                                            "enum ota_client_state of the OTA client.", NULL, ota_client_read_state);
+
+const char* ota_client_state_str(uint8_t state) {
+    return (state <= OTA_CLIENT_FAILED) ? ota_client_state_strs[state] : "unknown";
+}
+
+void ota_client_get_status(ota_client_status_t* status) {
+    uint64_t now = hal_time_us();
+
+    memset(status, 0, sizeof(*status));
+    if (!hal_lock_take(s_lock))
+        return;
+    *status = s_status;
+    status->next_s = (s_next_us > now) ? (s_next_us - now) / 1000000 : 0;
+    hal_lock_give(s_lock);
+}
+
+static void ota_client_set_state(uint8_t state, esp_err_t err) {
+    if (!hal_lock_take(s_lock))
+        return;
+    s_status.state = state;
+    s_status.last_err = err;
+    hal_lock_give(s_lock);
+}
+
+static void ota_client_set_progress(size_t offset, size_t total) {
+    if (!hal_lock_take(s_lock))
+        return;
+    s_status.offset = offset;
+    s_status.total = total;
+    hal_lock_give(s_lock);
+}
+
+void ota_client_check_now(void) {
+    s_check_now = true;
+    xSemaphoreGive(s_wake);
+}
+
+static void ota_client_cfg_updated(enum cfg_data_idt id, const cfg_value_t* val, void* arg) {
+    // The task rereads both fields.
+    xSemaphoreGive(s_wake);
+}
+
+// Wait seconds, or until woken. Returns true if ota_client_check_now() woke it.
+static bool ota_client_sleep(uint32_t seconds) {
+    TickType_t ticks = portMAX_DELAY;
+
+    if (seconds != OTA_CLIENT_SLEEP_FOREVER)
+        ticks = (uint64_t) seconds * 1000 / portTICK_PERIOD_MS;
+    if (hal_lock_take(s_lock)) {
+        s_next_us = (seconds != OTA_CLIENT_SLEEP_FOREVER) ? hal_time_us() + seconds * 1000000ULL : 0;
+        hal_lock_give(s_lock);
+    }
+    xSemaphoreTake(s_wake, ticks);
+
+    bool now = s_check_now;
+    s_check_now = false;
+    return now;
+}
+
+// seconds +- 25%, so devices which started together drift apart.
+static uint32_t ota_client_jitter(uint32_t seconds) {
+    return seconds - seconds / 4 + esp_random() % (seconds / 2 + 1);
+}
+
+static uint8_t ota_client_bucket(void) {
+    uint8_t mac[6];
+
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, mac);
+    return ota_manifest_bucket(mac);
+}
+
+static esp_err_t ota_client_buf_sink(void* ctx, const char* data, size_t len) {
+    ota_client_buf_t* out = (ota_client_buf_t*) ctx;
+
+    if (len > out->max - out->len)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return ESP_OK;
+}
+
+// POST the outcome to the "report" URL of the manifest, if it has one. Best effort.
+static void ota_client_report(const char* state, const char* available, esp_err_t result) {
+    char body[OTA_CLIENT_REPORT_MAXLEN];
+    ota_client_buf_t out = { .data = body, .len = 0, .max = sizeof(body) };
+    json_writer_t writer;
+    uint8_t mac[6];
+    char mac_str[18];
+
+    if (s_report_url[0] == '\0')
+        return;
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, mac);
+    sprintf(mac_str, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    json_writer_init(&writer, ota_client_buf_sink, &out);
+    json_writer_begin_object(&writer);
+    json_writer_kv_string(&writer, "mac", mac_str);
+    json_writer_kv_string(&writer, "version", CONFIG_FW_VERSION);
+    json_writer_kv_string(&writer, "state", state);
+    json_writer_kv_string(&writer, "available", available);
+    json_writer_kv_string(&writer, "error", esp_err_to_name(result));
+    json_writer_end_object(&writer);
+    if (json_writer_flush(&writer) != ESP_OK)
+        return;
+
+    esp_http_client_config_t config = {
+        .url = s_report_url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = OTA_FETCH_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+        return;
+    esp_http_client_set_header(client, "Content-Type", "application/json");
+    esp_http_client_set_post_field(client, body, out.len);
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Report to %s failed, err=0x%x", s_report_url, err);
+    esp_http_client_cleanup(client);
+}
+
+// Download the file of offer into the passive partition and boot it on trial next.
+static esp_err_t ota_client_download(const ota_manifest_offer_t* offer) {
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+
+    if (partition == NULL)
+        return ESP_ERR_NOT_FOUND;
+    esp_err_t err = ota_fetch_image(offer, partition, ota_client_set_progress);
+    if (err == ESP_OK)
+        err = ota_selftest_arm(partition, offer->version);
+    if (err == ESP_OK)
+        err = esp_ota_set_boot_partition(partition);
+    return err;
+}
+
+// Fetch the manifest and install what it offers, when it is this device's turn or now is set.
+static esp_err_t ota_client_check(const char* manifest_url, bool now) {
+    ota_manifest_offer_t offer;
+    size_t len = 0;
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    // Nothing is installed over an image which has not passed its self-test yet.
+    if (ota_selftest_on_trial())
+        return ESP_ERR_INVALID_STATE;
+    metric_inc(&s_checks);
+    ota_client_set_state(OTA_CLIENT_CHECKING, ESP_OK);
+    char* buf = (char*) malloc(OTA_CLIENT_MANIFEST_MAXLEN + 1);
+    if (buf != NULL)
+        err = ota_fetch_text(manifest_url, buf, OTA_CLIENT_MANIFEST_MAXLEN, &len);
+    if (err == ESP_OK)
+        err = ota_manifest_parse(manifest_url, CONFIG_FW_VERSION, buf, len, &offer);
+    free(buf);
+    if (err != ESP_OK)
+        return err;
+    strcpy(s_report_url, offer.report_url);
+    if (hal_lock_take(s_lock)) {
+        strcpy(s_status.available, offer.version);
+        hal_lock_give(s_lock);
+    }
+
+    // Once per boot, the server learns which version each device came up with.
+    if (!s_boot_reported) {
+        const char* rejected = ota_selftest_rejected_version();
+        if (rejected[0] != '\0')
+            ota_client_report("rolled_back", rejected, ESP_OK);
+        else
+            ota_client_report("running", offer.version, ESP_OK);
+        s_boot_reported = true;
+    }
+    if (strcmp(offer.version, CONFIG_FW_VERSION) == 0) {
+        ota_client_set_state(OTA_CLIENT_IDLE, ESP_OK);
+        return ESP_OK;
+    }
+
+    if (!now) {
+        // Rolled back once, only a new version or check_now tries again.
+        if (strcmp(offer.version, ota_selftest_rejected_version()) == 0) {
+            ESP_LOGW(TAG, "%s failed its self-test here, not installed again", offer.version);
+            ota_client_set_state(OTA_CLIENT_IDLE, ESP_OK);
+            return ESP_OK;
+        }
+
+        uint8_t bucket = ota_client_bucket();
+        if (bucket >= offer.percent) {
+            ESP_LOGI(TAG, "%s is rolled out to %u%%, not to bucket %u yet", offer.version, offer.percent, bucket);
+            ota_client_set_state(OTA_CLIENT_IDLE, ESP_OK);
+            return ESP_OK;
+        }
+        if (offer.window_s > 0) {
+            uint64_t until_us = hal_time_us() + (esp_random() % offer.window_s) * 1000000ULL;
+            ESP_LOGI(TAG, "%s is available, downloading within %u s", offer.version, (unsigned) offer.window_s);
+            ota_client_set_state(OTA_CLIENT_WAITING, ESP_OK);
+            // Only a check_now cuts the wait short.
+            while (hal_time_us() < until_us && !ota_client_sleep((until_us - hal_time_us() + 999999) / 1000000))
+                ;
+        }
+    }
+
+    ESP_LOGI(TAG, "Updating from %s to %s, %s", CONFIG_FW_VERSION, offer.version, offer.url);
+    ota_client_set_progress(0, 0);
+    ota_client_set_state(OTA_CLIENT_DOWNLOADING, ESP_OK);
+    err = ota_client_download(&offer);
+    if (err != ESP_OK) {
+        ota_client_report("failed", offer.version, err);
+        return err;
+    }
+
+    ota_client_set_state(OTA_CLIENT_INSTALLED, ESP_OK);
+    ota_client_report("installed", offer.version, ESP_OK);
+    ESP_LOGI(TAG, "Restarting into %s", offer.version);
+    vTaskDelay(OTA_CLIENT_RESTART_DELAY_MS / portTICK_PERIOD_MS);
+    esp_restart();
+    return ESP_OK;
+}
+
+static void ota_client_task(void* arg) {
+    char url[CFG_STR_MAXLEN];
+    uint32_t period_min;
+    uint32_t retry_s = 0;
+    uint32_t wait_s = ota_client_jitter(OTA_CLIENT_FIRST_CHECK_S);
+
+    for (;;) {
+        bool now = ota_client_sleep(wait_s);
+        size_t len = sizeof(url);
+
+        if (cfg_adp_get_by_id(CFG_OTA_URL, url, &len) != ESP_OK || url[0] == '\0') {
+            ota_client_set_state(OTA_CLIENT_DISABLED, ESP_OK);
+            wait_s = OTA_CLIENT_SLEEP_FOREVER;
+            continue;
+        }
+        if (cfg_adp_get_u32_by_id(CFG_OTA_INTERVAL, &period_min) != ESP_OK)
+            period_min = 0;
+        // 0: only checked on demand.
+        uint32_t period_s = MIN(period_min, OTA_CLIENT_PERIOD_MAX_MIN) * 60;
+
+        if (wifi_hdl_sta_query_status() != STA_CONNECTED) {
+            wait_s = OTA_CLIENT_RETRY_MIN_S;
+            continue;
+        }
+
+        esp_err_t err = ota_client_check(url, now);
+        if (err == ESP_OK) {
+            retry_s = 0;
+            wait_s = (period_s > 0) ? ota_client_jitter(period_s) : OTA_CLIENT_SLEEP_FOREVER;
+            continue;
+        }
+        ESP_LOGW(TAG, "Update check failed, err=0x%x", err);
+        metric_inc(&s_failures);
+        ota_client_set_state(OTA_CLIENT_FAILED, err);
+        retry_s = (retry_s == 0) ? OTA_CLIENT_RETRY_MIN_S : MIN(2 * retry_s, MAX(period_s, OTA_CLIENT_RETRY_MIN_S));
+        wait_s = (period_s > 0) ? ota_client_jitter(retry_s) : OTA_CLIENT_SLEEP_FOREVER;
+    }
+}
+
+esp_err_t ota_client_init(void) {
+    s_lock = hal_lock_create();
+    s_wake = xSemaphoreCreateBinary();
+    if (s_lock == NULL || s_wake == NULL)
+        return ESP_ERR_NO_MEM;
+
+    metrics_register(&s_checks);
+    metrics_register(&s_failures);
+    metrics_register(&s_state);
+    cfg_adp_subscribe(CFG_OTA_URL, ota_client_cfg_updated, NULL);
+    cfg_adp_subscribe(CFG_OTA_INTERVAL, ota_client_cfg_updated, NULL);
+
+    if (xTaskCreate(ota_client_task, "ota_client", OTA_CLIENT_TASK_STACK, NULL, OTA_CLIENT_TASK_PRIO, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
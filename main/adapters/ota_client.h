@@ -0,0 +1,64 @@
+/*
+ * ota_client.h
+ *
+ * Pulls updates: every ota_interval minutes the JSON manifest at ota_url is fetched,
+ *   {"version": "1.2.0", "url": "modbus_switch.lz", "sha256": "<of the file at url>",
+ *    "patches": [{"from": "1.1.0", "url": "1.1.0.patch.lz", "sha256": "..."}],
+ *    "rollout": {"percent": 25, "window_s": 3600}, "report": "report",
+ *    "image_sha256": "<of the new image, optional>"}
+ * and whenever it names another version than CONFIG_FW_VERSION, the image (or the patch
+ * for the running version) is streamed into the passive partition and booted on trial
+ * (ota_selftest.h). A version which was rolled back is skipped, but by ota_client_check_now().
+ * Relative URLs are relative to the manifest.
+ *
+ * A fleet is spread out: checks are jittered, only devices whose MAC falls in the first
+ * percent of 100 buckets take part, and each one waits a random time within window_s
+ * before it downloads. A failed check is retried with a growing delay.
+ * With "report", the outcome is POSTed there as {"mac", "version", "state", "available", "error"},
+ * state "running", "rolled_back" (available: the rejected version), "installed" or "failed".
+ */
+
+#ifndef MAIN_OTA_CLIENT_H_
+#define MAIN_OTA_CLIENT_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define OTA_CLIENT_TASK_STACK        4096
+#define OTA_CLIENT_TASK_PRIO         3
+#define OTA_CLIENT_VERSION_MAXLEN    32
+#define OTA_CLIENT_URL_MAXLEN        128
+#define OTA_CLIENT_MANIFEST_MAXLEN   1024
+// The first check after boot, jittered so a fleet powered up together does not check at once.
+#define OTA_CLIENT_FIRST_CHECK_S     60
+// Retries of a failed check start here and double up to the period.
+#define OTA_CLIENT_RETRY_MIN_S       60
+
+enum ota_client_state {
+    OTA_CLIENT_DISABLED,    // no ota_url
+    OTA_CLIENT_IDLE,        // up to date, or not in the rollout
+    OTA_CLIENT_CHECKING,
+    OTA_CLIENT_WAITING,     // for its time within the rollout window
+    OTA_CLIENT_DOWNLOADING,
+    OTA_CLIENT_INSTALLED,   // restarting into the new version
+    OTA_CLIENT_FAILED
+};
+
+typedef struct ota_client_status {
+    uint8_t state;
+    esp_err_t last_err;
+    uint32_t next_s;        // until the next check or the download
+    uint32_t offset;        // of the download
+    uint32_t total;
+    char available[OTA_CLIENT_VERSION_MAXLEN]; // the version of the last manifest
+} ota_client_status_t;
+
+// Start the client task, once after the Wi-Fi handler.
+esp_err_t ota_client_init(void);
+void ota_client_get_status(ota_client_status_t* status);
+const char* ota_client_state_str(uint8_t state);
+// Check now, an update found this way is installed at once, whatever the rollout says.
+void ota_client_check_now(void);
+
+#endif /* MAIN_OTA_CLIENT_H_ */
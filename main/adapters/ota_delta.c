@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+#include "ota_delta.h"
+
+#define TAG "OTA delta"
+// The source check reads the running image in pieces of this size.
+#define OTA_DELTA_READ_LEN 256
+// 5 groups of 7 bits cover a u32.
+#define OTA_DELTA_VARINT_MAXSHIFT 28
+
+enum ota_delta_state {
+    OTA_DELTA_OP,
+    OTA_DELTA_LEN,
+    OTA_DELTA_OFFSET,
+    OTA_DELTA_DATA
+};
+
+struct ota_delta {
+    const esp_partition_t* source;
+    uint32_t source_size;
+    uint32_t target_size;
+    uint32_t target_crc;
+    // parser, resumes wherever a chunk of the patch ended
+    uint8_t state;
+    uint8_t op;
+    uint8_t shift;
+    uint32_t varint;
+    uint32_t len;
+    uint32_t src_pos;  // end of the last copy
+    // output
+    uint32_t written;
+    uint32_t crc;
+};
+
+static const uint32_t ota_delta_crc_tab[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+// CRC-32 as zlib.crc32(buf, crc), a nibble at a time: whole images go through it.
+static uint32_t ota_delta_crc32(uint32_t crc, const uint8_t* buf, size_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        crc = (crc >> 4) ^ ota_delta_crc_tab[crc & 0x0f];
+        crc = (crc >> 4) ^ ota_delta_crc_tab[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+static uint32_t ota_delta_get_u32(const uint8_t* buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+bool ota_delta_is_patch(const uint8_t* buf, size_t len) {
+    return len >= 4 && ota_delta_get_u32(buf) == OTA_DELTA_MAGIC;
+}
+
+static esp_err_t ota_delta_check_source(const esp_partition_t* source, uint32_t size, uint32_t expected) {
+    uint8_t* buf = (uint8_t*) malloc(OTA_DELTA_READ_LEN);
+    uint32_t crc = 0;
+    esp_err_t err = ESP_OK;
+
+    if (buf == NULL)
+        return ESP_ERR_NO_MEM;
+
+    for (uint32_t off = 0; off < size; off += OTA_DELTA_READ_LEN) {
+        size_t n = (size - off < OTA_DELTA_READ_LEN) ? size - off : OTA_DELTA_READ_LEN;
+        err = esp_partition_read(source, off, buf, n);
+        if (err != ESP_OK)
+            goto free_ret;
+        crc = ota_delta_crc32(crc, buf, n);
+    }
+    if (crc != expected) {
+        ESP_LOGW(TAG, "The running image is not the source of the patch, crc 0x%08x != 0x%08x",
+                 (unsigned) crc, (unsigned) expected);
+        err = ESP_ERR_INVALID_VERSION;
+    }
+
+free_ret:
+    free(buf);
+    return err;
+}
+
+esp_err_t ota_delta_begin(const uint8_t* header, ota_delta_handle_t* delta) {
+    ota_delta_handle_t d;
+    esp_err_t err;
+
+    if (!ota_delta_is_patch(header, OTA_DELTA_HEADER_LEN) || header[4] != OTA_DELTA_VERSION)
+        return ESP_ERR_INVALID_ARG;
+
+    d = (ota_delta_handle_t) calloc(1, sizeof(struct ota_delta));
+    if (d == NULL)
+        return ESP_ERR_NO_MEM;
+    d->source = esp_ota_get_running_partition();
+    d->source_size = ota_delta_get_u32(header + 8);
+    d->target_size = ota_delta_get_u32(header + 16);
+    d->target_crc = ota_delta_get_u32(header + 20);
+    d->state = OTA_DELTA_OP;
+
+    if (d->source == NULL || d->source_size > d->source->size) {
+        err = ESP_ERR_INVALID_VERSION;
+        goto free_ret;
+    }
+    err = ota_delta_check_source(d->source, d->source_size, ota_delta_get_u32(header + 12));
+    if (err != ESP_OK)
+        goto free_ret;
+
+    ESP_LOGI(TAG, "Patching %u bytes of 0x%x into a %u bytes image", (unsigned) d->source_size,
+             d->source->address, (unsigned) d->target_size);
+    *delta = d;
+    return ESP_OK;
+
+free_ret:
+    free(d);
+    return err;
+}
+
+size_t ota_delta_target_size(ota_delta_handle_t delta) {
+    return delta->target_size;
+}
+
+// Flash to flash, through the free buffer of the writer.
+static esp_err_t ota_delta_copy(ota_delta_handle_t d, ota_adp_writer_handle_t writer) {
+    esp_err_t err = ESP_OK;
+
+    while (d->len > 0 && err == ESP_OK) {
+        size_t space;
+        uint8_t* buf = ota_adp_get_buf(writer, &space);
+        size_t n = (d->len < space) ? d->len : space;
+        err = esp_partition_read(d->source, d->src_pos, buf, n);
+        if (err != ESP_OK)
+            break;
+        d->crc = ota_delta_crc32(d->crc, buf, n);
+        d->src_pos += n;
+        d->written += n;
+        d->len -= n;
+        err = ota_adp_put(writer, n);
+    }
+    return err;
+}
+
+// The op is complete once its length (and offset) are known.
+static esp_err_t ota_delta_start_op(ota_delta_handle_t d, ota_adp_writer_handle_t writer) {
+    if (d->len > d->target_size - d->written)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (d->op == OTA_DELTA_OP_INSERT) {
+        d->state = (d->len > 0) ? OTA_DELTA_DATA : OTA_DELTA_OP;
+        return ESP_OK;
+    }
+
+    // zigzag
+    d->src_pos += (int32_t) ((d->varint >> 1) ^ -(d->varint & 1));
+    if (d->src_pos > d->source_size || d->len > d->source_size - d->src_pos)
+        return ESP_ERR_INVALID_SIZE;
+    d->state = OTA_DELTA_OP;
+    return ota_delta_copy(d, writer);
+}
+
+esp_err_t ota_delta_feed(ota_delta_handle_t delta, ota_adp_writer_handle_t writer, const uint8_t* data, size_t len) {
+    ota_delta_handle_t d = delta;
+    esp_err_t err = ESP_OK;
+
+    while (len > 0 && err == ESP_OK) {
+        switch (d->state) {
+        case OTA_DELTA_OP:
+            d->op = *data++;
+            len--;
+            if (d->op != OTA_DELTA_OP_COPY && d->op != OTA_DELTA_OP_INSERT)
+                return ESP_ERR_INVALID_ARG;
+            d->state = OTA_DELTA_LEN;
+            d->varint = 0;
+            d->shift = 0;
+            break;
+
+        case OTA_DELTA_LEN:
+        case OTA_DELTA_OFFSET: {
+            uint8_t b = *data++;
+            len--;
+            if (d->shift > OTA_DELTA_VARINT_MAXSHIFT)
+                return ESP_ERR_INVALID_ARG;
+            d->varint |= (uint32_t) (b & 0x7f) << d->shift;
+            d->shift += 7;
+            if (b & 0x80)
+                break;
+
+            if (d->state == OTA_DELTA_LEN) {
+                d->len = d->varint;
+                if (d->op == OTA_DELTA_OP_COPY) {
+                    d->state = OTA_DELTA_OFFSET;
+                    d->varint = 0;
+                    d->shift = 0;
+                    break;
+                }
+            }
+            err = ota_delta_start_op(d, writer);
+            break;
+        }
+
+        case OTA_DELTA_DATA: {
+            size_t n = (len < d->len) ? len : d->len;
+            d->crc = ota_delta_crc32(d->crc, data, n);
+            d->written += n;
+            d->len -= n;
+            err = ota_adp_write(writer, data, n);
+            data += n;
+            len -= n;
+            if (d->len == 0)
+                d->state = OTA_DELTA_OP;
+            break;
+        }
+        }
+    }
+    return err;
+}
+
+esp_err_t ota_delta_end(ota_delta_handle_t delta) {
+    esp_err_t err = ESP_OK;
+
+    if (delta->state != OTA_DELTA_OP || delta->written != delta->target_size) {
+        ESP_LOGE(TAG, "Patch truncated, %u of %u bytes", (unsigned) delta->written, (unsigned) delta->target_size);
+        err = ESP_ERR_INVALID_SIZE;
+    } else if (delta->crc != delta->target_crc) {
+        ESP_LOGE(TAG, "Patched image crc 0x%08x != 0x%08x", (unsigned) delta->crc, (unsigned) delta->target_crc);
+        err = ESP_ERR_INVALID_CRC;
+    }
+    free(delta);
+    return err;
+}
@@ -0,0 +1,46 @@
+/*
+ * ota_delta.h
+ *
+ * Applies a patch made by tools/gen_ota_delta.py, the new image is rebuilt from the
+ * running partition and the patch while the patch is streamed in.
+ *
+ * Layout, little endian:
+ *   u32 magic "MSDL", u8 version, 3 bytes reserved,
+ *   u32 source size, u32 source CRC-32, u32 target size, u32 target CRC-32,
+ *   ops: u8 OTA_DELTA_OP_COPY, varint length, zigzag varint source offset relative to the end of the last copy
+ *        u8 OTA_DELTA_OP_INSERT, varint length, the bytes.
+ * A varint is 7 bits per byte, least significant group first.
+ */
+
+#ifndef MAIN_OTA_DELTA_H_
+#define MAIN_OTA_DELTA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ota_adapter.h"
+
+#define OTA_DELTA_MAGIC      0x4c44534d
+#define OTA_DELTA_VERSION    1
+#define OTA_DELTA_HEADER_LEN 24
+
+#define OTA_DELTA_OP_COPY    1
+#define OTA_DELTA_OP_INSERT  2
+
+typedef struct ota_delta* ota_delta_handle_t;
+
+// len bytes at buf are enough to tell, OTA_DELTA_HEADER_LEN at most.
+bool ota_delta_is_patch(const uint8_t* buf, size_t len);
+// Parse the OTA_DELTA_HEADER_LEN bytes at header. ESP_ERR_INVALID_VERSION if the running
+// firmware is not the source of the patch, this reads the running image once.
+esp_err_t ota_delta_begin(const uint8_t* header, ota_delta_handle_t* delta);
+// The size of the new image, for ota_adp_begin().
+size_t ota_delta_target_size(ota_delta_handle_t delta);
+// The next len bytes of the patch, after the header. The output goes to writer.
+esp_err_t ota_delta_feed(ota_delta_handle_t delta, ota_adp_writer_handle_t writer, const uint8_t* data, size_t len);
+// Check that the whole image was rebuilt, delta is freed either way.
+esp_err_t ota_delta_end(ota_delta_handle_t delta);
+
+#endif /* MAIN_OTA_DELTA_H_ */
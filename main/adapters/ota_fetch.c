@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ota_fetch.h"
+#include "ota_stream.h"
+
+#define TAG "OTA fetch"
+#define OTA_FETCH_RANGE_MAXLEN 24
+
+esp_err_t ota_fetch_text(const char* url, char* buf, size_t maxlen, size_t* len) {
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = OTA_FETCH_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    size_t got = 0;
+    int n = 0;
+
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+        goto cleanup_ret;
+
+    esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    if (status != 200) {
+        ESP_LOGW(TAG, "%s: HTTP %d", url, status);
+        err = ESP_ERR_INVALID_RESPONSE;
+        goto close_ret;
+    }
+    while (got < maxlen && (n = esp_http_client_read(client, buf + got, maxlen - got)) > 0)
+        got += n;
+    if (n < 0)
+        err = ESP_FAIL;
+    else if (got == maxlen)
+        err = ESP_ERR_INVALID_SIZE;
+    buf[got] = '\0';
+    *len = got;
+
+close_ret:
+    esp_http_client_close(client);
+cleanup_ret:
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+// The response to the first request creates the stream, the one to a ranged request must continue it.
+static esp_err_t ota_fetch_start(esp_http_client_handle_t client, const esp_partition_t* partition,
+                                 ota_stream_handle_t* stream) {
+    int len = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+
+    if (len < 0)
+        return ESP_FAIL;
+    if (*stream == NULL) {
+        if (status != 200 || len == 0) {
+            ESP_LOGE(TAG, "HTTP %d, %d bytes", status, len);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        return ota_stream_begin(partition, len, stream);
+    }
+    // A server ignoring the range sends the whole file again.
+    if (status != 206 || len != ota_stream_total(*stream) - ota_stream_offset(*stream)) {
+        ESP_LOGE(TAG, "Cannot resume, HTTP %d, %d bytes", status, len);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+}
+
+// The body of the response. Once a plain image is detected it is received straight into
+// the buffer the writer is not busy with. ESP_FAIL if the connection dropped.
+static esp_err_t ota_fetch_recv(esp_http_client_handle_t client, ota_stream_handle_t stream, uint8_t* buf,
+                                ota_fetch_progress_cb_t progress) {
+    esp_err_t err;
+
+    while (ota_stream_offset(stream) < ota_stream_total(stream)) {
+        size_t space = OTA_FETCH_RECV_BUF_SIZE;
+        uint8_t* direct = ota_stream_get_buf(stream, &space);
+        uint8_t* dst = (direct != NULL) ? direct : buf;
+        int n = esp_http_client_read(client, (char*) dst,
+                                     MIN(space, ota_stream_total(stream) - ota_stream_offset(stream)));
+        if (n <= 0)
+            return ESP_FAIL;
+
+        if (direct != NULL)
+            err = ota_stream_put(stream, n);
+        else
+            err = ota_stream_write(stream, buf, n);
+        if (err != ESP_OK)
+            return err;
+        if (progress != NULL)
+            progress(ota_stream_offset(stream), ota_stream_total(stream));
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_fetch_image(const ota_manifest_offer_t* offer, const esp_partition_t* partition,
+                          ota_fetch_progress_cb_t progress) {
+    esp_http_client_config_t config = {
+        .url = offer->url,
+        .timeout_ms = OTA_FETCH_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = NULL;
+    ota_stream_handle_t stream = NULL;
+    ota_adp_writer_handle_t writer;
+    uint8_t digest[OTA_STREAM_SHA256_LEN];
+    char range[OTA_FETCH_RANGE_MAXLEN];
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    uint8_t* buf = (uint8_t*) malloc(OTA_FETCH_RECV_BUF_SIZE);
+    client = esp_http_client_init(&config);
+    if (buf == NULL || client == NULL)
+        goto cleanup_ret;
+
+    for (uint8_t attempt = 0; attempt <= OTA_FETCH_RESUME_MAX; attempt++) {
+        if (stream != NULL) {
+            ESP_LOGW(TAG, "Download dropped at %u of %u bytes", (unsigned) ota_stream_offset(stream),
+                     (unsigned) ota_stream_total(stream));
+            vTaskDelay(attempt * OTA_FETCH_RESUME_DELAY_MS / portTICK_PERIOD_MS);
+            snprintf(range, sizeof(range), "bytes=%u-", (unsigned) ota_stream_offset(stream));
+            esp_http_client_set_header(client, "Range", range);
+        }
+        err = esp_http_client_open(client, 0);
+        if (err == ESP_OK)
+            err = ota_fetch_start(client, partition, &stream);
+        if (err == ESP_OK)
+            err = ota_fetch_recv(client, stream, buf, progress);
+        esp_http_client_close(client);
+        // Only a download which got going is continued.
+        if (err != ESP_FAIL || stream == NULL)
+            break;
+    }
+    if (err != ESP_OK)
+        goto cleanup_ret;
+
+    ota_stream_sha256(stream, digest);
+    if (memcmp(digest, offer->sha256, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "SHA-256 of %s does not match the manifest", offer->url);
+        err = ESP_ERR_INVALID_CRC;
+        goto cleanup_ret;
+    }
+    err = ota_stream_finish(stream, &writer);
+    stream = NULL;
+    if (err == ESP_OK) {
+        if (offer->check_image)
+            ota_adp_expect_sha256(writer, offer->image_sha256);
+        err = ota_adp_end(writer, NULL);
+    }
+
+cleanup_ret:
+    if (stream != NULL)
+        ota_stream_abort(stream);
+    if (client != NULL)
+        esp_http_client_cleanup(client);
+    free(buf);
+    return err;
+}
@@ -0,0 +1,37 @@
+/*
+ * ota_fetch.h
+ *
+ * The HTTP side of the OTA client (ota_client.h): the manifest, and the download of an
+ * image or a patch into a partition through ota_stream.h, continued with Range requests
+ * when the connection drops.
+ */
+
+#ifndef MAIN_OTA_FETCH_H_
+#define MAIN_OTA_FETCH_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "ota_manifest.h"
+
+#define OTA_FETCH_TIMEOUT_MS       10000
+#define OTA_FETCH_RECV_BUF_SIZE    1024
+// Ranged requests continuing a dropped download, after 1, 2, ... times the delay.
+#define OTA_FETCH_RESUME_MAX       3
+#define OTA_FETCH_RESUME_DELAY_MS  2000
+
+// offset of total bytes downloaded.
+typedef void (*ota_fetch_progress_cb_t)(size_t offset, size_t total);
+
+// GET url into buf, which holds maxlen + 1 bytes, the body is null terminated.
+// ESP_ERR_INVALID_RESPONSE unless HTTP 200, ESP_ERR_INVALID_SIZE if it is maxlen or longer.
+esp_err_t ota_fetch_text(const char* url, char* buf, size_t maxlen, size_t* len);
+// Download the file of offer into partition. ESP_ERR_INVALID_CRC if it does not match the
+// SHA-256 of the manifest, or the written image its image_sha256; ESP_FAIL if the connection
+// dropped more than OTA_FETCH_RESUME_MAX times. ESP_OK once the image is complete and
+// checked, ready to be booted. progress may be NULL.
+esp_err_t ota_fetch_image(const ota_manifest_offer_t* offer, const esp_partition_t* partition,
+                          ota_fetch_progress_cb_t progress);
+
+#endif /* MAIN_OTA_FETCH_H_ */
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "ota_lz.h"
+
+#define TAG "OTA lz"
+
+enum ota_lz_state {
+    OTA_LZ_FLAGS,
+    OTA_LZ_ITEM,
+    OTA_LZ_MATCH
+};
+
+struct ota_lz {
+    uint32_t size;
+    uint32_t out;     // decompressed so far
+    uint8_t bits;
+    // parser, resumes wherever a chunk ended
+    uint8_t state;
+    uint8_t flags;
+    uint8_t items;    // left in the group
+    uint8_t match_lo;
+    // window, the output since flushed is window[flushed..pos)
+    uint16_t pos;
+    uint16_t flushed;
+    esp_err_t err;    // first error of the sink
+    ota_lz_sink_t sink;
+    void* ctx;
+    uint8_t window[];
+};
+
+static uint32_t ota_lz_get_u32(const uint8_t* buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+bool ota_lz_is_compressed(const uint8_t* buf, size_t len) {
+    return len >= 4 && ota_lz_get_u32(buf) == OTA_LZ_MAGIC;
+}
+
+esp_err_t ota_lz_begin(const uint8_t* header, ota_lz_handle_t* lz) {
+    uint8_t bits = header[5];
+
+    if (!ota_lz_is_compressed(header, OTA_LZ_HEADER_LEN) || header[4] != OTA_LZ_VERSION
+            || bits < OTA_LZ_WINDOW_BITS_MIN || bits > OTA_LZ_WINDOW_BITS_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    ota_lz_handle_t l = (ota_lz_handle_t) calloc(1, sizeof(struct ota_lz) + (1 << bits));
+    if (l == NULL)
+        return ESP_ERR_NO_MEM;
+    l->bits = bits;
+    l->size = ota_lz_get_u32(header + 8);
+    l->state = OTA_LZ_FLAGS;
+    ESP_LOGI(TAG, "Decompressing %u bytes, %u bytes window", (unsigned) l->size, 1 << bits);
+    *lz = l;
+    return ESP_OK;
+}
+
+size_t ota_lz_size(ota_lz_handle_t lz) {
+    return lz->size;
+}
+
+static void ota_lz_flush(ota_lz_handle_t lz) {
+    if (lz->pos > lz->flushed && lz->err == ESP_OK)
+        lz->err = lz->sink(lz->ctx, lz->window + lz->flushed, lz->pos - lz->flushed);
+    lz->flushed = lz->pos;
+}
+
+static void ota_lz_put(ota_lz_handle_t lz, uint8_t b) {
+    lz->window[lz->pos++] = b;
+    if (lz->pos == (1 << lz->bits)) {
+        ota_lz_flush(lz);
+        lz->pos = 0;
+        lz->flushed = 0;
+    }
+}
+
+static esp_err_t ota_lz_match(ota_lz_handle_t lz, uint8_t hi) {
+    uint16_t mask = (1 << lz->bits) - 1;
+    uint16_t code = lz->match_lo | (hi << 8);
+    uint32_t dist = (code & mask) + 1;
+    uint32_t len = (code >> lz->bits) + OTA_LZ_MIN_MATCH;
+
+    if (dist > lz->out || len > lz->size - lz->out)
+        return ESP_ERR_INVALID_SIZE;
+    lz->out += len;
+
+    // Byte by byte, a match may overlap its own output.
+    uint16_t from = (lz->pos - dist) & mask;
+    while (len--) {
+        uint8_t b = lz->window[from];
+        from = (from + 1) & mask;
+        ota_lz_put(lz, b);
+    }
+    return ESP_OK;
+}
+
+static void ota_lz_next_item(ota_lz_handle_t lz) {
+    lz->flags >>= 1;
+    lz->state = (--lz->items == 0) ? OTA_LZ_FLAGS : OTA_LZ_ITEM;
+}
+
+esp_err_t ota_lz_feed(ota_lz_handle_t lz, const uint8_t* data, size_t len, ota_lz_sink_t sink, void* ctx) {
+    esp_err_t err = ESP_OK;
+
+    lz->sink = sink;
+    lz->ctx = ctx;
+    while (len > 0 && err == ESP_OK && lz->err == ESP_OK) {
+        uint8_t b = *data++;
+        len--;
+
+        switch (lz->state) {
+        case OTA_LZ_FLAGS:
+            lz->flags = b;
+            lz->items = 8;
+            lz->state = OTA_LZ_ITEM;
+            break;
+
+        case OTA_LZ_ITEM:
+            if (!(lz->flags & 1)) {
+                lz->match_lo = b;
+                lz->state = OTA_LZ_MATCH;
+                break;
+            }
+            if (lz->out == lz->size) {
+                err = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            lz->out++;
+            ota_lz_put(lz, b);
+            ota_lz_next_item(lz);
+            break;
+
+        case OTA_LZ_MATCH:
+            err = ota_lz_match(lz, b);
+            ota_lz_next_item(lz);
+            break;
+        }
+    }
+    ota_lz_flush(lz);
+    return (err != ESP_OK) ? err : lz->err;
+}
+
+esp_err_t ota_lz_end(ota_lz_handle_t lz) {
+    esp_err_t err = ESP_OK;
+
+    if (lz->state == OTA_LZ_MATCH || lz->out != lz->size) {
+        ESP_LOGE(TAG, "Truncated, %u of %u bytes", (unsigned) lz->out, (unsigned) lz->size);
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    free(lz);
+    return err;
+}
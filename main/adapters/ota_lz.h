@@ -0,0 +1,46 @@
+/*
+ * ota_lz.h
+ *
+ * Decompresses an image or a patch made by tools/ota_lz.py while it is streamed in.
+ * LZSS, the window is the only buffer and holds the last 2^window bits bytes of output.
+ *
+ * Layout, little endian:
+ *   u32 magic "MSLZ", u8 version, u8 window bits, u16 reserved, u32 decompressed size,
+ *   groups: u8 flags, then 8 items, bit 0 first: 1 a literal byte,
+ *           0 a match of 2 bytes: distance - 1 in the low window bits,
+ *           length - OTA_LZ_MIN_MATCH in the high (16 - window bits).
+ */
+
+#ifndef MAIN_OTA_LZ_H_
+#define MAIN_OTA_LZ_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define OTA_LZ_MAGIC           0x5a4c534d
+#define OTA_LZ_VERSION         1
+#define OTA_LZ_HEADER_LEN      12
+#define OTA_LZ_WINDOW_BITS_MIN 8
+// 4 KiB of RAM, next to the OTA buffers.
+#define OTA_LZ_WINDOW_BITS_MAX 12
+#define OTA_LZ_MIN_MATCH       3
+
+typedef struct ota_lz* ota_lz_handle_t;
+// Receives the output, data is only valid during the call.
+typedef esp_err_t (*ota_lz_sink_t)(void* ctx, const uint8_t* data, size_t len);
+
+// len bytes at buf are enough to tell, OTA_LZ_HEADER_LEN at most.
+bool ota_lz_is_compressed(const uint8_t* buf, size_t len);
+// Parse the OTA_LZ_HEADER_LEN bytes at header.
+esp_err_t ota_lz_begin(const uint8_t* header, ota_lz_handle_t* lz);
+// The decompressed size.
+size_t ota_lz_size(ota_lz_handle_t lz);
+// The next len compressed bytes, after the header. The output goes to sink before the call returns.
+esp_err_t ota_lz_feed(ota_lz_handle_t lz, const uint8_t* data, size_t len, ota_lz_sink_t sink, void* ctx);
+// Check that everything was decompressed, lz is freed either way.
+esp_err_t ota_lz_end(ota_lz_handle_t lz);
+
+#endif /* MAIN_OTA_LZ_H_ */
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "json_stream.h"
+#include "ota_manifest.h"
+
+#define OTA_MANIFEST_TOKEN_MAX 48
+
+esp_err_t ota_manifest_resolve(const char* base, const char* ref, char* url) {
+    const char* host = strstr(base, "://");
+    int n;
+
+    if (strstr(ref, "://") != NULL) {
+        n = snprintf(url, OTA_CLIENT_URL_MAXLEN, "%s", ref);
+    } else if (host == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    } else {
+        const char* path = host + 3 + strcspn(host + 3, "/");
+        const char* dir_end = strrchr(path, '/');
+        if (ref[0] == '/')
+            n = snprintf(url, OTA_CLIENT_URL_MAXLEN, "%.*s%s", (int) (path - base), base, ref);
+        else if (dir_end != NULL)
+            n = snprintf(url, OTA_CLIENT_URL_MAXLEN, "%.*s%s", (int) (dir_end + 1 - base), base, ref);
+        else
+            n = snprintf(url, OTA_CLIENT_URL_MAXLEN, "%s/%s", base, ref);
+    }
+    return (n < 0 || n >= OTA_CLIENT_URL_MAXLEN) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+static esp_err_t ota_manifest_parse_sha256(const char* hex, uint8_t* digest) {
+    unsigned b;
+
+    if (hex == NULL || strlen(hex) != 2 * OTA_STREAM_SHA256_LEN)
+        return ESP_ERR_INVALID_ARG;
+    for (uint8_t i = 0; i < OTA_STREAM_SHA256_LEN; i++) {
+        if (sscanf(hex + 2 * i, "%2x", &b) != 1)
+            return ESP_ERR_INVALID_ARG;
+        digest[i] = b;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_manifest_parse(const char* manifest_url, const char* running_version, char* buf, size_t len,
+                             ota_manifest_offer_t* offer) {
+    json_token_t tokens[OTA_MANIFEST_TOKEN_MAX];
+    json_reader_t reader;
+    const char* text;
+    int src = 0;
+    int item;
+
+    if (json_reader_parse(&reader, buf, len, tokens, OTA_MANIFEST_TOKEN_MAX) != ESP_OK
+            || json_reader_type(&reader, 0) != JSON_OBJECT)
+        return ESP_ERR_INVALID_RESPONSE;
+
+    text = json_reader_str(&reader, json_reader_find(&reader, 0, "version"));
+    if (text == NULL || strlen(text) >= sizeof(offer->version))
+        return ESP_ERR_INVALID_RESPONSE;
+    strcpy(offer->version, text);
+
+    text = json_reader_str(&reader, json_reader_find(&reader, 0, "report"));
+    if (text == NULL || ota_manifest_resolve(manifest_url, text, offer->report_url) != ESP_OK)
+        offer->report_url[0] = '\0';
+
+    // A patch for the running version, or else the whole image.
+    int patches = json_reader_find(&reader, 0, "patches");
+    if (json_reader_type(&reader, patches) == JSON_ARRAY) {
+        json_reader_for_each_item(&reader, patches, item) {
+            text = json_reader_str(&reader, json_reader_find(&reader, item, "from"));
+            if (text != NULL && strcmp(text, running_version) == 0) {
+                src = item;
+                break;
+            }
+        }
+    }
+    text = json_reader_str(&reader, json_reader_find(&reader, src, "url"));
+    if (text == NULL || ota_manifest_resolve(manifest_url, text, offer->url) != ESP_OK)
+        return ESP_ERR_INVALID_RESPONSE;
+    text = json_reader_str(&reader, json_reader_find(&reader, src, "sha256"));
+    if (ota_manifest_parse_sha256(text, offer->sha256) != ESP_OK)
+        return ESP_ERR_INVALID_RESPONSE;
+    text = json_reader_str(&reader, json_reader_find(&reader, 0, "image_sha256"));
+    offer->check_image = (text != NULL);
+    if (offer->check_image && ota_manifest_parse_sha256(text, offer->image_sha256) != ESP_OK)
+        return ESP_ERR_INVALID_RESPONSE;
+
+    int rollout = json_reader_find(&reader, 0, "rollout");
+    text = json_reader_text(&reader, json_reader_find(&reader, rollout, "percent"));
+    offer->percent = (text != NULL) ? MIN(strtoul(text, NULL, 10), 100) : 100;
+    text = json_reader_text(&reader, json_reader_find(&reader, rollout, "window_s"));
+    offer->window_s = (text != NULL) ? strtoul(text, NULL, 10) : 0;
+    return ESP_OK;
+}
+
+uint8_t ota_manifest_bucket(const uint8_t mac[6]) {
+    uint32_t hash = 0x811c9dc5;
+
+    for (uint8_t i = 0; i < 6; i++)
+        hash = (hash ^ mac[i]) * 0x01000193;
+    return hash % OTA_MANIFEST_ROLLOUT_BUCKETS;
+}
@@ -0,0 +1,47 @@
+/*
+ * ota_manifest.h
+ *
+ * The update manifest of the OTA client (ota_client.h): what it offers the running version,
+ * the patch from it or else the whole image, with the URLs resolved against the manifest URL,
+ * and which devices take part in its rollout.
+ */
+
+#ifndef MAIN_OTA_MANIFEST_H_
+#define MAIN_OTA_MANIFEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ota_adapter.h"
+#include "ota_client.h"
+#include "ota_stream.h"
+
+// Devices are spread over this many buckets by their MAC, "percent" picks the first ones.
+#define OTA_MANIFEST_ROLLOUT_BUCKETS 100
+
+// What the manifest offers a device.
+typedef struct ota_manifest_offer {
+    char version[OTA_CLIENT_VERSION_MAXLEN];
+    char url[OTA_CLIENT_URL_MAXLEN];
+    uint8_t sha256[OTA_STREAM_SHA256_LEN];
+    bool check_image;
+    uint8_t image_sha256[OTA_ADP_SHA256_LEN]; // of the new image, whether patch or image is downloaded
+    uint8_t percent;
+    uint32_t window_s;
+    char report_url[OTA_CLIENT_URL_MAXLEN];   // empty without "report"
+} ota_manifest_offer_t;
+
+// ref relative to base, the manifest URL: "a.bin", "/fw/a.bin" or "http://host/a.bin".
+// url holds OTA_CLIENT_URL_MAXLEN bytes.
+esp_err_t ota_manifest_resolve(const char* base, const char* ref, char* url);
+// What the manifest at manifest_url, len bytes in buf, offers a device running running_version.
+// buf is tokenized in place. ESP_ERR_INVALID_RESPONSE if a field is missing or invalid.
+esp_err_t ota_manifest_parse(const char* manifest_url, const char* running_version, char* buf, size_t len,
+                             ota_manifest_offer_t* offer);
+// The rollout bucket of a device, the same on every boot: a device which took part in a
+// rollout keeps taking part while its percent grows. It takes part if bucket < percent.
+uint8_t ota_manifest_bucket(const uint8_t mac[6]);
+
+#endif /* MAIN_OTA_MANIFEST_H_ */
@@ -0,0 +1,207 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "board_hal.h"
+#include "configuration_adapter.h"
+#include "metrics.h"
+#include "ota_selftest.h"
+
+#define TAG "OTA selftest"
+#define OTA_SELFTEST_KEY "ota_trial"
+
+enum ota_selftest_state {
+    OTA_SELFTEST_NONE,
+    OTA_SELFTEST_ARMED,     // set as boot partition, not booted yet
+    OTA_SELFTEST_TRIAL,     // booted, the previous image is the boot partition again
+    OTA_SELFTEST_REJECTED,  // rolled back, version is kept
+    OTA_SELFTEST_FAILED     // the deadline passed, restarting into the previous image
+};
+
+typedef struct ota_selftest_record {
+    uint8_t state;
+    uint8_t prev_subtype;   // esp_partition_subtype_t of the image to return to
+    uint8_t trial_subtype;
+    char version[OTA_SELFTEST_VERSION_MAXLEN];
+} ota_selftest_record_t;
+
+static ota_selftest_record_t s_record;
+static hal_timer_handle_t s_deadline = NULL;
+// s_trial and s_passed are shared by the reporting tasks and the timer task.
+static volatile bool s_trial = false;
+static volatile uint8_t s_passed = 0;
+
+static metric_t s_rollbacks = METRIC_COUNTER_INIT("ota_rollbacks_total",
+                                                  "Failed trial images rolled back, counted at the boot after.", NULL);
+
+static esp_err_t ota_selftest_store(uint8_t state) {
+    s_record.state = state;
+    esp_err_t err = cfg_adp_store_blob(OTA_SELFTEST_KEY, &s_record, sizeof(s_record));
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Storing the trial record failed, err=0x%x", err);
+    return err;
+}
+
+// Storing takes more stack than the timer task may have.
+static void ota_selftest_fail_task(void* arg) {
+    ota_selftest_store(OTA_SELFTEST_FAILED);
+    // The boot partition already points to the previous image.
+    esp_restart();
+    vTaskDelete(NULL);
+}
+
+static void ota_selftest_deadline(void* arg) {
+    bool expired;
+
+    hal_critical_enter();
+    expired = s_trial;
+    s_trial = false;
+    hal_critical_exit();
+    if (!expired)
+        return;
+
+    ESP_LOGE(TAG, "Self-test of %s failed (passed 0x%x of 0x%x), rolling back",
+             s_record.version, s_passed, OTA_SELFTEST_ALL);
+    if (xTaskCreate(ota_selftest_fail_task, "ota_selftest", OTA_SELFTEST_CONFIRM_STACK, NULL,
+                    OTA_SELFTEST_CONFIRM_PRIO, NULL) != pdPASS) {
+        // Not recorded as failed, the next boot retries the version.
+        ESP_LOGE(TAG, "Storing the failure of %s failed, no memory", s_record.version);
+        esp_restart();
+    }
+}
+
+// The first boot of a new image: until it passed, every restart returns to the previous one.
+static esp_err_t ota_selftest_start_trial(void) {
+    const esp_partition_t* prev = esp_partition_find_first(ESP_PARTITION_TYPE_APP, s_record.prev_subtype, NULL);
+    esp_err_t err;
+
+    if (prev == NULL) {
+        ESP_LOGW(TAG, "Previous image not found, %s is not on trial", s_record.version);
+        return ota_selftest_store(OTA_SELFTEST_NONE);
+    }
+    err = ota_selftest_store(OTA_SELFTEST_TRIAL);
+    if (err != ESP_OK)
+        return err;
+    err = esp_ota_set_boot_partition(prev);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Previous image not bootable, err=0x%x, %s is not on trial", err, s_record.version);
+        return ota_selftest_store(OTA_SELFTEST_NONE);
+    }
+
+    s_deadline = hal_timer_create("ota_selftest", OTA_SELFTEST_DEADLINE_MS, false, ota_selftest_deadline, NULL);
+    if (s_deadline == NULL)
+        return ESP_ERR_NO_MEM;
+    s_trial = true;
+    ESP_LOGI(TAG, "%s on trial for %u ms", s_record.version, OTA_SELFTEST_DEADLINE_MS);
+    return hal_timer_start(s_deadline);
+}
+
+// Whether the reset that ended a trial is the image's fault.
+static bool ota_selftest_reset_is_failure(void) {
+    switch (esp_reset_reason()) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+esp_err_t ota_selftest_init(void) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+
+    s_trial = false;
+    s_passed = 0;
+    metrics_register(&s_rollbacks);
+    if (cfg_adp_load_blob(OTA_SELFTEST_KEY, &s_record, sizeof(s_record)) != ESP_OK) {
+        memset(&s_record, 0, sizeof(s_record));
+        return ESP_OK;
+    }
+    s_record.version[sizeof(s_record.version) - 1] = '\0';
+
+    switch (s_record.state) {
+    case OTA_SELFTEST_ARMED:
+    case OTA_SELFTEST_TRIAL:
+    case OTA_SELFTEST_FAILED:
+        // A trial interrupted before it confirmed or set back the boot partition starts over.
+        if (running->subtype == s_record.trial_subtype)
+            return ota_selftest_start_trial();
+        if (running->subtype != s_record.prev_subtype || s_record.state == OTA_SELFTEST_ARMED) {
+            // Never booted, e.g. the boot partition could not be set.
+            return ota_selftest_store(OTA_SELFTEST_NONE);
+        }
+        if (s_record.state == OTA_SELFTEST_FAILED || ota_selftest_reset_is_failure()) {
+            ESP_LOGW(TAG, "Rolled back from %s", s_record.version);
+            metric_inc(&s_rollbacks);
+            return ota_selftest_store(OTA_SELFTEST_REJECTED);
+        }
+        // A power cut or a reset from outside is not held against the image, it is tried again.
+        ESP_LOGW(TAG, "Trial of %s interrupted, reset reason %d", s_record.version, esp_reset_reason());
+        return ota_selftest_store(OTA_SELFTEST_NONE);
+    default:
+        return ESP_OK;
+    }
+}
+
+esp_err_t ota_selftest_arm(const esp_partition_t* partition, const char* version) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+
+    // The running image would be confirmed over the one about to be installed.
+    if (s_trial)
+        return ESP_ERR_INVALID_STATE;
+    s_record.prev_subtype = running->subtype;
+    s_record.trial_subtype = partition->subtype;
+    snprintf(s_record.version, sizeof(s_record.version), "%s", version);
+    return ota_selftest_store(OTA_SELFTEST_ARMED);
+}
+
+// esp_ota_set_boot_partition() verifies the image, more stack than a reporting task may have.
+static void ota_selftest_confirm_task(void* arg) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+
+    esp_err_t err = esp_ota_set_boot_partition(running);
+    if (err == ESP_OK) {
+        ota_selftest_store(OTA_SELFTEST_NONE);
+        ESP_LOGI(TAG, "Self-test of %s passed", s_record.version);
+    } else {
+        // Left on the previous image, the next restart rolls back.
+        ESP_LOGE(TAG, "Confirming %s failed, err=0x%x", s_record.version, err);
+    }
+    vTaskDelete(NULL);
+}
+
+void ota_selftest_pass(uint8_t service) {
+    bool passed;
+
+    hal_critical_enter();
+    s_passed |= service;
+    passed = s_trial && (s_passed & OTA_SELFTEST_ALL) == OTA_SELFTEST_ALL;
+    if (passed)
+        s_trial = false;
+    hal_critical_exit();
+    if (!passed)
+        return;
+
+    hal_timer_stop(s_deadline);
+    if (xTaskCreate(ota_selftest_confirm_task, "ota_selftest", OTA_SELFTEST_CONFIRM_STACK, NULL,
+                    OTA_SELFTEST_CONFIRM_PRIO, NULL) != pdPASS)
+        ESP_LOGE(TAG, "Confirming %s failed, no memory", s_record.version);
+}
+
+bool ota_selftest_on_trial(void) {
+    return s_trial;
+}
+
+const char* ota_selftest_rejected_version(void) {
+    return (s_record.state == OTA_SELFTEST_REJECTED) ? s_record.version : "";
+}
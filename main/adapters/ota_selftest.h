@@ -0,0 +1,42 @@
+/*
+ * ota_selftest.h
+ *
+ * A new image is booted on trial. Right after its first boot the boot partition is set back
+ * to the previous image, so a crash, a watchdog or a power cut returns to it. Once every
+ * OTA_SELFTEST_ALL service reported itself up, the new image is booted for good; if that
+ * does not happen within OTA_SELFTEST_DEADLINE_MS, the device restarts into the previous one.
+ * A version that missed the deadline or crashed (panic or watchdog reset) is rejected and
+ * remembered, the OTA client does not install it again by itself. After any other reset,
+ * e.g. a power cut, the version is left to be tried again.
+ */
+
+#ifndef MAIN_OTA_SELFTEST_H_
+#define MAIN_OTA_SELFTEST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+
+#define OTA_SELFTEST_DEADLINE_MS    60000
+#define OTA_SELFTEST_VERSION_MAXLEN 32
+#define OTA_SELFTEST_CONFIRM_STACK  3072
+#define OTA_SELFTEST_CONFIRM_PRIO   3
+
+#define OTA_SELFTEST_MODBUS         0x01 // Modbus TCP server set up
+#define OTA_SELFTEST_SWITCH         0x02 // switch adapter initialized
+#define OTA_SELFTEST_ALL            (OTA_SELFTEST_MODBUS | OTA_SELFTEST_SWITCH)
+
+// Once at start up, after cfg_adp_init() and before the services report.
+esp_err_t ota_selftest_init(void);
+// partition, holding version ("" if unknown), is about to be set as boot partition.
+esp_err_t ota_selftest_arm(const esp_partition_t* partition, const char* version);
+// A service of the trial image is up, harmless outside a trial.
+void ota_selftest_pass(uint8_t service);
+// Whether the running image is still on trial.
+bool ota_selftest_on_trial(void);
+// The version the last trial rolled back from, "" if none.
+const char* ota_selftest_rejected_version(void);
+
+#endif /* MAIN_OTA_SELFTEST_H_ */
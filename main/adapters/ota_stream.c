@@ -0,0 +1,213 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "ota_stream.h"
+#include "ota_delta.h"
+#include "ota_lz.h"
+
+#define TAG "OTA stream"
+
+struct ota_stream {
+    const esp_partition_t* partition;
+    size_t total;
+    size_t offset;               // bytes handed on
+    mbedtls_sha256_context sha;  // of the first offset bytes
+    bool started;
+    uint8_t head[OTA_LZ_HEADER_LEN];
+    size_t head_len;
+    ota_lz_handle_t lz;
+    size_t payload_len;          // the image or the patch, after decompression
+    uint8_t payload_head[OTA_DELTA_HEADER_LEN];
+    size_t payload_head_len;
+    ota_delta_handle_t delta;
+    ota_adp_writer_handle_t writer;
+};
+
+esp_err_t ota_stream_begin(const esp_partition_t* partition, size_t total, ota_stream_handle_t* stream) {
+    ota_stream_handle_t s;
+
+    if (total == 0)
+        return ESP_ERR_INVALID_SIZE;
+    s = (ota_stream_handle_t) calloc(1, sizeof(struct ota_stream));
+    if (s == NULL)
+        return ESP_ERR_NO_MEM;
+    s->partition = partition;
+    s->total = total;
+    mbedtls_sha256_init(&s->sha);
+    mbedtls_sha256_starts_ret(&s->sha, 0);
+    *stream = s;
+    return ESP_OK;
+}
+
+size_t ota_stream_offset(ota_stream_handle_t stream) {
+    return stream->offset;
+}
+
+size_t ota_stream_total(ota_stream_handle_t stream) {
+    return stream->total;
+}
+
+void ota_stream_sha256(ota_stream_handle_t stream, uint8_t digest[OTA_STREAM_SHA256_LEN]) {
+    mbedtls_sha256_context sha;
+
+    // The running hash goes on, a copy is finished.
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_clone(&sha, &stream->sha);
+    mbedtls_sha256_finish_ret(&sha, digest);
+    mbedtls_sha256_free(&sha);
+}
+
+// The first bytes of the payload tell a patch from an image, and the size of the image.
+static esp_err_t ota_stream_start(ota_stream_handle_t s) {
+    size_t image_size = s->payload_len;
+    esp_err_t err;
+
+    if (ota_delta_is_patch(s->payload_head, s->payload_head_len)) {
+        if (s->payload_head_len < OTA_DELTA_HEADER_LEN)
+            return ESP_ERR_INVALID_SIZE;
+        err = ota_delta_begin(s->payload_head, &s->delta);
+        if (err != ESP_OK)
+            return err;
+        image_size = ota_delta_target_size(s->delta);
+    }
+
+    // Only the sectors of the image are erased, by the writer task while the download goes on.
+    err = ota_adp_begin(s->partition, image_size, &s->writer);
+    if (err != ESP_OK)
+        return err;
+    ESP_LOGI(TAG, "%s of %u bytes%s, image %u bytes", (s->delta != NULL) ? "Patch" : "Image",
+             (unsigned) s->payload_len, (s->lz != NULL) ? " decompressed" : "", (unsigned) image_size);
+    if (s->delta != NULL)
+        return ota_delta_feed(s->delta, s->writer, s->payload_head + OTA_DELTA_HEADER_LEN,
+                              s->payload_head_len - OTA_DELTA_HEADER_LEN);
+    return ota_adp_write(s->writer, s->payload_head, s->payload_head_len);
+}
+
+// The next len bytes of the payload.
+static esp_err_t ota_stream_payload(void* ctx, const uint8_t* data, size_t len) {
+    ota_stream_handle_t s = (ota_stream_handle_t) ctx;
+
+    if (s->writer == NULL) {
+        size_t want = MIN(sizeof(s->payload_head), s->payload_len) - s->payload_head_len;
+        size_t n = MIN(want, len);
+        memcpy(s->payload_head + s->payload_head_len, data, n);
+        s->payload_head_len += n;
+        data += n;
+        len -= n;
+        if (n < want)
+            return ESP_OK;
+        esp_err_t err = ota_stream_start(s);
+        if (err != ESP_OK)
+            return err;
+    }
+
+    if (s->delta != NULL)
+        return ota_delta_feed(s->delta, s->writer, data, len);
+    return ota_adp_write(s->writer, data, len);
+}
+
+uint8_t* ota_stream_get_buf(ota_stream_handle_t stream, size_t* space) {
+    if (stream->writer == NULL || stream->lz != NULL || stream->delta != NULL)
+        return NULL;
+    return ota_adp_get_buf(stream->writer, space);
+}
+
+esp_err_t ota_stream_put(ota_stream_handle_t stream, size_t len) {
+    size_t space;
+    uint8_t* buf = ota_adp_get_buf(stream->writer, &space);
+
+    mbedtls_sha256_update_ret(&stream->sha, buf, len);
+    stream->offset += len;
+    return ota_adp_put(stream->writer, len);
+}
+
+esp_err_t ota_stream_write(ota_stream_handle_t stream, const uint8_t* data, size_t len) {
+    ota_stream_handle_t s = stream;
+    esp_err_t err;
+
+    if (len > s->total - s->offset)
+        return ESP_ERR_INVALID_SIZE;
+    mbedtls_sha256_update_ret(&s->sha, data, len);
+    s->offset += len;
+
+    // The first bytes tell whether it is compressed.
+    if (!s->started) {
+        size_t want = MIN(sizeof(s->head), s->total) - s->head_len;
+        size_t n = MIN(want, len);
+        memcpy(s->head + s->head_len, data, n);
+        s->head_len += n;
+        data += n;
+        len -= n;
+        if (n < want)
+            return ESP_OK;
+        s->started = true;
+
+        if (ota_lz_is_compressed(s->head, s->head_len)) {
+            if (s->head_len < OTA_LZ_HEADER_LEN)
+                return ESP_ERR_INVALID_SIZE;
+            err = ota_lz_begin(s->head, &s->lz);
+            if (err != ESP_OK)
+                return err;
+            s->payload_len = ota_lz_size(s->lz);
+        } else {
+            s->payload_len = s->total;
+            err = ota_stream_payload(s, s->head, s->head_len);
+            if (err != ESP_OK)
+                return err;
+        }
+    }
+
+    if (len == 0)
+        return ESP_OK;
+    if (s->lz != NULL)
+        return ota_lz_feed(s->lz, data, len, ota_stream_payload, s);
+    return ota_stream_payload(s, data, len);
+}
+
+static void ota_stream_free(ota_stream_handle_t stream) {
+    if (stream->lz != NULL)
+        ota_lz_end(stream->lz);
+    if (stream->delta != NULL)
+        ota_delta_end(stream->delta);
+    if (stream->writer != NULL)
+        ota_adp_abort(stream->writer);
+    mbedtls_sha256_free(&stream->sha);
+    free(stream);
+}
+
+esp_err_t ota_stream_finish(ota_stream_handle_t stream, ota_adp_writer_handle_t* writer) {
+    ota_stream_handle_t s = stream;
+    esp_err_t err = ESP_OK;
+
+    if (s->offset != s->total || s->writer == NULL) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto free_ret;
+    }
+    if (s->lz != NULL) {
+        err = ota_lz_end(s->lz);
+        s->lz = NULL;
+        if (err != ESP_OK)
+            goto free_ret;
+    }
+    if (s->delta != NULL) {
+        err = ota_delta_end(s->delta);
+        s->delta = NULL;
+        if (err != ESP_OK)
+            goto free_ret;
+    }
+    *writer = s->writer;
+    s->writer = NULL;
+
+free_ret:
+    ota_stream_free(s);
+    return err;
+}
+
+void ota_stream_abort(ota_stream_handle_t stream) {
+    ota_stream_free(stream);
+}
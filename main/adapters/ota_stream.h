@@ -0,0 +1,40 @@
+/*
+ * ota_stream.h
+ *
+ * One firmware download, whatever its format: a plain image, a delta patch (ota_delta.h),
+ * or either compressed (ota_lz.h), told apart by their first bytes. The bytes may arrive
+ * in any pieces and across several connections, the decoders keep their state in here.
+ */
+
+#ifndef MAIN_OTA_STREAM_H_
+#define MAIN_OTA_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "ota_adapter.h"
+
+#define OTA_STREAM_SHA256_LEN 32
+
+typedef struct ota_stream* ota_stream_handle_t;
+
+// total bytes to come, written to partition.
+esp_err_t ota_stream_begin(const esp_partition_t* partition, size_t total, ota_stream_handle_t* stream);
+size_t ota_stream_offset(ota_stream_handle_t stream);
+size_t ota_stream_total(ota_stream_handle_t stream);
+// The SHA-256 of the first ota_stream_offset() bytes, the stream goes on.
+void ota_stream_sha256(ota_stream_handle_t stream, uint8_t digest[OTA_STREAM_SHA256_LEN]);
+// Where the next bytes may be received in place, once they are known to be a plain image.
+// NULL while they must be passed to ota_stream_write().
+uint8_t* ota_stream_get_buf(ota_stream_handle_t stream, size_t* space);
+// len bytes were stored at ota_stream_get_buf().
+esp_err_t ota_stream_put(ota_stream_handle_t stream, size_t len);
+esp_err_t ota_stream_write(ota_stream_handle_t stream, const uint8_t* data, size_t len);
+// All total bytes are in: check that the decoders are done and hand over the writer,
+// for ota_adp_end(). stream is freed either way.
+esp_err_t ota_stream_finish(ota_stream_handle_t stream, ota_adp_writer_handle_t* writer);
+void ota_stream_abort(ota_stream_handle_t stream);
+
+#endif /* MAIN_OTA_STREAM_H_ */
@@ -0,0 +1,177 @@
+#include <stdio.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+#include "board_hal.h"
+#include "pwm_engine.h"
+
+typedef struct pwm_channel {
+  uint8_t pin;
+  uint8_t on_level;
+  uint32_t period_ticks;
+  uint32_t on_ticks;
+  uint32_t tick;
+  uint32_t pulses_left;
+} pwm_channel_t;
+
+static pwm_channel_t s_channels[PWM_ENGINE_CHANNEL_MAX];
+// written by tasks inside critical sections, and by the ISR.
+static volatile uint32_t s_active_mask = 0;
+static volatile uint32_t s_done_mask = 0;
+static bool s_hw_timer_running = false;
+static hal_lock_handle_t s_engine_lock = NULL;
+static hal_timer_handle_t s_done_timer = NULL;
+static pwm_done_callback_t s_done_callback = NULL;
+
+static void IRAM_ATTR pwm_engine_isr(void* arg)
+{
+  uint32_t done_mask = 0;
+
+  for (uint8_t channel = 0; channel < PWM_ENGINE_CHANNEL_MAX; channel++)
+  {
+    if (!(s_active_mask & (1UL << channel)))
+      continue;
+
+    pwm_channel_t* ch = &s_channels[channel];
+    if (0 == ch->tick && ch->on_ticks > 0)
+    {
+      hal_gpio_set_level_from_isr(ch->pin, ch->on_level);
+    }
+    if (ch->tick == ch->on_ticks && ch->on_ticks < ch->period_ticks)
+    {
+      hal_gpio_set_level_from_isr(ch->pin, !ch->on_level);
+    }
+
+    if (++ch->tick >= ch->period_ticks)
+    {
+      ch->tick = 0;
+      if (ch->pulses_left > 0 && 0 == --ch->pulses_left)
+      {
+        hal_gpio_set_level_from_isr(ch->pin, !ch->on_level);
+        done_mask |= 1UL << channel;
+      }
+    }
+  }
+
+  if (done_mask)
+  {
+    s_active_mask &= ~done_mask;
+    s_done_mask |= done_mask;
+    // leave the notification and the timer shutdown to task context.
+    hal_timer_reset_from_isr(s_done_timer);
+  }
+}
+
+// Start or stop the hardware timer to match the active channels, caller holds s_engine_lock.
+static esp_err_t pwm_engine_update_hw_timer()
+{
+  esp_err_t err = ESP_OK;
+
+  if (s_active_mask && !s_hw_timer_running)
+  {
+    err = hal_hw_timer_start(PWM_ENGINE_TICK_US, pwm_engine_isr, NULL);
+    s_hw_timer_running = (ESP_OK == err);
+  }
+  else if (!s_active_mask && s_hw_timer_running)
+  {
+    err = hal_hw_timer_stop();
+    s_hw_timer_running = false;
+  }
+  return err;
+}
+
+static void pwm_engine_done(void* arg)
+{
+  uint32_t done_mask;
+
+  hal_critical_enter();
+  done_mask = s_done_mask;
+  s_done_mask = 0;
+  hal_critical_exit();
+
+  if (hal_lock_take(s_engine_lock))
+  {
+    pwm_engine_update_hw_timer();
+    hal_lock_give(s_engine_lock);
+  }
+
+  for (uint8_t channel = 0; channel < PWM_ENGINE_CHANNEL_MAX; channel++)
+  {
+    if ((done_mask & (1UL << channel)) && NULL != s_done_callback)
+    {
+      s_done_callback(channel);
+    }
+  }
+}
+
+esp_err_t pwm_engine_init(pwm_done_callback_t done_callback)
+{
+  s_done_callback = done_callback;
+  s_engine_lock = hal_lock_create();
+  s_done_timer = hal_timer_create("PWM Done Timer", 1, false, pwm_engine_done, NULL);
+  if (NULL == s_engine_lock || NULL == s_done_timer)
+    return ESP_ERR_NO_MEM;
+  return ESP_OK;
+}
+
+esp_err_t pwm_engine_check_conf(const pwm_conf_t* conf)
+{
+  // a period needs at least two ticks to produce an edge in each direction.
+  if (conf->period_ms > 0 && (uint32_t)conf->period_ms * 1000 < 2 * PWM_ENGINE_TICK_US)
+    return ESP_ERR_INVALID_ARG;
+  if (conf->duty_permille > PWM_DUTY_MAX)
+    return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
+esp_err_t pwm_engine_start(uint8_t channel, uint8_t pin, uint8_t on_level, const pwm_conf_t* conf)
+{
+  if (channel >= PWM_ENGINE_CHANNEL_MAX || 0 == conf->period_ms)
+    return ESP_ERR_INVALID_ARG;
+  esp_err_t err = pwm_engine_check_conf(conf);
+  if (ESP_OK != err)
+    return err;
+
+  pwm_channel_t ch = {
+    .pin = pin,
+    .on_level = on_level,
+    .period_ticks = (uint32_t)conf->period_ms * 1000 / PWM_ENGINE_TICK_US,
+    .tick = 0,
+    .pulses_left = conf->pulses
+  };
+  ch.on_ticks = (ch.period_ticks * conf->duty_permille + PWM_DUTY_MAX / 2) / PWM_DUTY_MAX;
+
+  if (!hal_lock_take(s_engine_lock))
+    return ESP_FAIL;
+
+  hal_critical_enter();
+  s_channels[channel] = ch;
+  s_active_mask |= 1UL << channel;
+  s_done_mask &= ~(1UL << channel);
+  hal_critical_exit();
+
+  err = pwm_engine_update_hw_timer();
+  hal_lock_give(s_engine_lock);
+  return err;
+}
+
+void pwm_engine_stop(uint8_t channel)
+{
+  if (channel >= PWM_ENGINE_CHANNEL_MAX || !hal_lock_take(s_engine_lock))
+    return;
+
+  hal_critical_enter();
+  if (s_active_mask & (1UL << channel))
+  {
+    s_active_mask &= ~(1UL << channel);
+    hal_gpio_set_level_from_isr(s_channels[channel].pin, !s_channels[channel].on_level);
+  }
+  hal_critical_exit();
+
+  pwm_engine_update_hw_timer();
+  hal_lock_give(s_engine_lock);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "esp_err.h"
+
+#include "board_hal.h"
+
+// One hardware timer tick services every channel, 2 kHz keeps 20 duty steps at 100 Hz.
+#define PWM_ENGINE_TICK_US 500
+#define PWM_ENGINE_CHANNEL_MAX 3
+#define PWM_DUTY_MAX 1000
+
+typedef struct pwm_conf {
+  uint16_t period_ms;     // 0 disables the PWM output
+  uint16_t duty_permille; // 0..PWM_DUTY_MAX
+  uint16_t pulses;        // 0 runs continuously, otherwise stop after N periods
+} pwm_conf_t;
+
+// called in timer task context once a channel has produced all of its pulses.
+typedef void (*pwm_done_callback_t)(uint8_t channel);
+
+esp_err_t pwm_engine_init(pwm_done_callback_t done_callback);
+esp_err_t pwm_engine_check_conf(const pwm_conf_t* conf);
+esp_err_t pwm_engine_start(uint8_t channel, uint8_t pin, uint8_t on_level, const pwm_conf_t* conf);
+void pwm_engine_stop(uint8_t channel);
@@ -1,24 +1,131 @@
 #include <stdio.h>
 
-#include "esp_system.h"
-
-#include "freertos/FreeRTOS.h"
-#include "semphr.h"
-#include "freertos/event_groups.h"
-#include "driver/gpio.h"
-
+#include "board_hal.h"
 #include "configuration_adapter.h"
 #include "switch_adapter.h"
+#include "metrics.h"
+#include "ota_selftest.h"
+
+#define SW_TRANSITIONS_METRIC "switch_transitions_total"
+#define SW_TRANSITIONS_HELP "Status changes of a switch since boot."
 
-static switch_context_t sw_context[3] = {
+static switch_context_t sw_context[SW_MAX] = {
   [SW1] = {.sw_gpio_pin = SW_1_GPIO_PIN, .sw_conf.value = 0},
   [SW2] = {.sw_gpio_pin = SW_2_GPIO_PIN, .sw_conf.value = 0},
   [SW3] = {.sw_gpio_pin = SW_3_GPIO_PIN, .sw_conf.value = 0}
 };
 
-static void switch_time_out(TimerHandle_t timer_handler)
+static stats_update_callback_t s_stats_update_callback = NULL;
+static status_update_callback_t s_status_listeners[SW_STATUS_LISTENER_MAX] = {NULL};
+static hal_timer_handle_t s_stats_timer = NULL;
+static uint32_t s_stats_refresh_count = 0;
+static bool s_stats_dirty = false;
+// each one is only updated under its switch lock.
+static metric_t s_transition_metrics[SW_MAX] = {
+  [SW1] = METRIC_COUNTER_INIT(SW_TRANSITIONS_METRIC, SW_TRANSITIONS_HELP, "switch=\"1\""),
+  [SW2] = METRIC_COUNTER_INIT(SW_TRANSITIONS_METRIC, SW_TRANSITIONS_HELP, "switch=\"2\""),
+  [SW3] = METRIC_COUNTER_INIT(SW_TRANSITIONS_METRIC, SW_TRANSITIONS_HELP, "switch=\"3\"")
+};
+
+// Add the running ON period up to now, caller holds the switch lock.
+static void switch_stats_fold_on_time(switch_context_t* sw_ctx, uint64_t now_us)
+{
+  if (STA_ON == sw_ctx->sw_conf.conf.sw_status)
+  {
+    sw_ctx->sw_stats.on_time_us += now_us - sw_ctx->sw_on_since_us;
+    sw_ctx->sw_on_since_us = now_us;
+    s_stats_dirty = true;
+  }
+}
+
+static void switch_stats_refresh(void* arg)
+{
+  switch_stats_t sw_stats[SW_MAX];
+  uint64_t now_us = hal_time_us();
+  bool complete = true;
+
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    switch_context_t* sw_ctx = &sw_context[sw_index];
+    // without its lock a switch has no statistics to publish or checkpoint this time.
+    if (!hal_lock_take(sw_ctx->sw_mutex_req))
+    {
+      complete = false;
+      continue;
+    }
+    switch_stats_fold_on_time(sw_ctx, now_us);
+    sw_stats[sw_index] = sw_ctx->sw_stats;
+    hal_lock_give(sw_ctx->sw_mutex_req);
+    if (NULL != s_stats_update_callback)
+    {
+      s_stats_update_callback(sw_index, &sw_stats[sw_index]);
+    }
+  }
+
+  // checkpoint at most once per SW_STATS_CHECKPOINT_REFRESHES, and only if something changed,
+  // an incomplete refresh leaves it to the next one.
+  if (++s_stats_refresh_count >= SW_STATS_CHECKPOINT_REFRESHES && s_stats_dirty && complete)
+  {
+    s_stats_refresh_count = 0;
+    s_stats_dirty = false;
+    cfg_adp_store_blob(SW_STATS_NVS_KEY, sw_stats, sizeof(sw_stats));
+  }
+}
+
+static void switch_stats_init()
+{
+  switch_stats_t sw_stats[SW_MAX] = {0};
+  uint64_t now_us = hal_time_us();
+
+  cfg_adp_load_blob(SW_STATS_NVS_KEY, sw_stats, sizeof(sw_stats));
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    sw_context[sw_index].sw_stats = sw_stats[sw_index];
+    sw_context[sw_index].sw_stats.last_change_s = 0;
+    sw_context[sw_index].sw_on_since_us = now_us;
+  }
+
+  s_stats_timer = hal_timer_create("SW Stats Timer", SW_STATS_REFRESH_MS, true, switch_stats_refresh, NULL);
+  if (NULL != s_stats_timer)
+  {
+    hal_timer_start(s_stats_timer);
+  }
+}
+
+static enum switch_type switch_type_of(const switch_context_t* sw_ctx)
+{
+  return (sw_ctx->sw_pwm.period_ms > 0) ? PWM : sw_ctx->sw_conf.conf.sw_type;
+}
+
+// Drive the output for status, caller holds the switch lock.
+static void switch_apply_output(uint8_t sw_index, switch_context_t* sw_ctx, enum switch_status status)
+{
+  if (PWM == switch_type_of(sw_ctx))
+  {
+    if (STA_ON == status)
+      pwm_engine_start(sw_index, sw_ctx->sw_gpio_pin, SW_ON_LEVEL, &sw_ctx->sw_pwm);
+    else
+      pwm_engine_stop(sw_index);
+  }
+  else
+  {
+    SW_SET_STATUS(sw_ctx->sw_gpio_pin, status);
+  }
+}
+
+// all pulses of a PWM switch have been produced, it turns OFF like a LIMIT switch does.
+static void switch_pwm_done(uint8_t sw_index)
+{
+  switch_adapter_set_status(sw_index, STA_OFF);
+  if (NULL != sw_context[sw_index].status_update_callback)
+  {
+    sw_context[sw_index].status_update_callback(sw_index, STA_OFF);
+  }
+}
+
+static void switch_time_out(void* arg)
 {
-  uint32_t sw_id = (uint32_t) pvTimerGetTimerID(timer_handler);
+  uint32_t sw_id = (uintptr_t) arg;
   uint32_t sw_cfg_id[3] = {CFG_SW_1, CFG_SW_2, CFG_SW_3};
 
   switch_conf_t sw_conf = {0};
@@ -31,62 +138,64 @@ static void switch_time_out(TimerHandle_t timer_handler)
   }
 }
 
-// TODO: udpate sw_hold_duration when it changed in webUI.
-static void switch_configuration_updated()
+// a switch configuration was committed, e.g. from the webUI: pick up the new type and hold
+// duration, the running status is left alone, the new default applies on the next reset.
+static void switch_configuration_updated(enum cfg_data_idt id, const cfg_value_t* val, void* arg)
 {
+  uint8_t sw_index = (uintptr_t) arg;
+  switch_context_t* sw_ctx = &sw_context[sw_index];
+  switch_conf_t sw_conf = {.value = val->u8};
 
+  if (!hal_lock_take(sw_ctx->sw_mutex_req))
+    return;
+  sw_ctx->sw_conf.conf.sw_type = sw_conf.conf.sw_type;
+  sw_ctx->sw_conf.conf.sw_hold_duration = sw_conf.conf.sw_hold_duration;
+  hal_lock_give(sw_ctx->sw_mutex_req);
+
+  if (LIMIT != sw_conf.conf.sw_type)
+  {
+    hal_timer_stop(sw_ctx->sw_timer_handler);
+  }
+  else if (sw_conf.conf.sw_hold_duration > 0)
+  {
+    hal_timer_change_period(sw_ctx->sw_timer_handler, sw_conf.conf.sw_hold_duration * 1000);
+  }
 }
 
 void switch_adapter_init()
 {
-  gpio_config_t io_conf;
-  //disable interrupt
-  io_conf.intr_type = GPIO_INTR_DISABLE;
-  //set as output mode
-  io_conf.mode = GPIO_MODE_OUTPUT;
-  //bit mask of the pins that you want to set,e.g.GPIO15/16
-  io_conf.pin_bit_mask = SW_PIN_SEL;
-  //disable pull-down mode
-  io_conf.pull_down_en = 0;
-  //disable pull-up mode
-  io_conf.pull_up_en = 0;
-  //configure GPIO with the given settings
-  gpio_config(&io_conf);
-
-  switch_configuration_updated();
-
-  // get default switch status
-  cfg_adp_get_u8_by_id(CFG_SW_1, &sw_context[SW1].sw_conf.value);
-  cfg_adp_get_u8_by_id(CFG_SW_2, &sw_context[SW2].sw_conf.value);
-  cfg_adp_get_u8_by_id(CFG_SW_3, &sw_context[SW3].sw_conf.value);
-  SW_SET_STATUS(sw_context[SW1].sw_gpio_pin, sw_context[SW1].sw_conf.conf.sw_status);
-  SW_SET_STATUS(sw_context[SW2].sw_gpio_pin, sw_context[SW2].sw_conf.conf.sw_status);
-  SW_SET_STATUS(sw_context[SW3].sw_gpio_pin, sw_context[SW3].sw_conf.conf.sw_status);
-
-  sw_context[SW1].sw_mutex_req = xSemaphoreCreateMutex();
-  sw_context[SW2].sw_mutex_req = xSemaphoreCreateMutex();
-  sw_context[SW3].sw_mutex_req = xSemaphoreCreateMutex();
-
-  sw_context[SW1].status_update_callback = NULL;
-  sw_context[SW2].status_update_callback = NULL;
-  sw_context[SW3].status_update_callback= NULL;
-
-  sw_context[SW1].sw_timer_handler = xTimerCreate("SW1 Timer",
-                                                  pdMS_TO_TICKS(sw_context[SW1].sw_conf.conf.sw_hold_duration * 1000),
-                                                  pdFALSE,
-                                                  (void *)SW1,
-                                                  switch_time_out);
-  sw_context[SW2].sw_timer_handler = xTimerCreate("SW2 Timer",
-                                                  pdMS_TO_TICKS(sw_context[SW2].sw_conf.conf.sw_hold_duration * 1000),
-                                                  pdFALSE,
-                                                  (void *)SW2,
-                                                  switch_time_out);
-  sw_context[SW3].sw_timer_handler = xTimerCreate("SW3 Timer",
-                                                  pdMS_TO_TICKS(sw_context[SW3].sw_conf.conf.sw_hold_duration * 1000),
-                                                  pdFALSE,
-                                                  (void *)SW3,
-                                                  switch_time_out);
+  static const char* sw_timer_name[3] = {"SW1 Timer", "SW2 Timer", "SW3 Timer"};
+  uint32_t sw_cfg_id[3] = {CFG_SW_1, CFG_SW_2, CFG_SW_3};
+  bool sw_ready = true;
 
+  hal_gpio_output_init(SW_PIN_SEL);
+  pwm_engine_init(switch_pwm_done);
+
+  for (uint8_t sw_index = SW1; sw_index <= SW3; sw_index++)
+  {
+    switch_context_t* sw_ctx = &sw_context[sw_index];
+    // get default switch status
+    cfg_adp_get_u8_by_id(sw_cfg_id[sw_index], &sw_ctx->sw_conf.value);
+    SW_SET_STATUS(sw_ctx->sw_gpio_pin, sw_ctx->sw_conf.conf.sw_status);
+
+    sw_ctx->sw_mutex_req = hal_lock_create();
+    sw_ctx->status_update_callback = NULL;
+    sw_ctx->sw_timer_handler = hal_timer_create(sw_timer_name[sw_index],
+                                                sw_ctx->sw_conf.conf.sw_hold_duration * 1000,
+                                                false,
+                                                switch_time_out,
+                                                (void *)(uintptr_t)sw_index);
+    cfg_adp_subscribe(sw_cfg_id[sw_index], switch_configuration_updated, (void *)(uintptr_t)sw_index);
+    metrics_register(&s_transition_metrics[sw_index]);
+    sw_ready = sw_ready && sw_ctx->sw_mutex_req != NULL && sw_ctx->sw_timer_handler != NULL;
+  }
+
+  switch_stats_init();
+  // A new image whose switches cannot work is rolled back.
+  if (sw_ready)
+  {
+    ota_selftest_pass(OTA_SELFTEST_SWITCH);
+  }
 }
 
 void switch_adapter_set_state_update_callback(uint8_t sw_index, void * state_update_callback)
@@ -94,17 +203,65 @@ void switch_adapter_set_state_update_callback(uint8_t sw_index, void * state_upd
   sw_context[sw_index].status_update_callback = state_update_callback;
 }
 
+// listeners are meant to be added once at start up, they are called without the switch lock.
+esp_err_t switch_adapter_add_status_listener(status_update_callback_t status_listener)
+{
+  for (uint8_t i = 0; i < SW_STATUS_LISTENER_MAX; i++)
+  {
+    if (NULL == s_status_listeners[i])
+    {
+      s_status_listeners[i] = status_listener;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NO_MEM;
+}
+
+// Record a new status and its statistics, caller holds the switch lock and drives the output.
+static bool switch_update_status(uint8_t sw_index, switch_context_t* sw_ctx, enum switch_status status, uint64_t now_us)
+{
+  bool changed = (status != sw_ctx->sw_conf.conf.sw_status);
+  if (changed)
+  {
+    switch_stats_fold_on_time(sw_ctx, now_us);
+    sw_ctx->sw_on_since_us = now_us;
+    sw_ctx->sw_stats.transitions++;
+    metric_inc(&s_transition_metrics[sw_index]);
+    sw_ctx->sw_stats.last_change_s = (uint32_t)(now_us / 1000000);
+    s_stats_dirty = true;
+  }
+  sw_ctx->sw_conf.conf.sw_status = status;
+  if (changed && NULL != s_stats_update_callback)
+  {
+    s_stats_update_callback(sw_index, &sw_ctx->sw_stats);
+  }
+  return changed;
+}
+
+static void switch_notify_listeners(uint8_t sw_index, enum switch_status status)
+{
+  for (uint8_t i = 0; i < SW_STATUS_LISTENER_MAX; i++)
+  {
+    if (NULL != s_status_listeners[i])
+      s_status_listeners[i](sw_index, status);
+  }
+}
+
 // this will change run time switch status, and not impact on default status.
 esp_err_t switch_adapter_set_status(uint8_t sw_index, enum switch_status status)
 {
   if (sw_index < 3)
   {
-    if (NULL != sw_context[sw_index].sw_mutex_req
-        && pdTRUE == xSemaphoreTake(sw_context[sw_index].sw_mutex_req, portMAX_DELAY))
+    switch_context_t* sw_ctx = &sw_context[sw_index];
+    if (NULL != sw_ctx->sw_mutex_req
+        && hal_lock_take(sw_ctx->sw_mutex_req))
     {
-      SW_SET_STATUS(sw_context[sw_index].sw_gpio_pin, status);
-      sw_context[sw_index].sw_conf.conf.sw_status = status;
-      xSemaphoreGive(sw_context[sw_index].sw_mutex_req);
+      bool changed = switch_update_status(sw_index, sw_ctx, status, hal_time_us());
+      switch_apply_output(sw_index, sw_ctx, status);
+      hal_lock_give(sw_ctx->sw_mutex_req);
+
+      if (changed)
+        switch_notify_listeners(sw_index, status);
     }
   }
   else
@@ -113,34 +270,116 @@ esp_err_t switch_adapter_set_status(uint8_t sw_index, enum switch_status status)
   return ESP_OK;
 }
 
-esp_err_t switch_adapter_chg_sta(uint8_t sw_index, bool sw_status)
+// a LIMIT switch away from its default status returns to it after the hold duration.
+static esp_err_t switch_limit_rearm(uint8_t sw_index, enum switch_status sw_status)
 {
   uint32_t sw_cfg_id[3] = {CFG_SW_1, CFG_SW_2, CFG_SW_3};
   switch_conf_t sw_conf = {0};
-  if (sw_index >=3 )
-    return 0;
 
-  switch_adapter_set_status(sw_index, (enum switch_status) sw_status);
-  if (LIMIT == sw_context[sw_index].sw_conf.conf.sw_type)
+  if (LIMIT == switch_type_of(&sw_context[sw_index]))
   {
-    if (pdFALSE != xTimerIsTimerActive(sw_context[sw_index].sw_timer_handler))
+    if (hal_timer_is_active(sw_context[sw_index].sw_timer_handler))
     {
-      if (pdFAIL == xTimerStop(sw_context[sw_index].sw_timer_handler, 0))
+      if (ESP_OK != hal_timer_stop(sw_context[sw_index].sw_timer_handler))
       {
         return ESP_FAIL;
       }
     }
     cfg_adp_get_u8_by_id(sw_cfg_id[sw_index], &sw_conf.value);
     // if switch set to default state, do not start the timer.
-    if (((enum switch_status) sw_status) != sw_conf.conf.sw_status)
+    if (sw_status != sw_conf.conf.sw_status)
     {
-      if (pdPASS != xTimerStart(sw_context[sw_index].sw_timer_handler, 0))
+      if (ESP_OK != hal_timer_start(sw_context[sw_index].sw_timer_handler))
       {
         return ESP_FAIL;
       }
     }
   }
-  return ESP_OK; 
+  return ESP_OK;
+}
+
+esp_err_t switch_adapter_chg_sta(uint8_t sw_index, bool sw_status)
+{
+  if (sw_index >=3 )
+    return 0;
+
+  switch_adapter_set_status(sw_index, (enum switch_status) sw_status);
+  return switch_limit_rearm(sw_index, (enum switch_status) sw_status);
+}
+
+esp_err_t switch_adapter_chg_sta_batch(uint8_t sw_mask, uint8_t sw_states)
+{
+  uint32_t pin_mask = 0;
+  uint32_t pin_levels = 0;
+  uint8_t locked = 0;
+  uint8_t changed = 0;
+  uint64_t now_us = hal_time_us();
+  esp_err_t err = ESP_OK;
+
+  if (sw_mask >> SW_MAX)
+    return ESP_ERR_NOT_SUPPORTED;
+
+  // locks are taken in index order, the outputs change while all of them are held.
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    if (!(sw_mask & (1 << sw_index)))
+      continue;
+    if (NULL == sw_context[sw_index].sw_mutex_req
+        || !hal_lock_take(sw_context[sw_index].sw_mutex_req))
+    {
+      err = ESP_FAIL;
+      goto unlock;
+    }
+    locked |= 1 << sw_index;
+  }
+
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    switch_context_t* sw_ctx = &sw_context[sw_index];
+    enum switch_status status = (enum switch_status) ((sw_states >> sw_index) & 0x1);
+    if (!(sw_mask & (1 << sw_index)))
+      continue;
+
+    if (switch_update_status(sw_index, sw_ctx, status, now_us))
+      changed |= 1 << sw_index;
+    if (PWM == switch_type_of(sw_ctx))
+    {
+      switch_apply_output(sw_index, sw_ctx, status);
+    }
+    else
+    {
+      pin_mask |= 1UL << sw_ctx->sw_gpio_pin;
+      pin_levels |= (uint32_t) SW_STATUS_LEVEL(status) << sw_ctx->sw_gpio_pin;
+    }
+  }
+  hal_gpio_set_levels(pin_mask, pin_levels);
+
+unlock:
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    if (locked & (1 << sw_index))
+      hal_lock_give(sw_context[sw_index].sw_mutex_req);
+  }
+  if (ESP_OK != err)
+    return err;
+
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    enum switch_status status = (enum switch_status) ((sw_states >> sw_index) & 0x1);
+    if (!(sw_mask & (1 << sw_index)))
+      continue;
+
+    // the Modbus coils follow, as they do after a LIMIT or PWM switch turned itself OFF.
+    if (changed & (1 << sw_index))
+    {
+      switch_notify_listeners(sw_index, status);
+      if (NULL != sw_context[sw_index].status_update_callback)
+        sw_context[sw_index].status_update_callback(sw_index, status);
+    }
+    if (ESP_OK != switch_limit_rearm(sw_index, status))
+      err = ESP_FAIL;
+  }
+  return err;
 }
 
 esp_err_t switch_adapter_get_status(uint8_t sw_index, uint8_t * status)
@@ -151,3 +390,53 @@ esp_err_t switch_adapter_get_status(uint8_t sw_index, uint8_t * status)
   *status = sw_context[sw_index].sw_conf.conf.sw_status;
   return ESP_OK;
 }
+
+enum switch_type switch_adapter_get_type(uint8_t sw_index)
+{
+  return (sw_index < SW_MAX) ? switch_type_of(&sw_context[sw_index]) : TOGGLING;
+}
+
+// a non-zero period turns the switch into a PWM switch, a zero period restores its configured type.
+esp_err_t switch_adapter_set_pwm(uint8_t sw_index, const pwm_conf_t * pwm)
+{
+  if (sw_index >= SW_MAX)
+    return ESP_ERR_NOT_SUPPORTED;
+  esp_err_t err = pwm_engine_check_conf(pwm);
+  if (ESP_OK != err)
+    return err;
+
+  switch_context_t* sw_ctx = &sw_context[sw_index];
+  if (!hal_lock_take(sw_ctx->sw_mutex_req))
+    return ESP_FAIL;
+  if (PWM == switch_type_of(sw_ctx) && 0 == pwm->period_ms)
+  {
+    pwm_engine_stop(sw_index);
+  }
+  sw_ctx->sw_pwm = *pwm;
+  // an ON switch picks up the new waveform immediately.
+  if (STA_ON == sw_ctx->sw_conf.conf.sw_status)
+  {
+    switch_apply_output(sw_index, sw_ctx, STA_ON);
+  }
+  hal_lock_give(sw_ctx->sw_mutex_req);
+  return ESP_OK;
+}
+
+esp_err_t switch_adapter_get_stats(uint8_t sw_index, switch_stats_t * stats)
+{
+  if (sw_index >= SW_MAX)
+    return ESP_ERR_NOT_SUPPORTED;
+
+  switch_context_t* sw_ctx = &sw_context[sw_index];
+  if (!hal_lock_take(sw_ctx->sw_mutex_req))
+    return ESP_FAIL;
+  switch_stats_fold_on_time(sw_ctx, hal_time_us());
+  *stats = sw_ctx->sw_stats;
+  hal_lock_give(sw_ctx->sw_mutex_req);
+  return ESP_OK;
+}
+
+void switch_adapter_set_stats_update_callback(stats_update_callback_t stats_update_callback)
+{
+  s_stats_update_callback = stats_update_callback;
+}
@@ -1,6 +1,7 @@
-#include "driver/gpio.h"
-#include "freertos/event_groups.h"
-#include "esp_netif.h"
+#include "esp_err.h"
+
+#include "board_hal.h"
+#include "pwm_engine.h"
 
 
 #define GPIO_OUTPUT_IO_0    15
@@ -13,19 +14,25 @@
 #define SW_PIN_SEL ((1ULL<<SW_1_GPIO_PIN) | (1ULL<<SW_2_GPIO_PIN) | (1ULL<<SW_3_GPIO_PIN))
 
 // HW switch was designed 'ON' at low level, 'OFF' at high level.
-#define SW_SET_STATUS(p, s) (gpio_set_level(p, !(s & 0x1)))
+#define SW_STATUS_LEVEL(s) (!(s & 0x1))
+#define SW_SET_STATUS(p, s) (hal_gpio_set_level(p, SW_STATUS_LEVEL(s)))
+#define SW_ON_LEVEL 0
 
 enum switch_index {
   SW1 = 0,
   SW2,
-  SW3
+  SW3,
+  SW_MAX
 };
 
 enum switch_type {
     // ON or OFF
     TOGGLING = 0,
     // ON->OFF->ON or OFF->ON->OFF
-    LIMIT = 1
+    LIMIT = 1,
+    // duty-cycle or N-pulse output while ON, selected at run time by a
+    // non-zero PWM period, it never appears in the stored conf_t.
+    PWM = 2
 };
 
 enum switch_status {
@@ -33,11 +40,27 @@ enum switch_status {
   STA_ON = 1
 };
 
+// running on-time is folded into the statistics and published this often.
+#define SW_STATS_REFRESH_MS (60 * 1000)
+// statistics are checkpointed to flash every N refreshes (hourly), to limit wear.
+#define SW_STATS_CHECKPOINT_REFRESHES 60
+#define SW_STATS_NVS_KEY "sw_stats"
+
 typedef void (*status_update_callback_t)(uint8_t sw_index, bool status);
+// observers of every status change, beside the single per switch update callback.
+#define SW_STATUS_LISTENER_MAX 2
+
+typedef struct switch_stats {
+  uint32_t transitions;
+  uint32_t last_change_s; // uptime in seconds, not persisted
+  uint64_t on_time_us;
+} switch_stats_t;
+
+typedef void (*stats_update_callback_t)(uint8_t sw_index, const switch_stats_t* stats);
 
 typedef struct conf {
     uint8_t sw_hold_duration:6; // in seconds
-    enum switch_type sw_type:1;
+    uint8_t sw_type:1; // enum switch_type, TOGGLING or LIMIT only
     enum switch_status sw_status:1;
 } conf_t;
 
@@ -48,15 +71,26 @@ typedef union switch_conf {
 
 typedef struct switch_context {
   uint8_t sw_gpio_pin;
-  SemaphoreHandle_t  sw_mutex_req;
-  TimerHandle_t sw_timer_handler;
+  hal_lock_handle_t sw_mutex_req;
+  hal_timer_handle_t sw_timer_handler;
   status_update_callback_t status_update_callback;
   switch_conf_t sw_conf;
+  switch_stats_t sw_stats;
+  uint64_t sw_on_since_us;
+  pwm_conf_t sw_pwm;
 } switch_context_t;
 
 void switch_adapter_init();
 esp_err_t switch_adapter_set_status(uint8_t sw_index, enum switch_status status);
 esp_err_t switch_adapter_chg_sta(uint8_t sw_index, bool sw_status);
+// switch_adapter_chg_sta() for every switch n in sw_mask, to bit n of sw_states. Plain outputs
+// change in one GPIO write, then listeners, the per switch update callbacks and LIMIT timers follow.
+esp_err_t switch_adapter_chg_sta_batch(uint8_t sw_mask, uint8_t sw_states);
 esp_err_t switch_adapter_get_status(uint8_t sw_index, uint8_t * status);
 void switch_adapter_set_state_update_callback(uint8_t sw_index, void * state_update_callback);
+esp_err_t switch_adapter_add_status_listener(status_update_callback_t status_listener);
+enum switch_type switch_adapter_get_type(uint8_t sw_index);
+esp_err_t switch_adapter_set_pwm(uint8_t sw_index, const pwm_conf_t * pwm);
+esp_err_t switch_adapter_get_stats(uint8_t sw_index, switch_stats_t * stats);
+void switch_adapter_set_stats_update_callback(stats_update_callback_t stats_update_callback);
 
@@ -2,6 +2,12 @@
 # "main" pseudo-component makefile.
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
-COMPONENT_SRCDIRS := . adapters servers
-COMPONENT_ADD_INCLUDEDIRS := . adapters servers
-COMPONENT_EMBED_TXTFILES := servers/index.html
+COMPONENT_SRCDIRS := . adapters servers hal
+COMPONENT_ADD_INCLUDEDIRS := . adapters servers hal
+# The web UI is not part of the image, it goes to the "www" partition (see the project Makefile).
+
+# configuration_schema_hash.h follows configuration_schema.h, see tools/gen_cfg_hash.py.
+$(COMPONENT_PATH)/adapters/configuration_schema_hash.h: $(COMPONENT_PATH)/adapters/configuration_schema.h $(PROJECT_PATH)/tools/gen_cfg_hash.py
+	$(PYTHON) $(PROJECT_PATH)/tools/gen_cfg_hash.py $< $@
+
+adapters/configuration_adapter.o: $(COMPONENT_PATH)/adapters/configuration_schema_hash.h
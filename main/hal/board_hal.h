@@ -0,0 +1,90 @@
+/*
+ * board_hal.h
+ *
+ * Thin hardware abstraction for digital outputs, digital inputs, timers and locks.
+ * board_hal_esp8266.c maps it onto the ESP8266 RTOS SDK (gpio driver, FreeRTOS timers),
+ * board_hal_linux.c provides a host backend driven by a simulated clock, which records
+ * every output edge so the actuation logic can be exercised off-target.
+ */
+
+#ifndef MAIN_BOARD_HAL_H_
+#define MAIN_BOARD_HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#define HAL_PIN_MAX 17
+
+typedef void (*hal_timer_cb_t)(void* arg);
+typedef void (*hal_gpio_isr_t)(void* arg);
+typedef void (*hal_hw_timer_isr_t)(void* arg);
+typedef struct hal_timer* hal_timer_handle_t;
+typedef struct hal_lock* hal_lock_handle_t;
+
+// digital outputs
+esp_err_t hal_gpio_output_init(uint32_t pin_mask);
+void hal_gpio_set_level(uint8_t pin, uint8_t level);
+// IRAM safe variant, for use in ISRs.
+void hal_gpio_set_level_from_isr(uint8_t pin, uint8_t level);
+// drive every pin of pin_mask to its bit in levels at once.
+void hal_gpio_set_levels(uint32_t pin_mask, uint32_t levels);
+
+// digital inputs
+esp_err_t hal_gpio_input_init(uint32_t pin_mask, bool pull_up);
+uint8_t hal_gpio_get_level(uint8_t pin);
+// isr is called on both edges of pin, in interrupt context.
+esp_err_t hal_gpio_set_edge_isr(uint8_t pin, hal_gpio_isr_t isr, void* arg);
+
+// monotonic time since boot
+uint64_t hal_time_us(void);
+
+// timers, callbacks run in timer task context (never in ISR).
+hal_timer_handle_t hal_timer_create(const char* name, uint32_t period_ms, bool auto_reload,
+                                    hal_timer_cb_t callback, void* arg);
+esp_err_t hal_timer_start(hal_timer_handle_t timer);
+esp_err_t hal_timer_stop(hal_timer_handle_t timer);
+esp_err_t hal_timer_change_period(hal_timer_handle_t timer, uint32_t period_ms);
+bool hal_timer_is_active(hal_timer_handle_t timer);
+// (re)start the timer from an ISR, the period restarts from now.
+void hal_timer_reset_from_isr(hal_timer_handle_t timer);
+
+// the single hardware timer, isr runs in interrupt context every period_us.
+esp_err_t hal_hw_timer_start(uint32_t period_us, hal_hw_timer_isr_t isr, void* arg);
+esp_err_t hal_hw_timer_stop(void);
+
+// short sections shared with ISRs
+void hal_critical_enter(void);
+void hal_critical_exit(void);
+
+// locks
+hal_lock_handle_t hal_lock_create(void);
+bool hal_lock_take(hal_lock_handle_t lock);
+void hal_lock_give(hal_lock_handle_t lock);
+
+#ifndef ESP_PLATFORM
+// Simulation controls, only available in the Linux backend.
+#define HAL_SIM_EDGE_LOG_SIZE 1024
+
+typedef struct hal_sim_edge {
+  uint64_t time_us;
+  uint8_t pin;
+  uint8_t level;
+} hal_sim_edge_t;
+
+// Reset clock, pin levels, timers and the edge log.
+void hal_sim_reset(void);
+// Advance the simulated clock, firing every expired timer in time order.
+void hal_sim_advance_us(uint64_t delta_us);
+// Copy the recorded edges (oldest first) into edges, return the number copied.
+size_t hal_sim_get_edges(hal_sim_edge_t* edges, size_t max_edges);
+// Drive the level seen by an input pin, edge ISRs fire on change.
+void hal_sim_set_input(uint8_t pin, uint8_t level);
+// Run each hardware timer ISR up to max_latency_us late, like behind a critical section on the
+// target, the next period still starts on time. The delays are pseudo random, same after each reset.
+void hal_sim_set_hw_timer_latency(uint32_t max_latency_us);
+#endif
+
+#endif /* MAIN_BOARD_HAL_H_ */
@@ -0,0 +1,241 @@
+#ifdef ESP_PLATFORM
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "driver/gpio.h"
+#include "driver/hw_timer.h"
+#include "esp8266/gpio_struct.h"
+#include "esp8266/eagle_soc.h"
+
+#include "board_hal.h"
+
+struct hal_timer {
+  TimerHandle_t handle;
+  hal_timer_cb_t callback;
+  void* arg;
+};
+
+struct hal_lock {
+  SemaphoreHandle_t handle;
+};
+
+esp_err_t hal_gpio_output_init(uint32_t pin_mask)
+{
+  gpio_config_t io_conf = {
+    .intr_type = GPIO_INTR_DISABLE,
+    .mode = GPIO_MODE_OUTPUT,
+    .pin_bit_mask = pin_mask,
+    .pull_down_en = 0,
+    .pull_up_en = 0
+  };
+  return gpio_config(&io_conf);
+}
+
+void hal_gpio_set_level(uint8_t pin, uint8_t level)
+{
+  gpio_set_level(pin, level);
+}
+
+void IRAM_ATTR hal_gpio_set_level_from_isr(uint8_t pin, uint8_t level)
+{
+  // gpio_set_level() lives in flash, write the registers directly.
+  if (16 == pin)
+  {
+    // GPIO16 is in the RTC domain.
+    WRITE_PERI_REG(RTC_GPIO_OUT, (READ_PERI_REG(RTC_GPIO_OUT) & ~1UL) | (level & 1));
+  }
+  else if (level)
+  {
+    GPIO.out_w1ts = 1UL << pin;
+  }
+  else
+  {
+    GPIO.out_w1tc = 1UL << pin;
+  }
+}
+
+void hal_gpio_set_levels(uint32_t pin_mask, uint32_t levels)
+{
+  uint32_t mask = pin_mask & 0xffff;
+
+  // GPIO0..15 change together in a single store, the PWM ISR also drives outputs.
+  if (mask)
+  {
+    hal_critical_enter();
+    GPIO.out.val = (GPIO.out.val & ~mask) | (levels & mask);
+    hal_critical_exit();
+  }
+  // GPIO16 is in the RTC domain, it follows right after.
+  if (pin_mask & (1UL << 16))
+  {
+    gpio_set_level(16, (levels >> 16) & 1);
+  }
+}
+
+esp_err_t hal_gpio_input_init(uint32_t pin_mask, bool pull_up)
+{
+  gpio_config_t io_conf = {
+    .intr_type = GPIO_INTR_DISABLE,
+    .mode = GPIO_MODE_INPUT,
+    .pin_bit_mask = pin_mask,
+    .pull_down_en = 0,
+    .pull_up_en = pull_up
+  };
+  return gpio_config(&io_conf);
+}
+
+uint8_t hal_gpio_get_level(uint8_t pin)
+{
+  return gpio_get_level(pin);
+}
+
+esp_err_t hal_gpio_set_edge_isr(uint8_t pin, hal_gpio_isr_t isr, void* arg)
+{
+  static bool isr_service_installed = false;
+  esp_err_t err;
+
+  if (!isr_service_installed)
+  {
+    err = gpio_install_isr_service(0);
+    if (ESP_OK != err)
+      return err;
+    isr_service_installed = true;
+  }
+
+  err = gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+  if (ESP_OK != err)
+    return err;
+  return gpio_isr_handler_add(pin, isr, arg);
+}
+
+uint64_t hal_time_us(void)
+{
+  return esp_timer_get_time();
+}
+
+// Periods shorter than one tick are rounded up, FreeRTOS rejects zero periods.
+static TickType_t hal_ms_to_ticks(uint32_t period_ms)
+{
+  TickType_t ticks = pdMS_TO_TICKS(period_ms);
+  return ticks > 0 ? ticks : 1;
+}
+
+static void hal_timer_expired(TimerHandle_t handle)
+{
+  struct hal_timer* timer = (struct hal_timer*) pvTimerGetTimerID(handle);
+  timer->callback(timer->arg);
+}
+
+hal_timer_handle_t hal_timer_create(const char* name, uint32_t period_ms, bool auto_reload,
+                                    hal_timer_cb_t callback, void* arg)
+{
+  struct hal_timer* timer = malloc(sizeof(struct hal_timer));
+  if (NULL == timer)
+    return NULL;
+
+  timer->callback = callback;
+  timer->arg = arg;
+  timer->handle = xTimerCreate(name,
+                               hal_ms_to_ticks(period_ms),
+                               auto_reload ? pdTRUE : pdFALSE,
+                               (void*) timer,
+                               hal_timer_expired);
+  if (NULL == timer->handle)
+  {
+    free(timer);
+    return NULL;
+  }
+  return timer;
+}
+
+esp_err_t hal_timer_start(hal_timer_handle_t timer)
+{
+  return (pdPASS == xTimerStart(timer->handle, 0)) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t hal_timer_stop(hal_timer_handle_t timer)
+{
+  return (pdPASS == xTimerStop(timer->handle, 0)) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t hal_timer_change_period(hal_timer_handle_t timer, uint32_t period_ms)
+{
+  if (0 == period_ms)
+    return ESP_ERR_INVALID_ARG;
+  // xTimerChangePeriod() also starts a dormant timer, keep the previous state.
+  bool active = hal_timer_is_active(timer);
+  if (pdPASS != xTimerChangePeriod(timer->handle, hal_ms_to_ticks(period_ms), 0))
+    return ESP_FAIL;
+  if (!active)
+    return hal_timer_stop(timer);
+  return ESP_OK;
+}
+
+bool hal_timer_is_active(hal_timer_handle_t timer)
+{
+  return pdFALSE != xTimerIsTimerActive(timer->handle);
+}
+
+void IRAM_ATTR hal_timer_reset_from_isr(hal_timer_handle_t timer)
+{
+  BaseType_t task_woken = pdFALSE;
+  xTimerResetFromISR(timer->handle, &task_woken);
+  if (pdFALSE != task_woken)
+    portYIELD_FROM_ISR();
+}
+
+esp_err_t hal_hw_timer_start(uint32_t period_us, hal_hw_timer_isr_t isr, void* arg)
+{
+  esp_err_t err = hw_timer_init(isr, arg);
+  if (ESP_OK != err)
+    return err;
+  return hw_timer_alarm_us(period_us, true);
+}
+
+esp_err_t hal_hw_timer_stop(void)
+{
+  hw_timer_disarm();
+  return hw_timer_deinit();
+}
+
+void hal_critical_enter(void)
+{
+  portENTER_CRITICAL();
+}
+
+void hal_critical_exit(void)
+{
+  portEXIT_CRITICAL();
+}
+
+hal_lock_handle_t hal_lock_create(void)
+{
+  struct hal_lock* lock = malloc(sizeof(struct hal_lock));
+  if (NULL == lock)
+    return NULL;
+
+  lock->handle = xSemaphoreCreateMutex();
+  if (NULL == lock->handle)
+  {
+    free(lock);
+    return NULL;
+  }
+  return lock;
+}
+
+bool hal_lock_take(hal_lock_handle_t lock)
+{
+  return pdTRUE == xSemaphoreTake(lock->handle, portMAX_DELAY);
+}
+
+void hal_lock_give(hal_lock_handle_t lock)
+{
+  xSemaphoreGive(lock->handle);
+}
+#endif
@@ -0,0 +1,319 @@
+#ifndef ESP_PLATFORM
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "esp_err.h"
+
+#include "board_hal.h"
+
+#define HAL_SIM_TIMER_MAX 16
+
+struct hal_timer {
+  const char* name;
+  uint64_t period_us;
+  uint64_t expiry_us;
+  bool auto_reload;
+  bool active;
+  hal_timer_cb_t callback;
+  void* arg;
+};
+
+struct hal_lock {
+  pthread_mutex_t mutex;
+};
+
+static uint64_t s_now_us = 0;
+static uint8_t s_pin_level[HAL_PIN_MAX];
+static hal_gpio_isr_t s_pin_isr[HAL_PIN_MAX];
+static void* s_pin_isr_arg[HAL_PIN_MAX];
+static uint32_t s_output_mask = 0;
+static uint32_t s_input_mask = 0;
+static struct hal_timer s_timers[HAL_SIM_TIMER_MAX];
+static size_t s_timer_count = 0;
+static struct hal_timer s_hw_timer;
+static hal_sim_edge_t s_edge_log[HAL_SIM_EDGE_LOG_SIZE];
+static size_t s_edge_head = 0;
+static size_t s_edge_count = 0;
+static uint32_t s_hw_timer_latency_us = 0;
+static uint32_t s_sim_random = 1;
+
+static void hal_sim_record_edge(uint8_t pin, uint8_t level)
+{
+  hal_sim_edge_t* edge = &s_edge_log[s_edge_head];
+  edge->time_us = s_now_us;
+  edge->pin = pin;
+  edge->level = level;
+  s_edge_head = (s_edge_head + 1) % HAL_SIM_EDGE_LOG_SIZE;
+  if (s_edge_count < HAL_SIM_EDGE_LOG_SIZE)
+    s_edge_count++;
+}
+
+esp_err_t hal_gpio_output_init(uint32_t pin_mask)
+{
+  if (pin_mask >> HAL_PIN_MAX)
+    return ESP_ERR_INVALID_ARG;
+  s_output_mask |= pin_mask;
+  return ESP_OK;
+}
+
+void hal_gpio_set_level(uint8_t pin, uint8_t level)
+{
+  if (pin >= HAL_PIN_MAX || !(s_output_mask & (1UL << pin)))
+    return;
+
+  level = !!level;
+  // only real transitions are recorded, like a logic analyzer would.
+  if (s_pin_level[pin] != level)
+  {
+    s_pin_level[pin] = level;
+    hal_sim_record_edge(pin, level);
+  }
+}
+
+void hal_gpio_set_level_from_isr(uint8_t pin, uint8_t level)
+{
+  hal_gpio_set_level(pin, level);
+}
+
+void hal_gpio_set_levels(uint32_t pin_mask, uint32_t levels)
+{
+  // the edges share one timestamp, as they do on the target.
+  for (uint8_t pin = 0; pin < HAL_PIN_MAX; pin++)
+  {
+    if (pin_mask & (1UL << pin))
+      hal_gpio_set_level(pin, (levels >> pin) & 1);
+  }
+}
+
+esp_err_t hal_gpio_input_init(uint32_t pin_mask, bool pull_up)
+{
+  if (pin_mask >> HAL_PIN_MAX)
+    return ESP_ERR_INVALID_ARG;
+  s_input_mask |= pin_mask;
+  for (uint8_t pin = 0; pin < HAL_PIN_MAX; pin++)
+  {
+    if (pin_mask & (1UL << pin))
+      s_pin_level[pin] = pull_up;
+  }
+  return ESP_OK;
+}
+
+uint8_t hal_gpio_get_level(uint8_t pin)
+{
+  return (pin < HAL_PIN_MAX) ? s_pin_level[pin] : 0;
+}
+
+esp_err_t hal_gpio_set_edge_isr(uint8_t pin, hal_gpio_isr_t isr, void* arg)
+{
+  if (pin >= HAL_PIN_MAX)
+    return ESP_ERR_INVALID_ARG;
+  s_pin_isr[pin] = isr;
+  s_pin_isr_arg[pin] = arg;
+  return ESP_OK;
+}
+
+uint64_t hal_time_us(void)
+{
+  return s_now_us;
+}
+
+hal_timer_handle_t hal_timer_create(const char* name, uint32_t period_ms, bool auto_reload,
+                                    hal_timer_cb_t callback, void* arg)
+{
+  if (s_timer_count >= HAL_SIM_TIMER_MAX)
+    return NULL;
+
+  struct hal_timer* timer = &s_timers[s_timer_count++];
+  timer->name = name;
+  timer->period_us = (uint64_t) period_ms * 1000;
+  timer->expiry_us = 0;
+  timer->auto_reload = auto_reload;
+  timer->active = false;
+  timer->callback = callback;
+  timer->arg = arg;
+  return timer;
+}
+
+esp_err_t hal_timer_start(hal_timer_handle_t timer)
+{
+  if (0 == timer->period_us)
+    return ESP_FAIL;
+  // same as FreeRTOS: (re)starting an active timer restarts its period.
+  timer->expiry_us = s_now_us + timer->period_us;
+  timer->active = true;
+  return ESP_OK;
+}
+
+esp_err_t hal_timer_stop(hal_timer_handle_t timer)
+{
+  timer->active = false;
+  return ESP_OK;
+}
+
+esp_err_t hal_timer_change_period(hal_timer_handle_t timer, uint32_t period_ms)
+{
+  if (0 == period_ms)
+    return ESP_ERR_INVALID_ARG;
+  timer->period_us = (uint64_t) period_ms * 1000;
+  if (timer->active)
+    timer->expiry_us = s_now_us + timer->period_us;
+  return ESP_OK;
+}
+
+bool hal_timer_is_active(hal_timer_handle_t timer)
+{
+  return timer->active;
+}
+
+void hal_timer_reset_from_isr(hal_timer_handle_t timer)
+{
+  hal_timer_start(timer);
+}
+
+esp_err_t hal_hw_timer_start(uint32_t period_us, hal_hw_timer_isr_t isr, void* arg)
+{
+  if (0 == period_us)
+    return ESP_ERR_INVALID_ARG;
+  s_hw_timer.name = "hw_timer";
+  s_hw_timer.period_us = period_us;
+  s_hw_timer.expiry_us = s_now_us + period_us;
+  s_hw_timer.auto_reload = true;
+  s_hw_timer.active = true;
+  s_hw_timer.callback = isr;
+  s_hw_timer.arg = arg;
+  return ESP_OK;
+}
+
+esp_err_t hal_hw_timer_stop(void)
+{
+  s_hw_timer.active = false;
+  return ESP_OK;
+}
+
+// the simulation is single threaded, ISRs only run from hal_sim_advance_us().
+void hal_critical_enter(void)
+{
+}
+
+void hal_critical_exit(void)
+{
+}
+
+hal_lock_handle_t hal_lock_create(void)
+{
+  struct hal_lock* lock = malloc(sizeof(struct hal_lock));
+  if (NULL == lock)
+    return NULL;
+  pthread_mutex_init(&lock->mutex, NULL);
+  return lock;
+}
+
+bool hal_lock_take(hal_lock_handle_t lock)
+{
+  return 0 == pthread_mutex_lock(&lock->mutex);
+}
+
+void hal_lock_give(hal_lock_handle_t lock)
+{
+  pthread_mutex_unlock(&lock->mutex);
+}
+
+void hal_sim_reset(void)
+{
+  s_now_us = 0;
+  memset(s_pin_level, 0, sizeof(s_pin_level));
+  memset(s_pin_isr, 0, sizeof(s_pin_isr));
+  memset(s_pin_isr_arg, 0, sizeof(s_pin_isr_arg));
+  s_output_mask = 0;
+  s_input_mask = 0;
+  memset(s_timers, 0, sizeof(s_timers));
+  s_timer_count = 0;
+  memset(&s_hw_timer, 0, sizeof(s_hw_timer));
+  s_edge_head = 0;
+  s_edge_count = 0;
+  s_hw_timer_latency_us = 0;
+  s_sim_random = 1;
+}
+
+void hal_sim_set_hw_timer_latency(uint32_t max_latency_us)
+{
+  s_hw_timer_latency_us = max_latency_us;
+}
+
+// xorshift32, reproducible unlike rand().
+static uint32_t hal_sim_random(void)
+{
+  s_sim_random ^= s_sim_random << 13;
+  s_sim_random ^= s_sim_random >> 17;
+  s_sim_random ^= s_sim_random << 5;
+  return s_sim_random;
+}
+
+static struct hal_timer* hal_sim_next_timer(uint64_t deadline_us)
+{
+  struct hal_timer* next = NULL;
+  for (size_t i = 0; i <= s_timer_count; i++)
+  {
+    // the hardware timer is checked last, software timers win ties.
+    struct hal_timer* timer = (i < s_timer_count) ? &s_timers[i] : &s_hw_timer;
+    if (timer->active && timer->expiry_us <= deadline_us
+        && (NULL == next || timer->expiry_us < next->expiry_us))
+    {
+      next = timer;
+    }
+  }
+  return next;
+}
+
+void hal_sim_advance_us(uint64_t delta_us)
+{
+  uint64_t deadline_us = s_now_us + delta_us;
+  struct hal_timer* timer;
+
+  // callbacks may start or stop timers, so pick the earliest one again after each of them.
+  while (NULL != (timer = hal_sim_next_timer(deadline_us)))
+  {
+    uint64_t run_us = timer->expiry_us;
+    if (&s_hw_timer == timer && s_hw_timer_latency_us > 0)
+      run_us += hal_sim_random() % (s_hw_timer_latency_us + 1);
+    // the clock never goes back, a timer that expired during a late ISR runs after it.
+    if (run_us > deadline_us)
+      run_us = deadline_us;
+    if (run_us > s_now_us)
+      s_now_us = run_us;
+    if (timer->auto_reload)
+      timer->expiry_us += timer->period_us;
+    else
+      timer->active = false;
+    timer->callback(timer->arg);
+  }
+  s_now_us = deadline_us;
+}
+
+size_t hal_sim_get_edges(hal_sim_edge_t* edges, size_t max_edges)
+{
+  size_t count = (s_edge_count < max_edges) ? s_edge_count : max_edges;
+  size_t tail = (s_edge_head + HAL_SIM_EDGE_LOG_SIZE - s_edge_count) % HAL_SIM_EDGE_LOG_SIZE;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    edges[i] = s_edge_log[(tail + i) % HAL_SIM_EDGE_LOG_SIZE];
+  }
+  return count;
+}
+
+void hal_sim_set_input(uint8_t pin, uint8_t level)
+{
+  if (pin >= HAL_PIN_MAX || !(s_input_mask & (1UL << pin)))
+    return;
+
+  level = !!level;
+  if (s_pin_level[pin] != level)
+  {
+    s_pin_level[pin] = level;
+    if (NULL != s_pin_isr[pin])
+      s_pin_isr[pin](s_pin_isr_arg[pin]);
+  }
+}
+#endif
@@ -0,0 +1,107 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_system.h"
+
+#include "board_hal.h"
+#include "metrics.h"
+
+static uint32_t metrics_free_heap(void) {
+    return esp_get_free_heap_size();
+}
+
+static uint32_t metrics_min_free_heap(void) {
+    return esp_get_minimum_free_heap_size();
+}
+
+// Always present, the list starts with them.
+static metric_t s_min_free_heap = {
+    .name = "heap_min_free_bytes",
+    .help = "Lowest free heap since boot.",
+    .type = METRIC_GAUGE,
+    .read = metrics_min_free_heap
+};
+static metric_t s_free_heap = {
+    .name = "heap_free_bytes",
+    .help = "Free heap.",
+    .type = METRIC_GAUGE,
+    .read = metrics_free_heap,
+    .next = &s_min_free_heap
+};
+static metric_t* s_metrics = &s_free_heap;
+
+void metrics_register(metric_t* metric) {
+    metric_t* last = NULL;
+
+    hal_critical_enter();
+    for (metric_t* m = s_metrics; m != NULL; m = m->next) {
+        if (m == metric)
+            goto unlock_ret;
+        // Join the end of the own family, or of the list.
+        if (last == NULL || strcmp(m->name, metric->name) == 0 || strcmp(last->name, metric->name) != 0)
+            last = m;
+    }
+    // A scrape may walk the list meanwhile, metric is complete before it is linked.
+    metric->next = last->next;
+    last->next = metric;
+unlock_ret:
+    hal_critical_exit();
+}
+
+typedef struct metrics_render_ctx {
+    metrics_sink_t sink;
+    void* ctx;
+    esp_err_t err;
+    size_t len;
+    char buf[METRICS_RENDER_BUF_LEN];
+} metrics_render_ctx_t;
+
+static void metrics_flush(metrics_render_ctx_t* render) {
+    if (render->len > 0 && render->err == ESP_OK)
+        render->err = render->sink(render->ctx, render->buf, render->len);
+    render->len = 0;
+}
+
+// Format a line straight into the buffer, flushing first if it does not fit.
+static void metrics_printf(metrics_render_ctx_t* render, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void metrics_printf(metrics_render_ctx_t* render, const char* fmt, ...) {
+    va_list args;
+
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        size_t room = sizeof(render->buf) - render->len;
+        va_start(args, fmt);
+        int n = vsnprintf(render->buf + render->len, room, fmt, args);
+        va_end(args);
+        if (n < 0)
+            return;
+        if ((size_t) n < room) {
+            render->len += n;
+            return;
+        }
+        metrics_flush(render);
+    }
+}
+
+esp_err_t metrics_render(metrics_sink_t sink, void* ctx) {
+    metrics_render_ctx_t render = {.sink = sink, .ctx = ctx, .err = ESP_OK, .len = 0};
+    const char* family = NULL;
+
+    for (metric_t* m = s_metrics; m != NULL; m = m->next) {
+        if (family == NULL || strcmp(family, m->name) != 0) {
+            family = m->name;
+            metrics_printf(&render, "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help,
+                           m->name, (m->type == METRIC_COUNTER) ? "counter" : "gauge");
+        }
+
+        uint32_t value = (m->read != NULL) ? m->read() : m->value;
+        if (m->labels != NULL) {
+            metrics_printf(&render, "%s{%s} %u\n", m->name, m->labels, (unsigned) value);
+        } else {
+            metrics_printf(&render, "%s %u\n", m->name, (unsigned) value);
+        }
+    }
+
+    metrics_flush(&render);
+    return render.err;
+}
@@ -0,0 +1,63 @@
+/*
+ * metrics.h
+ *
+ * Runtime counters and gauges shared by all modules, rendered in the Prometheus text format.
+ * A module keeps its metric_t in static storage and registers it once at start up.
+ * Every counter has a single writer: one task, or callers already serialized by a lock.
+ * An aligned 32-bit word is loaded and stored atomically, so updates and scrapes need
+ * neither a lock nor a read-modify-write instruction, which the ESP8266 does not have.
+ */
+
+#ifndef MAIN_METRICS_H_
+#define MAIN_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// a rendered sample line must fit, longer ones are dropped.
+#define METRICS_RENDER_BUF_LEN 256
+
+enum metric_type {
+    METRIC_COUNTER = 0,
+    METRIC_GAUGE
+};
+
+typedef uint32_t (*metric_read_t)(void);
+
+typedef struct metric {
+    const char* name;   // metric family, samples of a family are rendered together
+    const char* help;
+    const char* labels; // e.g. "switch=\"1\"", NULL without labels
+    uint8_t type;       // enum metric_type
+    volatile uint32_t value;
+    metric_read_t read; // sampled at render time instead of value, NULL otherwise
+    struct metric* next;
+} metric_t;
+
+#define METRIC_COUNTER_INIT(name, help, labels) \
+    {(name), (help), (labels), METRIC_COUNTER, 0, NULL, NULL}
+#define METRIC_GAUGE_INIT(name, help, labels, read) \
+    {(name), (help), (labels), METRIC_GAUGE, 0, (read), NULL}
+
+typedef esp_err_t (*metrics_sink_t)(void* ctx, const char* data, size_t len);
+
+static inline void metric_add(metric_t* metric, uint32_t delta) {
+    metric->value = metric->value + delta;
+}
+
+static inline void metric_inc(metric_t* metric) {
+    metric_add(metric, 1);
+}
+
+static inline void metric_set(metric_t* metric, uint32_t value) {
+    metric->value = value;
+}
+
+// Register once, before the metric is scraped, registering it again is ignored.
+void metrics_register(metric_t* metric);
+// Stream every metric through a small buffer into sink, returns the first sink error.
+esp_err_t metrics_render(metrics_sink_t sink, void* ctx);
+
+#endif /* MAIN_METRICS_H_ */
@@ -20,6 +20,10 @@
 #include "wifi_handler.h"
 #include "configuration_adapter.h"
 #include "switch_adapter.h"
+#include "input_adapter.h"
+#include "ota_adapter.h"
+#include "ota_client.h"
+#include "ota_selftest.h"
 #include "web_server_cfg_service.h"
 #include "web_server.h"
 #include "modbus_tcp_server.h"
@@ -27,11 +31,17 @@
 void app_main()
 {
   ESP_ERROR_CHECK(nvs_flash_init());
+  ESP_ERROR_CHECK(cfg_adp_init());
+  // Before the services it waits for, a new image is on trial from here.
+  ESP_ERROR_CHECK(ota_selftest_init());
   ESP_ERROR_CHECK(esp_netif_init()); // mDNS Implies tcpip_adapter_init();
   ESP_ERROR_CHECK(esp_event_loop_create_default());
 
   switch_adapter_init();
+  ESP_ERROR_CHECK(input_adapter_init());
+  ota_adp_init();
   wifi_hdl_start_service();
+  ESP_ERROR_CHECK(ota_client_init());
   // configurationServer
   ESP_ERROR_CHECK(web_server_start());
   modbus_tcp_server_start();
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/param.h>
 
@@ -78,6 +79,26 @@ const char* httpd_query_key_value_byref(const char *qry_str, const char *key, si
     return NULL;
 }
 
+esp_err_t httpd_req_query_value_decode_byref(httpd_req_t *r, const char *key, size_t max_len,
+                                             char** value, size_t* value_len) {
+    size_t query_len = 0;
+    size_t raw_len = 0;
+    char* query = (char*) httpd_req_get_url_query_str_byref(r, &query_len);
+
+    if (query == NULL || query_len > max_len)
+        return ESP_ERR_INVALID_SIZE;
+
+    // A "#fragment" may follow the query in the URI, the key lookup must not run into it.
+    query[query_len - 1] = '\0';
+    *value = (char*) httpd_query_key_value_byref(query, key, &raw_len);
+    if (*value == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    // Decoding never grows the value, the terminator replaces the following '&' or the query's own.
+    *value_len = httpd_query_value_decode(*value, raw_len, *value) - 1;
+    return ESP_OK;
+}
+
 static uint8_t hexstr_to_num(char c) {
     if(c>='0' && c<='9'){
         return c - '0';
@@ -91,17 +112,24 @@ static uint8_t hexstr_to_num(char c) {
 }
 
 // rawlen is the size of the raw input, also the size of decoded buffer.
-// The result (decoded) should be shorter than the raw input.
+// The result (decoded) is never longer than the raw input, decoded may be raw itself.
+// A malformed escape is kept as it is.
 // This function returns the actual length of the decoded string, including \0.
 size_t httpd_query_value_decode(const char* raw, size_t rawlen, char* decoded) {
     size_t rawpos = 0;
     size_t outlen = 0;
 
     while (rawpos < rawlen) {
-        if (raw[rawpos] == '%') {
-            rawpos++;
-            decoded[outlen] = hexstr_to_num(raw[rawpos++]) << 4;
-            decoded[outlen] |= hexstr_to_num(raw[rawpos++]);
+        uint8_t hi = 255;
+        uint8_t lo = 255;
+        if (raw[rawpos] == '%' && rawpos + 2 < rawlen) {
+            hi = hexstr_to_num(raw[rawpos + 1]);
+            lo = hexstr_to_num(raw[rawpos + 2]);
+        }
+
+        if (hi != 255 && lo != 255) {
+            decoded[outlen] = (hi << 4) | lo;
+            rawpos += 3;
         } else {
             decoded[outlen] = raw[rawpos++];
         }
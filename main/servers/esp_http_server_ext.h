@@ -19,15 +19,23 @@ static inline struct http_parser_url* httpd_url_from_req(httpd_req_t *req) {
     return (struct http_parser_url*) (((char*) req->aux) + AUX_OFFSET);
 }
 
-// Return the url string, the returned string should not be modified.
-// str_len outputs the length of the url, including the null terminator.
+// Return the query string, a reference into r->uri.
+// str_len outputs the length of the query, including the null terminator.
+// The query is not terminated at str_len - 1 if a "#fragment" follows it in the URI.
+// r->uri belongs to the request, its handler may modify the query in place, within str_len - 1 chars.
 const char* httpd_req_get_url_query_str_byref(httpd_req_t *r, size_t* str_len);
-// Return the value (CAREFUL: not null terminated), the returned string should not be modified.
+// Return the value (CAREFUL: not null terminated), a reference into qry_str.
 // str_len outputs the length of the value string, excluding the null terminator.
+// The value may be modified in place whenever qry_str may be.
 const char* httpd_query_key_value_byref(const char *qry_str, const char *key, size_t* strlen_out);
+// The value of key in the query of r, URL-decoded and terminated in place in r->uri, nothing is copied.
+// ESP_ERR_INVALID_SIZE without a query or with one longer than max_len, ESP_ERR_NOT_FOUND without key.
+// The query is modified, other values of it are read before, or not at all.
+esp_err_t httpd_req_query_value_decode_byref(httpd_req_t *r, const char *key, size_t max_len,
+                                             char** value, size_t* value_len);
 // Recover the non-printable chars in the raw request, null-terminated output will be placed in a decoded.
 // rawlen is the length of the raw string, excluding the null terminator.
-// decoded should be at least rawlen+1.
+// decoded should be at least rawlen+1, it may also be raw itself to decode in place.
 size_t httpd_query_value_decode(const char* raw, size_t rawlen, char* decoded);
 
 #endif /* MAIN_ESP_HTTP_SERVER_EXT_H_ */
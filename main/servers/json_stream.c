@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "json_stream.h"
+
+enum json_expect {
+    JSON_EXPECT_VALUE,
+    JSON_EXPECT_KEY,
+    JSON_EXPECT_COLON,
+    JSON_EXPECT_SEP, // ',' or the end of the container
+    JSON_EXPECT_NOTHING
+};
+
+static int json_reader_add(json_reader_t* reader, uint8_t type, size_t start, size_t end) {
+    if (reader->count >= reader->max || end > UINT16_MAX)
+        return -1;
+
+    json_token_t* tok = &reader->tokens[reader->count];
+    tok->type = type;
+    tok->start = start;
+    tok->end = end;
+    tok->next = reader->count + 1;
+    return reader->count++;
+}
+
+static int8_t json_hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static size_t json_skip_digits(const char* buf, size_t pos, size_t end) {
+    while (pos < end && buf[pos] >= '0' && buf[pos] <= '9')
+        pos++;
+    return pos;
+}
+
+// true, false, null or a number as RFC 8259 has it, callers convert them without further checks.
+static bool json_primitive_valid(const char* buf, size_t start, size_t end) {
+    static const char* const literals[] = {"true", "false", "null"};
+    size_t pos = start;
+    size_t digits;
+
+    for (uint8_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        if (end - start == strlen(literals[i]) && memcmp(buf + start, literals[i], end - start) == 0)
+            return true;
+    }
+
+    if (pos < end && buf[pos] == '-')
+        pos++;
+    // No leading zeros.
+    if (pos < end && buf[pos] == '0')
+        pos++;
+    else if ((digits = json_skip_digits(buf, pos, end)) > pos)
+        pos = digits;
+    else
+        return false;
+    if (pos < end && buf[pos] == '.') {
+        digits = json_skip_digits(buf, pos + 1, end);
+        if (digits == pos + 1)
+            return false;
+        pos = digits;
+    }
+    if (pos < end && (buf[pos] == 'e' || buf[pos] == 'E')) {
+        pos++;
+        if (pos < end && (buf[pos] == '+' || buf[pos] == '-'))
+            pos++;
+        digits = json_skip_digits(buf, pos, end);
+        if (digits == pos)
+            return false;
+        pos = digits;
+    }
+    return pos == end;
+}
+
+// Unescape [start, end) in place and terminate it, the result is never longer.
+static esp_err_t json_reader_unescape(char* buf, json_token_t* tok) {
+    size_t out = tok->start;
+
+    for (size_t in = tok->start; in < tok->end; in++) {
+        char c = buf[in];
+        if (c != '\\') {
+            buf[out++] = c;
+            continue;
+        }
+
+        c = buf[++in];
+        switch (c) {
+        case 'b': buf[out++] = '\b'; break;
+        case 'f': buf[out++] = '\f'; break;
+        case 'n': buf[out++] = '\n'; break;
+        case 'r': buf[out++] = '\r'; break;
+        case 't': buf[out++] = '\t'; break;
+        case '"':
+        case '\\':
+        case '/':
+            buf[out++] = c;
+            break;
+        case 'u': {
+            uint16_t cp = 0;
+            for (uint8_t i = 1; i <= 4; i++) {
+                int8_t digit = (in + i < tok->end) ? json_hex_digit(buf[in + i]) : -1;
+                if (digit < 0)
+                    return ESP_ERR_INVALID_ARG;
+                cp = (cp << 4) | digit;
+            }
+            in += 4;
+            // UTF-8, surrogate halves are kept as they are.
+            if (cp < 0x80) {
+                buf[out++] = cp;
+            } else if (cp < 0x800) {
+                buf[out++] = 0xc0 | (cp >> 6);
+                buf[out++] = 0x80 | (cp & 0x3f);
+            } else {
+                buf[out++] = 0xe0 | (cp >> 12);
+                buf[out++] = 0x80 | ((cp >> 6) & 0x3f);
+                buf[out++] = 0x80 | (cp & 0x3f);
+            }
+            break;
+        }
+        default:
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    tok->end = out;
+    buf[out] = '\0';
+    return ESP_OK;
+}
+
+esp_err_t json_reader_parse(json_reader_t* reader, char* buf, size_t len, json_token_t* tokens, uint16_t max_tokens) {
+    uint16_t stack[JSON_DEPTH_MAX];
+    uint8_t depth = 0;
+    bool allow_end = false;
+    enum json_expect expect = JSON_EXPECT_VALUE;
+    size_t pos;
+    int tok;
+
+    reader->buf = buf;
+    reader->tokens = tokens;
+    reader->count = 0;
+    reader->max = max_tokens;
+
+    for (pos = 0; pos < len && buf[pos] != '\0'; pos++) {
+        char c = buf[pos];
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            continue;
+
+        switch (c) {
+        case '{':
+        case '[':
+            if (expect != JSON_EXPECT_VALUE || depth >= JSON_DEPTH_MAX)
+                return ESP_ERR_INVALID_ARG;
+            tok = json_reader_add(reader, (c == '{') ? JSON_OBJECT : JSON_ARRAY, pos, pos);
+            if (tok < 0)
+                return ESP_ERR_NO_MEM;
+            stack[depth++] = tok;
+            expect = (c == '{') ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+            allow_end = true;
+            continue;
+
+        case '}':
+        case ']':
+            if (depth == 0 || (expect != JSON_EXPECT_SEP && !allow_end))
+                return ESP_ERR_INVALID_ARG;
+            tok = stack[--depth];
+            if (tokens[tok].type != ((c == '}') ? JSON_OBJECT : JSON_ARRAY))
+                return ESP_ERR_INVALID_ARG;
+            tokens[tok].end = pos + 1;
+            tokens[tok].next = reader->count;
+            expect = (depth > 0) ? JSON_EXPECT_SEP : JSON_EXPECT_NOTHING;
+            break;
+
+        case '"': {
+            if (expect != JSON_EXPECT_KEY && expect != JSON_EXPECT_VALUE)
+                return ESP_ERR_INVALID_ARG;
+            size_t start = pos + 1;
+            for (pos = start; pos < len && buf[pos] != '"'; pos++) {
+                if ((uint8_t) buf[pos] < 0x20)
+                    return ESP_ERR_INVALID_ARG;
+                if (buf[pos] == '\\')
+                    pos++;
+            }
+            if (pos >= len)
+                return ESP_ERR_INVALID_ARG;
+            if (json_reader_add(reader, JSON_STRING, start, pos) < 0)
+                return ESP_ERR_NO_MEM;
+            if (expect == JSON_EXPECT_KEY)
+                expect = JSON_EXPECT_COLON;
+            else
+                expect = (depth > 0) ? JSON_EXPECT_SEP : JSON_EXPECT_NOTHING;
+            break;
+        }
+
+        case ':':
+            if (expect != JSON_EXPECT_COLON)
+                return ESP_ERR_INVALID_ARG;
+            expect = JSON_EXPECT_VALUE;
+            break;
+
+        case ',':
+            // Separators only exist inside a container.
+            if (expect != JSON_EXPECT_SEP || depth == 0)
+                return ESP_ERR_INVALID_ARG;
+            expect = (tokens[stack[depth - 1]].type == JSON_OBJECT) ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+            break;
+
+        default: {
+            if (expect != JSON_EXPECT_VALUE || strchr("-0123456789tfn", c) == NULL)
+                return ESP_ERR_INVALID_ARG;
+            size_t start = pos;
+            while (pos < len && buf[pos] != '\0' && strchr(" \t\r\n,]}", buf[pos]) == NULL)
+                pos++;
+            if (!json_primitive_valid(buf, start, pos))
+                return ESP_ERR_INVALID_ARG;
+            if (json_reader_add(reader, JSON_PRIMITIVE, start, pos) < 0)
+                return ESP_ERR_NO_MEM;
+            pos--;
+            expect = (depth > 0) ? JSON_EXPECT_SEP : JSON_EXPECT_NOTHING;
+            break;
+        }
+        }
+        allow_end = false;
+    }
+
+    if (depth != 0 || reader->count == 0 || expect != JSON_EXPECT_NOTHING)
+        return ESP_ERR_INVALID_ARG;
+
+    // Tokenizing is over, delimiters may now be overwritten by terminators.
+    for (tok = 0; tok < reader->count; tok++) {
+        if (tokens[tok].type == JSON_STRING) {
+            if (json_reader_unescape(buf, &tokens[tok]) != ESP_OK)
+                return ESP_ERR_INVALID_ARG;
+        } else if (tokens[tok].type == JSON_PRIMITIVE) {
+            buf[tokens[tok].end] = '\0';
+        }
+    }
+    return ESP_OK;
+}
+
+const char* json_reader_text(const json_reader_t* reader, int tok) {
+    uint8_t type = json_reader_type(reader, tok);
+    return (type == JSON_STRING || type == JSON_PRIMITIVE) ? reader->buf + reader->tokens[tok].start : NULL;
+}
+
+const char* json_reader_str(const json_reader_t* reader, int tok) {
+    return (json_reader_type(reader, tok) == JSON_STRING) ? reader->buf + reader->tokens[tok].start : NULL;
+}
+
+int json_reader_find(const json_reader_t* reader, int obj, const char* key) {
+    int item;
+
+    if (json_reader_type(reader, obj) != JSON_OBJECT || key == NULL)
+        return -1;
+
+    json_reader_for_each_key(reader, obj, item) {
+        if (strcmp(reader->buf + reader->tokens[item].start, key) == 0)
+            return item + 1;
+    }
+    return -1;
+}
+
+void json_writer_init(json_writer_t* writer, json_sink_t sink, void* ctx) {
+    writer->sink = sink;
+    writer->ctx = ctx;
+    writer->err = ESP_OK;
+    writer->depth = 0;
+    writer->after_key = false;
+    writer->nonempty = 0;
+    writer->len = 0;
+}
+
+esp_err_t json_writer_flush(json_writer_t* writer) {
+    if (writer->len > 0 && writer->err == ESP_OK)
+        writer->err = writer->sink(writer->ctx, writer->buf, writer->len);
+    writer->len = 0;
+    return writer->err;
+}
+
+static void json_writer_put(json_writer_t* writer, const char* data, size_t len) {
+    while (len > 0) {
+        if (writer->len == sizeof(writer->buf))
+            json_writer_flush(writer);
+
+        size_t n = sizeof(writer->buf) - writer->len;
+        if (n > len)
+            n = len;
+        memcpy(writer->buf + writer->len, data, n);
+        writer->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void json_writer_putc(json_writer_t* writer, char c) {
+    json_writer_put(writer, &c, 1);
+}
+
+// Emit the ',' owed before a new element of the current container.
+static void json_writer_separate(json_writer_t* writer) {
+    if (writer->after_key) {
+        writer->after_key = false;
+        return;
+    }
+    if (writer->nonempty & (1 << writer->depth))
+        json_writer_putc(writer, ',');
+    writer->nonempty |= 1 << writer->depth;
+}
+
+static void json_writer_begin(json_writer_t* writer, char c) {
+    json_writer_separate(writer);
+    json_writer_putc(writer, c);
+    writer->depth++;
+    writer->nonempty &= ~(1 << writer->depth);
+}
+
+static void json_writer_end(json_writer_t* writer, char c) {
+    writer->depth--;
+    json_writer_putc(writer, c);
+}
+
+void json_writer_begin_object(json_writer_t* writer) {
+    json_writer_begin(writer, '{');
+}
+
+void json_writer_end_object(json_writer_t* writer) {
+    json_writer_end(writer, '}');
+}
+
+void json_writer_begin_array(json_writer_t* writer) {
+    json_writer_begin(writer, '[');
+}
+
+void json_writer_end_array(json_writer_t* writer) {
+    json_writer_end(writer, ']');
+}
+
+static void json_writer_quoted(json_writer_t* writer, const char* str) {
+    char esc[8];
+    const char* run = str;
+
+    json_writer_putc(writer, '"');
+    for (; *str; str++) {
+        uint8_t c = *str;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        // Copy the plain run in one go, then the escape.
+        json_writer_put(writer, run, str - run);
+        run = str + 1;
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = c;
+            json_writer_put(writer, esc, 2);
+        } else {
+            json_writer_put(writer, esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+        }
+    }
+    json_writer_put(writer, run, str - run);
+    json_writer_putc(writer, '"');
+}
+
+void json_writer_key(json_writer_t* writer, const char* key) {
+    json_writer_separate(writer);
+    json_writer_quoted(writer, key);
+    json_writer_putc(writer, ':');
+    writer->after_key = true;
+}
+
+void json_writer_string(json_writer_t* writer, const char* str) {
+    json_writer_separate(writer);
+    json_writer_quoted(writer, (str != NULL) ? str : "");
+}
+
+void json_writer_bool(json_writer_t* writer, bool val) {
+    json_writer_primitive(writer, val ? "true" : "false");
+}
+
+void json_writer_uint(json_writer_t* writer, uint32_t val) {
+    char num[12];
+
+    json_writer_separate(writer);
+    json_writer_put(writer, num, snprintf(num, sizeof(num), "%u", (unsigned) val));
+}
+
+void json_writer_primitive(json_writer_t* writer, const char* text) {
+    json_writer_separate(writer);
+    json_writer_put(writer, text, strlen(text));
+}
@@ -0,0 +1,93 @@
+/*
+ * json_stream.h
+ *
+ * Allocation free JSON for the HTTP API.
+ * The reader tokenizes a request in place: strings are unescaped and every string or
+ * primitive token is null terminated inside the caller's buffer, tokens live in a
+ * caller provided array.
+ * The writer streams the response through a small buffer into a sink, e.g.
+ * httpd_resp_send_chunk(), so no response tree or string is ever built.
+ */
+
+#ifndef MAIN_JSON_STREAM_H_
+#define MAIN_JSON_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define JSON_DEPTH_MAX 8
+#define JSON_WRITER_BUF_LEN 256
+
+enum json_type {
+    JSON_UNDEFINED = 0,
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_PRIMITIVE // number, true, false or null
+};
+
+typedef struct json_token {
+    uint8_t type;
+    uint16_t start;
+    uint16_t end;
+    uint16_t next; // index of the token following this one and all of its children
+} json_token_t;
+
+typedef struct json_reader {
+    char* buf;
+    json_token_t* tokens;
+    uint16_t count;
+    uint16_t max;
+} json_reader_t;
+
+// buf must hold len + 1 bytes, it is modified in place. Token 0 is the root value.
+esp_err_t json_reader_parse(json_reader_t* reader, char* buf, size_t len, json_token_t* tokens, uint16_t max_tokens);
+// Index of the value of key in the object token obj, -1 if there is none.
+int json_reader_find(const json_reader_t* reader, int obj, const char* key);
+// The text of a string or primitive token, NULL for containers and out of range indices.
+const char* json_reader_text(const json_reader_t* reader, int tok);
+// Like json_reader_text(), but NULL unless tok is a string.
+const char* json_reader_str(const json_reader_t* reader, int tok);
+
+#define json_reader_type(reader, tok) (((tok) >= 0 && (tok) < (reader)->count) ? (reader)->tokens[tok].type : JSON_UNDEFINED)
+// Iterate the values of an array, or the keys of an object (the value of key is key + 1).
+#define json_reader_for_each_item(reader, arr, item) \
+    for ((item) = (arr) + 1; (item) < (reader)->tokens[arr].next; (item) = (reader)->tokens[item].next)
+#define json_reader_for_each_key(reader, obj, key) \
+    for ((key) = (obj) + 1; (key) < (reader)->tokens[obj].next; (key) = (reader)->tokens[(key) + 1].next)
+
+typedef esp_err_t (*json_sink_t)(void* ctx, const char* data, size_t len);
+
+typedef struct json_writer {
+    json_sink_t sink;
+    void* ctx;
+    esp_err_t err; // first sink error, further output is dropped
+    uint8_t depth;
+    bool after_key;
+    uint16_t nonempty; // one bit per depth, set once the container holds an element
+    uint16_t len;
+    char buf[JSON_WRITER_BUF_LEN];
+} json_writer_t;
+
+void json_writer_init(json_writer_t* writer, json_sink_t sink, void* ctx);
+void json_writer_begin_object(json_writer_t* writer);
+void json_writer_end_object(json_writer_t* writer);
+void json_writer_begin_array(json_writer_t* writer);
+void json_writer_end_array(json_writer_t* writer);
+void json_writer_key(json_writer_t* writer, const char* key);
+void json_writer_string(json_writer_t* writer, const char* str);
+void json_writer_bool(json_writer_t* writer, bool val);
+void json_writer_uint(json_writer_t* writer, uint32_t val);
+// A primitive taken verbatim, e.g. a json_reader_text() of a JSON_PRIMITIVE token.
+void json_writer_primitive(json_writer_t* writer, const char* text);
+// Hand the buffered output to the sink, returns the first error of the whole response.
+esp_err_t json_writer_flush(json_writer_t* writer);
+
+#define json_writer_kv_string(writer, key, str) do { json_writer_key(writer, key); json_writer_string(writer, str); } while (0)
+#define json_writer_kv_bool(writer, key, val) do { json_writer_key(writer, key); json_writer_bool(writer, val); } while (0)
+#define json_writer_kv_uint(writer, key, val) do { json_writer_key(writer, key); json_writer_uint(writer, val); } while (0)
+
+#endif /* MAIN_JSON_STREAM_H_ */
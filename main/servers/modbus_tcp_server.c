@@ -16,11 +16,34 @@
 #include "wifi_handler.h"
 #include "configuration_adapter.h"
 #include "switch_adapter.h"
+#include "input_adapter.h"
 #include "modbus_tcp_server.h"
+#include "metrics.h"
+#include "ota_selftest.h"
 
 #define SLAVE_TAG "modbus tcp slave"
+#define MB_REQUESTS_METRIC "modbus_requests_total"
+#define MB_REQUESTS_HELP "Modbus requests by function, write functions include single and multiple writes."
 
 QueueHandle_t s_modbus_event_queue = NULL;
+static switch_stats_reg_t s_switch_stats_regs[SW_MAX];
+static switch_pwm_reg_t s_switch_pwm_regs[SW_MAX];
+
+// The controller reports the accessed area, which identifies the function code.
+// Only the distribute task updates these.
+static struct {
+  mb_event_group_t mb_event;
+  metric_t requests;
+} s_mb_request_metrics[] = {
+  {MB_EVENT_COILS_RD,       METRIC_COUNTER_INIT(MB_REQUESTS_METRIC, MB_REQUESTS_HELP, "function=\"read_coils\"")},
+  {MB_EVENT_DISCRETE_RD,    METRIC_COUNTER_INIT(MB_REQUESTS_METRIC, MB_REQUESTS_HELP, "function=\"read_discrete_inputs\"")},
+  {MB_EVENT_HOLDING_REG_RD, METRIC_COUNTER_INIT(MB_REQUESTS_METRIC, MB_REQUESTS_HELP, "function=\"read_holding_registers\"")},
+  {MB_EVENT_INPUT_REG_RD,   METRIC_COUNTER_INIT(MB_REQUESTS_METRIC, MB_REQUESTS_HELP, "function=\"read_input_registers\"")},
+  {MB_EVENT_COILS_WR,       METRIC_COUNTER_INIT(MB_REQUESTS_METRIC, MB_REQUESTS_HELP, "function=\"write_coils\"")},
+  {MB_EVENT_HOLDING_REG_WR, METRIC_COUNTER_INIT(MB_REQUESTS_METRIC, MB_REQUESTS_HELP, "function=\"write_registers\"")}
+};
+static metric_t s_mb_queue_drops = METRIC_COUNTER_INIT("modbus_event_queue_drops_total",
+    "Modbus events dropped because the event queue was full.", NULL);
 
 static void modbus_server_got_ip(void *arg, esp_event_base_t event_base,
                                  int32_t event_id, void *event_data)
@@ -34,6 +57,13 @@ static void modbus_server_got_ip(void *arg, esp_event_base_t event_base,
 void modbus_tcp_server_start()
 {
   modbus_tcp_server_init();
+  input_adapter_set_state_update_callback(&update_discrete_register);
+  switch_adapter_set_stats_update_callback(&update_stats_register);
+  for (uint8_t i = 0; i < sizeof(s_mb_request_metrics) / sizeof(s_mb_request_metrics[0]); i++)
+  {
+    metrics_register(&s_mb_request_metrics[i].requests);
+  }
+  metrics_register(&s_mb_queue_drops);
   xTaskCreate(modbus_tcp_distribute_event_task, "modbus_tcp_distribute_event_task", 2048, NULL, 2, NULL);
   xTaskCreate(modbus_tcp_switch_task, "modbus_tcp_switch_task", 2048, NULL, 2, NULL);
   ESP_LOGI(SLAVE_TAG, "Modbus slave is initialized.");
@@ -52,6 +82,8 @@ void modbus_tcp_server_init()
   ESP_ERROR_CHECK(mbc_slave_init_tcp(&mbc_slave_handler)); // Initialization of Modbus controller
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &modbus_server_got_ip, NULL));
   ESP_ERROR_CHECK(mbc_slave_start());
+  // Up in any Wi-Fi mode, the station may never get an IP within the trial.
+  ota_selftest_pass(OTA_SELFTEST_MODBUS);
 }
 
 void modbus_tcp_server_setup()
@@ -92,7 +124,15 @@ void modbus_tcp_distribute_event_task(void* param)
     // Check for read/write events of Modbus master for certain events
     modbus_event.mb_event = mbc_slave_check_event(MB_READ_WRITE_MASK);
     ESP_ERROR_CHECK(mbc_slave_get_param_info(&modbus_event.mb_params, MB_PAR_INFO_GET_TOUT));
-    xQueueSend(s_modbus_event_queue,(void *)&modbus_event,(TickType_t )MB_EVENT_QUEUE_TOUT);
+    for (uint8_t i = 0; i < sizeof(s_mb_request_metrics) / sizeof(s_mb_request_metrics[0]); i++)
+    {
+      if (modbus_event.mb_event & s_mb_request_metrics[i].mb_event)
+        metric_inc(&s_mb_request_metrics[i].requests);
+    }
+    if (pdTRUE != xQueueSend(s_modbus_event_queue,(void *)&modbus_event,(TickType_t )MB_EVENT_QUEUE_TOUT))
+    {
+      metric_inc(&s_mb_queue_drops);
+    }
   }
 
   ESP_LOGE(SLAVE_TAG, "Modbus Distribute Event task exits...");
@@ -110,11 +150,54 @@ static void update_switch_register(uint8_t sw_index, bool status)
            sw_index, status);
 }
 
+static void update_discrete_register(uint8_t states)
+{
+  // discrete inputs 0..7 share one byte, a single store publishes all of them
+  // atomically, so Modbus reads never need a critical section here.
+  *((volatile uint8_t*)&discrete_reg_params) = states;
+  ESP_LOGD(SLAVE_TAG, "DISCRETE Register changed: 0x%02x.", states);
+}
+
+#define MB_SET_U32_REG(reg, val) do { (reg)[0] = (uint16_t)((val) >> 16); (reg)[1] = (uint16_t)(val); } while (0)
+
+static void update_stats_register(uint8_t sw_index, const switch_stats_t* stats)
+{
+  uint32_t on_time_s = (uint32_t)(stats->on_time_us / 1000000);
+  // keep the three values of a switch consistent for a concurrent FC4 read.
+  portENTER_CRITICAL();
+  MB_SET_U32_REG(s_switch_stats_regs[sw_index].transitions, stats->transitions);
+  MB_SET_U32_REG(s_switch_stats_regs[sw_index].on_time_s, on_time_s);
+  MB_SET_U32_REG(s_switch_stats_regs[sw_index].last_change_s, stats->last_change_s);
+  portEXIT_CRITICAL();
+}
+
 static bool get_coil_status(uint8_t sw_index)
 {
   return (coil_reg_params.coils_port0 >> sw_index) & 1U;
 }
 
+static void apply_pwm_registers(uint32_t reg_offset, uint32_t reg_count)
+{
+  uint32_t first_sw = reg_offset / MB_PWM_REG_COUNT;
+  uint32_t last_sw = (reg_offset + reg_count - 1) / MB_PWM_REG_COUNT;
+
+  for (uint32_t sw_index = first_sw; sw_index <= last_sw && sw_index < SW_MAX; sw_index++)
+  {
+    pwm_conf_t pwm;
+    portENTER_CRITICAL();
+    pwm.period_ms = s_switch_pwm_regs[sw_index].period_ms;
+    pwm.duty_permille = s_switch_pwm_regs[sw_index].duty_permille;
+    pwm.pulses = s_switch_pwm_regs[sw_index].pulses;
+    portEXIT_CRITICAL();
+
+    if (ESP_OK != switch_adapter_set_pwm(sw_index, &pwm))
+    {
+      ESP_LOGE(SLAVE_TAG, "Invalid PWM parameters for Switch %d: period %u ms, duty %u, pulses %u.",
+               sw_index, pwm.period_ms, pwm.duty_permille, pwm.pulses);
+    }
+  }
+}
+
 void modbus_tcp_switch_task(void* param)
 {
   ESP_LOGI(SLAVE_TAG, "Start Modbus Switch task...");
@@ -158,6 +241,15 @@ void modbus_tcp_switch_task(void* param)
           ESP_LOGE(SLAVE_TAG, "Change Switch Status failed.");
         }
       }
+      else if (modbus_event.mb_event & MB_EVENT_HOLDING_REG_WR) {
+        ESP_LOGI(SLAVE_TAG, "HOLDING WRITE (%u us), ADDR:%u, TYPE:%u, INST_ADDR:0x%.4x, SIZE:%u",
+                 (uint32_t)modbus_event.mb_params.time_stamp,
+                 (uint32_t)modbus_event.mb_params.mb_offset,
+                 (uint32_t)modbus_event.mb_params.type,
+                 (uint32_t)modbus_event.mb_params.address,
+                 (uint32_t)modbus_event.mb_params.size);
+        apply_pwm_registers((uint32_t)modbus_event.mb_params.mb_offset, (uint32_t)modbus_event.mb_params.size);
+      }
       else
       {
         ESP_LOGI(SLAVE_TAG, "Unsupported Operation. (%u us), ADDR:%u, TYPE:%u, INST_ADDR:0x%.4x, SIZE:%u",
@@ -189,15 +281,15 @@ void modbus_tcp_server_setup_reg_data(void)
   // will send exception response for this register area.
   reg_area.type = MB_PARAM_HOLDING; // Set type of register area
   reg_area.start_offset = MB_REG_HOLDING_START; // Offset of register area in Modbus protocol
-  reg_area.address = (void*)&holding_reg_params; // Set pointer to storage instance
-  reg_area.size = sizeof(holding_reg_params); // Set the size of register storage instance
+  reg_area.address = (void*)s_switch_pwm_regs; // Set pointer to storage instance
+  reg_area.size = sizeof(s_switch_pwm_regs); // Set the size of register storage instance
   ESP_ERROR_CHECK(mbc_slave_set_descriptor(reg_area));
 
-  // Initialization of Input Registers area
+  // Initialization of Input Registers area, holds the switch statistics.
   reg_area.type = MB_PARAM_INPUT;
   reg_area.start_offset = MB_REG_INPUT_START;
-  reg_area.address = (void*)&input_reg_params;
-  reg_area.size = sizeof(input_reg_params);
+  reg_area.address = (void*)s_switch_stats_regs;
+  reg_area.size = sizeof(s_switch_stats_regs);
   ESP_ERROR_CHECK(mbc_slave_set_descriptor(reg_area));
 
   // Initialization of Coils register area
@@ -215,15 +307,8 @@ void modbus_tcp_server_setup_reg_data(void)
   ESP_ERROR_CHECK(mbc_slave_set_descriptor(reg_area));
 
   // Define initial state of parameters
-  discrete_reg_params.discrete_input1 = 1;
-  discrete_reg_params.discrete_input3 = 1;
-  discrete_reg_params.discrete_input5 = 1;
-  discrete_reg_params.discrete_input7 = 1;
+  update_discrete_register(input_adapter_get_states());
 
-  holding_reg_params.holding_data0 = 1.34;
-  holding_reg_params.holding_data1 = 2.56;
-  holding_reg_params.holding_data2 = 3.78;
-  holding_reg_params.holding_data3 = 4.90;
 
   coil_reg_params.coils_port0 = 0x55;
   coil_reg_params.coils_port1 = 0xAA;
@@ -237,9 +322,13 @@ void modbus_tcp_server_setup_reg_data(void)
   cfg_adp_get_u8_by_id(CFG_SW_3, (uint8_t*)&switch_value);
   update_switch_register(2, switch_value.sw_status);
 
-  input_reg_params.input_data0 = 1.12;
-  input_reg_params.input_data1 = 2.34;
-  input_reg_params.input_data2 = 3.56;
-  input_reg_params.input_data3 = 4.78;
+  switch_stats_t switch_stats;
+  for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++)
+  {
+    if (ESP_OK == switch_adapter_get_stats(sw_index, &switch_stats))
+    {
+      update_stats_register(sw_index, &switch_stats);
+    }
+  }
   ESP_LOGI(SLAVE_TAG, "Registers is initialized.");
 }
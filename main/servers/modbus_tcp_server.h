@@ -37,6 +37,26 @@
 #define MB_EVENT_QUEUE_SIZE (16)
 #define MB_EVENT_QUEUE_TOUT (10)
 
+// Per switch operating statistics, exposed as contiguous input registers
+// (FC4) starting at MB_REG_INPUT_START, 32-bit values are sent high word first.
+typedef struct switch_stats_reg
+{
+  uint16_t transitions[2];
+  uint16_t on_time_s[2];
+  uint16_t last_change_s[2];
+}switch_stats_reg_t;
+
+// Per switch PWM parameters, holding registers starting at MB_REG_HOLDING_START.
+// A non-zero period turns the switch into a PWM switch, see pwm_conf_t.
+typedef struct switch_pwm_reg
+{
+  uint16_t period_ms;
+  uint16_t duty_permille;
+  uint16_t pulses;
+}switch_pwm_reg_t;
+
+#define MB_PWM_REG_COUNT (sizeof(switch_pwm_reg_t) / sizeof(uint16_t))
+
 typedef struct modbus_event
 {
   mb_event_group_t mb_event;
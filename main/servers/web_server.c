@@ -1,5 +1,4 @@
 #include <sys/param.h>
-#include <cJSON.h>
 
 #include "esp_system.h"
 #include "esp_log.h"
@@ -16,13 +15,42 @@
 #include "esp_http_server_ext.h"
 
 #include "web_server.h"
+#include "json_stream.h"
 #include "wifi_handler.h"
 #include "web_server_cfg_service.h"
 #include "web_server_fota_service.h"
+#include "web_server_ws_service.h"
+#include "web_server_switch_service.h"
+#include "web_server_asset_service.h"
+#include "web_server_job.h"
 #include "configuration_adapter.h"
+#include "metrics.h"
 
 static httpd_handle_t server = NULL;
 #define TAG "webServer"
+
+typedef struct json_method_entry {
+    const char* name;
+    uint32_t hash;
+    web_srv_json_method_t handler;
+} json_method_entry_t;
+
+// JSON API methods of json_get and json_post, hashed by name.
+static json_method_entry_t json_methods[WEB_SRV_JSON_METHOD_SLOTS];
+static uint8_t json_method_count = 0;
+static void json_register_builtin_methods(void);
+
+// A registered URI handler, wrapped to count its requests.
+typedef struct web_srv_uri {
+    const httpd_uri_t* uri;
+    esp_err_t (*handler)(httpd_req_t *req);
+    void* user_ctx;
+    metric_t requests; // only updated in the httpd task
+    char labels[WEB_SRV_URI_LABELS_MAXLEN];
+} web_srv_uri_t;
+
+static web_srv_uri_t web_srv_uris[WEB_SRV_URI_HANDLERS_MAX];
+static uint8_t web_srv_uri_count = 0;
 httpd_uri_t restart = {
     .uri       = "/restart",
     .method    = HTTP_GET,
@@ -33,14 +61,57 @@ httpd_uri_t restart = {
 httpd_uri_t config_get = {
     .uri       = "/config",
     .method    = HTTP_GET,
-    .handler   = web_srv_cfg_service,
-    .user_ctx  = "Ok~~~"
+    .handler   = web_srv_cfg_service
+};
+
+httpd_uri_t config_snapshot_get = {
+    .uri       = "/config_snapshot",
+    .method    = HTTP_GET,
+    .handler   = web_srv_cfg_snapshot_get_service
+};
+
+httpd_uri_t config_snapshot_post = {
+    .uri       = "/config_snapshot",
+    .method    = HTTP_POST,
+    .handler   = web_srv_cfg_snapshot_post_service
+};
+
+httpd_uri_t ws_status = {
+    .uri          = "/ws",
+    .method       = HTTP_GET,
+    .handler      = web_srv_ws_service,
+    .is_websocket = true
+};
+
+httpd_uri_t jobs_get = {
+    .uri       = "/jobs",
+    .method    = HTTP_GET,
+    .handler   = web_srv_job_service
+};
+
+// Matches any path, registered last.
+httpd_uri_t asset_get = {
+    .uri       = "/*",
+    .method    = HTTP_GET,
+    .handler   = web_srv_asset_get_service
 };
 
-httpd_uri_t index_get = {
-    .uri       = "/",
+httpd_uri_t asset_list = {
+    .uri       = "/www",
     .method    = HTTP_GET,
-    .handler   = web_srv_index_service 
+    .handler   = web_srv_asset_list_service
+};
+
+httpd_uri_t asset_put = {
+    .uri       = "/www/*",
+    .method    = HTTP_PUT,
+    .handler   = web_srv_asset_put_service
+};
+
+httpd_uri_t asset_delete = {
+    .uri       = "/www/*",
+    .method    = HTTP_DELETE,
+    .handler   = web_srv_asset_delete_service
 };
 
 httpd_uri_t json_get = {
@@ -55,11 +126,35 @@ httpd_uri_t json_post = {
     .handler   = web_srv_json_post_service
 };
 
+httpd_uri_t switches_get = {
+    .uri       = "/switches",
+    .method    = HTTP_GET,
+    .handler   = web_srv_switch_get_service
+};
+
+httpd_uri_t switches_post = {
+    .uri       = "/switches",
+    .method    = HTTP_POST,
+    .handler   = web_srv_switch_post_service
+};
+
+httpd_uri_t metrics_get = {
+    .uri       = "/metrics",
+    .method    = HTTP_GET,
+    .handler   = web_srv_metrics_service
+};
+
 httpd_uri_t fota_post = {
     .uri       = "/fota",
     .method    = HTTP_POST,
     .handler   = web_srv_fota_service
 };
+
+httpd_uri_t fota_get = {
+    .uri       = "/fota",
+    .method    = HTTP_GET,
+    .handler   = web_srv_fota_status_service
+};
 // "/restart?confirm=yes", restart the system
 void restart_task(void* param) {
     web_server_stop();
@@ -95,9 +190,54 @@ esp_err_t web_srv_rst_service(httpd_req_t *req) {
     return ESP_OK;
 }
 
-esp_err_t web_srv_index_service(httpd_req_t *req) {
-    web_srv_send_rsp(req, NULL, index_html_start, strlen(index_html_start));
-    return ESP_OK;
+static esp_err_t web_srv_chunk_sink(void* ctx, const char* data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t*) ctx, data, len);
+}
+
+// "/metrics", Prometheus text format, streamed as it is rendered.
+esp_err_t web_srv_metrics_service(httpd_req_t *req) {
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    esp_err_t err = metrics_render(web_srv_chunk_sink, req);
+    if (err != ESP_OK)
+        return err;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t web_srv_uri_trampoline(httpd_req_t *req) {
+    web_srv_uri_t* entry = (web_srv_uri_t*) req->user_ctx;
+
+    metric_inc(&entry->requests);
+    // The handler sees its own user_ctx.
+    req->user_ctx = entry->user_ctx;
+    return entry->handler(req);
+}
+
+static esp_err_t web_srv_register_uri(httpd_uri_t* uri) {
+    web_srv_uri_t* entry = NULL;
+
+    // A restarted server reuses the entry, the handler is already wrapped.
+    for (uint8_t i = 0; i < web_srv_uri_count; i++) {
+        if (web_srv_uris[i].uri == uri)
+            entry = &web_srv_uris[i];
+    }
+
+    if (entry == NULL) {
+        if (web_srv_uri_count >= WEB_SRV_URI_HANDLERS_MAX)
+            return ESP_ERR_NO_MEM;
+        entry = &web_srv_uris[web_srv_uri_count++];
+        entry->uri = uri;
+        entry->handler = uri->handler;
+        entry->user_ctx = uri->user_ctx;
+        snprintf(entry->labels, sizeof(entry->labels), "uri=\"%s\",method=\"%s\"",
+                 uri->uri, http_method_str((enum http_method) uri->method));
+        entry->requests = (metric_t) METRIC_COUNTER_INIT("http_requests_total", "HTTP requests by URI handler.",
+                                                         entry->labels);
+        metrics_register(&entry->requests);
+
+        uri->handler = web_srv_uri_trampoline;
+        uri->user_ctx = entry;
+    }
+    return httpd_register_uri_handler(server, uri);
 }
 
 esp_err_t web_server_start(void) {
@@ -105,18 +245,38 @@ esp_err_t web_server_start(void) {
         return ESP_OK;
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = WEB_SRV_URI_HANDLERS_MAX;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+
+    json_register_builtin_methods();
+    if (web_srv_job_init() != ESP_OK)
+        ESP_LOGE(TAG, "Starting the job workers failed, slow requests are refused.");
+    // The API keeps working without the UI partition.
+    web_srv_asset_init();
 
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
-        httpd_register_uri_handler(server, &index_get);
-        httpd_register_uri_handler(server, &config_get);
-        httpd_register_uri_handler(server, &restart);
-        httpd_register_uri_handler(server, &json_get);
-        httpd_register_uri_handler(server, &json_post);
-        httpd_register_uri_handler(server, &fota_post);
+        web_srv_register_uri(&config_get);
+        web_srv_register_uri(&config_snapshot_get);
+        web_srv_register_uri(&config_snapshot_post);
+        web_srv_register_uri(&restart);
+        web_srv_register_uri(&json_get);
+        web_srv_register_uri(&json_post);
+        web_srv_register_uri(&fota_post);
+        web_srv_register_uri(&fota_get);
+        web_srv_register_uri(&switches_get);
+        web_srv_register_uri(&switches_post);
+        web_srv_register_uri(&metrics_get);
+        web_srv_register_uri(&ws_status);
+        web_srv_register_uri(&jobs_get);
+        web_srv_register_uri(&asset_list);
+        web_srv_register_uri(&asset_put);
+        web_srv_register_uri(&asset_delete);
+        web_srv_register_uri(&asset_get);
+        web_srv_ws_init(server);
         return ESP_OK;
     }
 
@@ -135,87 +295,168 @@ void web_server_stop(void) {
     ESP_LOGI(TAG, "Web server stopped.");
 }
 
-static void json_get_get_fields(cJSON* resp_root, cJSON* req_array) {
+void web_srv_json_writer_init(json_writer_t* writer, httpd_req_t *req) {
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    json_writer_init(writer, web_srv_chunk_sink, req);
+}
+
+esp_err_t web_srv_json_writer_finish(json_writer_t* writer, httpd_req_t *req) {
+    esp_err_t err = json_writer_flush(writer);
+    if (err != ESP_OK)
+        return err;
+    // Terminate the chunked response.
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+uint32_t web_srv_hash_str(const char* str) {
+    // FNV-1a
+    uint32_t h = 0x811c9dc5;
+    while (*str) {
+        h = (h ^ (uint8_t)*str++) * 0x01000193;
+    }
+    return h;
+}
+
+static json_method_entry_t* json_method_slot(const char* name, uint32_t hash) {
+    uint32_t slot = hash;
+
+    // Linear probing, the table is never more than half full.
+    for (uint8_t i = 0; i < WEB_SRV_JSON_METHOD_SLOTS; i++, slot++) {
+        json_method_entry_t* entry = &json_methods[slot & (WEB_SRV_JSON_METHOD_SLOTS - 1)];
+        if (entry->name == NULL || (entry->hash == hash && strcmp(entry->name, name) == 0))
+            return entry;
+    }
+    return NULL;
+}
+
+esp_err_t web_srv_json_register_method(const char* name, web_srv_json_method_t handler) {
+    uint32_t hash = web_srv_hash_str(name);
+    json_method_entry_t* entry = json_method_slot(name, hash);
+
+    if (entry == NULL || handler == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (entry->name == NULL && json_method_count >= WEB_SRV_JSON_METHOD_MAX)
+        return ESP_ERR_NO_MEM;
+
+    if (entry->name == NULL)
+        json_method_count++;
+    entry->hash = hash;
+    entry->handler = handler;
+    entry->name = name;
+    return ESP_OK;
+}
+
+static void json_get_get_fields(json_writer_t* writer, const json_reader_t* reader, int fields) {
     char param[HTTP_PARAM_MAXLEN];
+    int item;
 
-    if (req_array == NULL)
+    if (json_reader_type(reader, fields) != JSON_ARRAY)
         return;
 
-    cJSON* req_iterator = NULL;
-    cJSON_ArrayForEach(req_iterator, req_array) {
-        char* field_name = cJSON_GetStringValue(req_iterator);
+    json_reader_for_each_item(reader, fields, item) {
+        const char* field_name = json_reader_str(reader, item);
         enum cfg_data_idt cfg_id = cfg_adp_id_from_name(field_name);
         if (cfg_adp_get_by_id_to_readable(cfg_id, param, sizeof(param)) == ESP_OK) {
-            cJSON_AddStringToObject(resp_root, field_name, param);
+            json_writer_kv_string(writer, field_name, param);
         }
     }
 }
 
-static const char* json_post_set_fields(cJSON* req_array) {
-    const char* ret = HTTPD_200;
+static const char* json_post_set_fields(const json_reader_t* reader, int fields) {
+    int key;
 
-    if (req_array == NULL)
+    if (json_reader_type(reader, fields) != JSON_OBJECT)
         return NULL;
 
-    cJSON* req_iterator = NULL;
-    cJSON_ArrayForEach(req_iterator, req_array) {
-        char* field_name = req_iterator->string;
-        char* field_value = NULL;
-        if (cJSON_IsString(req_iterator))
-        {
-          field_value = cJSON_GetStringValue(req_iterator);
-        }
-        else
-        {
-          continue;
-        }
+    // All fields of the form are applied together in one NVS commit, or not at all.
+    cfg_adp_txn_handle_t txn = cfg_adp_txn_begin();
+    if (txn == NULL)
+        return HTTPD_500;
+
+    json_reader_for_each_key(reader, fields, key) {
+        const char* field_name = json_reader_str(reader, key);
+        const char* field_value = json_reader_str(reader, key + 1);
+        if (field_value == NULL)
+            continue;
 
         enum cfg_data_idt cfg_id = cfg_adp_id_from_name(field_name);
-        if (CFG_IDT_MAX == cfg_id || cfg_adp_set_by_id_from_raw(cfg_id, field_value) != ESP_OK) {
-            ret = HTTPD_404;
+        if (CFG_IDT_MAX == cfg_id || cfg_adp_txn_stage_from_raw(txn, cfg_id, field_value) != ESP_OK) {
+            cfg_adp_txn_rollback(txn);
+            return HTTPD_404;
         }
     }
-    return ret;
+
+    esp_err_t err = cfg_adp_txn_commit(txn);
+    if (err == ESP_OK)
+        return HTTPD_200;
+    // validators reject with ESP_ERR_INVALID_ARG, anything else failed to persist.
+    return (err == ESP_ERR_INVALID_ARG) ? HTTPD_404 : HTTPD_500;
 }
 
-static const char* json_post_parser(const cJSON* req) {
-    cJSON* req_method_node = cJSON_GetObjectItem(req, "method");
-    char* req_method = cJSON_GetStringValue(req_method_node);
+static esp_err_t json_method_get(const json_reader_t* request, json_writer_t* response) {
+    json_get_get_fields(response, request, json_reader_find(request, 0, "fields"));
+    return ESP_OK;
+}
 
-    if (strcmp(req_method, "set") == 0) {
-        return json_post_set_fields(cJSON_GetObjectItem(req, "fields"));
+static esp_err_t json_method_set(const json_reader_t* request, json_writer_t* response) {
+    const char* ret = json_post_set_fields(request, json_reader_find(request, 0, "fields"));
+    if (ret != NULL) {
+        json_writer_kv_string(response, "return_value", ret);
     }
-
-    return HTTPD_404;
+    return (ret != NULL && strcmp(ret, HTTPD_200) == 0) ? ESP_OK : ESP_FAIL;
 }
 static const char* const wifi_sta_status_str[] = {"disconnected", "connecting", "connected"};
 
-static void json_get_wifi_sta_status(cJSON* resp_root) {
-    char ssid[WIFI_SSID_MAXLEN];
-    ip_info_t ip_info;
+void json_get_wifi_sta_status(json_writer_t* writer) {
+    wifi_status_t status;
 
-    cJSON_AddStringToObjectCS(resp_root, "wifi_sta_status", wifi_sta_status_str[wifi_hdl_sta_query_status()]);
+    wifi_hdl_query_status(&status);
+    json_writer_kv_string(writer, "wifi_sta_status", wifi_sta_status_str[status.sta_status]);
 
-    if (wifi_hdl_sta_query_ap(ssid, sizeof(ssid)) == ESP_OK) {
-        cJSON_AddStringToObjectCS(resp_root, "wifi_sta_ap_ssid", ssid);
+    if (status.sta_associated) {
+        json_writer_kv_string(writer, "wifi_sta_ap_ssid", status.sta_ap_ssid);
 
-        if (wifi_hdl_query_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info) == ESP_OK) {
-            cJSON_AddStringToObjectCS(resp_root, "wifi_sta_ip4_address", ip_info.ip4_addr);
-            cJSON_AddStringToObjectCS(resp_root, "wifi_sta_ip4_netmask", ip_info.ip4_netmask);
-            cJSON_AddStringToObjectCS(resp_root, "wifi_sta_ip4_gateway", ip_info.ip4_gateway);
+        if (status.sta_ip_valid) {
+            json_writer_kv_string(writer, "wifi_sta_ip4_address", status.sta_ip.ip4_addr);
+            json_writer_kv_string(writer, "wifi_sta_ip4_netmask", status.sta_ip.ip4_netmask);
+            json_writer_kv_string(writer, "wifi_sta_ip4_gateway", status.sta_ip.ip4_gateway);
 
-            char* ipv6_addr[IPV6_ADDR_COUNT];
-            for (size_t i=0; i<ip_info.ip6_count; i++) {
-                ipv6_addr[i] = (char*)&ip_info.ip6_addr[i];
+            json_writer_key(writer, "wifi_sta_ip6_address");
+            json_writer_begin_array(writer);
+            for (size_t i=0; i<status.sta_ip.ip6_count; i++) {
+                json_writer_string(writer, status.sta_ip.ip6_addr[i]);
             }
-            cJSON_AddItemToObjectCS(resp_root, "wifi_sta_ip6_address",
-                                    cJSON_CreateStringArray((const char**)ipv6_addr, ip_info.ip6_count));
+            json_writer_end_array(writer);
+        }
+    }
+}
+
+static esp_err_t json_method_wifi_sta_status(const json_reader_t* request, json_writer_t* response) {
+    json_get_wifi_sta_status(response);
+    return ESP_OK;
+}
+
+// Worker: follow a connection attempt, done once connected, failed if it gave up or took too long.
+static esp_err_t json_job_wifi_connect(web_srv_job_t* job, void* arg) {
+    bool connecting = false;
+
+    for (uint32_t waited = 0; waited < WEB_SRV_WIFI_CONNECT_TIMEOUT_MS; waited += WEB_SRV_JOB_POLL_MS) {
+        uint8_t status = wifi_hdl_sta_query_status();
+        if (status == STA_CONNECTING) {
+            connecting = true;
+        } else if (connecting || waited >= WEB_SRV_WIFI_CONNECT_START_MS) {
+            // Not picked up in time: whatever the Wi-Fi task settled on.
+            return (status == STA_CONNECTED) ? ESP_OK : ESP_FAIL;
         }
+        web_srv_job_set_progress(job, waited * 100 / WEB_SRV_WIFI_CONNECT_TIMEOUT_MS);
+        vTaskDelay(WEB_SRV_JOB_POLL_MS / portTICK_PERIOD_MS);
     }
+    return ESP_ERR_TIMEOUT;
 }
 
-static void json_get_wifi_connect(cJSON* resp_root, cJSON* req) {
-    cJSON* req_item_node;
+static esp_err_t json_method_wifi_connect(const json_reader_t* reader, json_writer_t* writer) {
+    uint32_t job_id;
+    const char* req_item;
     char sta_ssid_req[WIFI_SSID_MAXLEN];
     char sta_pass_req[WIFI_PASS_MAXLEN];
     int use_prev_cfg = 0;
@@ -223,176 +464,179 @@ static void json_get_wifi_connect(cJSON* resp_root, cJSON* req) {
     sta_ssid_req[0] = '\0';
     sta_pass_req[0] = '\0';
 
-    req_item_node = cJSON_GetObjectItem(req, "wifi_sta_ssid");
-    if (req_item_node != NULL) {
+    req_item = json_reader_str(reader, json_reader_find(reader, 0, "wifi_sta_ssid"));
+    if (req_item != NULL) {
         use_prev_cfg = 1;
 
-        strncpy(sta_ssid_req, cJSON_GetStringValue(req_item_node), WIFI_SSID_MAXLEN);
+        strncpy(sta_ssid_req, req_item, WIFI_SSID_MAXLEN);
         // Trucate the string if it is greater than WIFI_SSID_MAXLEN-1
         sta_ssid_req[WIFI_SSID_MAXLEN-1] = '\0';
-        cJSON_AddStringToObjectCS(resp_root, "wifi_sta_ssid", sta_ssid_req);
+        json_writer_kv_string(writer, "wifi_sta_ssid", sta_ssid_req);
 
-        req_item_node = cJSON_GetObjectItem(req, "wifi_sta_pass");
-        if (req_item_node != NULL) {
-            strncpy(sta_pass_req, cJSON_GetStringValue(req_item_node), WIFI_PASS_MAXLEN);
+        req_item = json_reader_str(reader, json_reader_find(reader, 0, "wifi_sta_pass"));
+        if (req_item != NULL) {
+            strncpy(sta_pass_req, req_item, WIFI_PASS_MAXLEN);
             // Trucate the string if it is greater than WIFI_PASS_MAXLEN-1
             sta_pass_req[WIFI_PASS_MAXLEN-1] = '\0';
-            cJSON_AddStringToObjectCS(resp_root, "wifi_sta_pass", sta_pass_req);
+            json_writer_kv_string(writer, "wifi_sta_pass", sta_pass_req);
         }
     }
 
-    cJSON_AddBoolToObject(resp_root, "wifi_sta_use_prev_cfg", use_prev_cfg);
-    cJSON_AddBoolToObject(resp_root, "return_value",
-                          wifi_hdl_sta_connect(sta_ssid_req, sta_pass_req));
+    json_writer_kv_bool(writer, "wifi_sta_use_prev_cfg", use_prev_cfg);
+    uint8_t started = wifi_hdl_sta_connect(sta_ssid_req, sta_pass_req);
+    json_writer_kv_bool(writer, "return_value", started);
+    // The outcome is only known once the Wi-Fi task settles, a worker waits for it.
+    if (started && web_srv_job_submit("wifi_sta_connect", json_job_wifi_connect, NULL, 0, &job_id) == ESP_OK)
+        json_writer_kv_uint(writer, "job_id", job_id);
+    return ESP_OK;
 }
 
-static void json_get_wifi_ap_status(cJSON* resp_root) {
-    char ssid[WIFI_SSID_MAXLEN];
-    ip_info_t ip_info;
-    esp_err_t ret = wifi_hdl_ap_query(ssid, WIFI_SSID_MAXLEN);
+static esp_err_t json_method_wifi_disconnect(const json_reader_t* request, json_writer_t* response) {
+    wifi_hdl_sta_disconnect();
+    return ESP_OK;
+}
 
-    cJSON_AddBoolToObject(resp_root, "wifi_ap_turned_on", ret == ESP_OK);
+static esp_err_t json_method_wifi_ap_on(const json_reader_t* request, json_writer_t* response) {
+    json_writer_kv_bool(response, "return_value", wifi_hdl_ap_turn_on());
+    return ESP_OK;
+}
 
-    if (ret == ESP_OK) {
-        cJSON_AddStringToObjectCS(resp_root, "wifi_ap_ssid", ssid);
+static esp_err_t json_method_wifi_ap_off(const json_reader_t* request, json_writer_t* response) {
+    json_writer_kv_bool(response, "return_value", wifi_hdl_ap_turn_off());
+    return ESP_OK;
+}
+
+void json_get_wifi_ap_status(json_writer_t* writer) {
+    wifi_status_t status;
+
+    wifi_hdl_query_status(&status);
+    json_writer_kv_bool(writer, "wifi_ap_turned_on", status.ap_on);
+
+    if (status.ap_on) {
+        json_writer_kv_string(writer, "wifi_ap_ssid", status.ap_ssid);
 
-        if (wifi_hdl_query_ip_info(TCPIP_ADAPTER_IF_AP, &ip_info) == ESP_OK) {
-            cJSON_AddStringToObjectCS(resp_root, "wifi_ap_ip4_address", ip_info.ip4_addr);
-            cJSON_AddStringToObjectCS(resp_root, "wifi_ap_ip4_netmask", ip_info.ip4_netmask);
-            cJSON_AddStringToObjectCS(resp_root, "wifi_ap_ip4_gateway", ip_info.ip4_gateway);
+        if (status.ap_ip_valid) {
+            json_writer_kv_string(writer, "wifi_ap_ip4_address", status.ap_ip.ip4_addr);
+            json_writer_kv_string(writer, "wifi_ap_ip4_netmask", status.ap_ip.ip4_netmask);
+            json_writer_kv_string(writer, "wifi_ap_ip4_gateway", status.ap_ip.ip4_gateway);
 
-            char* ipv6_addr[IPV6_ADDR_COUNT];
-            for (size_t i=0; i<ip_info.ip6_count; i++) {
-                ipv6_addr[i] = (char*)&ip_info.ip6_addr[i];
+            json_writer_key(writer, "wifi_ap_ip6_address");
+            json_writer_begin_array(writer);
+            for (size_t i=0; i<status.ap_ip.ip6_count; i++) {
+                json_writer_string(writer, status.ap_ip.ip6_addr[i]);
             }
-            cJSON_AddItemToObjectCS(resp_root, "wifi_ap_ip6_address",
-                                    cJSON_CreateStringArray((const char**)ipv6_addr, ip_info.ip6_count));
+            json_writer_end_array(writer);
         }
     }
 }
 
-static cJSON* json_get_parser(cJSON* req) {
-    // Duplicate "method" field to the response
-    cJSON* req_item_node = cJSON_GetObjectItem(req, "method");
-    if (req_item_node == NULL) {
-        return NULL;
+static esp_err_t json_method_wifi_ap_status(const json_reader_t* request, json_writer_t* response) {
+    json_get_wifi_ap_status(response);
+    return ESP_OK;
+}
+
+static void json_register_builtin_methods(void) {
+    web_srv_json_register_method("get", json_method_get);
+    web_srv_json_register_method("set", json_method_set);
+    web_srv_json_register_method("wifi_sta_status", json_method_wifi_sta_status);
+    web_srv_json_register_method("wifi_sta_connect", json_method_wifi_connect);
+    web_srv_json_register_method("wifi_sta_disconnect", json_method_wifi_disconnect);
+    web_srv_json_register_method("wifi_ap_on", json_method_wifi_ap_on);
+    web_srv_json_register_method("wifi_ap_off", json_method_wifi_ap_off);
+    web_srv_json_register_method("wifi_ap_status", json_method_wifi_ap_status);
+    web_srv_json_register_method("ota_client_status", web_srv_ota_client_status_method);
+    web_srv_json_register_method("ota_client_check", web_srv_ota_client_check_method);
+}
+
+// Stream the response of a parsed request, ESP_ERR_NOT_FOUND before sending anything
+// if the method is missing or unknown.
+static esp_err_t json_dispatch(httpd_req_t *req, const json_reader_t* reader) {
+    json_writer_t writer;
+    json_method_entry_t* method;
+    const char* req_method = json_reader_str(reader, json_reader_find(reader, 0, "method"));
+    if (req_method == NULL) {
+        return ESP_ERR_NOT_FOUND;
     }
-    cJSON* resp_root = cJSON_CreateObject();
-    cJSON_DetachItemViaPointer(req, req_item_node);
-    cJSON_AddItemToObject(resp_root, "method", req_item_node);
-    char* req_method = cJSON_GetStringValue(req_item_node);
+
+    method = json_method_slot(req_method, web_srv_hash_str(req_method));
+    if (method == NULL || method->name == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    web_srv_json_writer_init(&writer, req);
+    json_writer_begin_object(&writer);
+
+    // Duplicate "method" field to the response
+    json_writer_kv_string(&writer, "method", req_method);
 
     // Copy trans_id
-    req_item_node = cJSON_GetObjectItem(req, "trans_id");
-    if (req_item_node != NULL) {
-        cJSON_DetachItemViaPointer(req, req_item_node);
-        cJSON_AddItemToObject(resp_root, "trans_id", req_item_node);
+    int trans_id = json_reader_find(reader, 0, "trans_id");
+    if (trans_id >= 0) {
+        json_writer_key(&writer, "trans_id");
+        if (json_reader_type(reader, trans_id) == JSON_STRING) {
+            json_writer_string(&writer, json_reader_text(reader, trans_id));
+        } else {
+            json_writer_primitive(&writer, (json_reader_type(reader, trans_id) == JSON_PRIMITIVE) ?
+                                           json_reader_text(reader, trans_id) : "null");
+        }
     }
 
-    if (strcmp(req_method, "get") == 0) {
-        json_get_get_fields(resp_root, cJSON_GetObjectItem(req, "fields"));
-    } else if (strcmp(req_method, "set") == 0) {
-        cJSON_AddStringToObjectCS(resp_root, "return_value",
-                                json_post_set_fields(cJSON_GetObjectItem(req, "fields")));
-    } else if (strcmp(req_method, "wifi_sta_status") == 0) {
-        json_get_wifi_sta_status(resp_root);
-    } else if (strcmp(req_method, "wifi_sta_connect") == 0) {
-        json_get_wifi_connect(resp_root, req);
-    } else if (strcmp(req_method, "wifi_sta_disconnect") == 0) {
-        wifi_hdl_sta_disconnect();
-    } else if (strcmp(req_method, "wifi_ap_on") == 0) {
-        cJSON_AddBoolToObject(resp_root, "return_value", wifi_hdl_ap_turn_on());
-    } else if (strcmp(req_method, "wifi_ap_off") == 0) {
-        cJSON_AddBoolToObject(resp_root, "return_value", wifi_hdl_ap_turn_off());
-    } else if (strcmp(req_method, "wifi_ap_status") == 0) {
-        json_get_wifi_ap_status(resp_root);
+    if (method->handler(reader, &writer) != ESP_OK) {
+        ESP_LOGD(TAG, "Method %s failed", req_method);
     }
 
-    return resp_root;
+    json_writer_end_object(&writer);
+    return web_srv_json_writer_finish(&writer, req);
 }
 
 esp_err_t web_srv_json_get_service(httpd_req_t *req) {
-    cJSON* json_req = NULL;
+    json_token_t tokens[WEB_SRV_JSON_TOKEN_MAX];
+    json_reader_t reader;
     esp_err_t ret = ESP_OK;
-    char* buf = NULL;
-    char* raw_json = NULL;
-    char* json_buf = NULL;
+    char* json = NULL;
     char* status = NULL;
     char* rsp_msg = NULL;
-    size_t buf_len = 0;
+    size_t json_len = 0;
 
-    buf_len = httpd_req_get_url_query_len(req) + 1;
-    // HTTP request value decode
-    if (buf_len <= 0 || buf_len > HTTP_GET_ARG_MAXLEN) {
+    // The URI belongs to this request, the value is decoded in place in it, nothing is copied.
+    ret = httpd_req_query_value_decode_byref(req, "json", HTTP_GET_ARG_MAXLEN, &json, &json_len);
+    if (ret != ESP_OK) {
       status = HTTPD_400;
-      rsp_msg = "query string has wrong size.";
-      goto func_ret;
-    }
-    buf = malloc(buf_len);
-
-    if (ESP_OK != httpd_req_get_url_query_str(req, buf, buf_len))
-    {
-      status = HTTPD_400; 
-      rsp_msg = "query string is not found.";
+      rsp_msg = (ret == ESP_ERR_INVALID_SIZE) ? "query string has wrong size." : "query string is not found.";
       goto func_ret;
     }
 
-    // it's suppose key value less than request's length.
-    // buf_len is enough.
-    raw_json = malloc(buf_len);
-    if (ESP_OK != httpd_query_key_value(buf, "json", raw_json, buf_len))
-    {
-      status = HTTPD_400; 
-      rsp_msg = "query string is not found.";
-      goto func_ret;
-    }
-
-    json_buf = malloc(buf_len);
-    httpd_query_value_decode(raw_json, strlen(raw_json), json_buf);
-
-    // Json Parse
-    json_req = cJSON_Parse(json_buf);
-    if (!json_req) {
-        ESP_LOGE("json", "Error before: [%s]", cJSON_GetErrorPtr());
+    // Json Parse, in place
+    if (json_reader_parse(&reader, json, json_len, tokens, WEB_SRV_JSON_TOKEN_MAX) != ESP_OK
+            || reader.tokens[0].type != JSON_OBJECT) {
+        ESP_LOGE("json", "Error parsing [%s]", json);
         status = HTTPD_400;
         rsp_msg = "parse json request failed.";
         goto func_ret;
     }
 
-    // Generate and send the response
-    cJSON* json_resp = json_get_parser(json_req);
-    if (json_resp) {
-        rsp_msg = cJSON_PrintUnformatted(json_resp);
-        cJSON_Delete(json_resp);
-    } else {
-      status = HTTPD_400;
-      rsp_msg = "unknown methods.";
-    }
+    // Generate and stream the response
+    ret = json_dispatch(req, &reader);
+    if (ret != ESP_ERR_NOT_FOUND)
+        return ret;
+    status = HTTPD_400;
+    rsp_msg = "unknown methods.";
 
 func_ret:
     ret = web_srv_send_rsp(req, status, rsp_msg, strlen(rsp_msg));
-    if (json_req)
-      cJSON_Delete(json_req);
-    if (buf)
-      free(buf);
-    if (raw_json)
-      free(raw_json);
-    if (json_buf)
-      free(json_buf);
-    if (rsp_msg)
-      free(rsp_msg);
-
     return ret;
 }
 
 
 
 esp_err_t web_srv_json_post_service(httpd_req_t *req) {
-    cJSON* json_req = NULL;
+    json_token_t tokens[WEB_SRV_JSON_TOKEN_MAX];
+    json_reader_t reader;
     esp_err_t ret = ESP_OK;
     char* status = NULL;
     char* buf = NULL;
     char* rsp_msg = NULL;
+    size_t received = 0;
 
     size_t remaining = req->content_len;
     if (remaining <= 1 || remaining >= 1024) {
@@ -402,10 +646,16 @@ esp_err_t web_srv_json_post_service(httpd_req_t *req) {
         goto func_ret;
     }
 
-    buf = (char*) malloc(remaining);
+    // One byte more for the reader's terminator.
+    buf = (char*) malloc(remaining + 1);
+    if (buf == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
     while (remaining > 0) {
-        ret = httpd_req_recv(req, buf, remaining);
+        ret = httpd_req_recv(req, buf + received, remaining);
         if (ret > 0) {
+            received += ret;
             remaining -= ret;
         } else if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
             /* Retry receiving if timeout occurred */
@@ -415,27 +665,27 @@ esp_err_t web_srv_json_post_service(httpd_req_t *req) {
             goto func_ret;
         }
     }
+    buf[received] = '\0';
 
-    json_req = cJSON_Parse(buf);
-    free(buf);
-    buf = NULL;
-    if (!json_req) {
-      ESP_LOGE("json", "Error before: [%s]", cJSON_GetErrorPtr());
+    if (json_reader_parse(&reader, buf, received, tokens, WEB_SRV_JSON_TOKEN_MAX) != ESP_OK
+            || reader.tokens[0].type != JSON_OBJECT) {
+      ESP_LOGE("json", "Error parsing the request");
       status = HTTPD_400;
       rsp_msg = "parse failed.";
       ret = web_srv_send_rsp(req, status, rsp_msg, strlen(rsp_msg));
       goto func_ret;
     }
 
-    // Json Parse
-    rsp_msg = "OK";
-    ret = web_srv_send_rsp(req, json_post_parser(json_req), rsp_msg, strlen(rsp_msg));
+    // Same methods and response as json_get
+    ret = json_dispatch(req, &reader);
+    if (ret == ESP_ERR_NOT_FOUND) {
+      status = HTTPD_404;
+      rsp_msg = "unknown methods.";
+      ret = web_srv_send_rsp(req, status, rsp_msg, strlen(rsp_msg));
+    }
 
 func_ret:
-    if (json_req)
-        cJSON_Delete(json_req);
     if (buf)
         free(buf);
     return ret;
 }
-
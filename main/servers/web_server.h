@@ -3,19 +3,44 @@
 #include "esp_http_server_ext.h"
 
 #include "web_server_cfg_service.h"
+#include "json_stream.h"
 
-// cJSON helpers
-// This method assumes the name is a literal, immutable during the entire lifecycle.
-#define cJSON_AddStringToObjectCS(object, name, value) (cJSON_AddItemToObjectCS(object, name, cJSON_CreateString(value)))
+// tokens of a JSON request, 8 bytes each on the handler stack.
+#define WEB_SRV_JSON_TOKEN_MAX 48
+
+#define WEB_SRV_URI_HANDLERS_MAX 20
+// uri="...",method="..." of the http_requests_total metric.
+#define WEB_SRV_URI_LABELS_MAXLEN 48
+
+// wifi_sta_connect job: the Wi-Fi task picks the request up, then the attempt settles.
+#define WEB_SRV_WIFI_CONNECT_START_MS 2000
+#define WEB_SRV_WIFI_CONNECT_TIMEOUT_MS 30000
+#define WEB_SRV_JOB_POLL_MS 100
+
+// JSON API methods, the hash table keeps twice as many slots.
+#define WEB_SRV_JSON_METHOD_MAX 16
+#define WEB_SRV_JSON_METHOD_SLOTS (2 * WEB_SRV_JSON_METHOD_MAX)
+
+// A JSON API method, called in the httpd task. The method, trans_id and the surrounding
+// object are written by the caller, the handler adds its own members to response.
+typedef esp_err_t (*web_srv_json_method_t)(const json_reader_t* request, json_writer_t* response);
 
 // server API
 esp_err_t web_server_start(void);
 void web_server_stop(void);
 
 esp_err_t web_srv_rst_service(httpd_req_t *req);
-esp_err_t web_srv_index_service(httpd_req_t *req);
 esp_err_t web_srv_json_get_service(httpd_req_t *req);
 esp_err_t web_srv_json_post_service(httpd_req_t *req);
+esp_err_t web_srv_metrics_service(httpd_req_t *req);
+void json_get_wifi_sta_status(json_writer_t* writer);
+void json_get_wifi_ap_status(json_writer_t* writer);
+// Stream a JSON response as chunks, finish sends the last chunk.
+void web_srv_json_writer_init(json_writer_t* writer, httpd_req_t *req);
+esp_err_t web_srv_json_writer_finish(json_writer_t* writer, httpd_req_t *req);
+// Register before web_server_start(), name must stay valid, registering it again replaces the handler.
+esp_err_t web_srv_json_register_method(const char* name, web_srv_json_method_t handler);
+uint32_t web_srv_hash_str(const char* str);
 esp_err_t web_srv_send_rsp(httpd_req_t *req, const char *status, const char * msg, size_t msg_len);
 void restart_task(void* param);
 
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_spiffs.h"
+
+#include <esp_http_server.h>
+
+#include "web_server.h"
+#include "web_server_asset_service.h"
+#include "json_stream.h"
+
+#define TAG "webServer assets"
+
+#ifndef HTTPD_304
+#define HTTPD_304 "304 Not Modified"
+#endif
+#define WEB_ASSET_PATH_MAXLEN (sizeof(WEB_ASSET_BASE_PATH) + WEB_ASSET_NAME_MAXLEN)
+#define WEB_ASSET_UPLOAD_PREFIX "/www/"
+// Digits of the content hash in a file name, see tools/gen_web_assets.py
+#define WEB_ASSET_HASH_LEN 8
+#define web_srv_asset_rsp(req, status, msg) web_srv_send_rsp(req, status, msg, strlen(msg))
+
+typedef struct web_asset_etag {
+    uint32_t path_hash; // 0 for a free slot
+    uint32_t etag;
+} web_asset_etag_t;
+
+// Served at "/" while the partition has no UI: mounting failed, the image was not flashed, or
+// the partition table of a device updated over the air has no "www" yet. Firmware updates
+// still work from it.
+static const char s_asset_fallback_page[] =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\">"
+    "<meta name=\"viewport\" content=\"width=device-width\"><title>Modbus Switch</title></head><body>"
+    "<h1>Modbus Switch</h1><p>The web UI is not installed. Flash it over serial with the firmware, or "
+    "upload it with tools/gen_web_assets.py --upload if the device has a \"www\" partition.</p>"
+    "<p><input type=\"file\" id=\"image\"> <button onclick=\"update()\">Update firmware</button> "
+    "<span id=\"status\"></span></p><script>function update(){"
+    "var f=document.getElementById('image').files[0],s=document.getElementById('status');"
+    "if(!f)return;s.textContent='Uploading...';"
+    "fetch('/fota',{method:'POST',body:f}).then(function(r){return r.text();})"
+    ".then(function(t){s.textContent=t;},function(e){s.textContent=e;});}</script></body></html>";
+
+// Only touched in the httpd task.
+static web_asset_etag_t s_asset_etags[WEB_ASSET_ETAG_SLOTS];
+static uint8_t s_asset_etag_next = 0;
+
+esp_err_t web_srv_asset_init(void) {
+    static bool s_asset_mounted = false;
+
+    if (s_asset_mounted)
+        return ESP_OK;
+
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = WEB_ASSET_BASE_PATH,
+        .partition_label = WEB_ASSET_PARTITION,
+        .max_files = 2,
+        .format_if_mount_failed = true
+    };
+    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Mounting partition \"%s\" failed, err=0x%x. Only the fallback page is served.",
+                 WEB_ASSET_PARTITION, err);
+        return err;
+    }
+    s_asset_mounted = true;
+    return ESP_OK;
+}
+
+// Copy the file name of a request path, anything that could leave the base directory is refused.
+static esp_err_t web_srv_asset_name(const char* uri, const char* prefix, char* name, size_t name_len) {
+    size_t prefix_len = strlen(prefix);
+    size_t len;
+
+    if (strncmp(uri, prefix, prefix_len) != 0)
+        return ESP_ERR_NOT_FOUND;
+    uri += prefix_len;
+    len = strcspn(uri, "?#");
+
+    // Room for the leading '/' of the object name and a ".gz" or "~" suffix.
+    if (len == 0 || len + 4 >= name_len || uri[0] == '.')
+        return ESP_ERR_NOT_FOUND;
+    for (size_t i = 0; i < len; i++) {
+        char c = uri[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                || c == '.' || c == '-' || c == '_' || c == '~'))
+            return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(name, uri, len);
+    name[len] = '\0';
+    return ESP_OK;
+}
+
+// "app.0123abcd.js": a dot separated part of WEB_ASSET_HASH_LEN hex digits, never the extension.
+static bool web_srv_asset_is_hashed(const char* name) {
+    const char* part = strchr(name, '.');
+
+    while (part != NULL) {
+        const char* end = strchr(part + 1, '.');
+        if (end == NULL)
+            break;
+        if (end - part - 1 == WEB_ASSET_HASH_LEN && strspn(part + 1, "0123456789abcdef") >= WEB_ASSET_HASH_LEN)
+            return true;
+        part = end;
+    }
+    return false;
+}
+
+static const char* web_srv_asset_type(const char* name, size_t len) {
+    static const char* const types[][2] = {
+        {".html", "text/html"},
+        {".js",   "application/javascript"},
+        {".css",  "text/css"},
+        {".json", "application/json"},
+        {".svg",  "image/svg+xml"},
+        {".png",  "image/png"},
+        {".ico",  "image/x-icon"},
+        {".woff2", "font/woff2"},
+    };
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        size_t ext_len = strlen(types[i][0]);
+        if (len >= ext_len && strncmp(name + len - ext_len, types[i][0], ext_len) == 0)
+            return types[i][1];
+    }
+    return "application/octet-stream";
+}
+
+static void web_srv_asset_forget(const char* path) {
+    uint32_t path_hash = web_srv_hash_str(path);
+
+    for (uint8_t i = 0; i < WEB_ASSET_ETAG_SLOTS; i++) {
+        if (s_asset_etags[i].path_hash == path_hash)
+            s_asset_etags[i].path_hash = 0;
+    }
+}
+
+// The FNV-1a of the content, computed once per upload and kept for the next requests.
+static uint32_t web_srv_asset_etag(const char* path, FILE* f, char* buf, size_t buf_len) {
+    uint32_t path_hash = web_srv_hash_str(path);
+    uint32_t h = 0x811c9dc5;
+    size_t n;
+
+    for (uint8_t i = 0; i < WEB_ASSET_ETAG_SLOTS; i++) {
+        if (s_asset_etags[i].path_hash == path_hash)
+            return s_asset_etags[i].etag;
+    }
+
+    while ((n = fread(buf, 1, buf_len, f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            h = (h ^ (uint8_t) buf[i]) * 0x01000193;
+        }
+    }
+    fseek(f, 0, SEEK_SET);
+
+    s_asset_etags[s_asset_etag_next].path_hash = path_hash;
+    s_asset_etags[s_asset_etag_next].etag = h;
+    s_asset_etag_next = (s_asset_etag_next + 1) % WEB_ASSET_ETAG_SLOTS;
+    return h;
+}
+
+esp_err_t web_srv_asset_get_service(httpd_req_t *req) {
+    char name[WEB_ASSET_NAME_MAXLEN];
+    char path[WEB_ASSET_PATH_MAXLEN];
+    char etag[12];
+    char if_none_match[64];
+    char chunk[WEB_ASSET_CHUNK_LEN];
+    bool gzip = true;
+    size_t n;
+    FILE* f;
+
+    if (req->uri[1] == '\0' || req->uri[1] == '?') {
+        strcpy(name, "index.html");
+    } else if (web_srv_asset_name(req->uri, "/", name, sizeof(name)) != ESP_OK) {
+        return web_srv_asset_rsp(req, HTTPD_404, "Not found.");
+    }
+
+    // Every browser accepts gzip, so the UI is normally only stored compressed.
+    snprintf(path, sizeof(path), "%s/%s.gz", WEB_ASSET_BASE_PATH, name);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        gzip = false;
+        snprintf(path, sizeof(path), "%s/%s", WEB_ASSET_BASE_PATH, name);
+        f = fopen(path, "r");
+    }
+    if (f == NULL && strcmp(name, "index.html") == 0) {
+        httpd_resp_set_type(req, "text/html");
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+        return httpd_resp_send(req, s_asset_fallback_page, sizeof(s_asset_fallback_page) - 1);
+    }
+    if (f == NULL)
+        return web_srv_asset_rsp(req, HTTPD_404, "Not found.");
+
+    if (web_srv_asset_is_hashed(name)) {
+        // A new content comes with a new name.
+        httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
+    } else {
+        snprintf(etag, sizeof(etag), "\"%08x\"", web_srv_asset_etag(path, f, chunk, sizeof(chunk)));
+        httpd_resp_set_hdr(req, "ETag", etag);
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+        // Still current in the browser cache, a truncated or missing header is simply a miss.
+        if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK
+                && strstr(if_none_match, etag) != NULL) {
+            fclose(f);
+            httpd_resp_set_status(req, HTTPD_304);
+            return httpd_resp_send(req, NULL, 0);
+        }
+    }
+
+    httpd_resp_set_type(req, web_srv_asset_type(name, strlen(name)));
+    if (gzip)
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+
+    // Straight from flash, one small buffer at a time.
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        if (httpd_resp_send_chunk(req, chunk, n) != ESP_OK) {
+            fclose(f);
+            return ESP_FAIL;
+        }
+    }
+    fclose(f);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t web_srv_asset_list_service(httpd_req_t *req) {
+    char path[WEB_ASSET_PATH_MAXLEN];
+    json_writer_t writer;
+    struct dirent* entry;
+    struct stat st;
+    size_t total = 0, used = 0;
+    DIR* dir = opendir(WEB_ASSET_BASE_PATH);
+
+    if (dir == NULL)
+        return web_srv_asset_rsp(req, HTTPD_500, "Web UI partition not mounted.");
+
+    esp_spiffs_info(WEB_ASSET_PARTITION, &total, &used);
+
+    web_srv_json_writer_init(&writer, req);
+    json_writer_begin_object(&writer);
+    json_writer_kv_uint(&writer, "total", total);
+    json_writer_kv_uint(&writer, "used", used);
+    json_writer_key(&writer, "files");
+    json_writer_begin_array(&writer);
+    while ((entry = readdir(dir)) != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", WEB_ASSET_BASE_PATH, entry->d_name);
+        json_writer_begin_object(&writer);
+        json_writer_kv_string(&writer, "name", entry->d_name);
+        json_writer_kv_uint(&writer, "size", (stat(path, &st) == 0) ? st.st_size : 0);
+        json_writer_end_object(&writer);
+    }
+    closedir(dir);
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    return web_srv_json_writer_finish(&writer, req);
+}
+
+esp_err_t web_srv_asset_put_service(httpd_req_t *req) {
+    char name[WEB_ASSET_NAME_MAXLEN];
+    char path[WEB_ASSET_PATH_MAXLEN];
+    char tmp_path[WEB_ASSET_PATH_MAXLEN];
+    char chunk[WEB_ASSET_CHUNK_LEN];
+    size_t remaining = req->content_len;
+    esp_err_t err = ESP_OK;
+    FILE* f;
+
+    if (web_srv_asset_name(req->uri, WEB_ASSET_UPLOAD_PREFIX, name, sizeof(name)) != ESP_OK)
+        return web_srv_asset_rsp(req, HTTPD_400, "Invalid file name.");
+
+    // Received next to the old file, which keeps being served until the upload is complete.
+    snprintf(path, sizeof(path), "%s/%s", WEB_ASSET_BASE_PATH, name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s~", path);
+    f = fopen(tmp_path, "w");
+    if (f == NULL)
+        return web_srv_asset_rsp(req, HTTPD_500, "Web UI partition not writable.");
+
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, chunk, MIN(remaining, sizeof(chunk)));
+        if (received == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (received <= 0) {
+            err = ESP_FAIL;
+            break;
+        }
+        if (fwrite(chunk, 1, received, f) != received) {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        remaining -= received;
+    }
+    if (fclose(f) != 0 && err == ESP_OK)
+        err = ESP_ERR_NO_MEM;
+
+    if (err != ESP_OK) {
+        unlink(tmp_path);
+        ESP_LOGE(TAG, "Upload of %s failed, %u bytes missing.", name, (unsigned) remaining);
+        // The connection is gone if the body could not be received.
+        if (err == ESP_FAIL)
+            return ESP_FAIL;
+        return web_srv_asset_rsp(req, HTTPD_500, "Web UI partition full.");
+    }
+
+    unlink(path);
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return web_srv_asset_rsp(req, HTTPD_500, "Replacing the file failed.");
+    }
+    web_srv_asset_forget(path);
+    ESP_LOGI(TAG, "Stored %s, %u bytes.", name, (unsigned) req->content_len);
+    return web_srv_asset_rsp(req, NULL, "OK");
+}
+
+esp_err_t web_srv_asset_delete_service(httpd_req_t *req) {
+    char name[WEB_ASSET_NAME_MAXLEN];
+    char path[WEB_ASSET_PATH_MAXLEN];
+
+    if (web_srv_asset_name(req->uri, WEB_ASSET_UPLOAD_PREFIX, name, sizeof(name)) != ESP_OK)
+        return web_srv_asset_rsp(req, HTTPD_400, "Invalid file name.");
+
+    snprintf(path, sizeof(path), "%s/%s", WEB_ASSET_BASE_PATH, name);
+    if (unlink(path) != 0)
+        return web_srv_asset_rsp(req, HTTPD_404, "Not found.");
+    web_srv_asset_forget(path);
+    return web_srv_asset_rsp(req, NULL, "OK");
+}
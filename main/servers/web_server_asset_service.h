@@ -0,0 +1,26 @@
+#pragma once
+#include <esp_http_server.h>
+
+// The web UI lives in its own SPIFFS partition, it is updated without a firmware OTA.
+#define WEB_ASSET_PARTITION   "www"
+#define WEB_ASSET_BASE_PATH   "/www"
+// Bytes read from flash and sent per chunk, on the handler stack.
+#define WEB_ASSET_CHUNK_LEN   512
+// SPIFFS object names, including the leading '/' and a ".gz" suffix.
+#define WEB_ASSET_NAME_MAXLEN CONFIG_SPIFFS_OBJ_NAME_LEN
+// Unhashed files whose ETag is remembered.
+#define WEB_ASSET_ETAG_SLOTS  4
+
+// Mount the partition, a blank one is formatted. If it fails, "/" is a minimal built-in page.
+esp_err_t web_srv_asset_init(void);
+
+// GET "/<name>", "/" is "/index.html" or else the built-in page. "<name>.gz" is preferred and
+// sent with "Content-Encoding: gzip". Names like "app.0123abcd.js" are content hashed by
+// tools/gen_web_assets.py and cached forever, the others are revalidated by ETag.
+esp_err_t web_srv_asset_get_service(httpd_req_t *req);
+// GET "/www": {"files":[{"name":"index.html.gz","size":1234}, ...]}
+esp_err_t web_srv_asset_list_service(httpd_req_t *req);
+// PUT "/www/<name>": the raw body replaces the file once it is complete.
+esp_err_t web_srv_asset_put_service(httpd_req_t *req);
+// DELETE "/www/<name>"
+esp_err_t web_srv_asset_delete_service(httpd_req_t *req);
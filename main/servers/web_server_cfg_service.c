@@ -1,5 +1,4 @@
 #include <sys/param.h>
-#include <cJSON.h>
 
 #include "esp_system.h"
 #include "esp_log.h"
@@ -15,15 +14,70 @@
 #include <esp_http_server.h>
 #include "esp_http_server_ext.h"
 
+#include "web_server.h"
 #include "web_server_cfg_service.h"
+#include "web_server_job.h"
 #include "configuration_adapter.h"
 
 static const char *TAG="APP";
 
+typedef struct cfg_snapshot_job {
+    size_t len;
+    uint8_t buf[];
+} cfg_snapshot_job_t;
+
+// Worker: commit the transaction staged and validated by the handler, in one NVS commit.
+static esp_err_t web_srv_cfg_commit_job(web_srv_job_t* job, void* arg) {
+    return cfg_adp_txn_commit(*(cfg_adp_txn_handle_t*) arg);
+}
+
+// Stage field/value, field2/value2, ... in a transaction, a worker applies it.
+static esp_err_t web_srv_cfg_set_fields(const char* query, uint32_t* job_id) {
+    char key[16];
+    char param[128];
+    uint8_t staged = 0;
+    esp_err_t err = ESP_OK;
+
+    cfg_adp_txn_handle_t txn = cfg_adp_txn_begin();
+    if (txn == NULL)
+        return ESP_ERR_NO_MEM;
+
+    for (uint8_t i = 1; i <= CFG_IDT_MAX; i++) {
+        // the first pair keeps the historical unnumbered keys.
+        snprintf(key, sizeof(key), (i == 1) ? "field" : "field%u", i);
+        if (httpd_query_key_value(query, key, param, sizeof(param)) != ESP_OK)
+            break;
+
+        enum cfg_data_idt cfg_id = cfg_adp_id_from_name(param);
+        snprintf(key, sizeof(key), (i == 1) ? "value" : "value%u", i);
+        if (httpd_query_key_value(query, key, param, sizeof(param)) != ESP_OK) {
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        err = cfg_adp_txn_stage_from_raw(txn, cfg_id, param);
+        if (err != ESP_OK)
+            break;
+        ESP_LOGI(TAG, "Stage %s = %s", cfg_adp_name_from_id(cfg_id), param);
+        staged++;
+    }
+
+    if (err == ESP_OK && staged == 0)
+        err = ESP_ERR_NOT_FOUND;
+    // Bad values get their 400 now, not a failed job later.
+    if (err == ESP_OK)
+        err = cfg_adp_txn_validate(txn);
+    if (err == ESP_OK)
+        err = web_srv_job_submit("config_set", web_srv_cfg_commit_job, &txn, sizeof(txn), job_id);
+    if (err != ESP_OK)
+        cfg_adp_txn_rollback(txn);
+    return err;
+}
+
 esp_err_t web_srv_cfg_service(httpd_req_t *req) {
     char* resp = NULL;
     char param[128];
     char* buf = NULL;
+    uint32_t job_id = 0;
 
     size_t buf_len = httpd_req_get_url_query_len(req) + 1;
     if (buf_len > 1) {
@@ -31,14 +85,9 @@ esp_err_t web_srv_cfg_service(httpd_req_t *req) {
         if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK) {
             if (httpd_query_key_value(buf, "method", param, sizeof(param)) == ESP_OK) {
                 if (strcmp(param, "set") == 0) {
-                    if (httpd_query_key_value(buf, "field", param, sizeof(param)) == ESP_OK) {
-                        enum cfg_data_idt cfg_id = cfg_adp_id_from_name(param);
-                        if (httpd_query_key_value(buf, "value", param, sizeof(param)) == ESP_OK) {
-                            if (cfg_adp_set_by_id_from_raw(cfg_id, param) == ESP_OK) {
-                                ESP_LOGI(TAG, "Set %s to %s", cfg_adp_name_from_id(cfg_id), param);
-                                resp = (char*)req->user_ctx;
-                            }
-                        }
+                    if (web_srv_cfg_set_fields(buf, &job_id) == ESP_OK) {
+                        free(buf);
+                        return web_srv_job_send_accepted(req, job_id);
                     }
                 } else if (strcmp(param, "get") == 0) {
                     if (httpd_query_key_value(buf, "field", param, sizeof(param)) == ESP_OK) {
@@ -65,3 +114,78 @@ esp_err_t web_srv_cfg_service(httpd_req_t *req) {
     return ESP_OK;
 }
 
+
+// GET "/config_snapshot", the whole configuration as one binary blob.
+esp_err_t web_srv_cfg_snapshot_get_service(httpd_req_t *req) {
+    size_t len = 0;
+    uint8_t* buf = (uint8_t*) malloc(CFG_SNAPSHOT_MAXLEN);
+    if (buf == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    if (cfg_adp_export_snapshot(buf, CFG_SNAPSHOT_MAXLEN, &len) == ESP_OK) {
+        httpd_resp_set_type(req, "application/octet-stream");
+        httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"config.bin\"");
+        httpd_resp_send(req, (const char*) buf, len);
+    } else {
+        httpd_resp_send_500(req);
+    }
+
+    free(buf);
+    return ESP_OK;
+}
+
+// Worker: verify and apply a snapshot, the copy made at submission is freed afterwards.
+static esp_err_t web_srv_cfg_import_job(web_srv_job_t* job, void* arg) {
+    const cfg_snapshot_job_t* snapshot = (const cfg_snapshot_job_t*) arg;
+    esp_err_t err = cfg_adp_import_snapshot(snapshot->buf, snapshot->len);
+
+    ESP_LOGI(TAG, "Import configuration snapshot of %d bytes, err=0x%x", snapshot->len, err);
+    return err;
+}
+
+// POST "/config_snapshot", a blob from GET or tools/cfg_snapshot.py is applied in one NVS commit by a worker.
+esp_err_t web_srv_cfg_snapshot_post_service(httpd_req_t *req) {
+    const char* status = HTTPD_400;
+    const char* resp = "Invalid snapshot.";
+    cfg_snapshot_job_t* snapshot;
+    size_t received = 0;
+    uint32_t job_id;
+
+    if (req->content_len == 0 || req->content_len > CFG_SNAPSHOT_MAXLEN) {
+        httpd_resp_set_status(req, status);
+        httpd_resp_send(req, resp, strlen(resp));
+        return ESP_OK;
+    }
+
+    size_t job_len = sizeof(cfg_snapshot_job_t) + req->content_len;
+    snapshot = (cfg_snapshot_job_t*) malloc(job_len);
+    if (snapshot == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, (char*) snapshot->buf + received, req->content_len - received);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (ret <= 0)
+            goto free_ret;
+        received += ret;
+    }
+    snapshot->len = received;
+
+    if (web_srv_job_submit("config_import", web_srv_cfg_import_job, snapshot, job_len, &job_id) == ESP_OK) {
+        web_srv_job_send_accepted(req, job_id);
+    } else {
+        status = "503 Service Unavailable";
+        resp = "Too many pending jobs.";
+        httpd_resp_set_status(req, status);
+        httpd_resp_send(req, resp, strlen(resp));
+    }
+
+free_ret:
+    free(snapshot);
+    return (received == req->content_len) ? ESP_OK : ESP_FAIL;
+}
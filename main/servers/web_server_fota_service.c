@@ -1,103 +1,342 @@
 #include <sys/param.h>
+#include <stdlib.h>
 
 #include <esp_ota_ops.h>
 #include <esp_log.h>
 #include "sdkconfig.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "board_hal.h"
 #include "web_server.h"
 #include "web_server_fota_service.h"
+#include "web_server_ws_service.h"
+#include "web_server_job.h"
+#include "ota_adapter.h"
+#include "ota_client.h"
+#include "ota_selftest.h"
+#include "ota_stream.h"
 
 
-#define OTA_BUF_SIZE   256 
 #define otaTag "webServer FOTA"
+// Patches and compressed uploads are received in pieces of this size, a plain image goes
+// straight to the OTA buffers.
+#define FOTA_RECV_BUF_SIZE 1024
+#define FOTA_RANGE_MAXLEN 48
+#define FOTA_SHA256_HDR "X-Image-SHA256"
 
-esp_err_t web_srv_fota_service(httpd_req_t *req) {
-  esp_ota_handle_t update_handle = 0;
-  const esp_partition_t *update_partition = NULL;
-  char* resp_str = "Upgrading OK.";
-  char* status = NULL;
-  ESP_LOGI(otaTag, "Starting OTA...");
-  update_partition = esp_ota_get_next_update_partition(NULL);
+typedef struct fota_job {
+  ota_adp_writer_handle_t writer;
+  const esp_partition_t *update_partition;
+} fota_job_t;
+
+// Worker: flush the last buffer, verify the image (esp_ota_end() reads the partition once more)
+// and boot it on trial (ota_selftest.h).
+static esp_err_t web_srv_fota_finish_job(web_srv_job_t* job, void* arg) {
+  const fota_job_t* fota = (const fota_job_t*) arg;
+
+  esp_err_t err = ota_adp_end(fota->writer, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGE(otaTag, "Error: esp_ota_end failed! err=0x%d. Image is invalid", err);
+    return err;
+  }
+  web_srv_job_set_progress(job, 50);
+
+  err = ota_selftest_arm(fota->update_partition, "");
+  if (err != ESP_OK) {
+    ESP_LOGE(otaTag, "Cannot start a trial of the image, err=0x%x", err);
+    return err;
+  }
+
+  err = esp_ota_set_boot_partition(fota->update_partition);
+  if (err != ESP_OK) {
+    ESP_LOGE(otaTag, "esp_ota_set_boot_partition failed! err=0x%d", err);
+    return err;
+  }
+  ESP_LOGI(otaTag, "esp_ota_set_boot_partition succeeded");
+
+  xTaskCreate(restart_task, "restart_task", 1024, NULL, 6, NULL);
+  return ESP_OK;
+}
+
+// One upload, possibly in several requests. The stream keeps the state of the decoders,
+// so a resumed upload continues exactly where the last request stopped.
+typedef struct fota_session {
+  const esp_partition_t *update_partition;
+  ota_stream_handle_t stream;
+  uint64_t last_us;
+  bool check_sha;
+  uint8_t image_sha256[OTA_ADP_SHA256_LEN]; // from FOTA_SHA256_HDR of the first request
+} fota_session_t;
+
+// Only used by the httpd task, which serves one request at a time.
+static fota_session_t* s_fota = NULL;
+
+static void web_srv_fota_discard(void) {
+  fota_session_t* s = s_fota;
+
+  if (s == NULL)
+    return;
+  if (s->stream != NULL)
+    ota_stream_abort(s->stream);
+  free(s);
+  s_fota = NULL;
+}
+
+// An interrupted upload holds the OTA buffers and blocks other updates until it expires.
+static void web_srv_fota_expire(void) {
+  if (s_fota != NULL && hal_time_us() - s_fota->last_us > FOTA_RESUME_TIMEOUT_MS * 1000ULL) {
+    ESP_LOGW(otaTag, "Interrupted upload expired at %d of %d bytes",
+             ota_stream_offset(s_fota->stream), ota_stream_total(s_fota->stream));
+    web_srv_fota_discard();
+  }
+}
+
+// "X-Image-SHA256: <hex>", the SHA-256 of the image the upload results in, whatever its format.
+static esp_err_t web_srv_fota_get_image_sha256(httpd_req_t *req, uint8_t* digest) {
+  char hex[2 * OTA_ADP_SHA256_LEN + 1];
+  unsigned b;
+
+  esp_err_t err = httpd_req_get_hdr_value_str(req, FOTA_SHA256_HDR, hex, sizeof(hex));
+  if (err == ESP_ERR_NOT_FOUND)
+    return err;
+  if (err != ESP_OK || strlen(hex) != 2 * OTA_ADP_SHA256_LEN)
+    return ESP_ERR_INVALID_ARG;
+  for (uint8_t i = 0; i < OTA_ADP_SHA256_LEN; i++) {
+    if (sscanf(hex + 2 * i, "%2x", &b) != 1)
+      return ESP_ERR_INVALID_ARG;
+    digest[i] = b;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t web_srv_fota_session_new(size_t total) {
+  const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
   if (update_partition == NULL) {
-    status = HTTPD_500;
-    resp_str = "Passive OTA partition not found";
-    ESP_LOGE(otaTag, resp_str);
-    return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
+    ESP_LOGE(otaTag, "Passive OTA partition not found");
+    return ESP_ERR_NOT_FOUND;
   }
-  ESP_LOGI(otaTag, "Writing to partition subtype %d at offset 0x%x",
-           update_partition->subtype, update_partition->address);
+  ESP_LOGI(otaTag, "Writing to partition subtype %d at offset 0x%x, %d bytes to receive",
+           update_partition->subtype, update_partition->address, total);
 
-  esp_err_t err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
+  fota_session_t* s = (fota_session_t*) calloc(1, sizeof(fota_session_t));
+  if (s == NULL)
+    return ESP_ERR_NO_MEM;
+  esp_err_t err = ota_stream_begin(update_partition, total, &s->stream);
   if (err != ESP_OK) {
-    resp_str = "OTA Begin Failed.";
-    status = HTTPD_500;
-    ESP_LOGE(otaTag, "%s, error=%d", resp_str, err);
-    return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
+    free(s);
+    return err;
   }
-  ESP_LOGI(otaTag, "esp_ota_begin succeeded");
-  ESP_LOGI(otaTag, "Please Wait. This may take time");
+  s->update_partition = update_partition;
+  s->last_us = hal_time_us();
+  s_fota = s;
+  return ESP_OK;
+}
 
+// The body of one request. Once a plain image is detected it is received straight into
+// the buffer the writer is not busy with, anything else goes through buf.
+static esp_err_t web_srv_fota_recv(httpd_req_t *req, ota_stream_handle_t stream, uint8_t* buf) {
   size_t remaining = req->content_len;
-  ESP_LOGI(otaTag, "Total Upgrade data size: %d bytes", remaining);
+  esp_err_t err;
 
-  esp_err_t ota_write_err = ESP_OK;
-  char *upgrade_data_buf = (char *)malloc(OTA_BUF_SIZE);
-  if (!upgrade_data_buf) {
-    status = HTTPD_500;
-    resp_str = "Couldn't allocate memory to upgrade data buffer";
-    ESP_LOGE(otaTag, resp_str);
-    return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
-  }
-  int binary_file_len = 0;
-  while (1) {
-    int data_read = httpd_req_recv(req, upgrade_data_buf, OTA_BUF_SIZE);
-    if (data_read == 0) {
-      ESP_LOGI(otaTag, "Connection closed,all data received");
-      break;
-    }
-    if (data_read < 0) {
-      ESP_LOGE(otaTag, "Error: SSL data read error");
-      err = ESP_FAIL;
-      break; 
-    }
-    if (data_read > 0) {
-    //  ESP_LOG_BUFFER_HEXDUMP(otaTag, upgrade_data_buf, data_read, ESP_LOG_INFO);
-      ota_write_err = esp_ota_write( update_handle, (const void *)upgrade_data_buf, data_read);
-      if (ota_write_err != ESP_OK) {
-        break;
-      }
-      binary_file_len += data_read;
-     // ESP_LOGI(otaTag, "Written image length %d", binary_file_len);
+  while (remaining > 0) {
+    size_t space = FOTA_RECV_BUF_SIZE;
+    uint8_t* direct = ota_stream_get_buf(stream, &space);
+    uint8_t* dst = (direct != NULL) ? direct : buf;
+    int data_read = httpd_req_recv(req, (char*) dst, MIN(space, remaining));
+    if (data_read == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (data_read <= 0) {
+      ESP_LOGE(otaTag, "Error: connection closed, %d bytes missing", remaining);
+      return ESP_FAIL;
     }
+
+    if (direct != NULL)
+      err = ota_stream_put(stream, data_read);
+    else
+      err = ota_stream_write(stream, buf, data_read);
+    if (err != ESP_OK)
+      return err;
+    remaining -= data_read;
+    web_srv_ws_fota_progress(ota_stream_offset(stream), ota_stream_total(stream));
   }
-  free(upgrade_data_buf);
-  ESP_LOGI(otaTag, "Total binary data length writen: %d", binary_file_len);
+  return ESP_OK;
+}
 
-  esp_err_t ota_end_err = esp_ota_end(update_handle);
-  if (ESP_OK != err)
-  {
-    return err;
+// "Content-Range: bytes <first>-<last>/<total>", ESP_ERR_NOT_FOUND without one.
+static esp_err_t web_srv_fota_get_range(httpd_req_t *req, size_t* first, size_t* last, size_t* total) {
+  char range[FOTA_RANGE_MAXLEN];
+  unsigned f, l, t;
+
+  if (httpd_req_get_hdr_value_str(req, "Content-Range", range, sizeof(range)) != ESP_OK)
+    return ESP_ERR_NOT_FOUND;
+  if (sscanf(range, "bytes %u-%u/%u", &f, &l, &t) != 3 || f > l || l >= t)
+    return ESP_ERR_INVALID_ARG;
+  *first = f;
+  *last = l;
+  *total = t;
+  return ESP_OK;
+}
+
+// {"state":"idle"} or {"state":"receiving","offset":N,"total":N,"sha256":"<of the first offset bytes>"}
+static esp_err_t web_srv_fota_send_status(httpd_req_t *req, const char* status) {
+  json_writer_t writer;
+
+  if (status != NULL)
+    httpd_resp_set_status(req, status);
+  web_srv_json_writer_init(&writer, req);
+  json_writer_begin_object(&writer);
+  if (s_fota == NULL) {
+    json_writer_kv_string(&writer, "state", "idle");
+  } else {
+    uint8_t digest[OTA_STREAM_SHA256_LEN];
+    char hex[2 * sizeof(digest) + 1];
+
+    ota_stream_sha256(s_fota->stream, digest);
+    for (uint8_t i = 0; i < sizeof(digest); i++)
+      sprintf(hex + 2 * i, "%02x", digest[i]);
+
+    json_writer_kv_string(&writer, "state", "receiving");
+    json_writer_kv_uint(&writer, "offset", ota_stream_offset(s_fota->stream));
+    json_writer_kv_uint(&writer, "total", ota_stream_total(s_fota->stream));
+    json_writer_kv_string(&writer, "sha256", hex);
   }
-  if (ota_write_err != ESP_OK) {
-    ESP_LOGE(otaTag, "Error: esp_ota_write failed! err=0x%d", err);
+  json_writer_end_object(&writer);
+  return web_srv_json_writer_finish(&writer, req);
+}
+
+static esp_err_t web_srv_fota_send_err(httpd_req_t *req, esp_err_t err) {
+  char* resp_str;
+  char* status;
+
+  switch (err) {
+  case ESP_ERR_INVALID_STATE:
+    status = "409 Conflict";
+    resp_str = "Another update is in progress.";
+    break;
+  case ESP_ERR_INVALID_VERSION:
+    status = "409 Conflict";
+    resp_str = "The patch is not for the running firmware.";
+    break;
+  case ESP_ERR_INVALID_ARG:
+  case ESP_ERR_INVALID_SIZE:
+  case ESP_ERR_INVALID_CRC:
+    status = HTTPD_400;
+    resp_str = "Invalid image.";
+    break;
+  case ESP_ERR_NOT_FOUND:
+    status = HTTPD_500;
+    resp_str = "Passive OTA partition not found";
+    break;
+  default:
     status = HTTPD_500;
     resp_str = "OTA Write Failed";
+    break;
+  }
+  ESP_LOGE(otaTag, "%s err=0x%x", resp_str, err);
+  return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
+}
+
+esp_err_t web_srv_fota_status_service(httpd_req_t *req) {
+  web_srv_fota_expire();
+  return web_srv_fota_send_status(req, NULL);
+}
+
+esp_err_t web_srv_fota_service(httpd_req_t *req) {
+  size_t first = 0, last = 0, total = req->content_len;
+  char* resp_str = NULL;
+  char* status = NULL;
+
+  esp_err_t err = web_srv_fota_get_range(req, &first, &last, &total);
+  if (err == ESP_ERR_INVALID_ARG || total == 0 || (err == ESP_OK && last - first + 1 != req->content_len)) {
+    status = HTTPD_400;
+    resp_str = "Invalid Content-Range.";
     return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
-  } else if (ota_end_err != ESP_OK) {
-    ESP_LOGE(otaTag, "Error: esp_ota_end failed! err=0x%d. Image is invalid", ota_end_err);
-    return ota_end_err;
   }
+  uint8_t image_sha256[OTA_ADP_SHA256_LEN];
+  esp_err_t sha_err = web_srv_fota_get_image_sha256(req, image_sha256);
+  if (sha_err == ESP_ERR_INVALID_ARG) {
+    status = HTTPD_400;
+    resp_str = "Invalid " FOTA_SHA256_HDR ".";
+    return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
+  }
+
+  web_srv_fota_expire();
+  if (first == 0) {
+    // A new upload replaces an interrupted one.
+    ESP_LOGI(otaTag, "Starting OTA...");
+    web_srv_fota_discard();
+    err = web_srv_fota_session_new(total);
+    if (err != ESP_OK)
+      return web_srv_fota_send_err(req, err);
+    s_fota->check_sha = (sha_err == ESP_OK);
+    if (s_fota->check_sha)
+      memcpy(s_fota->image_sha256, image_sha256, sizeof(image_sha256));
+  } else if (s_fota == NULL || first != ota_stream_offset(s_fota->stream) || total != ota_stream_total(s_fota->stream)) {
+    ESP_LOGW(otaTag, "Cannot resume at %d of %d bytes", first, total);
+    return web_srv_fota_send_status(req, "416 Range Not Satisfiable");
+  } else {
+    ESP_LOGI(otaTag, "Resuming OTA at %d of %d bytes", first, total);
+  }
+
+  fota_session_t* s = s_fota;
+  uint8_t* buf = (uint8_t*) malloc(FOTA_RECV_BUF_SIZE);
+  err = (buf != NULL) ? web_srv_fota_recv(req, s->stream, buf) : ESP_ERR_NO_MEM;
+  free(buf);
+  s->last_us = hal_time_us();
+  if (err == ESP_FAIL) {
+    // Kept for a resume, the client learns the offset from GET "/fota".
+    ESP_LOGW(otaTag, "Upload interrupted at %d of %d bytes", ota_stream_offset(s->stream), ota_stream_total(s->stream));
+    return ESP_FAIL;
+  }
+  if (err == ESP_OK && ota_stream_offset(s->stream) < ota_stream_total(s->stream))
+    return web_srv_fota_send_status(req, NULL);
 
-  err = esp_ota_set_boot_partition(update_partition);
+  // The upload is complete, the connection is free while a worker verifies and switches over.
+  fota_job_t fota = {
+    .writer = NULL,
+    .update_partition = s->update_partition
+  };
+  if (err == ESP_OK)
+    err = ota_stream_finish(s->stream, &fota.writer);
+  else
+    ota_stream_abort(s->stream);
+  s->stream = NULL;
+  // The writer hashed the image as it went, ota_adp_end() compares.
+  if (err == ESP_OK && s->check_sha)
+    ota_adp_expect_sha256(fota.writer, s->image_sha256);
+  web_srv_fota_discard();
+  if (err != ESP_OK)
+    return web_srv_fota_send_err(req, err);
+
+  uint32_t job_id;
+  err = web_srv_job_submit("fota", web_srv_fota_finish_job, &fota, sizeof(fota), &job_id);
   if (err != ESP_OK) {
-    status = HTTPD_500;
-    resp_str = "ESP Set Boot Partition Failed";
-    ESP_LOGE(otaTag, "esp_ota_set_boot_partition failed! err=0x%d", err);
+    ota_adp_abort(fota.writer);
+    status = "503 Service Unavailable";
+    resp_str = "Too many pending jobs.";
     return web_srv_send_rsp(req, status, resp_str, strlen(resp_str));
   }
-  ESP_LOGI(otaTag, "esp_ota_set_boot_partition succeeded"); 
+  return web_srv_job_send_accepted(req, job_id);
+}
 
-  xTaskCreate(restart_task, "restart_task", 1024, NULL, 6, NULL);
-  return web_srv_send_rsp(req, NULL, resp_str, strlen(resp_str));
+esp_err_t web_srv_ota_client_status_method(const json_reader_t* request, json_writer_t* response) {
+  ota_client_status_t status;
+
+  ota_client_get_status(&status);
+  json_writer_kv_string(response, "version", CONFIG_FW_VERSION);
+  json_writer_kv_string(response, "state", ota_client_state_str(status.state));
+  json_writer_kv_string(response, "available", status.available);
+  json_writer_kv_uint(response, "next_s", status.next_s);
+  json_writer_kv_uint(response, "offset", status.offset);
+  json_writer_kv_uint(response, "total", status.total);
+  json_writer_kv_string(response, "error", esp_err_to_name(status.last_err));
+  return ESP_OK;
+}
 
+esp_err_t web_srv_ota_client_check_method(const json_reader_t* request, json_writer_t* response) {
+  ota_client_check_now();
+  json_writer_kv_bool(response, "return_value", true);
+  return ESP_OK;
 }
@@ -1,3 +1,17 @@
 #pragma once
+#include "json_stream.h"
 
+// An interrupted upload may be resumed for this long, it keeps the OTA buffers meanwhile.
+#define FOTA_RESUME_TIMEOUT_MS (5 * 60 * 1000)
+
+// POST "/fota": an image, a delta patch, or either compressed. With "Content-Range: bytes
+// N-M/T" it continues an interrupted upload of T bytes at N, the offset GET "/fota" reports.
+// 202 with a job once all T bytes are in, 200 with the status while more are expected.
 esp_err_t web_srv_fota_service(httpd_req_t *req);
+// GET "/fota": the upload in progress, see web_srv_fota_send_status().
+esp_err_t web_srv_fota_status_service(httpd_req_t *req);
+// JSON API "ota_client_status": {"version", "state", "available", "next_s", "offset", "total", "error"}
+// of the client pulling updates from ota_url.
+esp_err_t web_srv_ota_client_status_method(const json_reader_t* request, json_writer_t* response);
+// JSON API "ota_client_check": check ota_url now and install what it offers, skipping the rollout.
+esp_err_t web_srv_ota_client_check_method(const json_reader_t* request, json_writer_t* response);
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include <esp_http_server.h>
+#include "esp_http_server_ext.h"
+
+#include "web_server.h"
+#include "web_server_job.h"
+#include "json_stream.h"
+
+#define TAG "webServer job"
+
+#ifndef HTTPD_202
+#define HTTPD_202 "202 Accepted"
+#endif
+
+struct web_srv_job {
+    uint32_t id; // 0 for a free slot
+    const char* name;
+    web_srv_job_fn_t fn;
+    void* arg;
+    uint8_t state;
+    uint8_t progress;
+    esp_err_t result;
+};
+
+static const char* const job_state_str[] = {"queued", "running", "done", "failed"};
+
+// Slots are claimed and finished in critical sections, a pending job is never reused.
+static web_srv_job_t s_jobs[WEB_SRV_JOB_MAX];
+static uint32_t s_job_next_id = 1;
+// One entry per slot, so it never overflows.
+static QueueHandle_t s_job_queue = NULL;
+
+static void web_srv_job_worker(void* param) {
+    web_srv_job_t* job;
+
+    for (;;) {
+        if (xQueueReceive(s_job_queue, &job, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        job->state = WEB_SRV_JOB_RUNNING;
+        esp_err_t result = job->fn(job, job->arg);
+        ESP_LOGI(TAG, "Job %u (%s) finished, err=0x%x", (unsigned) job->id, job->name, result);
+
+        free(job->arg);
+        portENTER_CRITICAL();
+        job->arg = NULL;
+        job->result = result;
+        if (result == ESP_OK)
+            job->progress = 100;
+        job->state = (result == ESP_OK) ? WEB_SRV_JOB_DONE : WEB_SRV_JOB_FAILED;
+        portEXIT_CRITICAL();
+    }
+}
+
+esp_err_t web_srv_job_init(void) {
+    char name[configMAX_TASK_NAME_LEN];
+
+    if (s_job_queue != NULL)
+        return ESP_OK;
+
+    s_job_queue = xQueueCreate(WEB_SRV_JOB_MAX, sizeof(web_srv_job_t*));
+    if (s_job_queue == NULL)
+        return ESP_ERR_NO_MEM;
+
+    for (uint8_t i = 0; i < WEB_SRV_JOB_WORKERS; i++) {
+        snprintf(name, sizeof(name), "web_job%u", i);
+        if (xTaskCreate(web_srv_job_worker, name, WEB_SRV_JOB_STACK_SIZE, NULL, WEB_SRV_JOB_PRIORITY, NULL) != pdPASS)
+            return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t web_srv_job_submit(const char* name, web_srv_job_fn_t fn, const void* arg, size_t arg_len, uint32_t* job_id) {
+    web_srv_job_t* job = NULL;
+    void* copy = NULL;
+
+    if (s_job_queue == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    if (arg_len > 0) {
+        copy = malloc(arg_len);
+        if (copy == NULL)
+            return ESP_ERR_NO_MEM;
+        memcpy(copy, arg, arg_len);
+    }
+
+    portENTER_CRITICAL();
+    for (uint8_t i = 0; i < WEB_SRV_JOB_MAX; i++) {
+        web_srv_job_t* slot = &s_jobs[i];
+        if (slot->id == 0) {
+            job = slot;
+            break;
+        }
+        if (slot->state >= WEB_SRV_JOB_DONE && (job == NULL || slot->id < job->id))
+            job = slot;
+    }
+    if (job != NULL) {
+        job->id = s_job_next_id++;
+        job->name = name;
+        job->fn = fn;
+        job->arg = copy;
+        job->state = WEB_SRV_JOB_QUEUED;
+        job->progress = 0;
+        job->result = ESP_OK;
+        *job_id = job->id;
+    }
+    portEXIT_CRITICAL();
+
+    if (job == NULL) {
+        free(copy);
+        ESP_LOGW(TAG, "No room for job %s, all are pending.", name);
+        return ESP_ERR_NO_MEM;
+    }
+    xQueueSend(s_job_queue, &job, 0);
+    return ESP_OK;
+}
+
+void web_srv_job_set_progress(web_srv_job_t* job, uint8_t percent) {
+    job->progress = (percent > 100) ? 100 : percent;
+}
+
+esp_err_t web_srv_job_send_accepted(httpd_req_t *req, uint32_t job_id) {
+    char location[24];
+    json_writer_t writer;
+
+    snprintf(location, sizeof(location), "/jobs?id=%u", (unsigned) job_id);
+    httpd_resp_set_status(req, HTTPD_202);
+    httpd_resp_set_hdr(req, "Location", location);
+    web_srv_json_writer_init(&writer, req);
+    json_writer_begin_object(&writer);
+    json_writer_kv_uint(&writer, "job_id", job_id);
+    json_writer_end_object(&writer);
+    return web_srv_json_writer_finish(&writer, req);
+}
+
+static void web_srv_job_write(json_writer_t* writer, const web_srv_job_t* job) {
+    char result[12];
+
+    json_writer_begin_object(writer);
+    json_writer_kv_uint(writer, "id", job->id);
+    json_writer_kv_string(writer, "name", job->name);
+    json_writer_kv_string(writer, "state", job_state_str[job->state]);
+    json_writer_kv_uint(writer, "progress", job->progress);
+    snprintf(result, sizeof(result), "%d", job->result);
+    json_writer_key(writer, "result");
+    json_writer_primitive(writer, result);
+    json_writer_end_object(writer);
+}
+
+esp_err_t web_srv_job_service(httpd_req_t *req) {
+    web_srv_job_t jobs[WEB_SRV_JOB_MAX];
+    json_writer_t writer;
+    uint32_t id = 0;
+    size_t len;
+
+    const char* query = httpd_req_get_url_query_str_byref(req, &len);
+    if (query != NULL) {
+        const char* value = httpd_query_key_value_byref(query, "id", &len);
+        if (value != NULL)
+            id = strtoul(value, NULL, 10);
+    }
+
+    // A consistent copy, the workers keep going meanwhile.
+    portENTER_CRITICAL();
+    memcpy(jobs, s_jobs, sizeof(jobs));
+    portEXIT_CRITICAL();
+
+    if (id != 0) {
+        for (uint8_t i = 0; i < WEB_SRV_JOB_MAX; i++) {
+            if (jobs[i].id == id) {
+                web_srv_json_writer_init(&writer, req);
+                web_srv_job_write(&writer, &jobs[i]);
+                return web_srv_json_writer_finish(&writer, req);
+            }
+        }
+        return web_srv_send_rsp(req, HTTPD_404, "Unknown job.", strlen("Unknown job."));
+    }
+
+    web_srv_json_writer_init(&writer, req);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "jobs");
+    json_writer_begin_array(&writer);
+    for (uint8_t i = 0; i < WEB_SRV_JOB_MAX; i++) {
+        if (jobs[i].id != 0)
+            web_srv_job_write(&writer, &jobs[i]);
+    }
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    return web_srv_json_writer_finish(&writer, req);
+}
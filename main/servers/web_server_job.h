@@ -0,0 +1,34 @@
+#pragma once
+#include <esp_http_server.h>
+
+// Workers which run the slow part of a request, while the httpd task serves the others.
+#define WEB_SRV_JOB_WORKERS     2
+#define WEB_SRV_JOB_STACK_SIZE  3072
+// Below the httpd task, a busy worker never delays a request.
+#define WEB_SRV_JOB_PRIORITY    4
+// Jobs remembered for GET "/jobs", the oldest finished one makes room for a new one.
+#define WEB_SRV_JOB_MAX         8
+
+enum web_srv_job_state {
+    WEB_SRV_JOB_QUEUED,
+    WEB_SRV_JOB_RUNNING,
+    WEB_SRV_JOB_DONE,
+    WEB_SRV_JOB_FAILED
+};
+
+typedef struct web_srv_job web_srv_job_t;
+// Runs in a worker, arg is the copy made by web_srv_job_submit(). The return value is the result.
+typedef esp_err_t (*web_srv_job_fn_t)(web_srv_job_t* job, void* arg);
+
+esp_err_t web_srv_job_init(void);
+// Queue fn with a copy of arg_len bytes of arg, ESP_ERR_NO_MEM if every job is still pending.
+// name must stay valid, job_id identifies the job in GET "/jobs?id=".
+esp_err_t web_srv_job_submit(const char* name, web_srv_job_fn_t fn, const void* arg, size_t arg_len, uint32_t* job_id);
+// Called by the job, 0 to 100.
+void web_srv_job_set_progress(web_srv_job_t* job, uint8_t percent);
+// "202 Accepted" with {"job_id":N}, the response of a request handed to a worker.
+esp_err_t web_srv_job_send_accepted(httpd_req_t *req, uint32_t job_id);
+
+// GET "/jobs": {"jobs":[{"id":3,"name":"fota","state":"running","progress":40,"result":0}, ...]}
+// GET "/jobs?id=3": the job alone, 404 once it was forgotten.
+esp_err_t web_srv_job_service(httpd_req_t *req);
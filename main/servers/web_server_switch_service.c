@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include <esp_http_server.h>
+
+#include "web_server.h"
+#include "web_server_switch_service.h"
+#include "json_stream.h"
+#include "switch_adapter.h"
+
+#define TAG "webServer SW"
+
+static const char* const sw_type_str[] = {"toggling", "limit", "pwm"};
+
+static esp_err_t web_srv_switch_send_states(httpd_req_t *req) {
+    json_writer_t writer;
+    uint8_t status;
+
+    web_srv_json_writer_init(&writer, req);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "switches");
+    json_writer_begin_array(&writer);
+    for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++) {
+        switch_adapter_get_status(sw_index, &status);
+        json_writer_begin_object(&writer);
+        json_writer_kv_uint(&writer, "index", sw_index);
+        json_writer_kv_string(&writer, "type", sw_type_str[switch_adapter_get_type(sw_index)]);
+        json_writer_kv_uint(&writer, "status", status);
+        json_writer_end_object(&writer);
+    }
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    return web_srv_json_writer_finish(&writer, req);
+}
+
+// Collect the commands of a request, every switch at most once, in sw_mask and sw_states.
+static esp_err_t web_srv_switch_parse_batch(const json_reader_t* reader, uint8_t* sw_mask, uint8_t* sw_states) {
+    int switches = json_reader_find(reader, 0, "switches");
+    int item;
+
+    if (json_reader_type(reader, switches) != JSON_ARRAY)
+        return ESP_ERR_INVALID_ARG;
+
+    json_reader_for_each_item(reader, switches, item) {
+        const char* index = json_reader_text(reader, json_reader_find(reader, item, "index"));
+        const char* status = json_reader_text(reader, json_reader_find(reader, item, "status"));
+        if (index == NULL || status == NULL || index[1] != '\0' || index[0] < '0' || index[0] >= '0' + SW_MAX)
+            return ESP_ERR_INVALID_ARG;
+
+        uint8_t sw_bit = 1 << (index[0] - '0');
+        if (*sw_mask & sw_bit)
+            return ESP_ERR_INVALID_ARG;
+        *sw_mask |= sw_bit;
+
+        // 0/1 as in the Modbus coils, or false/true.
+        if (strcmp(status, "1") == 0 || strcmp(status, "true") == 0) {
+            *sw_states |= sw_bit;
+        } else if (strcmp(status, "0") != 0 && strcmp(status, "false") != 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return (*sw_mask != 0) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// GET "/switches", the status of all switches.
+esp_err_t web_srv_switch_get_service(httpd_req_t *req) {
+    return web_srv_switch_send_states(req);
+}
+
+// POST "/switches", a batch of switch commands.
+esp_err_t web_srv_switch_post_service(httpd_req_t *req) {
+    json_token_t tokens[SW_REST_TOKEN_MAX];
+    json_reader_t reader;
+    const char* status = HTTPD_400;
+    const char* resp = "Invalid switch commands.";
+    uint8_t sw_mask = 0;
+    uint8_t sw_states = 0;
+    size_t received = 0;
+    char* buf = NULL;
+    esp_err_t ret = ESP_OK;
+
+    if (req->content_len == 0 || req->content_len > SW_REST_BODY_MAXLEN) {
+        goto rsp_ret;
+    }
+
+    // One byte more for the reader's terminator.
+    buf = (char*) malloc(req->content_len + 1);
+    if (buf == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    while (received < req->content_len) {
+        int len = httpd_req_recv(req, buf + received, req->content_len - received);
+        if (len == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (len <= 0) {
+            free(buf);
+            return ESP_FAIL;
+        }
+        received += len;
+    }
+    buf[received] = '\0';
+
+    if (json_reader_parse(&reader, buf, received, tokens, SW_REST_TOKEN_MAX) == ESP_OK
+            && web_srv_switch_parse_batch(&reader, &sw_mask, &sw_states) == ESP_OK) {
+        ret = switch_adapter_chg_sta_batch(sw_mask, sw_states);
+        ESP_LOGI(TAG, "Switch batch mask 0x%x states 0x%x, err=0x%x", sw_mask, sw_states, ret);
+        if (ret == ESP_OK) {
+            free(buf);
+            return web_srv_switch_send_states(req);
+        }
+        status = HTTPD_500;
+        resp = "Switch commands failed.";
+    }
+    free(buf);
+
+rsp_ret:
+    return web_srv_send_rsp(req, status, resp, strlen(resp));
+}
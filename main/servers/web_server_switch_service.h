@@ -0,0 +1,12 @@
+#pragma once
+#include <esp_http_server.h>
+
+// largest accepted POST "/switches" body.
+#define SW_REST_BODY_MAXLEN 256
+#define SW_REST_TOKEN_MAX 32
+
+// GET "/switches":  {"switches":[{"index":0,"type":"toggling","status":1}, ...]}
+// POST "/switches": {"switches":[{"index":0,"status":1},{"index":2,"status":0}]}
+//   applied together through switch_adapter_chg_sta_batch(), answered like GET.
+esp_err_t web_srv_switch_get_service(httpd_req_t *req);
+esp_err_t web_srv_switch_post_service(httpd_req_t *req);
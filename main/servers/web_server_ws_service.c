@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <esp_http_server.h>
+
+#include "web_server.h"
+#include "web_server_ws_service.h"
+#include "wifi_handler.h"
+#include "switch_adapter.h"
+
+#define TAG "webServer WS"
+
+#define WS_PENDING_WIFI     (1 << 0)
+#define WS_PENDING_SWITCH   (1 << 1)
+#define WS_PENDING_ALL      (WS_PENDING_WIFI | WS_PENDING_SWITCH)
+#define WS_SWITCH_UNKNOWN   0xff
+#define WS_FOTA_MSG_MAXLEN  64
+#define WS_MSG_MAXLEN       512
+
+static httpd_handle_t s_ws_server = NULL;
+// Producers only flag what changed, the messages are built later in the httpd task.
+static volatile uint32_t s_ws_pending = 0;
+static volatile bool s_ws_work_queued = false;
+
+// Only touched in the httpd task: URI handlers and queued work.
+static int s_ws_fds[WS_CLIENT_MAX];
+static uint32_t s_ws_sta_hash = 0;
+static uint32_t s_ws_ap_hash = 0;
+static uint8_t s_ws_switch_states = WS_SWITCH_UNKNOWN;
+static uint8_t s_ws_fota_percent = 0;
+static char s_ws_msg[WS_MSG_MAXLEN];
+static size_t s_ws_msg_len = 0;
+
+static bool web_srv_ws_has_clients(void) {
+    for (uint8_t i = 0; i < WS_CLIENT_MAX; i++) {
+        if (s_ws_fds[i] >= 0)
+            return true;
+    }
+    return false;
+}
+
+static void web_srv_ws_broadcast(const char* msg) {
+    httpd_ws_frame_t frame = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t*) msg,
+        .len = strlen(msg)
+    };
+
+    for (uint8_t i = 0; i < WS_CLIENT_MAX; i++) {
+        int fd = s_ws_fds[i];
+        if (fd < 0)
+            continue;
+        // A closed tab is only noticed here, its slot is freed for the next one.
+        if (httpd_ws_get_fd_info(s_ws_server, fd) != HTTPD_WS_CLIENT_WEBSOCKET
+                || httpd_ws_send_frame_async(s_ws_server, fd, &frame) != ESP_OK) {
+            s_ws_fds[i] = -1;
+        }
+    }
+}
+
+static esp_err_t web_srv_ws_msg_sink(void* ctx, const char* data, size_t len) {
+    if (s_ws_msg_len + len >= sizeof(s_ws_msg))
+        return ESP_ERR_NO_MEM;
+    memcpy(s_ws_msg + s_ws_msg_len, data, len);
+    s_ws_msg_len += len;
+    s_ws_msg[s_ws_msg_len] = '\0';
+    return ESP_OK;
+}
+
+// Render a json_get style status message, sent unless it is exactly the previous one of its kind.
+static void web_srv_ws_push_status(const char* method, void (*render)(json_writer_t*), uint32_t* last_hash) {
+    json_writer_t writer;
+
+    s_ws_msg_len = 0;
+    json_writer_init(&writer, web_srv_ws_msg_sink, NULL);
+    json_writer_begin_object(&writer);
+    json_writer_kv_string(&writer, "method", method);
+    render(&writer);
+    json_writer_end_object(&writer);
+    if (json_writer_flush(&writer) != ESP_OK)
+        return;
+
+    uint32_t hash = web_srv_hash_str(s_ws_msg);
+    if (hash != *last_hash) {
+        *last_hash = hash;
+        web_srv_ws_broadcast(s_ws_msg);
+    }
+}
+
+static void web_srv_ws_push_wifi(void) {
+    web_srv_ws_push_status("wifi_sta_status", json_get_wifi_sta_status, &s_ws_sta_hash);
+    web_srv_ws_push_status("wifi_ap_status", json_get_wifi_ap_status, &s_ws_ap_hash);
+}
+
+static void web_srv_ws_push_switches(void) {
+    char msg[64];
+    uint8_t status[SW_MAX] = {0};
+    uint8_t states = 0;
+
+    for (uint8_t sw_index = SW1; sw_index < SW_MAX; sw_index++) {
+        switch_adapter_get_status(sw_index, &status[sw_index]);
+        states |= status[sw_index] << sw_index;
+    }
+    if (states == s_ws_switch_states)
+        return;
+
+    s_ws_switch_states = states;
+    snprintf(msg, sizeof(msg), "{\"method\":\"switch_status\",\"switch_status\":[%u,%u,%u]}",
+             status[SW1], status[SW2], status[SW3]);
+    web_srv_ws_broadcast(msg);
+}
+
+static void web_srv_ws_push_work(void* arg) {
+    uint32_t pending;
+
+    portENTER_CRITICAL();
+    pending = s_ws_pending;
+    s_ws_pending = 0;
+    s_ws_work_queued = false;
+    portEXIT_CRITICAL();
+
+    if (!web_srv_ws_has_clients())
+        return;
+    if (pending & WS_PENDING_WIFI)
+        web_srv_ws_push_wifi();
+    if (pending & WS_PENDING_SWITCH)
+        web_srv_ws_push_switches();
+}
+
+// Any task: coalesce changes into a single queued push.
+static void web_srv_ws_schedule(uint32_t pending) {
+    bool queue;
+
+    portENTER_CRITICAL();
+    s_ws_pending |= pending;
+    queue = (s_ws_server != NULL && !s_ws_work_queued);
+    if (queue)
+        s_ws_work_queued = true;
+    portEXIT_CRITICAL();
+
+    if (queue && httpd_queue_work(s_ws_server, web_srv_ws_push_work, NULL) != ESP_OK)
+        s_ws_work_queued = false;
+}
+
+static void web_srv_ws_wifi_updated(void) {
+    web_srv_ws_schedule(WS_PENDING_WIFI);
+}
+
+static void web_srv_ws_switch_updated(uint8_t sw_index, bool status) {
+    web_srv_ws_schedule(WS_PENDING_SWITCH);
+}
+
+static esp_err_t web_srv_ws_add_client(int fd) {
+    int8_t slot = -1;
+
+    for (uint8_t i = 0; i < WS_CLIENT_MAX; i++) {
+        if (s_ws_fds[i] >= 0 && httpd_ws_get_fd_info(s_ws_server, s_ws_fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET)
+            s_ws_fds[i] = -1;
+        if (s_ws_fds[i] < 0 && slot < 0)
+            slot = i;
+    }
+    if (slot < 0) {
+        ESP_LOGW(TAG, "Too many live status clients.");
+        return ESP_FAIL;
+    }
+    s_ws_fds[slot] = fd;
+
+    // A new client needs the whole state, the others just get it once more.
+    s_ws_sta_hash = 0;
+    s_ws_ap_hash = 0;
+    s_ws_switch_states = WS_SWITCH_UNKNOWN;
+    web_srv_ws_schedule(WS_PENDING_ALL);
+    return ESP_OK;
+}
+
+void web_srv_ws_init(httpd_handle_t server) {
+    static bool s_ws_listening = false;
+
+    for (uint8_t i = 0; i < WS_CLIENT_MAX; i++) {
+        s_ws_fds[i] = -1;
+    }
+    s_ws_server = server;
+
+    if (!s_ws_listening) {
+        s_ws_listening = true;
+        wifi_hdl_set_status_update_callback(web_srv_ws_wifi_updated);
+        switch_adapter_add_status_listener(web_srv_ws_switch_updated);
+    }
+}
+
+esp_err_t web_srv_ws_service(httpd_req_t *req) {
+    // The handshake, the socket is a WebSocket from now on.
+    if (req->method == HTTP_GET)
+        return web_srv_ws_add_client(httpd_req_to_sockfd(req));
+
+    // The channel is push only, drain whatever the client sends.
+    httpd_ws_frame_t frame = {0};
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+    if (ret != ESP_OK || frame.len == 0)
+        return ret;
+
+    frame.payload = malloc(frame.len);
+    if (frame.payload == NULL)
+        return ESP_ERR_NO_MEM;
+    ret = httpd_ws_recv_frame(req, &frame, frame.len);
+    free(frame.payload);
+    return ret;
+}
+
+void web_srv_ws_fota_progress(size_t written, size_t total) {
+    char msg[WS_FOTA_MSG_MAXLEN];
+    uint8_t percent = (total > 0) ? (uint64_t) written * 100 / total : 0;
+
+    // At most one message per percent, the handler blocks the httpd task meanwhile.
+    if ((written != 0 && percent == s_ws_fota_percent) || !web_srv_ws_has_clients())
+        return;
+
+    s_ws_fota_percent = percent;
+    snprintf(msg, sizeof(msg), "{\"method\":\"fota_progress\",\"written\":%u,\"total\":%u}",
+             (unsigned) written, (unsigned) total);
+    web_srv_ws_broadcast(msg);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <esp_http_server.h>
+
+// Browser tabs which may follow the live status at once.
+#define WS_CLIENT_MAX 4
+
+// "/ws" pushes JSON messages shaped like the json_get responses, only when they change:
+//   {"method":"wifi_sta_status", ...}, {"method":"wifi_ap_status", ...},
+//   {"method":"switch_status","switch_status":[0,1,0]},
+//   {"method":"fota_progress","written":N,"total":M}
+void web_srv_ws_init(httpd_handle_t server);
+esp_err_t web_srv_ws_service(httpd_req_t *req);
+// called by the FOTA handler, in the httpd task.
+void web_srv_ws_fota_progress(size_t written, size_t total);
@@ -15,6 +15,7 @@
 
 #include "wifi_handler.h"
 #include "configuration_adapter.h"
+#include "metrics.h"
 
 #define TAG "wifi softAP"
 #define STA_TAG "Wifi STA"
@@ -23,10 +24,46 @@ static EventGroupHandle_t s_connect_event_group;
 static ip4_addr_t s_ipv4_addr;
 static ip6_addr_t s_ipv6_addr;
 static wifi_cfg_t s_wifi_cfg = {0};
+static wifi_status_update_callback_t s_status_update_callback = NULL;
+// set by every Wi-Fi/IP event, the snapshot is rebuilt by the next query.
+static volatile bool s_status_dirty = true;
+static SemaphoreHandle_t s_status_mutex = NULL;
+static wifi_status_t s_status;
+// only updated by wifi_user_task.
+static metric_t s_sta_reconnects = METRIC_COUNTER_INIT("wifi_sta_reconnects_total",
+                                                       "Attempts to re-establish the STA connection.", NULL);
+
+static void wifi_status_updated()
+{
+  s_status_dirty = true;
+  if (s_status_update_callback != NULL) {
+    s_status_update_callback();
+  }
+}
+
+void wifi_hdl_set_status_update_callback(wifi_status_update_callback_t status_update_callback)
+{
+  s_status_update_callback = status_update_callback;
+}
+
+static void wifi_cfg_updated(enum cfg_data_idt id, const cfg_value_t* val, void* arg)
+{
+  if (id == CFG_WIFI_MODE) {
+    s_wifi_cfg.sta_preferred = val->u8;
+  } else if (id == CFG_WIFI_STA_MAX_RETRY) {
+    s_wifi_cfg.sta_max_retry = val->u8;
+  }
+}
 
 void wifi_hdl_start_service()
 {
   s_connect_event_group = xEventGroupCreate();
+  s_status_mutex = xSemaphoreCreateMutex();
+
+  ESP_ERROR_CHECK(cfg_adp_get_u8_by_id(CFG_WIFI_MODE, &s_wifi_cfg.sta_preferred));
+  ESP_ERROR_CHECK(cfg_adp_get_u8_by_id(CFG_WIFI_STA_MAX_RETRY, &s_wifi_cfg.sta_max_retry));
+  ESP_ERROR_CHECK(cfg_adp_subscribe(CFG_WIFI_MODE, wifi_cfg_updated, NULL));
+  ESP_ERROR_CHECK(cfg_adp_subscribe(CFG_WIFI_STA_MAX_RETRY, wifi_cfg_updated, NULL));
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -123,6 +160,7 @@ void wifi_hdl_sta_disconnect() {
 uint8_t  wifi_hdl_ap_turn_on() {
     wifi_init_softap();
     ESP_LOGI(STA_TAG, "wifi_hdl_ap_turn_on()");
+    wifi_status_updated();
     return 1;
 }
 
@@ -135,6 +173,7 @@ uint8_t wifi_hdl_ap_turn_off() {
     ESP_ERROR_CHECK(esp_wifi_get_mode(&wifi_mode));
     if (wifi_mode == WIFI_MODE_APSTA && esp_wifi_sta_get_ap_info(&ap_rec) == ESP_OK) {
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+        wifi_status_updated();
         return 1;
     }
 
@@ -158,6 +197,35 @@ esp_err_t wifi_hdl_ap_query(char* ssid, size_t ssid_len) {
     return ESP_OK;
 }
 
+// Caller holds s_status_mutex.
+static void wifi_status_rebuild() {
+    wifi_status_t* status = &s_status;
+
+    // An event during the rebuild invalidates it again.
+    s_status_dirty = false;
+
+    status->sta_associated = (wifi_hdl_sta_query_ap(status->sta_ap_ssid, sizeof(status->sta_ap_ssid)) == ESP_OK);
+    status->sta_ip_valid = status->sta_associated
+                           && (wifi_hdl_query_ip_info(TCPIP_ADAPTER_IF_STA, &status->sta_ip) == ESP_OK);
+
+    status->ap_ssid[0] = '\0';
+    status->ap_on = (wifi_hdl_ap_query(status->ap_ssid, sizeof(status->ap_ssid)) == ESP_OK);
+    status->ap_ip_valid = status->ap_on
+                          && (wifi_hdl_query_ip_info(TCPIP_ADAPTER_IF_AP, &status->ap_ip) == ESP_OK);
+}
+
+void wifi_hdl_query_status(wifi_status_t* status) {
+    xSemaphoreTake(s_status_mutex, portMAX_DELAY);
+    if (s_status_dirty) {
+        wifi_status_rebuild();
+    }
+    *status = s_status;
+    xSemaphoreGive(s_status_mutex);
+
+    // Changes with the Wi-Fi task's state machine, not with an event.
+    status->sta_status = s_wifi_cfg.sta_conn_status;
+}
+
 void wifi_ap_gen_ssid(char* ssid)
 {
     uint8_t mac[6];
@@ -197,15 +265,11 @@ void wifi_sta_load_cfg(wifi_config_t* wifi_config) {
 }
 
 uint8_t wifi_sta_retry_before_ap() {
-    uint8_t ret;
-    ESP_ERROR_CHECK(cfg_adp_get_u8_by_id(CFG_WIFI_STA_MAX_RETRY, &ret));
-    return ret;
+    return s_wifi_cfg.sta_max_retry;
 }
 
 uint8_t wifi_sta_preferred() {
-    uint8_t ret;
-    ESP_ERROR_CHECK(cfg_adp_get_u8_by_id(CFG_WIFI_MODE, &ret));
-    return ret;
+    return s_wifi_cfg.sta_preferred;
 }
 
 void wifi_check_sta() {
@@ -224,6 +288,7 @@ void wifi_check_sta() {
             if (sta_list.num == 0) {
                 ESP_LOGI(AP_TAG, "Switch-off the backup AP. Enter STA-only mode.");
                 ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+                wifi_status_updated();
 
                 if (esp_wifi_sta_get_ap_info(&ap_rec) != ESP_OK) {
                     wifi_sta_load_cfg(&wifi_config);
@@ -239,6 +304,7 @@ void wifi_check_sta() {
 void on_got_ip(void *arg, esp_event_base_t event_base,
                int32_t event_id, void *event_data) {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+    s_status_dirty = true;
     memcpy(&s_ipv4_addr, &event->ip_info.ip, sizeof(s_ipv4_addr));
     xEventGroupSetBits(s_connect_event_group, WIFI_EGBIT_GOT_IPV4);
 }
@@ -246,6 +312,7 @@ void on_got_ip(void *arg, esp_event_base_t event_base,
 void on_got_ipv6(void *arg, esp_event_base_t event_base,
                  int32_t event_id, void *event_data) {
     ip_event_got_ip6_t *event = (ip_event_got_ip6_t *)event_data;
+    s_status_dirty = true;
     memcpy(&s_ipv6_addr, &event->ip6_info.ip, sizeof(s_ipv6_addr));
     xEventGroupSetBits(s_connect_event_group, WIFI_EGBIT_GOT_IPV6);
 }
@@ -257,6 +324,7 @@ void on_ap_assign_sta_ip(void *arg, esp_event_base_t event_base,
 
 void wifi_event_handler(void* arg, esp_event_base_t event_base,
                         int32_t event_id, void* event_data) {
+    s_status_dirty = true;
     if (event_id == WIFI_EVENT_AP_STACONNECTED) {
         wifi_event_ap_staconnected_t* event = (wifi_event_ap_staconnected_t*) event_data;
         ESP_LOGI(TAG, "station "MACSTR" join, AID=%d",
@@ -386,6 +454,7 @@ void wifi_user_task(void* param) {
 
             if (wifi_mode == WIFI_MODE_STA || (wifi_mode == WIFI_MODE_APSTA && !s_wifi_cfg.apsta_stop_scan_flag)) {
                 ESP_LOGI(STA_TAG, "[%d] Attempt to re-establish connection to AP...", s_wifi_cfg.sta_retry_num);
+                metric_inc(&s_sta_reconnects);
                 ESP_ERROR_CHECK(esp_wifi_connect());
             }
 
@@ -425,5 +494,10 @@ void wifi_user_task(void* param) {
             }
         }
 
+        // Reconnection attempts alone change nothing visible.
+        if (bits != WIFI_EGBIT_STA_RECONN) {
+            wifi_status_updated();
+        }
+
     }
 }
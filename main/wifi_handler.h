@@ -33,6 +33,10 @@ typedef struct wifi_cfg{
     uint8_t apsta_stop_scan_flag;
     enum sta_conn_status sta_conn_status;
 
+    // Configuration, kept up to date by wifi_cfg_updated()
+    uint8_t sta_preferred;
+    uint8_t sta_max_retry;
+
     // STA connect request
     SemaphoreHandle_t  sta_mutex_req;
     char sta_ssid_req[WIFI_SSID_MAXLEN];
@@ -47,8 +51,25 @@ typedef struct ip_info {
     char ip6_addr[IPV6_ADDR_COUNT][IPV6_ADDR_MAXLEN];
 } ip_info_t;
 
+// What wifi_sta_status and wifi_ap_status report, rebuilt only after a Wi-Fi/IP event.
+typedef struct wifi_status {
+    uint8_t sta_status;
+    bool sta_associated; // sta_ap_ssid is valid
+    bool sta_ip_valid;
+    bool ap_on;          // ap_ssid is valid
+    bool ap_ip_valid;
+    char sta_ap_ssid[WIFI_SSID_MAXLEN];
+    char ap_ssid[WIFI_SSID_MAXLEN];
+    ip_info_t sta_ip;
+    ip_info_t ap_ip;
+} wifi_status_t;
+
+// called from the Wi-Fi task whenever the STA or AP state may have changed.
+typedef void (*wifi_status_update_callback_t)(void);
+
 // handler API
 void wifi_hdl_start_service();
+void wifi_hdl_set_status_update_callback(wifi_status_update_callback_t status_update_callback);
 esp_err_t wifi_hdl_sta_query_ap(char* ssid, size_t ssid_len);
 esp_err_t wifi_hdl_query_ip_info(tcpip_adapter_if_t sta_0_ap_1, ip_info_t* ip_info);
 uint8_t wifi_hdl_sta_connect(char ssid[WIFI_SSID_MAXLEN], char password[WIFI_PASS_MAXLEN]);
@@ -57,6 +78,8 @@ void wifi_hdl_sta_disconnect();
 uint8_t  wifi_hdl_ap_turn_on();
 uint8_t wifi_hdl_ap_turn_off();
 esp_err_t wifi_hdl_ap_query(char* ssid, size_t ssid_len);
+// copy the status snapshot, it is only queried again after an event invalidated it.
+void wifi_hdl_query_status(wifi_status_t* status);
 
 // internal function
 void wifi_ap_gen_ssid(char* ssid);
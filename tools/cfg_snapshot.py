@@ -0,0 +1,170 @@
+#!/usr/bin/env python
+#
+# Generate, dump and diff configuration snapshots, as served and accepted by
+# "/config_snapshot" (cfg_adp_export_snapshot() / cfg_adp_import_snapshot()).
+#
+# Layout, little endian:
+#   u32 magic "MSCF", u8 version, u8 record count, u16 records length,
+#   records: u8 name length, name, u8 type, u8 value length, value,
+#   u32 CRC-32 of everything before it.
+#
+# usage: cfg_snapshot.py gen [-s schema.h] [-b base.bin] -o out.bin name=value ...
+#        cfg_snapshot.py dump blob.bin
+#        cfg_snapshot.py diff a.bin b.bin
+#
+# e.g. provisioning a unit in one request:
+#   cfg_snapshot.py gen -o unit.bin wifi_sta_ssid=plant wifi_sta_pass=secret uart_baud_rate=19200
+#   curl --data-binary @unit.bin http://<ip>/config_snapshot
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = 0x4643534d
+VERSION = 1
+HEADER = struct.Struct('<IBBH')
+TYPE_STR, TYPE_U8, TYPE_U32 = 1, 2, 3
+TYPE_NAMES = {'STR': TYPE_STR, 'U8': TYPE_U8, 'U32': TYPE_U32}
+STR_MAXLEN = 64
+FIELD_RE = re.compile(r'CFG_FIELD\(\s*\w+\s*,\s*"([^"]+)"\s*,\s*(\w+)')
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+DEFAULT_SCHEMA = os.path.join(ROOT, 'main', 'adapters', 'configuration_schema.h')
+
+
+def parse_schema(path):
+    with open(path) as f:
+        return [(name, TYPE_NAMES[t]) for name, t in FIELD_RE.findall(f.read())]
+
+
+def encode_value(name, ftype, value):
+    if ftype == TYPE_STR:
+        raw = value.encode('utf-8')
+        if len(raw) >= STR_MAXLEN:
+            raise ValueError('%s: longer than %d bytes' % (name, STR_MAXLEN - 1))
+        return raw
+    number = int(value, 0)
+    if ftype == TYPE_U8:
+        return struct.pack('<B', number)
+    return struct.pack('<I', number)
+
+
+def decode_value(ftype, raw):
+    if ftype == TYPE_STR:
+        return raw.decode('utf-8', 'replace')
+    if ftype == TYPE_U8:
+        return struct.unpack('<B', raw)[0]
+    return struct.unpack('<I', raw)[0]
+
+
+def pack(records):
+    body = b''
+    for name, ftype, raw in records:
+        body += struct.pack('<B', len(name)) + name.encode('ascii')
+        body += struct.pack('<BB', ftype, len(raw)) + raw
+    blob = HEADER.pack(MAGIC, VERSION, len(records), len(body)) + body
+    return blob + struct.pack('<I', zlib.crc32(blob) & 0xffffffff)
+
+
+def unpack(blob):
+    if len(blob) < HEADER.size + 4:
+        raise ValueError('too short for a snapshot')
+    magic, version, count, length = HEADER.unpack_from(blob)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a version %d snapshot' % VERSION)
+    end = HEADER.size + length
+    if end + 4 != len(blob):
+        raise ValueError('length mismatch')
+    if struct.unpack_from('<I', blob, end)[0] != zlib.crc32(blob[:end]) & 0xffffffff:
+        raise ValueError('CRC mismatch')
+
+    records = []
+    pos = HEADER.size
+    for _ in range(count):
+        name_len = blob[pos]
+        name = blob[pos + 1:pos + 1 + name_len].decode('ascii')
+        pos += 1 + name_len
+        ftype, val_len = blob[pos], blob[pos + 1]
+        records.append((name, ftype, bytes(blob[pos + 2:pos + 2 + val_len])))
+        pos += 2 + val_len
+    if pos != end:
+        raise ValueError('records do not match the header length')
+    return records
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        return unpack(bytearray(f.read()))
+
+
+def cmd_gen(args):
+    schema = dict(parse_schema(args.schema))
+    records = load(args.base) if args.base else []
+    fields = dict((name, (ftype, raw)) for name, ftype, raw in records)
+    for assignment in args.fields:
+        name, sep, value = assignment.partition('=')
+        if not sep or name not in schema:
+            raise ValueError('%s: not a name=value pair of a known field' % assignment)
+        fields[name] = (schema[name], encode_value(name, schema[name], value))
+
+    # keep the schema order, which is also the order the firmware exports in.
+    order = [name for name, _ in parse_schema(args.schema)]
+    names = sorted(fields, key=lambda n: order.index(n) if n in order else len(order))
+    blob = pack([(n, fields[n][0], fields[n][1]) for n in names])
+    with open(args.output, 'wb') as f:
+        f.write(blob)
+    print('%s: %d fields, %d bytes' % (args.output, len(names), len(blob)))
+
+
+def cmd_dump(args):
+    for name, ftype, raw in load(args.blob):
+        print('%s=%s' % (name, decode_value(ftype, raw)))
+
+
+def cmd_diff(args):
+    a = dict((n, decode_value(t, r)) for n, t, r in load(args.a))
+    b = dict((n, decode_value(t, r)) for n, t, r in load(args.b))
+    changed = 0
+    for name in list(a) + [n for n in b if n not in a]:
+        if a.get(name) != b.get(name):
+            print('%s: %r -> %r' % (name, a.get(name), b.get(name)))
+            changed += 1
+    return 1 if changed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='configuration snapshot tool')
+    sub = parser.add_subparsers(dest='cmd')
+
+    gen = sub.add_parser('gen', help='build a snapshot from name=value pairs')
+    gen.add_argument('-s', '--schema', default=DEFAULT_SCHEMA)
+    gen.add_argument('-b', '--base', help='start from an exported snapshot')
+    gen.add_argument('-o', '--output', required=True)
+    gen.add_argument('fields', nargs='*')
+    gen.set_defaults(func=cmd_gen)
+
+    dump = sub.add_parser('dump', help='print the fields of a snapshot')
+    dump.add_argument('blob')
+    dump.set_defaults(func=cmd_dump)
+
+    diff = sub.add_parser('diff', help='print the fields which differ, exit 1 if any')
+    diff.add_argument('a')
+    diff.add_argument('b')
+    diff.set_defaults(func=cmd_diff)
+
+    args = parser.parse_args()
+    if not hasattr(args, 'func'):
+        parser.print_help()
+        return 2
+    try:
+        return args.func(args) or 0
+    except (ValueError, IOError) as e:
+        sys.stderr.write('error: %s\n' % e)
+        return 2
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+#
+# Generate main/adapters/configuration_schema_hash.h from main/adapters/configuration_schema.h.
+#
+# The output is a minimal perfect hash (hash and displace) from field name to
+# cfg_data_idt, so cfg_adp_id_from_name() costs two FNV-1a passes and a single strcmp
+# however many fields the schema grows to.
+#
+# FNV-1a alone is a poor fit for the modulo: with a power of two field count the low
+# bits of the hash only depend on the low bits of the seed and of every character, and
+# no seed may separate a bucket. The hash is finalized before the modulo for that reason.
+#
+# usage: gen_cfg_hash.py [schema.h] [output.h]
+
+import os
+import re
+import sys
+
+NVS_KEY_MAXLEN = 15
+FNV_BASIS = 0x811c9dc5
+FNV_PRIME = 0x01000193
+MIX_PRIME = 0x85ebca6b
+FIELD_RE = re.compile(r'CFG_FIELD\(\s*(\w+)\s*,\s*"([^"]+)"')
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+DEFAULT_SCHEMA = os.path.join(ROOT, 'main', 'adapters', 'configuration_schema.h')
+DEFAULT_OUTPUT = os.path.join(ROOT, 'main', 'adapters', 'configuration_schema_hash.h')
+
+
+# Must match cfg_name_hash() in configuration_adapter.c
+def fnv_hash(seed, name):
+    h = FNV_BASIS ^ seed
+    for c in name.encode('ascii'):
+        h = ((h ^ c) * FNV_PRIME) & 0xffffffff
+    # Mix the high bits into the low ones.
+    h ^= h >> 16
+    h = (h * MIX_PRIME) & 0xffffffff
+    h ^= h >> 13
+    return h
+
+
+def parse_schema(path):
+    with open(path) as f:
+        fields = FIELD_RE.findall(f.read())
+    if not fields:
+        raise ValueError('%s: no CFG_FIELD entries found' % path)
+
+    names = [name for _, name in fields]
+    for name in names:
+        if len(name) > NVS_KEY_MAXLEN:
+            raise ValueError('"%s" is longer than %d chars, not a valid NVS key' % (name, NVS_KEY_MAXLEN))
+    if len(set(names)) != len(names):
+        raise ValueError('duplicated field names in %s' % path)
+    if len(names) > 255:
+        raise ValueError('cfg_name_hash_ids holds uint8_t ids, too many fields')
+    return fields
+
+
+def build_hash(names):
+    n = len(names)
+    buckets = [[] for _ in range(n)]
+    for i, name in enumerate(names):
+        buckets[fnv_hash(0, name) % n].append(i)
+
+    disp = [0] * n
+    slots = [None] * n
+    # Place the largest buckets first, each needs a seed sending all its keys to free slots.
+    for bucket in sorted(buckets, key=len, reverse=True):
+        if len(bucket) <= 1:
+            break
+        seed = 1
+        while True:
+            tried = [fnv_hash(seed, names[i]) % n for i in bucket]
+            if len(set(tried)) == len(bucket) and all(slots[s] is None for s in tried):
+                break
+            seed += 1
+            if seed > 0x7fff:
+                raise ValueError('no displacement found, change the hash')
+        disp[fnv_hash(0, names[bucket[0]]) % n] = seed
+        for i, s in zip(bucket, tried):
+            slots[s] = i
+
+    # Single key buckets go straight to a free slot, encoded as -(slot + 1).
+    free = [s for s in range(n) if slots[s] is None]
+    for bucket in buckets:
+        if len(bucket) == 1:
+            s = free.pop()
+            disp[fnv_hash(0, names[bucket[0]]) % n] = -s - 1
+            slots[s] = bucket[0]
+    return disp, slots
+
+
+def main():
+    schema = sys.argv[1] if len(sys.argv) > 1 else DEFAULT_SCHEMA
+    output = sys.argv[2] if len(sys.argv) > 2 else DEFAULT_OUTPUT
+
+    fields = parse_schema(schema)
+    ids = [idt for idt, _ in fields]
+    names = [name for _, name in fields]
+    disp, slots = build_hash(names)
+
+    lines = [
+        '// Generated by tools/gen_cfg_hash.py from configuration_schema.h, do not edit.',
+        '#pragma once',
+        '',
+        '#define CFG_SCHEMA_HASH_FIELD_COUNT %d' % len(names),
+        '',
+        '// Indexed by cfg_name_hash(0, name) % count: seed of the second hash, or -(slot + 1).',
+        'static const int16_t cfg_name_hash_disp[CFG_SCHEMA_HASH_FIELD_COUNT] = {',
+    ]
+    lines += ['    %d,' % d for d in disp]
+    lines += [
+        '};',
+        '',
+        'static const uint8_t cfg_name_hash_ids[CFG_SCHEMA_HASH_FIELD_COUNT] = {',
+    ]
+    width = max(len(idt) for idt in ids) + 1
+    lines += ['    %-*s // "%s"' % (width, ids[i] + ',', names[i]) for i in slots]
+    lines += ['};', '']
+
+    with open(output, 'w') as f:
+        f.write('\n'.join(lines))
+    print('%s: %d fields' % (os.path.relpath(output), len(names)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,184 @@
+#!/usr/bin/env python
+#
+# Generate and apply delta OTA patches, as accepted by "/fota" (main/adapters/ota_delta.h).
+#
+# The device rebuilds the new image from its running image and the patch, so a patch is
+# only valid for devices running exactly the old image (checked by CRC-32 before anything
+# is written).
+#
+# Layout, little endian:
+#   u32 magic "MSDL", u8 version, 3 bytes reserved,
+#   u32 source size, u32 source CRC-32, u32 target size, u32 target CRC-32,
+#   ops: u8 1 (copy), varint length, zigzag varint source offset relative to the end of the last copy
+#        u8 2 (insert), varint length, the bytes.
+#
+# usage: gen_ota_delta.py gen old.bin new.bin -o patch.bin
+#        gen_ota_delta.py apply old.bin patch.bin -o new.bin
+#
+# e.g. after a release build, with old.bin kept from the previous one:
+#   gen_ota_delta.py gen old.bin build/modbus_switch.bin -o patch.bin
+#   curl --data-binary @patch.bin http://<ip>/fota
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x4c44534d
+VERSION = 1
+HEADER = struct.Struct('<IB3xIIII')
+OP_COPY, OP_INSERT = 1, 2
+# Shortest copy worth an op, and the step of the source index.
+BLOCK = 16
+INDEX_STEP = 4
+
+
+def varint(val):
+    out = bytearray()
+    while val >= 0x80:
+        out.append((val & 0x7f) | 0x80)
+        val >>= 7
+    out.append(val)
+    return bytes(out)
+
+
+def read_varint(data, pos):
+    val = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        val |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return val, pos
+
+
+def zigzag(val):
+    return (val << 1) if val >= 0 else ((-val << 1) - 1)
+
+
+def unzigzag(val):
+    return (val >> 1) ^ -(val & 1)
+
+
+def match_len(old, o, new, n):
+    length = 0
+    # whole pieces first, the byte loop is slow
+    while new[n + length:n + length + 64] == old[o + length:o + length + 64] and n + length + 64 <= len(new):
+        length += 64
+    while n + length < len(new) and o + length < len(old) and new[n + length] == old[o + length]:
+        length += 1
+    return length
+
+
+def diff(old, new):
+    index = {}
+    for i in range(0, len(old) - BLOCK + 1, INDEX_STEP):
+        index.setdefault(old[i:i + BLOCK], i)
+
+    ops = bytearray()
+    src_pos = 0
+    literal = 0
+    i = 0
+    while i <= len(new) - BLOCK:
+        block = new[i:i + BLOCK]
+        # Changed bytes between two unchanged runs: the copy resumes at the same distance.
+        guess = src_pos + (i - literal)
+        if old[guess:guess + BLOCK] == block:
+            cand = guess
+        else:
+            cand = index.get(block)
+            if cand is None:
+                i += 1
+                continue
+
+        length = match_len(old, cand, new, i)
+        while i > literal and cand > 0 and new[i - 1] == old[cand - 1]:
+            i -= 1
+            cand -= 1
+            length += 1
+
+        if i > literal:
+            ops += bytes([OP_INSERT]) + varint(i - literal) + new[literal:i]
+        ops += bytes([OP_COPY]) + varint(length) + varint(zigzag(cand - src_pos))
+        src_pos = cand + length
+        i += length
+        literal = i
+
+    if literal < len(new):
+        ops += bytes([OP_INSERT]) + varint(len(new) - literal) + new[literal:]
+    return ops
+
+
+def crc32(data):
+    return zlib.crc32(data) & 0xffffffff
+
+
+def gen(old, new):
+    header = HEADER.pack(MAGIC, VERSION, len(old), crc32(old), len(new), crc32(new))
+    return header + diff(old, new)
+
+
+def apply(old, patch):
+    magic, version, source_size, source_crc, target_size, target_crc = HEADER.unpack_from(patch)
+    if magic != MAGIC or version != VERSION:
+        sys.exit('not a patch')
+    if source_size > len(old) or crc32(old[:source_size]) != source_crc:
+        sys.exit('the old image is not the source of the patch')
+
+    out = bytearray()
+    src_pos = 0
+    pos = HEADER.size
+    while pos < len(patch):
+        op = patch[pos]
+        length, pos = read_varint(patch, pos + 1)
+        if op == OP_COPY:
+            offset, pos = read_varint(patch, pos)
+            src_pos += unzigzag(offset)
+            out += old[src_pos:src_pos + length]
+            src_pos += length
+        elif op == OP_INSERT:
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            sys.exit('bad op %d at %d' % (op, pos - 1))
+
+    if len(out) != target_size or crc32(out) != target_crc:
+        sys.exit('patch result does not match')
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Delta OTA patches.')
+    sub = parser.add_subparsers(dest='cmd')
+    sub.required = True
+    p = sub.add_parser('gen')
+    p.add_argument('old')
+    p.add_argument('new')
+    p.add_argument('-o', '--output', required=True)
+    p = sub.add_parser('apply')
+    p.add_argument('old')
+    p.add_argument('patch')
+    p.add_argument('-o', '--output', required=True)
+    args = parser.parse_args()
+
+    with open(args.old, 'rb') as f:
+        old = f.read()
+    if args.cmd == 'gen':
+        with open(args.new, 'rb') as f:
+            new = f.read()
+        out = gen(old, new)
+        # Catch a generator bug here rather than on a device.
+        if apply(old, out) != new:
+            sys.exit('patch does not reproduce %s' % args.new)
+        print('%s: %d bytes, %.1f%% of %d' % (args.output, len(out), 100.0 * len(out) / len(new), len(new)))
+    else:
+        with open(args.patch, 'rb') as f:
+            out = apply(old, f.read())
+
+    with open(args.output, 'wb') as f:
+        f.write(out)
+
+
+if __name__ == '__main__':
+    main()
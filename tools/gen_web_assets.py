@@ -0,0 +1,118 @@
+#!/usr/bin/env python
+#
+# Build the web UI for the "www" SPIFFS partition, and optionally upload it to a device.
+#
+# Every asset is stored gzip compressed and served as is with "Content-Encoding: gzip".
+# The entry page keeps its name and is revalidated by ETag. The other assets get a content
+# hash in their name ("app.js" -> "app.0123abcd.js"), references to them in the entry page
+# are rewritten, and browsers may cache them forever.
+# The output is reproducible (no timestamp, no file name in the gzip header).
+#
+# usage: gen_web_assets.py [-o output dir] [--upload http://device] [index.html [asset ...]]
+#
+# The upload uses PUT /www/<name>: the hashed assets first and the entry page last, then the
+# files the new UI no longer needs are deleted. A page loaded meanwhile finds all of its assets.
+# The build runs it into build/www, which becomes the image of "www" and is flashed with the app.
+# Files of an older UI are removed from the output directory.
+
+import argparse
+import gzip
+import hashlib
+import io
+import json
+import os
+import sys
+
+try:
+    from urllib.request import Request, urlopen
+except ImportError:
+    from urllib2 import Request, urlopen
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+DEFAULT_INPUT = os.path.join(ROOT, 'main', 'servers', 'index.html')
+DEFAULT_OUTPUT_DIR = os.path.join(ROOT, 'build', 'www')
+# Must match WEB_ASSET_HASH_LEN
+HASH_LEN = 8
+# CONFIG_SPIFFS_OBJ_NAME_LEN minus the leading '/', the '~' of an upload and the terminator.
+NAME_MAXLEN = 32 - 4
+
+
+def compress(data):
+    out = io.BytesIO()
+    with gzip.GzipFile(filename='', mode='wb', compresslevel=9, fileobj=out, mtime=0) as f:
+        f.write(data)
+    return out.getvalue()
+
+
+def hashed_name(name, data):
+    stem, ext = os.path.splitext(name)
+    return '%s.%s%s' % (stem, hashlib.sha256(data).hexdigest()[:HASH_LEN], ext)
+
+
+def build(sources):
+    entry = sources[0]
+    with open(entry, 'rb') as f:
+        html = f.read()
+
+    files = {}
+    for source in sources[1:]:
+        name = os.path.basename(source)
+        with open(source, 'rb') as f:
+            data = f.read()
+        hashed = hashed_name(name, data)
+        html = html.replace(name.encode(), hashed.encode())
+        files[hashed + '.gz'] = compress(data)
+    files[os.path.basename(entry) + '.gz'] = compress(html)
+
+    for name in files:
+        if len(name) > NAME_MAXLEN:
+            sys.exit('%s: the name is longer than %d characters' % (name, NAME_MAXLEN))
+    return os.path.basename(entry) + '.gz', files
+
+
+def request(url, method, data=None):
+    req = Request(url, data=data)
+    req.get_method = lambda: method
+    return urlopen(req, timeout=30).read()
+
+
+def upload(device, entry, files):
+    device = device.rstrip('/')
+    # The entry page refers to the others, it is replaced last.
+    for name in sorted(files, key=lambda n: n == entry):
+        request('%s/www/%s' % (device, name), 'PUT', files[name])
+        print('uploaded %s' % name)
+
+    listing = json.loads(request(device + '/www', 'GET').decode())
+    for stale in listing['files']:
+        if stale['name'] not in files:
+            request('%s/www/%s' % (device, stale['name']), 'DELETE')
+            print('deleted %s' % stale['name'])
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build and upload the web UI assets.')
+    parser.add_argument('sources', nargs='*', default=[DEFAULT_INPUT],
+                        help='the entry page, then the assets it refers to')
+    parser.add_argument('-o', '--output', default=DEFAULT_OUTPUT_DIR)
+    parser.add_argument('--upload', metavar='URL', help='e.g. http://192.168.4.1')
+    args = parser.parse_args()
+
+    entry, files = build(args.sources)
+
+    if not os.path.isdir(args.output):
+        os.makedirs(args.output)
+    for stale in sorted(set(os.listdir(args.output)) - set(files)):
+        os.remove(os.path.join(args.output, stale))
+        print('removed %s' % stale)
+    for name, data in sorted(files.items()):
+        with open(os.path.join(args.output, name), 'wb') as f:
+            f.write(data)
+        print('%s: %d bytes' % (name, len(data)))
+
+    if args.upload:
+        upload(args.upload, entry, files)
+
+
+if __name__ == '__main__':
+    main()
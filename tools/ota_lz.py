@@ -0,0 +1,145 @@
+#!/usr/bin/env python
+#
+# Compress images and delta patches for "/fota" (main/adapters/ota_lz.h), the device
+# decompresses them while they are received, with a window of 2^bits bytes of RAM.
+#
+# Layout, little endian:
+#   u32 magic "MSLZ", u8 version, u8 window bits, u16 reserved, u32 decompressed size,
+#   groups: u8 flags, then 8 items, bit 0 first: 1 a literal byte,
+#           0 a match of 2 bytes: distance - 1 in the low window bits,
+#           length - 3 in the high (16 - window bits).
+#
+# usage: ota_lz.py compress [-b bits] in.bin -o out.lz
+#        ota_lz.py decompress in.lz -o out.bin
+#
+# e.g. a compressed delta patch:
+#   gen_ota_delta.py gen old.bin build/modbus_switch.bin -o patch.bin
+#   ota_lz.py compress patch.bin -o patch.lz
+#   curl --data-binary @patch.lz http://<ip>/fota
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x5a4c534d
+VERSION = 1
+HEADER = struct.Struct('<IBBxxI')
+# Must match OTA_LZ_WINDOW_BITS_MIN / OTA_LZ_WINDOW_BITS_MAX and OTA_LZ_MIN_MATCH.
+BITS_MIN, BITS_MAX = 8, 12
+MIN_MATCH = 3
+# Candidates tried per position, more compress a little better and a lot slower.
+CHAIN = 16
+
+
+def compress(data, bits):
+    window = 1 << bits
+    max_match = MIN_MATCH + (1 << (16 - bits)) - 1
+    chains = {}
+    out = bytearray(HEADER.pack(MAGIC, VERSION, bits, len(data)))
+    group = bytearray()
+    flags = 0
+    items = 0
+    flags_at = len(out)
+    out.append(0)
+
+    i = 0
+    while i < len(data):
+        best_len = 0
+        best_dist = 0
+        key = data[i:i + MIN_MATCH]
+        chain = chains.get(key, [])
+        for cand in reversed(chain):
+            dist = i - cand
+            if dist > window:
+                break
+            length = MIN_MATCH
+            while length < max_match and i + length < len(data) and data[cand + length] == data[i + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_dist = length, dist
+                if length == max_match:
+                    break
+
+        if best_len >= MIN_MATCH:
+            code = (best_dist - 1) | ((best_len - MIN_MATCH) << bits)
+            out += struct.pack('<H', code)
+            step = best_len
+        else:
+            flags |= 1 << items
+            out.append(data[i])
+            step = 1
+
+        for j in range(i, min(i + step, len(data) - MIN_MATCH + 1)):
+            c = chains.setdefault(data[j:j + MIN_MATCH], [])
+            c.append(j)
+            if len(c) > CHAIN:
+                del c[0]
+        i += step
+
+        items += 1
+        if items == 8:
+            out[flags_at] = flags
+            flags = items = 0
+            flags_at = len(out)
+            out.append(0)
+    out[flags_at] = flags
+    if items == 0:
+        del out[flags_at]
+    return bytes(out)
+
+
+def decompress(blob):
+    magic, version, bits, size = HEADER.unpack_from(blob)
+    if magic != MAGIC or version != VERSION or not BITS_MIN <= bits <= BITS_MAX:
+        sys.exit('not a compressed image')
+    mask = (1 << bits) - 1
+    out = bytearray()
+    pos = HEADER.size
+    while len(out) < size:
+        flags = blob[pos]
+        pos += 1
+        for _ in range(8):
+            if len(out) == size:
+                break
+            if flags & 1:
+                out.append(blob[pos])
+                pos += 1
+            else:
+                code = struct.unpack_from('<H', blob, pos)[0]
+                pos += 2
+                dist = (code & mask) + 1
+                for _ in range((code >> bits) + MIN_MATCH):
+                    out.append(out[-dist])
+            flags >>= 1
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compressed OTA images.')
+    sub = parser.add_subparsers(dest='cmd')
+    sub.required = True
+    p = sub.add_parser('compress')
+    p.add_argument('-b', '--bits', type=int, default=BITS_MAX, choices=range(BITS_MIN, BITS_MAX + 1))
+    p.add_argument('input')
+    p.add_argument('-o', '--output', required=True)
+    p = sub.add_parser('decompress')
+    p.add_argument('input')
+    p.add_argument('-o', '--output', required=True)
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    if args.cmd == 'compress':
+        out = compress(data, args.bits)
+        if decompress(out) != data:
+            sys.exit('%s does not decompress to %s' % (args.output, args.input))
+        print('%s: %d bytes, %.1f%% of %d' % (args.output, len(out), 100.0 * len(out) / max(len(data), 1), len(data)))
+    else:
+        out = decompress(data)
+
+    with open(args.output, 'wb') as f:
+        f.write(out)
+
+
+if __name__ == '__main__':
+    main()
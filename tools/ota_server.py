@@ -0,0 +1,184 @@
+#!/usr/bin/env python
+#
+# A local update server for the OTA client (main/adapters/ota_client.h): serves a manifest
+# for the given image and patches, the files themselves with Range support, and collects
+# the reports of the devices.
+#
+# usage: ota_server.py --version 1.2.0 --image modbus_switch.lz
+#                      [--patch 1.1.0:patch.lz ...] [--percent 25] [--window 3600]
+#                      [--max-downloads 8] [--drop-at BYTES] [--port 8070, 0 for any free one]
+#
+# then set ota_url of the devices to http://<this host>:8070/manifest.json, the files are
+# served under any directory too. GET /devices lists the last report of every device.
+# More than --max-downloads downloads at once are answered with 503, the devices retry later.
+# --drop-at closes every download which starts at 0 after BYTES, to exercise the resume.
+# The manifest carries the SHA-256 of the image, decompressed, which the devices check the
+# written image against whether they downloaded it or a patch.
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import struct
+import sys
+import threading
+import time
+
+import ota_lz
+
+try:
+    from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+except ImportError:
+    sys.exit('Python 3.7 or later is needed')
+
+CHUNK = 4096
+RANGE_RE = re.compile(r'bytes=(\d+)-$')
+
+
+class Release(object):
+    def __init__(self, args):
+        self.files = {}
+        self.manifest = {'version': args.version, 'report': 'report'}
+        self.manifest.update(self.add(args.image))
+        image = self.files[os.path.basename(args.image)]
+        if struct.unpack_from('<I', image)[0] == ota_lz.MAGIC:
+            image = ota_lz.decompress(image)
+        self.manifest['image_sha256'] = hashlib.sha256(image).hexdigest()
+        if args.patch:
+            self.manifest['patches'] = []
+            for spec in args.patch:
+                source, _, path = spec.partition(':')
+                if not path:
+                    sys.exit('--patch takes <from version>:<file>')
+                entry = {'from': source}
+                entry.update(self.add(path))
+                self.manifest['patches'].append(entry)
+        self.manifest['rollout'] = {'percent': args.percent, 'window_s': args.window}
+
+    def add(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        name = os.path.basename(path)
+        self.files[name] = data
+        return {'url': name, 'sha256': hashlib.sha256(data).hexdigest()}
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def reply(self, status, body, content_type='application/json', headers=()):
+        self.send_response(status)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        for name, value in headers:
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(body)
+
+    # Any directory will do, the URLs of the manifest are relative to it.
+    def name(self):
+        return self.path.split('?')[0].rsplit('/', 1)[-1]
+
+    def do_GET(self):
+        server = self.server
+        name = self.name()
+        if name == 'manifest.json':
+            self.reply(200, json.dumps(server.release.manifest).encode())
+        elif name == 'devices':
+            with server.lock:
+                self.reply(200, json.dumps(server.devices, indent=1, sort_keys=True).encode())
+        elif name in server.release.files:
+            self.send_file(server.release.files[name])
+        else:
+            self.reply(404, b'Not found', 'text/plain')
+
+    def send_file(self, data):
+        server = self.server
+        first = 0
+        m = RANGE_RE.match(self.headers.get('Range', ''))
+        if m:
+            first = int(m.group(1))
+            if first >= len(data):
+                self.reply(416, b'', 'text/plain', [('Content-Range', 'bytes */%d' % len(data))])
+                return
+
+        with server.lock:
+            busy = server.downloads >= server.max_downloads
+            if not busy:
+                server.downloads += 1
+                server.peak = max(server.peak, server.downloads)
+        if busy:
+            self.reply(503, b'Busy', 'text/plain', [('Retry-After', '60')])
+            return
+
+        try:
+            end = len(data)
+            if first == 0 and server.drop_at:
+                end = min(end, server.drop_at)
+            self.send_response(206 if m else 200)
+            self.send_header('Content-Type', 'application/octet-stream')
+            self.send_header('Content-Length', str(len(data) - first))
+            if m:
+                self.send_header('Content-Range', 'bytes %d-%d/%d' % (first, len(data) - 1, len(data)))
+            self.end_headers()
+            for pos in range(first, end, CHUNK):
+                self.wfile.write(data[pos:min(pos + CHUNK, end)])
+            if end < len(data):
+                self.log_message('dropping %s at %d of %d bytes', self.path, end, len(data))
+                self.close_connection = True
+        finally:
+            with server.lock:
+                server.downloads -= 1
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        if self.name() != 'report':
+            self.reply(404, b'Not found', 'text/plain')
+            return
+        try:
+            report = json.loads(body.decode())
+            mac = report['mac']
+        except (ValueError, KeyError, TypeError):
+            self.reply(400, b'Invalid report', 'text/plain')
+            return
+        report['time'] = time.strftime('%Y-%m-%d %H:%M:%S')
+        report['ip'] = self.client_address[0]
+        with self.server.lock:
+            self.server.devices[mac] = report
+        print('report %s: %s' % (mac, json.dumps(report, sort_keys=True)))
+        self.reply(200, b'', 'text/plain')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local update server for the OTA client.')
+    parser.add_argument('--version', required=True, help='version of the image')
+    parser.add_argument('--image', required=True, help='image, plain or compressed with ota_lz.py')
+    parser.add_argument('--patch', action='append', help='<from version>:<patch file>, from gen_ota_delta.py')
+    parser.add_argument('--percent', type=int, default=100, help='share of the devices to update')
+    parser.add_argument('--window', type=int, default=0, help='seconds the downloads are spread over')
+    parser.add_argument('--max-downloads', type=int, default=8, help='concurrent downloads, 503 beyond')
+    parser.add_argument('--drop-at', type=int, default=0, help='close downloads from 0 after this many bytes')
+    parser.add_argument('--port', type=int, default=8070)
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(('', args.port), Handler)
+    server.daemon_threads = True
+    server.release = Release(args)
+    server.lock = threading.Lock()
+    server.devices = {}
+    server.downloads = 0
+    server.peak = 0
+    server.max_downloads = args.max_downloads
+    server.drop_at = args.drop_at
+    print('manifest: %s' % json.dumps(server.release.manifest))
+    # --port 0 takes a free one.
+    print('serving on port %d' % server.server_address[1])
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        print('peak concurrent downloads: %d' % server.peak)
+
+
+if __name__ == '__main__':
+    main()